@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "refs.h"
 #include "object-store.h"
 #include "cache-tree.h"
@@ -11,6 +12,10 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "thread-utils.h"
+#include "tree-walk.h"
+#include "userdiff.h"
+#include "promisor-remote.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -1927,6 +1932,250 @@ static int blame_chunk_cb(long start_a, long count_a,
 	return 0;
 }
 
+/*
+ * With more than one thread, blame walks ahead of the commits it is
+ * about to process, guessing that the path stays the same, and lets
+ * worker threads read the blobs on both sides of each parent/child
+ * edge it finds and diff them. pass_blame_to_parent() then only has
+ * to replay the recorded hunks instead of running the diff itself.
+ *
+ * The worker threads only read objects (under obj_read_lock()) and
+ * run xdiff; commits, origins and blame entries are only ever touched
+ * by the main thread, which decides what to prefetch and in which
+ * order the results are applied, so the output does not change.
+ */
+#define BLAME_THREADS_MIN_DIFFS 16
+#define BLAME_PREFETCH_JOBS_PER_THREAD 8
+#define BLAME_PREFETCH_AHEAD 1024
+
+struct blame_hunk {
+	long start_a, count_a;
+	long start_b, count_b;
+};
+
+enum blame_prefetch_state {
+	BLAME_PREFETCH_PENDING,
+	BLAME_PREFETCH_RUNNING,
+	BLAME_PREFETCH_DONE,
+};
+
+struct blame_prefetch_job {
+	struct blame_prefetch_job *next; /* in the todo list */
+	struct commit *child, *parent;
+	const char *path; /* interned */
+	timestamp_t date; /* of the child */
+
+	/* the child's blob, or the tree to find it in if it is null */
+	struct object_id child_oid, child_tree;
+	struct object_id parent_oid, parent_tree;
+
+	enum blame_prefetch_state state;
+	unsigned abandoned:1, /* nobody wants it anymore */
+		 waiting:1, /* the main thread is waiting for it */
+		 ok:1; /* the blobs differ and were diffed */
+
+	mmfile_t parent_file;
+	struct blame_hunk *hunks;
+	size_t nr, alloc;
+};
+
+struct blame_prefetch_walk {
+	struct hashmap_entry ent;
+	struct commit *commit;
+	const char *path; /* interned */
+	struct object_id blob_oid; /* null when it is not known yet */
+};
+
+struct blame_prefetch {
+	struct repository *repo;
+	int xdl_opts;
+
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+	int quit;
+
+	/* jobs the main thread may still ask for, under the mutex */
+	struct blame_prefetch_job **jobs;
+	int nr_jobs, alloc_jobs, max_jobs;
+	struct blame_prefetch_job *todo, **todo_tail;
+
+	/* the speculative walk, only used by the main thread */
+	struct prio_queue walk;
+	struct hashmap walked;
+	unsigned long walked_nr, processed_nr;
+	intmax_t used_nr;
+};
+
+static void free_prefetch_job(struct blame_prefetch_job *job)
+{
+	free(job->parent_file.ptr);
+	free(job->hunks);
+	free(job);
+}
+
+/* Must be called with the mutex held. */
+static void unlist_prefetch_job(struct blame_prefetch *pf, int i)
+{
+	pf->jobs[i] = pf->jobs[--pf->nr_jobs];
+}
+
+static int record_blame_hunk(long start_a, long count_a,
+			     long start_b, long count_b, void *data)
+{
+	struct blame_prefetch_job *job = data;
+	struct blame_hunk *h;
+
+	ALLOC_GROW(job->hunks, job->nr + 1, job->alloc);
+	h = &job->hunks[job->nr++];
+	h->start_a = start_a;
+	h->count_a = count_a;
+	h->start_b = start_b;
+	h->count_b = count_b;
+	return 0;
+}
+
+static void *read_prefetch_blob(struct blame_prefetch *pf,
+				const struct object_id *oid,
+				unsigned long *size)
+{
+	enum object_type type;
+	void *buf = repo_read_object_file(pf->repo, oid, &type, size);
+
+	if (buf && type != OBJ_BLOB)
+		FREE_AND_NULL(buf);
+	return buf;
+}
+
+/*
+ * Runs in a worker thread, without the mutex. Returns 0 when the
+ * blobs differ and the hunks have been recorded.
+ */
+static int compute_prefetched_diff(struct blame_prefetch *pf,
+				    struct blame_prefetch_job *job)
+{
+	mmfile_t file_c;
+	unsigned long size;
+	unsigned short mode;
+
+	int ret;
+
+	if (is_null_oid(&job->child_oid) &&
+	    get_tree_entry(pf->repo, &job->child_tree, job->path,
+			   &job->child_oid, &mode))
+		return -1;
+	if (get_tree_entry(pf->repo, &job->parent_tree, job->path,
+			   &job->parent_oid, &mode) ||
+	    oideq(&job->child_oid, &job->parent_oid))
+		return -1;
+
+	if (!(file_c.ptr = read_prefetch_blob(pf, &job->child_oid, &size)))
+		return -1;
+	file_c.size = size;
+	if (!(job->parent_file.ptr = read_prefetch_blob(pf, &job->parent_oid,
+							&size))) {
+		free(file_c.ptr);
+		return -1;
+	}
+	job->parent_file.size = size;
+
+	ret = diff_hunks(&job->parent_file, &file_c, record_blame_hunk, job,
+			 pf->xdl_opts);
+	free(file_c.ptr);
+	return ret;
+}
+
+static void *blame_prefetch_thread(void *data)
+{
+	struct blame_prefetch *pf = data;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		struct blame_prefetch_job *job;
+		int i, ret;
+
+		while (!pf->todo && !pf->quit)
+			pthread_cond_wait(&pf->work_cond, &pf->mutex);
+		if (pf->quit)
+			break;
+
+		job = pf->todo;
+		if (!(pf->todo = job->next))
+			pf->todo_tail = &pf->todo;
+		if (job->abandoned) {
+			free_prefetch_job(job);
+			continue;
+		}
+
+		job->state = BLAME_PREFETCH_RUNNING;
+		pthread_mutex_unlock(&pf->mutex);
+		ret = compute_prefetched_diff(pf, job);
+		pthread_mutex_lock(&pf->mutex);
+		job->state = BLAME_PREFETCH_DONE;
+		job->ok = !ret;
+
+		if (job->abandoned) {
+			free_prefetch_job(job);
+		} else if (job->waiting) {
+			pthread_cond_broadcast(&pf->done_cond);
+		} else if (!job->ok) {
+			/* nothing to diff; the main thread will not ask */
+			for (i = 0; i < pf->nr_jobs; i++)
+				if (pf->jobs[i] == job)
+					break;
+			unlist_prefetch_job(pf, i);
+			free_prefetch_job(job);
+		}
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return NULL;
+}
+
+/*
+ * Return the prefetched diff between "parent" and "target", waiting
+ * for it if a worker is busy computing it, or NULL if it has not been
+ * started yet or turned out to be for different blobs.
+ */
+static struct blame_prefetch_job *take_prefetched_diff(struct blame_prefetch *pf,
+						      struct blame_origin *target,
+						      struct blame_origin *parent)
+{
+	struct blame_prefetch_job *job = NULL;
+	int i;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (i = 0; i < pf->nr_jobs; i++) {
+		struct blame_prefetch_job *j = pf->jobs[i];
+
+		if (j->child == target->commit && j->parent == parent->commit &&
+		    !strcmp(j->path, target->path)) {
+			job = j;
+			unlist_prefetch_job(pf, i);
+			break;
+		}
+	}
+	if (job && job->state == BLAME_PREFETCH_PENDING) {
+		job->abandoned = 1;
+		job = NULL;
+	} else if (job) {
+		job->waiting = 1;
+		while (job->state != BLAME_PREFETCH_DONE)
+			pthread_cond_wait(&pf->done_cond, &pf->mutex);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	if (job && (!job->ok ||
+		    !oideq(&job->child_oid, &target->blob_oid) ||
+		    !oideq(&job->parent_oid, &parent->blob_oid))) {
+		free_prefetch_job(job);
+		job = NULL;
+	}
+	if (job)
+		pf->used_nr++;
+	return job;
+}
+
 /*
  * We are looking at the origin 'target' and aiming to pass blame
  * for the lines it is suspected to its parent.  Run diff to find
@@ -1939,6 +2188,7 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	mmfile_t file_p, file_o;
 	struct blame_chunk_cb_data d;
 	struct blame_entry *newdest = NULL;
+	struct blame_prefetch_job *job = NULL;
 
 	if (!target->suspects)
 		return; /* nothing remains for this target */
@@ -1949,16 +2199,35 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	d.ignore_diffs = ignore_diffs;
 	d.dstq = &newdest; d.srcq = &target->suspects;
 
-	fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
-			 &sb->num_read_blob, ignore_diffs);
-	fill_origin_blob(&sb->revs->diffopt, target, &file_o,
-			 &sb->num_read_blob, ignore_diffs);
-	sb->num_get_patch++;
-
-	if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
-		die("unable to generate diff (%s -> %s)",
-		    oid_to_hex(&parent->commit->object.oid),
-		    oid_to_hex(&target->commit->object.oid));
+	if (sb->prefetch && !ignore_diffs)
+		job = take_prefetched_diff(sb->prefetch, target, parent);
+	if (job) {
+		size_t i;
+
+		if (!parent->file.ptr) {
+			parent->file = job->parent_file;
+			job->parent_file.ptr = NULL;
+			sb->num_read_blob++;
+		}
+		sb->num_get_patch++;
+
+		for (i = 0; i < job->nr; i++)
+			blame_chunk_cb(job->hunks[i].start_a, job->hunks[i].count_a,
+				       job->hunks[i].start_b, job->hunks[i].count_b,
+				       &d);
+		free_prefetch_job(job);
+	} else {
+		fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
+				 &sb->num_read_blob, ignore_diffs);
+		fill_origin_blob(&sb->revs->diffopt, target, &file_o,
+				 &sb->num_read_blob, ignore_diffs);
+		sb->num_get_patch++;
+
+		if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
+			die("unable to generate diff (%s -> %s)",
+			    oid_to_hex(&parent->commit->object.oid),
+			    oid_to_hex(&target->commit->object.oid));
+	}
 	/* The rest are the same as the parent */
 	blame_chunk(&d.dstq, &d.srcq, INT_MAX, d.offset, INT_MAX, 0,
 		    parent, target, 0);
@@ -2575,6 +2844,269 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+static unsigned int blame_prefetch_hash(struct commit *commit, const char *path)
+{
+	const void *key[2] = { commit, path };
+
+	return memhash(key, sizeof(key));
+}
+
+static int blame_prefetch_walk_cmp(const void *unused_cmp_data,
+				   const struct hashmap_entry *eptr,
+				   const struct hashmap_entry *entry_or_key,
+				   const void *unused_keydata)
+{
+	const struct blame_prefetch_walk *a, *b;
+
+	a = container_of(eptr, const struct blame_prefetch_walk, ent);
+	b = container_of(entry_or_key, const struct blame_prefetch_walk, ent);
+	return a->commit != b->commit || a->path != b->path;
+}
+
+static int compare_prefetch_walk(const void *a_, const void *b_, void *data)
+{
+	const struct blame_prefetch_walk *a = a_, *b = b_;
+
+	return compare_commits_by_commit_date(a->commit, b->commit, data);
+}
+
+/*
+ * Queue "commit" to be walked by the prefetcher with the given path,
+ * unless it already has been. "path" must be interned.
+ */
+static void add_prefetch_walk(struct blame_prefetch *pf, struct commit *commit,
+			      const char *path, const struct object_id *blob_oid)
+{
+	struct blame_prefetch_walk key, *w;
+
+	hashmap_entry_init(&key.ent, blame_prefetch_hash(commit, path));
+	key.commit = commit;
+	key.path = path;
+	if (hashmap_get(&pf->walked, &key.ent, NULL))
+		return;
+
+	w = xmalloc(sizeof(*w));
+	*w = key;
+	if (blob_oid)
+		oidcpy(&w->blob_oid, blob_oid);
+	else
+		oidclr(&w->blob_oid);
+	hashmap_add(&pf->walked, &w->ent);
+	prio_queue_put(&pf->walk, w);
+}
+
+static void add_prefetch_job(struct blame_prefetch *pf,
+			     struct blame_prefetch_walk *w,
+			     struct commit *parent)
+{
+	struct blame_prefetch_job *job = xcalloc(1, sizeof(*job));
+
+	job->child = w->commit;
+	job->parent = parent;
+	job->path = w->path;
+	job->date = w->commit->date;
+	if (is_null_oid(&w->blob_oid))
+		oidcpy(&job->child_tree, get_commit_tree_oid(w->commit));
+	else
+		oidcpy(&job->child_oid, &w->blob_oid);
+	oidcpy(&job->parent_tree, get_commit_tree_oid(parent));
+
+	pthread_mutex_lock(&pf->mutex);
+	ALLOC_GROW(pf->jobs, pf->nr_jobs + 1, pf->alloc_jobs);
+	pf->jobs[pf->nr_jobs++] = job;
+	*pf->todo_tail = job;
+	pf->todo_tail = &job->next;
+	pthread_cond_signal(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+static int blame_prefetch_path_ok(struct blame_scoreboard *sb, const char *path)
+{
+	struct userdiff_driver *drv;
+
+	/* fill_origin_blob() would run these through textconv */
+	if (!sb->revs->diffopt.flags.allow_textconv)
+		return 1;
+	drv = userdiff_find_by_path(sb->repo->index, path);
+	return !drv || !drv->textconv;
+}
+
+/*
+ * Start walking from the commits waiting in the scoreboard, and walk
+ * ahead from there until enough jobs are queued.
+ */
+static void refill_blame_prefetch(struct blame_scoreboard *sb)
+{
+	struct blame_prefetch *pf = sb->prefetch;
+	struct rev_info *revs = sb->revs;
+	int i;
+
+	for (i = 0; i < sb->commits.nr; i++) {
+		struct commit *commit = sb->commits.array[i].data;
+		struct blame_origin *o;
+
+		for (o = get_blame_suspects(commit); o; o = o->next)
+			if (o->suspects && blame_prefetch_path_ok(sb, o->path))
+				add_prefetch_walk(pf, commit, strintern(o->path),
+						  &o->blob_oid);
+	}
+
+	while (pf->walk.nr && pf->nr_jobs < pf->max_jobs &&
+	       pf->walked_nr < pf->processed_nr + BLAME_PREFETCH_AHEAD) {
+		struct blame_prefetch_walk *w = prio_queue_get(&pf->walk);
+		struct commit *commit = w->commit;
+		struct commit_list *sg;
+
+		pf->walked_nr++;
+		if (parse_commit(commit) ||
+		    (commit->object.flags & UNINTERESTING) ||
+		    (revs->max_age != -1 && commit->date < revs->max_age))
+			continue;
+
+		for (sg = first_scapegoat(revs, commit, 0); sg; sg = sg->next) {
+			struct commit *p = sg->item;
+
+			if (parse_commit(p))
+				continue;
+			/* the working tree has no tree to look the path up in */
+			if (!is_null_oid(&commit->object.oid))
+				add_prefetch_job(pf, w, p);
+			add_prefetch_walk(pf, p, w->path, NULL);
+		}
+	}
+}
+
+/*
+ * We are done with "commit"; drop the jobs for it and for any commit
+ * newer than it, which we are not going to visit anymore.
+ */
+static void expire_blame_prefetch(struct blame_prefetch *pf,
+				  struct commit *commit)
+{
+	int i = 0;
+
+	pf->processed_nr++;
+	pthread_mutex_lock(&pf->mutex);
+	while (i < pf->nr_jobs) {
+		struct blame_prefetch_job *job = pf->jobs[i];
+
+		if (job->child != commit && job->date <= commit->date) {
+			i++;
+			continue;
+		}
+		unlist_prefetch_job(pf, i);
+		if (job->state == BLAME_PREFETCH_DONE)
+			free_prefetch_job(job);
+		else
+			job->abandoned = 1;
+	}
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+static void start_blame_prefetch(struct blame_scoreboard *sb, int nr_threads)
+{
+	struct blame_prefetch *pf = xcalloc(1, sizeof(*pf));
+	int i;
+
+	pf->repo = sb->repo;
+	pf->xdl_opts = sb->xdl_opts;
+	pf->max_jobs = nr_threads * BLAME_PREFETCH_JOBS_PER_THREAD;
+	pf->todo_tail = &pf->todo;
+	pf->walk.compare = compare_prefetch_walk;
+	hashmap_init(&pf->walked, blame_prefetch_walk_cmp, NULL, 0);
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->work_cond, NULL);
+	pthread_cond_init(&pf->done_cond, NULL);
+
+	enable_obj_read_lock();
+	CALLOC_ARRAY(pf->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&pf->threads[i], NULL,
+				   blame_prefetch_thread, pf)) {
+			warning(_("unable to create thread: %s"),
+				strerror(errno));
+			break;
+		}
+	}
+	pf->nr_threads = i;
+	sb->prefetch = pf;
+}
+
+static void stop_blame_prefetch(struct blame_scoreboard *sb)
+{
+	struct blame_prefetch *pf = sb->prefetch;
+	int i;
+
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->quit = 1;
+	pthread_cond_broadcast(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+	for (i = 0; i < pf->nr_threads; i++)
+		pthread_join(pf->threads[i], NULL);
+	disable_obj_read_lock();
+	trace2_data_intmax("blame", sb->repo, "prefetch/threads", pf->nr_threads);
+	trace2_data_intmax("blame", sb->repo, "prefetch/used", pf->used_nr);
+
+	/* the jobs that are still listed are freed below */
+	while (pf->todo) {
+		struct blame_prefetch_job *job = pf->todo;
+
+		pf->todo = job->next;
+		if (job->abandoned)
+			free_prefetch_job(job);
+	}
+	for (i = 0; i < pf->nr_jobs; i++)
+		free_prefetch_job(pf->jobs[i]);
+	free(pf->jobs);
+
+	clear_prio_queue(&pf->walk);
+	hashmap_clear_and_free(&pf->walked, struct blame_prefetch_walk, ent);
+	pthread_cond_destroy(&pf->work_cond);
+	pthread_cond_destroy(&pf->done_cond);
+	pthread_mutex_destroy(&pf->mutex);
+	free(pf->threads);
+	FREE_AND_NULL(sb->prefetch);
+}
+
+static int blame_threads(struct blame_scoreboard *sb)
+{
+	int nr_threads = sb->num_threads;
+
+	/*
+	 * Guessing wrong would make us fetch blobs we do not need from
+	 * a promisor remote.
+	 */
+	if (!HAVE_THREADS || sb->reverse ||
+	    repo_has_promisor_remote(sb->repo))
+		return 1;
+	nr_threads = git_env_ulong("GIT_TEST_BLAME_THREADS", nr_threads);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+/*
+ * Called whenever the main loop is done with "commit". Threads are
+ * only started once the file turned out to have a history that is
+ * worth it.
+ */
+static void update_blame_prefetch(struct blame_scoreboard *sb,
+				  struct commit *commit, int nr_threads)
+{
+	if (!sb->prefetch) {
+		if (nr_threads < 2 ||
+		    (sb->num_commits < BLAME_THREADS_MIN_DIFFS &&
+		     !git_env_ulong("GIT_TEST_BLAME_THREADS", 0)))
+			return;
+		start_blame_prefetch(sb, nr_threads);
+	}
+	expire_blame_prefetch(sb->prefetch, commit);
+	refill_blame_prefetch(sb);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2583,6 +3115,7 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
 	struct commit *commit = prio_queue_get(&sb->commits);
+	int nr_threads = blame_threads(sb);
 
 	while (commit) {
 		struct blame_entry *ent;
@@ -2593,6 +3126,7 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 			suspect = suspect->next;
 
 		if (!suspect) {
+			update_blame_prefetch(sb, commit, nr_threads);
 			commit = prio_queue_get(&sb->commits);
 			continue;
 		}
@@ -2641,6 +3175,7 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		if (sb->debug) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+	stop_blame_prefetch(sb);
 }
 
 /*
@@ -2755,6 +3290,7 @@ static struct commit *find_single_initial(struct rev_info *revs,
 void init_scoreboard(struct blame_scoreboard *sb)
 {
 	memset(sb, 0, sizeof(struct blame_scoreboard));
+	sb->num_threads = 1;
 	sb->move_score = BLAME_DEFAULT_MOVE_SCORE;
 	sb->copy_score = BLAME_DEFAULT_COPY_SCORE;
 }
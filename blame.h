@@ -101,6 +101,7 @@ struct blame_entry {
 };
 
 struct blame_bloom_data;
+struct blame_prefetch;
 
 /*
  * The current state of the blame assignment.
@@ -153,12 +154,19 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/*
+	 * Number of threads diffing ahead of the main loop; 0 means
+	 * one per CPU, 1 (the default) means not to use threads.
+	 */
+	int num_threads;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
 
 	void *found_guilty_entry_data;
 	struct blame_bloom_data *bloom_data;
+	struct blame_prefetch *prefetch;
 };
 
 /*
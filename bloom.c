@@ -6,6 +6,7 @@
 #include "hashmap.h"
 #include "commit-graph.h"
 #include "commit.h"
+#include "object-store.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
@@ -184,6 +185,94 @@ static void init_truncated_large_filter(struct bloom_filter *filter)
 	filter->len = 1;
 }
 
+struct bloom_changed_paths {
+	struct hashmap pathmap;
+	int nr;
+	int max_changed_paths;
+};
+
+static void bloom_add_changed_path(struct diff_options *opt,
+				   const char *concatpath)
+{
+	struct bloom_changed_paths *paths = opt->change_fn_data;
+	struct pathmap_hash_entry *e;
+	char *path, *to_free;
+
+	/*
+	 * Once there are too many changes the filter is going to be
+	 * truncated anyway; tell the tree walk that it can stop.
+	 */
+	if (++paths->nr > paths->max_changed_paths) {
+		opt->flags.quick = 1;
+		opt->flags.has_changes = 1;
+		return;
+	}
+
+	/*
+	 * Add each leading directory of the changed file, i.e. for
+	 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
+	 * the Bloom filter could be used to speed up commands like
+	 * 'git log dir/subdir', too.
+	 *
+	 * Note that directories are added without the trailing '/'.
+	 */
+	path = to_free = xstrdup(concatpath);
+	do {
+		char *last_slash = strrchr(path, '/');
+
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->entry, strhash(path));
+
+		if (!hashmap_get(&paths->pathmap, &e->entry, NULL))
+			hashmap_add(&paths->pathmap, &e->entry);
+		else
+			free(e);
+
+		if (!last_slash)
+			last_slash = path;
+		*last_slash = '\0';
+
+	} while (*path);
+	free(to_free);
+}
+
+static int bloom_submodule_ignored(struct diff_options *opt, const char *path)
+{
+	int ret;
+
+	/* The submodule config cache is not thread-safe. */
+	obj_read_lock();
+	ret = is_submodule_ignored(path, opt);
+	obj_read_unlock();
+	return ret;
+}
+
+static void bloom_diff_change(struct diff_options *opt,
+			      unsigned old_mode, unsigned new_mode,
+			      const struct object_id *old_oid,
+			      const struct object_id *new_oid,
+			      int old_oid_valid, int new_oid_valid,
+			      const char *concatpath,
+			      unsigned old_dirty_submodule,
+			      unsigned new_dirty_submodule)
+{
+	if (S_ISGITLINK(old_mode) && S_ISGITLINK(new_mode) &&
+	    bloom_submodule_ignored(opt, concatpath))
+		return;
+	bloom_add_changed_path(opt, concatpath);
+}
+
+static void bloom_diff_addremove(struct diff_options *opt,
+				 int addremove, unsigned mode,
+				 const struct object_id *oid,
+				 int oid_valid, const char *concatpath,
+				 unsigned dirty_submodule)
+{
+	if (S_ISGITLINK(mode) && bloom_submodule_ignored(opt, concatpath))
+		return;
+	bloom_add_changed_path(opt, concatpath);
+}
+
 struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 struct commit *c,
 						 int compute_if_not_present,
@@ -191,7 +280,9 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 enum bloom_filter_computed *computed)
 {
 	struct bloom_filter *filter;
-	int i;
+	struct bloom_changed_paths paths = {
+		.pathmap = HASHMAP_INIT(pathmap_cmp, NULL),
+	};
 	struct diff_options diffopt;
 
 	if (computed)
@@ -213,65 +304,41 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	if (!compute_if_not_present)
 		return NULL;
 
+	/* ensure commit is parsed so we have parent information */
+	repo_parse_commit(r, c);
+
+	/*
+	 * Collect the changed paths through our own callbacks instead of
+	 * the global diff_queued_diff, so that filters for different
+	 * commits can be computed in parallel.
+	 */
 	repo_diff_setup(r, &diffopt);
 	diffopt.flags.recursive = 1;
 	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
+	diffopt.change = bloom_diff_change;
+	diffopt.add_remove = bloom_diff_addremove;
+	diffopt.change_fn_data = &paths;
 	diff_setup_done(&diffopt);
 
-	/* ensure commit is parsed so we have parent information */
-	repo_parse_commit(r, c);
+	paths.max_changed_paths = settings->max_changed_paths;
 
 	if (c->parents)
 		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
 	else
 		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
 
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
-		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
+	if (paths.nr <= settings->max_changed_paths) {
 		struct pathmap_hash_entry *e;
 		struct hashmap_iter iter;
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		}
-
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
+		if (hashmap_get_size(&paths.pathmap) > settings->max_changed_paths) {
 			init_truncated_large_filter(filter);
 			if (computed)
 				*computed |= BLOOM_TRUNC_LARGE;
 			goto cleanup;
 		}
 
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+		filter->len = (hashmap_get_size(&paths.pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
 		if (!filter->len) {
 			if (computed)
 				*computed |= BLOOM_TRUNC_EMPTY;
@@ -279,29 +346,24 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		}
 		CALLOC_ARRAY(filter->data, filter->len);
 
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
+		hashmap_for_each_entry(&paths.pathmap, &iter, e, entry) {
 			struct bloom_key key;
 			fill_bloom_key(e->path, strlen(e->path), &key, settings);
 			add_key_to_filter(&key, filter, settings);
 			clear_bloom_key(&key);
 		}
-
-	cleanup:
-		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
-		for (i = 0; i < diff_queued_diff.nr; i++)
-			diff_free_filepair(diff_queued_diff.queue[i]);
 		init_truncated_large_filter(filter);
 
 		if (computed)
 			*computed |= BLOOM_TRUNC_LARGE;
 	}
 
+cleanup:
 	if (computed)
 		*computed |= BLOOM_COMPUTED;
 
-	free(diff_queued_diff.queue);
-	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	hashmap_clear_and_free(&paths.pathmap, struct pathmap_hash_entry, entry);
 
 	return filter;
 }
@@ -50,6 +50,7 @@ static int incremental;
 static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
+static int num_threads;
 static int show_progress;
 static char repeated_meta_color[COLOR_MAXLEN];
 static int coloring_mode;
@@ -719,6 +720,17 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		mark_ignored_lines = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.threads")) {
+		int is_bool;
+
+		num_threads = git_config_bool_or_int(var, value, &is_bool);
+		if (is_bool)
+			num_threads = num_threads ? 0 : 1;
+		else if (num_threads < 0)
+			return error(_("invalid value for '%s': %d"),
+				     var, num_threads);
+		return 0;
+	}
 	if (!strcmp(var, "color.blame.repeatedlines")) {
 		if (color_parse_mem(value, strlen(value), repeated_meta_color))
 			warning(_("invalid value for '%s': '%s'"),
@@ -1156,6 +1168,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.num_threads = num_threads;
 
 	read_mailmap(&mailmap);
 
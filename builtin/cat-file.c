@@ -16,6 +16,7 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "thread-utils.h"
 
 enum batch_mode {
 	BATCH_MODE_CONTENTS,
@@ -31,6 +32,7 @@ struct batch_options {
 	int all_objects;
 	int unordered;
 	int transform_mode; /* may be 'w' or 'c' for --filters or --textconv */
+	int nr_threads;
 	const char *format;
 };
 
@@ -302,6 +304,22 @@ static void batch_write(struct batch_options *opt, const void *data, int len)
 		write_or_die(1, data, len);
 }
 
+static void *read_object_or_die(struct expand_data *data, unsigned long *size)
+{
+	const struct object_id *oid = &data->oid;
+	enum object_type type;
+	void *contents;
+
+	contents = read_object_file(oid, &type, size);
+	if (!contents)
+		die("object %s disappeared", oid_to_hex(oid));
+	if (type != data->type)
+		die("object %s changed type!?", oid_to_hex(oid));
+	if (data->info.sizep && *size != data->size)
+		die("object %s changed size!?", oid_to_hex(oid));
+	return contents;
+}
+
 static void print_object_or_die(struct batch_options *opt, struct expand_data *data)
 {
 	const struct object_id *oid = &data->oid;
@@ -343,18 +361,10 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 		}
 	}
 	else {
-		enum object_type type;
 		unsigned long size;
 		void *contents;
 
-		contents = read_object_file(oid, &type, &size);
-		if (!contents)
-			die("object %s disappeared", oid_to_hex(oid));
-		if (type != data->type)
-			die("object %s changed type!?", oid_to_hex(oid));
-		if (data->info.sizep && size != data->size)
-			die("object %s changed size!?", oid_to_hex(oid));
-
+		contents = read_object_or_die(data, &size);
 		batch_write(opt, contents, size);
 		free(contents);
 	}
@@ -372,40 +382,358 @@ static void print_default_format(struct strbuf *scratch, struct expand_data *dat
  * which the object may be accessed (though note that we may also rely on
  * data->oid, too). If "pack" is NULL, then offset is ignored.
  */
-static void batch_object_write(const char *obj_name,
-			       struct strbuf *scratch,
-			       struct batch_options *opt,
-			       struct expand_data *data,
-			       struct packed_git *pack,
-			       off_t offset)
+static int batch_object_info(struct expand_data *data,
+			     struct packed_git *pack,
+			     off_t offset)
 {
-	if (!data->skip_object_info) {
-		int ret;
+	int ret;
 
-		if (pack)
-			ret = packed_object_info(the_repository, pack, offset,
-						 &data->info);
-		else
-			ret = oid_object_info_extended(the_repository,
-						       &data->oid, &data->info,
-						       OBJECT_INFO_LOOKUP_REPLACE);
-		if (ret < 0) {
-			printf("%s missing\n",
-			       obj_name ? obj_name : oid_to_hex(&data->oid));
-			fflush(stdout);
-			return;
-		}
-	}
+	if (data->skip_object_info)
+		return 0;
 
-	strbuf_reset(scratch);
+	if (pack) {
+		/*
+		 * Unlike oid_object_info_extended(), packed_object_info()
+		 * does not take the object read lock on its own.
+		 */
+		obj_read_lock();
+		ret = packed_object_info(the_repository, pack, offset,
+					 &data->info);
+		obj_read_unlock();
+	} else
+		ret = oid_object_info_extended(the_repository,
+					       &data->oid, &data->info,
+					       OBJECT_INFO_LOOKUP_REPLACE);
+	return ret;
+}
 
+static void batch_format_header(struct strbuf *scratch,
+				struct batch_options *opt,
+				struct expand_data *data)
+{
 	if (!opt->format) {
 		print_default_format(scratch, data);
 	} else {
 		strbuf_expand(scratch, opt->format, expand_format, data);
 		strbuf_addch(scratch, '\n');
 	}
+}
+
+/*
+ * With --threads, the main thread resolves the object names read from
+ * stdin and adds work_items to 'todo', while the worker threads look
+ * up, inflate and format the objects. As in builtin/grep.c, the results
+ * are written to stdout strictly in the order the work_items were added.
+ */
+struct work_item {
+	struct expand_data data;
+	char *obj_name;
+	char *rest;
+	struct packed_git *pack;
+	off_t offset;
+
+	/* The formatted header (or the complete result if "ready"). */
+	struct strbuf out;
+	void *contents;
+	unsigned long size;
+
+	/* "out" was filled in by the main thread; nothing to look up. */
+	unsigned ready : 1;
+	/* The blob is too large to keep in memory; stream it at output. */
+	unsigned stream : 1;
+	char done;
+};
+
+/*
+ * In the range [todo_done, todo_start) in 'todo' we have work_items
+ * that have been or are processed by a worker thread. We haven't
+ * written the result for these to stdout yet.
+ *
+ * The work_items in [todo_start, todo_end) are waiting to be picked
+ * up by a worker thread.
+ *
+ * The ranges are modulo TODO_SIZE.
+ */
+#define TODO_SIZE 128
+static struct work_item todo[TODO_SIZE];
+static int todo_start;
+static int todo_end;
+static int todo_done;
+
+/* Has all work items been added? */
+static int all_work_added;
+
+static pthread_t *threads;
+
+/* This lock protects all the variables above. */
+static pthread_mutex_t batch_mutex;
+
+/* Signalled when a new work_item is added to todo. */
+static pthread_cond_t cond_add;
+
+/* Signalled when the result from one work_item is written to stdout. */
+static pthread_cond_t cond_write;
+
+/* Signalled when we are finished with everything. */
+static pthread_cond_t cond_result;
+
+static struct work_item *add_work_item(void)
+{
+	struct work_item *w;
+
+	pthread_mutex_lock(&batch_mutex);
+	while ((todo_end + 1) % ARRAY_SIZE(todo) == todo_done)
+		pthread_cond_wait(&cond_write, &batch_mutex);
+
+	w = &todo[todo_end];
+	w->done = 0;
+	w->ready = 0;
+	w->stream = 0;
+	strbuf_reset(&w->out);
+	return w;
+}
+
+static void queue_work_item(void)
+{
+	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
+	pthread_cond_signal(&cond_add);
+	pthread_mutex_unlock(&batch_mutex);
+}
+
+static void add_work(const char *obj_name, struct expand_data *data,
+		     struct packed_git *pack, off_t offset)
+{
+	struct work_item *w = add_work_item();
+
+	/*
+	 * The object_info in "data" points back into "data" itself, so
+	 * re-aim it at the copy owned by this work_item.
+	 */
+	w->data = *data;
+	if (data->info.typep)
+		w->data.info.typep = &w->data.type;
+	if (data->info.sizep)
+		w->data.info.sizep = &w->data.size;
+	if (data->info.disk_sizep)
+		w->data.info.disk_sizep = &w->data.disk_size;
+	if (data->info.delta_base_oid)
+		w->data.info.delta_base_oid = &w->data.delta_base_oid;
+
+	w->obj_name = xstrdup_or_null(obj_name);
+	w->rest = xstrdup_or_null(data->rest);
+	w->data.rest = w->rest;
+	w->pack = pack;
+	w->offset = offset;
+
+	queue_work_item();
+}
+
+static void add_result(const struct strbuf *result)
+{
+	struct work_item *w = add_work_item();
+
+	w->obj_name = NULL;
+	w->rest = NULL;
+	strbuf_addbuf(&w->out, result);
+	w->ready = 1;
+
+	queue_work_item();
+}
+
+static struct work_item *get_work(void)
+{
+	struct work_item *ret;
+
+	pthread_mutex_lock(&batch_mutex);
+	while (todo_start == todo_end && !all_work_added)
+		pthread_cond_wait(&cond_add, &batch_mutex);
+
+	if (todo_start == todo_end && all_work_added) {
+		ret = NULL;
+	} else {
+		ret = &todo[todo_start];
+		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+	}
+	pthread_mutex_unlock(&batch_mutex);
+	return ret;
+}
+
+static void write_work_item(struct batch_options *opt, struct work_item *w)
+{
+	batch_write(opt, w->out.buf, w->out.len);
+
+	if (w->contents) {
+		batch_write(opt, w->contents, w->size);
+		FREE_AND_NULL(w->contents);
+	} else if (w->stream) {
+		if (opt->buffer_output)
+			fflush(stdout);
+		obj_read_lock();
+		stream_blob(&w->data.oid);
+		obj_read_unlock();
+	} else {
+		return;
+	}
+	batch_write(opt, "\n", 1);
+}
+
+static void work_done(struct batch_options *opt, struct work_item *w)
+{
+	int old_done;
+
+	pthread_mutex_lock(&batch_mutex);
+	w->done = 1;
+	old_done = todo_done;
+	for (; todo[todo_done].done && todo_done != todo_start;
+	     todo_done = (todo_done + 1) % ARRAY_SIZE(todo)) {
+		w = &todo[todo_done];
+		write_work_item(opt, w);
+		FREE_AND_NULL(w->obj_name);
+		FREE_AND_NULL(w->rest);
+	}
+
+	if (old_done != todo_done)
+		pthread_cond_signal(&cond_write);
+
+	if (all_work_added && todo_done == todo_end)
+		pthread_cond_signal(&cond_result);
+
+	pthread_mutex_unlock(&batch_mutex);
+}
+
+static void process_work_item(struct batch_options *opt, struct work_item *w)
+{
+	struct expand_data *data = &w->data;
+
+	if (batch_object_info(data, w->pack, w->offset) < 0) {
+		strbuf_addf(&w->out, "%s missing\n",
+			    w->obj_name ? w->obj_name : oid_to_hex(&data->oid));
+		return;
+	}
+
+	batch_format_header(&w->out, opt, data);
+
+	if (opt->batch_mode != BATCH_MODE_CONTENTS)
+		return;
+
+	if (data->type == OBJ_BLOB && data->size > big_file_threshold)
+		w->stream = 1;
+	else
+		w->contents = read_object_or_die(data, &w->size);
+}
+
+static void *run(void *arg)
+{
+	struct batch_options *opt = arg;
+
+	while (1) {
+		struct work_item *w = get_work();
+		if (!w)
+			break;
+
+		if (!w->ready)
+			process_work_item(opt, w);
+		work_done(opt, w);
+	}
+
+	return NULL;
+}
+
+static void start_threads(struct batch_options *opt)
+{
+	int i;
+
+	pthread_mutex_init(&batch_mutex, NULL);
+	pthread_cond_init(&cond_add, NULL);
+	pthread_cond_init(&cond_write, NULL);
+	pthread_cond_init(&cond_result, NULL);
+	enable_obj_read_lock();
+
+	for (i = 0; i < ARRAY_SIZE(todo); i++)
+		strbuf_init(&todo[i].out, 0);
+
+	CALLOC_ARRAY(threads, opt->nr_threads);
+	for (i = 0; i < opt->nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, run, opt);
+
+		if (err)
+			die(_("cat-file: failed to create thread: %s"),
+			    strerror(err));
+	}
+}
+
+static void wait_all(struct batch_options *opt)
+{
+	int i;
+
+	if (!HAVE_THREADS)
+		BUG("Never call this function unless you have started threads");
+
+	pthread_mutex_lock(&batch_mutex);
+	all_work_added = 1;
+
+	/* Wait until all work is done. */
+	while (todo_done != todo_end)
+		pthread_cond_wait(&cond_result, &batch_mutex);
+
+	/*
+	 * Wake up all the worker threads so they can see that there is no
+	 * more work to do.
+	 */
+	pthread_cond_broadcast(&cond_add);
+	pthread_mutex_unlock(&batch_mutex);
+
+	for (i = 0; i < opt->nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	FREE_AND_NULL(threads);
+	for (i = 0; i < ARRAY_SIZE(todo); i++)
+		strbuf_release(&todo[i].out);
+
+	pthread_mutex_destroy(&batch_mutex);
+	pthread_cond_destroy(&cond_add);
+	pthread_cond_destroy(&cond_write);
+	pthread_cond_destroy(&cond_result);
+	disable_obj_read_lock();
+}
+
+/*
+ * Emit a result that was fully determined without looking at the object
+ * itself (e.g. because its name could not be resolved).
+ */
+static void batch_write_result(struct batch_options *opt,
+			       const struct strbuf *result)
+{
+	if (opt->nr_threads > 1) {
+		add_result(result);
+		return;
+	}
 
+	fwrite(result->buf, 1, result->len, stdout);
+	fflush(stdout);
+}
+
+static void batch_object_write(const char *obj_name,
+			       struct strbuf *scratch,
+			       struct batch_options *opt,
+			       struct expand_data *data,
+			       struct packed_git *pack,
+			       off_t offset)
+{
+	if (opt->nr_threads > 1) {
+		add_work(obj_name, data, pack, offset);
+		return;
+	}
+
+	if (batch_object_info(data, pack, offset) < 0) {
+		printf("%s missing\n",
+		       obj_name ? obj_name : oid_to_hex(&data->oid));
+		fflush(stdout);
+		return;
+	}
+
+	strbuf_reset(scratch);
+	batch_format_header(scratch, opt, data);
 	batch_write(opt, scratch->buf, scratch->len);
 
 	if (opt->batch_mode == BATCH_MODE_CONTENTS) {
@@ -423,42 +751,51 @@ static void batch_one_object(const char *obj_name,
 	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
 	enum get_oid_result result;
 
+	/*
+	 * Name resolution is not covered by the object read lock on its
+	 * own, so keep any worker threads out of the object store while
+	 * we are at it.
+	 */
+	obj_read_lock();
 	result = get_oid_with_context(the_repository, obj_name,
 				      flags, &data->oid, &ctx);
+	obj_read_unlock();
 	if (result != FOUND) {
+		strbuf_reset(scratch);
 		switch (result) {
 		case MISSING_OBJECT:
-			printf("%s missing\n", obj_name);
+			strbuf_addf(scratch, "%s missing\n", obj_name);
 			break;
 		case SHORT_NAME_AMBIGUOUS:
-			printf("%s ambiguous\n", obj_name);
+			strbuf_addf(scratch, "%s ambiguous\n", obj_name);
 			break;
 		case DANGLING_SYMLINK:
-			printf("dangling %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(scratch, "dangling %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case SYMLINK_LOOP:
-			printf("loop %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(scratch, "loop %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case NOT_DIR:
-			printf("notdir %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(scratch, "notdir %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		default:
 			BUG("unknown get_sha1_with_context result %d\n",
 			       result);
 			break;
 		}
-		fflush(stdout);
+		batch_write_result(opt, scratch);
 		return;
 	}
 
 	if (ctx.mode == 0) {
-		printf("symlink %"PRIuMAX"\n%s\n",
-		       (uintmax_t)ctx.symlink_path.len,
-		       ctx.symlink_path.buf);
-		fflush(stdout);
+		strbuf_reset(scratch);
+		strbuf_addf(scratch, "symlink %"PRIuMAX"\n%s\n",
+			    (uintmax_t)ctx.symlink_path.len,
+			    ctx.symlink_path.buf);
+		batch_write_result(opt, scratch);
 		return;
 	}
 
@@ -694,6 +1031,17 @@ static int batch_objects(struct batch_options *opt)
 	if (opt->batch_mode == BATCH_MODE_CONTENTS)
 		data.info.typep = &data.type;
 
+	if (opt->nr_threads > 1) {
+		/*
+		 * The worker threads need to know the size of blobs up
+		 * front, to decide whether to hold them in memory until
+		 * it is their turn to be written out.
+		 */
+		if (opt->batch_mode == BATCH_MODE_CONTENTS)
+			data.info.sizep = &data.size;
+		start_threads(opt);
+	}
+
 	if (opt->all_objects) {
 		struct object_cb_data cb;
 		struct object_info empty = OBJECT_INFO_INIT;
@@ -731,6 +1079,8 @@ static int batch_objects(struct batch_options *opt)
 			oid_array_clear(&sa);
 		}
 
+		if (opt->nr_threads > 1)
+			wait_all(opt);
 		strbuf_release(&output);
 		return 0;
 	}
@@ -769,6 +1119,8 @@ static int batch_objects(struct batch_options *opt)
 	}
 
  cleanup:
+	if (opt->nr_threads > 1)
+		wait_all(opt);
 	strbuf_release(&input);
 	strbuf_release(&output);
 	warn_on_object_refname_ambiguity = save_warning;
@@ -825,7 +1177,7 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		N_("git cat-file (-e | -p) <object>"),
 		N_("git cat-file (-t | -s) [--allow-unknown-type] <object>"),
 		N_("git cat-file (--batch | --batch-check | --batch-command) [--batch-all-objects]\n"
-		   "             [--buffer] [--follow-symlinks] [--unordered]\n"
+		   "             [--buffer] [--follow-symlinks] [--unordered] [--threads=<n>]\n"
 		   "             [--textconv | --filters]"),
 		N_("git cat-file (--textconv | --filters)\n"
 		   "             [<rev>:<path|tree-ish> | --path=<path|tree-ish> <rev>]"),
@@ -866,6 +1218,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			 N_("follow in-tree symlinks")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order objects before emitting them")),
+		OPT_INTEGER(0, "threads", &batch.nr_threads,
+			    N_("look up and inflate objects using <n> threads")),
 		/* Textconv options, stand-ole*/
 		OPT_GROUP(N_("Emit object (blob or tree) with conversion or filter (stand-alone, or with batch)")),
 		OPT_CMDMODE(0, "textconv", &opt,
@@ -880,6 +1234,7 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	git_config(git_cat_file_config, NULL);
 
 	batch.buffer_output = -1;
+	batch.nr_threads = 1;
 
 	argc = parse_options(argc, argv, prefix, options, usage, 0);
 	opt_cw = (opt == 'c' || opt == 'w');
@@ -908,11 +1263,24 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	else if (batch.all_objects)
 		usage_msg_optf(_("'%s' requires a batch mode"), usage, options,
 			       "--batch-all-objects");
+	else if (batch.nr_threads != 1)
+		usage_msg_optf(_("'%s' requires a batch mode"), usage, options,
+			       "--threads");
 
 	/* Batch defaults */
 	if (batch.buffer_output < 0)
 		batch.buffer_output = batch.all_objects;
 
+	if (batch.nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"),
+		    batch.nr_threads);
+	if (!batch.nr_threads)
+		batch.nr_threads = online_cpus();
+	if (!HAVE_THREADS && batch.nr_threads > 1) {
+		warning(_("no threads support, ignoring %s"), "--threads");
+		batch.nr_threads = 1;
+	}
+
 	/* Return early if we're in batch mode? */
 	if (batch.enabled) {
 		if (opt_cw)
@@ -924,6 +1292,18 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			usage_msg_opt(_("batch modes take no arguments"), usage,
 				      options);
 
+		if (batch.nr_threads > 1) {
+			if (batch.transform_mode)
+				usage_msg_optf(_("options '%s' and '%s' cannot be used together"),
+					       usage, options, "--threads",
+					       batch.transform_mode == 'c' ?
+					       "--textconv" : "--filters");
+			if (batch.batch_mode == BATCH_MODE_QUEUE_AND_DISPATCH)
+				usage_msg_optf(_("options '%s' and '%s' cannot be used together"),
+					       usage, options, "--threads",
+					       "--batch-command");
+		}
+
 		return batch_objects(&batch);
 	}
 
@@ -1,6 +1,7 @@
 #include "builtin.h"
 #include "config.h"
 #include "entry.h"
+#include "object-store.h"
 #include "parallel-checkout.h"
 #include "parse-options.h"
 #include "pkt-line.h"
@@ -76,31 +77,117 @@ static void release_pc_item_data(struct parallel_checkout_item *pc_item)
 	discard_cache_entry(pc_item->ce);
 }
 
-static void worker_loop(struct checkout *state)
+struct item_position {
+	size_t pos;
+	struct packed_git *pack; /* NULL if not found in a pack */
+	off_t offset;
+};
+
+static int item_position_cmp(const void *va, const void *vb)
 {
-	struct parallel_checkout_item *items = NULL;
-	size_t i, nr = 0, alloc = 0;
+	const struct item_position *a = va, *b = vb;
 
-	while (1) {
-		int len = packet_read(0, packet_buffer, sizeof(packet_buffer),
-				      0);
+	if (a->pack != b->pack) {
+		if (!a->pack || !b->pack)
+			return a->pack ? -1 : 1;
+		return (uintptr_t)a->pack < (uintptr_t)b->pack ? -1 : 1;
+	}
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a->pos < b->pos ? -1 : a->pos > b->pos;
+}
 
-		if (len < 0)
-			BUG("packet_read() returned negative value");
-		else if (!len)
-			break;
+/*
+ * Look the blobs of the items up in the packs before writing any of them,
+ * and return the order in which they are laid out there. Writing the items
+ * in that order reads each pack forward, mostly from pack windows that are
+ * already mapped, and makes the delta bases shared by neighbouring blobs
+ * more likely to still be in the delta base cache.
+ */
+static struct item_position *pack_order(struct parallel_checkout_item *items,
+					size_t nr)
+{
+	struct item_position *order;
+	size_t i;
 
-		ALLOC_GROW(items, nr + 1, alloc);
-		packet_to_pc_item(packet_buffer, len, &items[nr++]);
+	ALLOC_ARRAY(order, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		order[i].pos = i;
+		order[i].pack = NULL;
+		order[i].offset = 0;
+
+		if (!oid_object_info_extended(the_repository, &items[i].ce->oid,
+					      &oi, OBJECT_INFO_QUICK |
+					      OBJECT_INFO_SKIP_FETCH_OBJECT) &&
+		    oi.whence == OI_PACKED) {
+			order[i].pack = oi.u.packed.pack;
+			order[i].offset = oi.u.packed.offset;
+		}
 	}
+	QSORT(order, nr, item_position_cmp);
+
+	return order;
+}
+
+static void write_items(struct checkout *state,
+			struct parallel_checkout_item *items, size_t nr,
+			int stream)
+{
+	struct item_position *order = NULL;
+	size_t i;
+
+	if (stream)
+		order = pack_order(items, nr);
 
 	for (i = 0; i < nr; i++) {
-		struct parallel_checkout_item *pc_item = &items[i];
+		struct parallel_checkout_item *pc_item =
+			&items[order ? order[i].pos : i];
 		write_pc_item(pc_item, state);
 		report_result(pc_item);
 		release_pc_item_data(pc_item);
 	}
 
+	free(order);
+}
+
+/*
+ * Without `stream`, read all the items up to a flush packet, write them and
+ * report the results in the order they were received, followed by a flush.
+ *
+ * With `stream`, each flush packet ends a batch of items, which is written
+ * right away, in no particular order; the final flush is sent once the main
+ * process closes our input.
+ */
+static void worker_loop(struct checkout *state, int stream)
+{
+	struct parallel_checkout_item *items = NULL;
+	size_t i, nr = 0, alloc = 0;
+
+	while (1) {
+		int len = packet_read(0, packet_buffer, sizeof(packet_buffer),
+				      stream ? PACKET_READ_GENTLE_ON_EOF : 0);
+
+		if (len < 0) {
+			if (!stream)
+				BUG("packet_read() returned negative value");
+			break;
+		} else if (!len) {
+			write_items(state, items, nr, stream);
+			nr = 0;
+			if (!stream)
+				break;
+		} else {
+			ALLOC_GROW(items, nr + 1, alloc);
+			packet_to_pc_item(packet_buffer, len, &items[nr++]);
+		}
+	}
+
+	/* Items of a batch that was cut short are not written. */
+	for (i = 0; i < nr; i++)
+		release_pc_item_data(&items[i]);
+
 	packet_flush(1);
 
 	free(items);
@@ -114,9 +201,12 @@ static const char * const checkout_worker_usage[] = {
 int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 {
 	struct checkout state = CHECKOUT_INIT;
+	int stream = 0;
 	struct option checkout_worker_options[] = {
 		OPT_STRING(0, "prefix", &state.base_dir, N_("string"),
 			N_("when creating files, prepend <string>")),
+		OPT_BOOL(0, "stream", &stream,
+			 N_("write each batch of items as soon as it is received")),
 		OPT_END()
 	};
 
@@ -140,6 +230,6 @@ int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 	 */
 	state.refresh_cache = 1;
 
-	worker_loop(&state);
+	worker_loop(&state, stream);
 	return 0;
 }
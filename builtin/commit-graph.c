@@ -15,7 +15,8 @@
 #define BUILTIN_COMMIT_GRAPH_WRITE_USAGE \
 	N_("git commit-graph write [--object-dir <objdir>] [--append] " \
 	   "[--split[=<strategy>]] [--reachable|--stdin-packs|--stdin-commits] " \
-	   "[--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress] " \
+	   "[--changed-paths] [--[no-]max-new-filters <n>] [--threads=<n>] " \
+	   "[--[no-]progress] " \
 	   "<split options>")
 
 static const char * builtin_commit_graph_verify_usage[] = {
@@ -183,6 +184,12 @@ static int git_commit_graph_write_config(const char *var, const char *value,
 {
 	if (!strcmp(var, "commitgraph.maxnewfilters"))
 		write_opts.max_new_filters = git_config_int(var, value);
+	if (!strcmp(var, "commitgraph.threads")) {
+		write_opts.threads = git_config_int(var, value);
+		if (write_opts.threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    write_opts.threads, var);
+	}
 	/*
 	 * No need to fall-back to 'git_default_config', since this was already
 	 * called in 'cmd_commit_graph()'.
@@ -224,6 +231,8 @@ static int graph_write(int argc, const char **argv)
 		OPT_CALLBACK_F(0, "max-new-filters", &write_opts.max_new_filters,
 			NULL, N_("maximum number of changed-path Bloom filters to compute"),
 			0, write_option_max_new_filters),
+		OPT_INTEGER(0, "threads", &write_opts.threads,
+			N_("use <n> threads to compute changed-path Bloom filters")),
 		OPT_BOOL(0, "progress", &opts.progress,
 			 N_("force progress reporting")),
 		OPT_END(),
@@ -236,6 +245,7 @@ static int graph_write(int argc, const char **argv)
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
 	write_opts.max_new_filters = -1;
+	write_opts.threads = 0;
 
 	trace2_cmd_mode("write");
 
@@ -247,6 +257,9 @@ static int graph_write(int argc, const char **argv)
 	if (argc)
 		usage_with_options(builtin_commit_graph_write_usage, options);
 
+	if (write_opts.threads < 0)
+		die(_("invalid number of threads specified (%d)"),
+		    write_opts.threads);
 	if (opts.reachable + opts.stdin_packs + opts.stdin_commits > 1)
 		die(_("use at most one of --reachable, --stdin-commits, or --stdin-packs"));
 	if (!opts.obj_dir)
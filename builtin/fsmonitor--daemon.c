@@ -9,6 +9,7 @@
 #include "simple-ipc.h"
 #include "khash.h"
 #include "pkt-line.h"
+#include "list.h"
 
 static const char * const builtin_fsmonitor__daemon_usage[] = {
 	N_("git fsmonitor--daemon start [<options>]"),
@@ -552,6 +553,256 @@ static void fsmonitor_free_token_data(struct fsmonitor_token_data *token)
 	free(token);
 }
 
+/*
+ * The stat cache holds the lstat() results for the worktree paths that
+ * clients asked about with a FSMONITOR_STAT_CACHE_COMMAND request.  An
+ * entry stays valid until an event is published for its path (or for
+ * one of its leading directories), so subsequent requests for the same
+ * paths can be answered without touching the filesystem.
+ *
+ * Besides being hashed by their path, the entries are grouped by their
+ * leading directory, and these directories form a tree, so that an event
+ * for a directory only has to visit the entries below it.
+ */
+struct fsmonitor_stat_cache_dir {
+	struct hashmap_entry entry;
+	struct fsmonitor_stat_cache_dir *parent;
+	struct list_head files;		/* fsmonitor_stat_cache_entry.dir_list */
+	struct list_head subdirs;	/* fsmonitor_stat_cache_dir.siblings */
+	struct list_head siblings;
+	char path[FLEX_ARRAY];		/* with a trailing slash; "" for the root */
+};
+
+struct fsmonitor_stat_cache_entry {
+	struct hashmap_entry entry;
+	struct fsmonitor_stat_cache_dir *dir;
+	struct list_head dir_list;
+	struct fsmonitor_stat_cache_item item;
+	char path[FLEX_ARRAY];
+};
+
+static int stat_cache_cmp(const void *data, const struct hashmap_entry *he1,
+			  const struct hashmap_entry *he2, const void *keydata)
+{
+	const struct fsmonitor_stat_cache_entry *a =
+		container_of(he1, const struct fsmonitor_stat_cache_entry, entry);
+	const struct fsmonitor_stat_cache_entry *b =
+		container_of(he2, const struct fsmonitor_stat_cache_entry, entry);
+
+	return fspathcmp(a->path, keydata ? keydata : b->path);
+}
+
+static int stat_cache_dir_cmp(const void *data,
+			      const struct hashmap_entry *he1,
+			      const struct hashmap_entry *he2,
+			      const void *keydata)
+{
+	const struct fsmonitor_stat_cache_dir *a =
+		container_of(he1, const struct fsmonitor_stat_cache_dir, entry);
+	const struct fsmonitor_stat_cache_dir *b =
+		container_of(he2, const struct fsmonitor_stat_cache_dir, entry);
+
+	return fspathcmp(a->path, keydata ? keydata : b->path);
+}
+
+/*
+ * Look up the directory `path` (of length `len`, ending in a slash
+ * unless it is the root) in the stat cache.  With `create`, add it and
+ * any missing leading directories when it is not there yet.
+ */
+static struct fsmonitor_stat_cache_dir *with_lock__stat_cache_get_dir(
+	struct fsmonitor_daemon_state *state,
+	const char *path, size_t len, int create)
+{
+	/* assert current thread holding state->main_lock */
+
+	struct fsmonitor_stat_cache_dir *d;
+	char *key = xmemdupz(path, len);
+
+	d = hashmap_get_entry_from_hash(&state->stat_cache_dirs,
+					fspathhash(key), key,
+					struct fsmonitor_stat_cache_dir, entry);
+	free(key);
+	if (d || !create)
+		return d;
+
+	FLEX_ALLOC_MEM(d, path, path, len);
+	hashmap_entry_init(&d->entry, fspathhash(d->path));
+	INIT_LIST_HEAD(&d->files);
+	INIT_LIST_HEAD(&d->subdirs);
+	INIT_LIST_HEAD(&d->siblings);
+	if (len) {
+		size_t parent_len = len - 1;
+
+		while (parent_len && path[parent_len - 1] != '/')
+			parent_len--;
+		d->parent = with_lock__stat_cache_get_dir(state, path,
+							  parent_len, 1);
+		list_add_tail(&d->siblings, &d->parent->subdirs);
+	}
+	hashmap_add(&state->stat_cache_dirs, &d->entry);
+	return d;
+}
+
+/*
+ * Drop `dir` and its leading directories from the stat cache for as
+ * long as they are empty.
+ */
+static void with_lock__stat_cache_prune_dir(
+	struct fsmonitor_daemon_state *state,
+	struct fsmonitor_stat_cache_dir *dir)
+{
+	/* assert current thread holding state->main_lock */
+
+	while (dir && list_empty(&dir->files) && list_empty(&dir->subdirs)) {
+		struct fsmonitor_stat_cache_dir *parent = dir->parent;
+
+		hashmap_remove(&state->stat_cache_dirs, &dir->entry, NULL);
+		list_del(&dir->siblings);
+		free(dir);
+		dir = parent;
+	}
+}
+
+static void with_lock__stat_cache_add(struct fsmonitor_daemon_state *state,
+				      const char *path,
+				      const struct fsmonitor_stat_cache_item *item)
+{
+	/* assert current thread holding state->main_lock */
+
+	struct fsmonitor_stat_cache_entry *e;
+	const char *slash = strrchr(path, '/');
+
+	FLEX_ALLOC_STR(e, path, path);
+	hashmap_entry_init(&e->entry, fspathhash(e->path));
+	e->item = *item;
+	e->dir = with_lock__stat_cache_get_dir(state, path,
+					       slash ? slash - path + 1 : 0, 1);
+	list_add_tail(&e->dir_list, &e->dir->files);
+	hashmap_add(&state->stat_cache, &e->entry);
+}
+
+static void with_lock__stat_cache_remove(struct fsmonitor_daemon_state *state,
+					 struct fsmonitor_stat_cache_entry *e)
+{
+	/* assert current thread holding state->main_lock */
+
+	hashmap_remove(&state->stat_cache, &e->entry, NULL);
+	list_del(&e->dir_list);
+	with_lock__stat_cache_prune_dir(state, e->dir);
+	free(e);
+}
+
+static struct fsmonitor_stat_cache_entry *with_lock__stat_cache_get(
+	struct fsmonitor_daemon_state *state, const char *path)
+{
+	/* assert current thread holding state->main_lock */
+
+	return hashmap_get_entry_from_hash(&state->stat_cache,
+					   fspathhash(path), path,
+					   struct fsmonitor_stat_cache_entry,
+					   entry);
+}
+
+static void with_lock__stat_cache_clear(struct fsmonitor_daemon_state *state)
+{
+	/* assert current thread holding state->main_lock */
+
+	hashmap_partial_clear_and_free(&state->stat_cache,
+				       struct fsmonitor_stat_cache_entry, entry);
+	hashmap_partial_clear_and_free(&state->stat_cache_dirs,
+				       struct fsmonitor_stat_cache_dir, entry);
+	state->stat_cache_generation++;
+}
+
+static void with_lock__stat_cache_free_dir(
+	struct fsmonitor_daemon_state *state,
+	struct fsmonitor_stat_cache_dir *dir)
+{
+	/* assert current thread holding state->main_lock */
+
+	struct list_head *pos, *tmp;
+
+	list_for_each_safe(pos, tmp, &dir->files) {
+		struct fsmonitor_stat_cache_entry *e =
+			list_entry(pos, struct fsmonitor_stat_cache_entry,
+				   dir_list);
+
+		hashmap_remove(&state->stat_cache, &e->entry, NULL);
+		free(e);
+	}
+	list_for_each_safe(pos, tmp, &dir->subdirs)
+		with_lock__stat_cache_free_dir(
+			state, list_entry(pos, struct fsmonitor_stat_cache_dir,
+					  siblings));
+
+	hashmap_remove(&state->stat_cache_dirs, &dir->entry, NULL);
+	free(dir);
+}
+
+/*
+ * Forget about everything below the directory `dir` (of length `len`,
+ * with a trailing slash).
+ */
+static void with_lock__stat_cache_remove_dir(
+	struct fsmonitor_daemon_state *state,
+	const char *dir, size_t len)
+{
+	/* assert current thread holding state->main_lock */
+
+	struct fsmonitor_stat_cache_dir *d, *parent;
+
+	d = with_lock__stat_cache_get_dir(state, dir, len, 0);
+	if (!d)
+		return;
+
+	parent = d->parent;
+	list_del(&d->siblings);
+	with_lock__stat_cache_free_dir(state, d);
+	with_lock__stat_cache_prune_dir(state, parent);
+}
+
+static void with_lock__stat_cache_invalidate(
+	struct fsmonitor_daemon_state *state,
+	const struct fsmonitor_batch *batch)
+{
+	/* assert current thread holding state->main_lock */
+
+	struct strbuf path = STRBUF_INIT;
+	size_t k;
+
+	if (!hashmap_get_size(&state->stat_cache))
+		return;
+
+	for (; batch; batch = batch->next) {
+		for (k = 0; k < batch->nr; k++) {
+			struct fsmonitor_stat_cache_entry *e;
+
+			strbuf_reset(&path);
+			strbuf_addstr(&path, batch->interned_paths[k]);
+
+			/*
+			 * Something happened to a directory, so forget
+			 * about everything below it and about the
+			 * directory itself, which might have been replaced
+			 * by a file.
+			 */
+			if (path.len && path.buf[path.len - 1] == '/') {
+				with_lock__stat_cache_remove_dir(state, path.buf,
+								 path.len);
+				strbuf_setlen(&path, path.len - 1);
+			}
+
+			e = with_lock__stat_cache_get(state, path.buf);
+			if (e)
+				with_lock__stat_cache_remove(state, e);
+		}
+	}
+
+	strbuf_release(&path);
+	state->stat_cache_generation++;
+}
+
 /*
  * Flush all of our cached data about the filesystem.  Call this if we
  * lose sync with the filesystem and miss some notification events.
@@ -564,6 +815,8 @@ static void fsmonitor_free_token_data(struct fsmonitor_token_data *token)
  * [2] Some of those lost events may have been for cookie files.  We
  *     should assume the worst and abort them rather letting them starve.
  *
+ * [3] The stat cache may hold data for paths whose events were lost.
+ *
  * If there are no concurrent threads reading the current token data
  * series, we can free it now.  Otherwise, let the last reader free
  * it.
@@ -587,6 +840,7 @@ static void with_lock__do_force_resync(struct fsmonitor_daemon_state *state)
 	fsmonitor_free_token_data(free_me);
 
 	with_lock__abort_all_cookies(state);
+	with_lock__stat_cache_clear(state);
 }
 
 void fsmonitor_force_resync(struct fsmonitor_daemon_state *state)
@@ -946,6 +1200,126 @@ static int do_handle_client(struct fsmonitor_daemon_state *state,
 	return 0;
 }
 
+/*
+ * Answer a stat cache request.  `paths` is the part of the request after
+ * the command verb: a NUL before each of the requested paths.
+ */
+static int do_handle_stat_cache_request(struct fsmonitor_daemon_state *state,
+					const char *paths, size_t paths_len,
+					ipc_server_reply_cb *reply,
+					struct ipc_server_reply_data *reply_data)
+{
+	const char *p, *end = paths + paths_len;
+	const char **path = NULL;
+	struct fsmonitor_stat_cache_item *items = NULL;
+	struct strbuf abs_path = STRBUF_INIT;
+	enum fsmonitor_cookie_item_result cookie_result;
+	uint64_t generation;
+	size_t k, nr = 0, alloc = 0, nr_hits = 0, chunk;
+
+	for (p = paths; p < end; p += strnlen(p, end - p)) {
+		/*
+		 * Do not trust the client.  Answer a request that we
+		 * cannot parse with an empty response, which makes it
+		 * lstat() the paths itself.
+		 */
+		if (*p++) {
+			error(_("fsmonitor: malformed stat cache request"));
+			goto cleanup;
+		}
+		ALLOC_GROW(path, nr + 1, alloc);
+		path[nr++] = p;
+	}
+	CALLOC_ARRAY(items, nr);
+
+	pthread_mutex_lock(&state->main_lock);
+
+	/*
+	 * Like for a token request, make sure that we have seen the
+	 * events for everything that happened before the request, or
+	 * we might answer with stale data.  The client falls back to
+	 * lstat() when it gets an empty response.
+	 */
+	cookie_result = with_lock__wait_for_cookie(state);
+	if (cookie_result != FCIR_SEEN) {
+		pthread_mutex_unlock(&state->main_lock);
+		error(_("fsmonitor: cookie_result '%d' != SEEN"),
+		      cookie_result);
+		goto cleanup;
+	}
+
+	for (k = 0; k < nr; k++) {
+		struct fsmonitor_stat_cache_entry *e =
+			with_lock__stat_cache_get(state, path[k]);
+		if (e) {
+			items[k] = e->item;
+			nr_hits++;
+		} else {
+			items[k].err = -1;
+		}
+	}
+	generation = state->stat_cache_generation;
+
+	pthread_mutex_unlock(&state->main_lock);
+
+	strbuf_addbuf(&abs_path, &state->path_worktree_watch);
+	strbuf_addch(&abs_path, '/');
+	for (k = 0; k < nr; k++) {
+		size_t baselen = abs_path.len;
+
+		if (items[k].err != -1)
+			continue;
+
+		strbuf_addstr(&abs_path, path[k]);
+		items[k].err = lstat(abs_path.buf, &items[k].st) ? errno : 0;
+		strbuf_setlen(&abs_path, baselen);
+	}
+
+	pthread_mutex_lock(&state->main_lock);
+
+	/*
+	 * If events were published while we were looking at the
+	 * filesystem, some of what we found may already be outdated.
+	 * Send it anyway, as it is no older than the request, but do
+	 * not keep it.
+	 */
+	if (generation == state->stat_cache_generation) {
+		for (k = 0; k < nr; k++) {
+			/*
+			 * Only remember paths that exist or are known not
+			 * to exist; other errors might be transient.
+			 */
+			if (items[k].err && items[k].err != ENOENT &&
+			    items[k].err != ENOTDIR)
+				continue;
+			if (with_lock__stat_cache_get(state, path[k]))
+				continue;
+
+			with_lock__stat_cache_add(state, path[k], &items[k]);
+		}
+	}
+
+	pthread_mutex_unlock(&state->main_lock);
+
+	chunk = LARGE_PACKET_DATA_MAX / sizeof(*items);
+	for (k = 0; k < nr; k += chunk)
+		reply(reply_data, (const char *)(items + k),
+		      st_mult(nr - k < chunk ? nr - k : chunk,
+			      sizeof(*items)));
+
+	trace2_data_intmax("fsmonitor", the_repository,
+			   "stat-cache/count/paths", nr);
+	trace2_data_intmax("fsmonitor", the_repository,
+			   "stat-cache/count/hits", nr_hits);
+
+cleanup:
+	strbuf_release(&abs_path);
+	free(items);
+	free(path);
+
+	return 0;
+}
+
 static ipc_server_application_cb handle_client;
 
 static int handle_client(void *data,
@@ -954,14 +1328,27 @@ static int handle_client(void *data,
 			 struct ipc_server_reply_data *reply_data)
 {
 	struct fsmonitor_daemon_state *state = data;
+	size_t verb_len = strlen(command);
 	int result;
 
+	if (!strcmp(command, FSMONITOR_STAT_CACHE_COMMAND)) {
+		trace2_region_enter("fsmonitor", "handle_stat_cache",
+				    the_repository);
+		result = do_handle_stat_cache_request(
+			state, command + verb_len, command_len - verb_len,
+			reply, reply_data);
+		trace2_region_leave("fsmonitor", "handle_stat_cache",
+				    the_repository);
+		return result;
+	}
+
 	/*
 	 * The Simple IPC API now supports {char*, len} arguments, but
-	 * FSMonitor always uses proper null-terminated strings, so
-	 * we can ignore the command_len argument.  (Trust, but verify.)
+	 * FSMonitor always uses proper null-terminated strings for
+	 * everything but stat cache requests, so we can ignore the
+	 * command_len argument.  (Trust, but verify.)
 	 */
-	if (command_len != strlen(command))
+	if (command_len != verb_len)
 		BUG("FSMonitor assumes text messages");
 
 	trace_printf_key(&trace_fsmonitor, "requested token: %s", command);
@@ -1080,6 +1467,8 @@ void fsmonitor_publish(struct fsmonitor_daemon_state *state,
 	if (batch) {
 		struct fsmonitor_batch *head;
 
+		with_lock__stat_cache_invalidate(state, batch);
+
 		head = state->current_token_data->batch_head;
 		if (!head) {
 			BUG("token does not have batch");
@@ -1271,6 +1660,8 @@ static int fsmonitor_run_daemon(void)
 	memset(&state, 0, sizeof(state));
 
 	hashmap_init(&state.cookies, cookies_cmp, NULL, 0);
+	hashmap_init(&state.stat_cache, stat_cache_cmp, NULL, 0);
+	hashmap_init(&state.stat_cache_dirs, stat_cache_dir_cmp, NULL, 0);
 	pthread_mutex_init(&state.main_lock, NULL);
 	pthread_cond_init(&state.cookies_cond, NULL);
 	state.listen_error_code = 0;
@@ -1379,6 +1770,10 @@ static int fsmonitor_run_daemon(void)
 	err = fsmonitor_run_daemon_1(&state);
 
 done:
+	hashmap_clear_and_free(&state.stat_cache,
+			       struct fsmonitor_stat_cache_entry, entry);
+	hashmap_clear_and_free(&state.stat_cache_dirs,
+			       struct fsmonitor_stat_cache_dir, entry);
 	pthread_cond_destroy(&state.cookies_cond);
 	pthread_mutex_destroy(&state.main_lock);
 	fsm_listen__dtor(&state);
@@ -32,6 +32,7 @@
 #include "remote.h"
 #include "exec-cmd.h"
 #include "hook.h"
+#include "rename-cache.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -1192,6 +1193,32 @@ static int maintenance_task_incremental_repack(struct maintenance_run_opts *opts
 	return 0;
 }
 
+static int rename_cache_auto_condition(void)
+{
+	int rename_cache_auto_limit = 10;
+
+	git_config_get_int("maintenance.rename-cache.auto",
+			   &rename_cache_auto_limit);
+
+	if (!rename_cache_auto_limit)
+		return 0;
+	if (rename_cache_auto_limit < 0)
+		return 1;
+
+	return rename_cache_count_files(the_repository) >= rename_cache_auto_limit;
+}
+
+static int maintenance_task_rename_cache(MAYBE_UNUSED struct maintenance_run_opts *opts)
+{
+	prepare_repo_settings(the_repository);
+	if (!the_repository->settings.diff_rename_cache)
+		return 0;
+
+	if (rename_cache_compact(the_repository))
+		return error(_("failed to compact the rename cache"));
+	return 0;
+}
+
 typedef int maintenance_task_fn(struct maintenance_run_opts *opts);
 
 /*
@@ -1220,6 +1247,7 @@ enum maintenance_task_label {
 	TASK_GC,
 	TASK_COMMIT_GRAPH,
 	TASK_PACK_REFS,
+	TASK_RENAME_CACHE,
 
 	/* Leave as final value */
 	TASK__COUNT
@@ -1256,6 +1284,11 @@ static struct maintenance_task tasks[] = {
 		maintenance_task_pack_refs,
 		NULL,
 	},
+	[TASK_RENAME_CACHE] = {
+		"rename-cache",
+		maintenance_task_rename_cache,
+		rename_cache_auto_condition,
+	},
 };
 
 static int compare_tasks_by_selection(const void *a_, const void *b_)
@@ -520,8 +520,6 @@ static int grep_cache(struct grep_opt *opt,
 	if (repo_read_index(repo) < 0)
 		die(_("index file corrupt"));
 
-	/* TODO: audit for interaction with sparse-index. */
-	ensure_full_index(repo->index);
 	for (nr = 0; nr < repo->index->cache_nr; nr++) {
 		const struct cache_entry *ce = repo->index->cache[nr];
 
@@ -531,7 +529,25 @@ static int grep_cache(struct grep_opt *opt,
 		strbuf_setlen(&name, name_base_len);
 		strbuf_addstr(&name, ce->name);
 
-		if (S_ISREG(ce->ce_mode) &&
+		if (S_ISSPARSEDIR(ce->ce_mode)) {
+			enum object_type type;
+			struct tree_desc tree;
+			void *data;
+			unsigned long size;
+
+			/*
+			 * Only reached with --cached, as sparse directories
+			 * are skip-worktree: search the tree they record.
+			 */
+			data = repo_read_object_file(repo, &ce->oid, &type, &size);
+			if (!data)
+				die(_("unable to read tree (%s)"),
+				    oid_to_hex(&ce->oid));
+
+			init_tree_desc(&tree, data, size);
+			hit |= grep_tree(opt, pathspec, &tree, &name, 0, 0);
+			free(data);
+		} else if (S_ISREG(ce->ce_mode) &&
 		    match_pathspec(repo->index, pathspec, name.buf, name.len, 0, NULL,
 				   S_ISDIR(ce->ce_mode) ||
 				   S_ISGITLINK(ce->ce_mode))) {
@@ -995,6 +1011,11 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (!use_index)
 		recurse_submodules = 0;
 
+	if (the_repository->gitdir) {
+		prepare_repo_settings(the_repository);
+		the_repository->settings.command_requires_full_index = 0;
+	}
+
 	/*
 	 * skip a -- separator; we know it cannot be
 	 * separating revisions from pathnames if
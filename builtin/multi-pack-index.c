@@ -8,7 +8,7 @@
 
 #define BUILTIN_MIDX_WRITE_USAGE \
 	N_("git multi-pack-index [<options>] write [--preferred-pack=<pack>]" \
-	   "[--refs-snapshot=<path>]")
+	   "[--refs-snapshot=<path>] [--incremental [--size-multiple=<n>]]")
 
 #define BUILTIN_MIDX_VERIFY_USAGE \
 	N_("git multi-pack-index [<options>] verify")
@@ -50,6 +50,8 @@ static struct opts_multi_pack_index {
 	unsigned long batch_size;
 	unsigned flags;
 	int stdin_packs;
+	int incremental;
+	int size_multiple;
 } opts;
 
 
@@ -87,6 +89,20 @@ static int git_multi_pack_index_write_config(const char *var, const char *value,
 			opts.flags &= ~MIDX_WRITE_BITMAP_HASH_CACHE;
 	}
 
+	if (!strcmp(var, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(var, value))
+			opts.flags |= MIDX_WRITE_BITMAP_LOOKUP_TABLE;
+		else
+			opts.flags &= ~MIDX_WRITE_BITMAP_LOOKUP_TABLE;
+	}
+
+	if (!strcmp(var, "pack.writebitmaproaring")) {
+		if (git_config_bool(var, value))
+			opts.flags |= MIDX_WRITE_BITMAP_ROARING;
+		else
+			opts.flags &= ~MIDX_WRITE_BITMAP_ROARING;
+	}
+
 	/*
 	 * We should never make a fall-back call to 'git_default_config', since
 	 * this was already called in 'cmd_multi_pack_index()'.
@@ -119,6 +135,10 @@ static int cmd_multi_pack_index_write(int argc, const char **argv)
 			 N_("write multi-pack index containing only given indexes")),
 		OPT_FILENAME(0, "refs-snapshot", &opts.refs_snapshot,
 			     N_("refs snapshot for selecting bitmap commits")),
+		OPT_BOOL(0, "incremental", &opts.incremental,
+			 N_("add a layer for new packs to the multi-pack-index chain")),
+		OPT_INTEGER(0, "size-multiple", &opts.size_multiple,
+			    N_("maximum ratio between two levels of an incremental chain")),
 		OPT_END(),
 	};
 
@@ -141,6 +161,24 @@ static int cmd_multi_pack_index_write(int argc, const char **argv)
 
 	FREE_AND_NULL(options);
 
+	if (opts.incremental) {
+		if (opts.stdin_packs)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--incremental", "--stdin-packs");
+		if (opts.flags & MIDX_WRITE_BITMAP)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--incremental", "--bitmap");
+		if (opts.preferred_pack)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--incremental", "--preferred-pack");
+
+		return write_midx_file_incremental(opts.object_dir,
+						   opts.size_multiple,
+						   opts.flags);
+	} else if (opts.size_multiple)
+		die(_("the option '%s' requires '%s'"),
+		    "--size-multiple", "--incremental");
+
 	if (opts.stdin_packs) {
 		struct string_list packs = STRING_LIST_INIT_DUP;
 		int ret;
@@ -143,6 +143,8 @@ int cmd_mv(int argc, const char **argv, const char *prefix)
 	if (--argc < 1)
 		usage_with_options(builtin_mv_usage, builtin_mv_options);
 
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
 	hold_locked_index(&lock_file, LOCK_DIE_ON_ERROR);
 	if (read_cache() < 0)
 		die(_("index file corrupt"));
@@ -173,6 +175,17 @@ int cmd_mv(int argc, const char **argv, const char *prefix)
 		destination = dest_path;
 	}
 
+	/*
+	 * Moves inside the sparse-checkout cone only deal with entries
+	 * outside of sparse directories; anything else is handled on
+	 * the full index.
+	 */
+	for (i = 0; the_index.sparse_index && i < argc; i++) {
+		if (!path_in_cone_mode_sparse_checkout(source[i], &the_index) ||
+		    !path_in_cone_mode_sparse_checkout(destination[i], &the_index))
+			ensure_full_index(&the_index);
+	}
+
 	/* Checking */
 	for (i = 0; i < argc; i++) {
 		const char *src = source[i], *dst = destination[i];
@@ -206,6 +219,20 @@ int cmd_mv(int argc, const char **argv, const char *prefix)
 			else { /* last - first >= 1 */
 				int j, dst_len, n;
 
+				/*
+				 * A directory in the cone may still hold
+				 * sparse directories, which are moved
+				 * file by file.
+				 */
+				for (j = first; the_index.sparse_index && j < last; j++) {
+					if (S_ISSPARSEDIR(active_cache[j]->ce_mode)) {
+						ensure_full_index(&the_index);
+						index_range_of_same_dir(src, length,
+									&first, &last);
+						break;
+					}
+				}
+
 				modes[i] = WORKING_DIRECTORY;
 				n = argc + last - first;
 				REALLOC_ARRAY(source, n);
@@ -3148,6 +3148,18 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	}
+	if (!strcmp(k, "pack.writebitmaproaring")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_ROARING;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_ROARING;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
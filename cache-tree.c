@@ -243,15 +243,113 @@ static int must_check_existence(const struct cache_entry *ce)
 	return !(has_promisor_remote() && ce_skip_worktree(ce));
 }
 
+/*
+ * When a directory has to be written again, most of its entries are
+ * usually the same as in an older version of its tree: the one it
+ * had before it was invalidated, or the one HEAD has at that path.
+ * Entries found unchanged in that "base" tree are copied from it byte
+ * for byte, and their objects need no existence check, because the
+ * base tree already refers to them.
+ */
+struct base_tree {
+	void *buf;
+	struct tree_desc desc;
+};
+
+static void base_tree_init(struct base_tree *base, const struct object_id *oid)
+{
+	enum object_type type;
+	unsigned long size;
+
+	memset(base, 0, sizeof(*base));
+	if (!oid || is_null_oid(oid) || has_promisor_remote())
+		return;
+
+	base->buf = read_object_file(oid, &type, &size);
+	if (base->buf &&
+	    (type != OBJ_TREE || init_tree_desc_gently(&base->desc, base->buf, size)))
+		FREE_AND_NULL(base->buf);
+}
+
+static void base_tree_release(struct base_tree *base)
+{
+	FREE_AND_NULL(base->buf);
+}
+
+static const char *canonical_mode_text(unsigned mode)
+{
+	switch (mode) {
+	case S_IFDIR:
+		return "40000";
+	case S_IFREG | 0644:
+		return "100644";
+	case S_IFREG | 0755:
+		return "100755";
+	case S_IFLNK:
+		return "120000";
+	case S_IFGITLINK:
+		return "160000";
+	}
+	return NULL;
+}
+
+/*
+ * Advance "desc" past the entry for "name" and return a pointer to the
+ * raw bytes of that entry, with their length in "len", if it has the
+ * given mode and object name.  The entries of a tree being written are
+ * visited in order, so each base tree is scanned only once.
+ */
+static const char *find_base_entry(struct tree_desc *desc,
+				   const char *name, int namelen, unsigned mode,
+				   const struct object_id *oid, size_t *len)
+{
+	while (desc->size) {
+		const struct name_entry *e = &desc->entry;
+		const char *start = desc->buffer;
+		const char *mode_text;
+		size_t mode_len;
+		int cmp;
+
+		cmp = base_name_compare(e->path, tree_entry_len(e), e->mode,
+					name, namelen, mode);
+		if (cmp > 0)
+			return NULL;
+		if (cmp < 0) {
+			if (update_tree_entry_gently(desc))
+				desc->size = 0;
+			continue;
+		}
+
+		if (e->mode != mode || !oideq(&e->oid, oid) ||
+		    !(mode_text = canonical_mode_text(mode)))
+			start = NULL;
+		else {
+			/* the tree may spell the mode differently */
+			mode_len = strlen(mode_text);
+			if (memcmp(start, mode_text, mode_len) || start[mode_len] != ' ')
+				start = NULL;
+		}
+		if (update_tree_entry_gently(desc))
+			desc->size = 0;
+		if (start)
+			*len = (const char *)desc->buffer - start;
+		return start;
+	}
+	return NULL;
+}
+
 static int update_one(struct cache_tree *it,
 		      struct cache_entry **cache,
 		      int entries,
 		      const char *base,
 		      int baselen,
+		      const struct object_id *base_oid,
 		      int *skip_count,
 		      int flags)
 {
 	struct strbuf buffer;
+	struct base_tree base_tree;
+	struct tree_desc sub_desc;
 	int missing_ok = flags & WRITE_TREE_MISSING_OK;
 	int dryrun = flags & WRITE_TREE_DRY_RUN;
 	int repair = flags & WRITE_TREE_REPAIR;
@@ -283,6 +381,9 @@ static int update_one(struct cache_tree *it,
 	if (0 <= it->entry_count && has_object_file(&it->oid))
 		return it->entry_count;
 
+	base_tree_init(&base_tree, is_null_oid(&it->oid) ? base_oid : &it->oid);
+	sub_desc = base_tree.desc;
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -300,6 +401,7 @@ static int update_one(struct cache_tree *it,
 		struct cache_tree_sub *sub;
 		const char *path, *slash;
 		int pathlen, sublen, subcnt, subskip;
+		const struct object_id *sub_base_oid = NULL;
 
 		path = ce->name;
 		pathlen = ce_namelen(ce);
@@ -320,14 +422,31 @@ static int update_one(struct cache_tree *it,
 		sub = find_subtree(it, path + baselen, sublen, 1);
 		if (!sub->cache_tree)
 			sub->cache_tree = cache_tree();
+		if (base_tree.buf) {
+			/* look for the directory itself, whatever its oid */
+			while (sub_desc.size &&
+			       base_name_compare(sub_desc.entry.path,
+						 tree_entry_len(&sub_desc.entry),
+						 sub_desc.entry.mode,
+						 path + baselen, sublen, S_IFDIR) < 0)
+				if (update_tree_entry_gently(&sub_desc))
+					sub_desc.size = 0;
+			if (sub_desc.size && S_ISDIR(sub_desc.entry.mode) &&
+			    tree_entry_len(&sub_desc.entry) == sublen &&
+			    !memcmp(sub_desc.entry.path, path + baselen, sublen))
+				sub_base_oid = &sub_desc.entry.oid;
+		}
 		subcnt = update_one(sub->cache_tree,
 				    cache + i, entries - i,
 				    path,
 				    baselen + sublen + 1,
+				    sub_base_oid,
 				    &subskip,
 				    flags);
-		if (subcnt < 0)
+		if (subcnt < 0) {
+			base_tree_release(&base_tree);
 			return subcnt;
+		}
 		if (!subcnt)
 			die("index cache-tree records empty sub-tree");
 		i += subcnt;
@@ -354,6 +473,8 @@ static int update_one(struct cache_tree *it,
 		int expected_missing = 0;
 		int contains_ita = 0;
 		int ce_missing_ok;
+		const char *raw = NULL;
+		size_t raw_len = 0;
 
 		path = ce->name;
 		pathlen = ce_namelen(ce);
@@ -383,11 +504,15 @@ static int update_one(struct cache_tree *it,
 			i++;
 		}
 
-		ce_missing_ok = mode == S_IFGITLINK || missing_ok ||
+		if (base_tree.buf)
+			raw = find_base_entry(&base_tree.desc, path + baselen,
+					      entlen, mode, oid, &raw_len);
+		ce_missing_ok = mode == S_IFGITLINK || missing_ok || raw ||
 			!must_check_existence(ce);
 		if (is_null_oid(oid) ||
 		    (!ce_missing_ok && !has_object_file(oid))) {
 			strbuf_release(&buffer);
+			base_tree_release(&base_tree);
 			if (expected_missing)
 				return -1;
 			return error("invalid object %06o %s for '%.*s'",
@@ -420,9 +545,13 @@ static int update_one(struct cache_tree *it,
 		if (contains_ita && is_empty_tree_oid(oid))
 			continue;
 
-		strbuf_grow(&buffer, entlen + 100);
-		strbuf_addf(&buffer, "%o %.*s%c", mode, entlen, path + baselen, '\0');
-		strbuf_add(&buffer, oid->hash, the_hash_algo->rawsz);
+		if (raw) {
+			strbuf_add(&buffer, raw, raw_len);
+		} else {
+			strbuf_grow(&buffer, entlen + 100);
+			strbuf_addf(&buffer, "%o %.*s%c", mode, entlen, path + baselen, '\0');
+			strbuf_add(&buffer, oid->hash, the_hash_algo->rawsz);
+		}
 
 #if DEBUG_CACHE_TREE
 		fprintf(stderr, "cache-tree update-one %o %.*s\n",
@@ -430,6 +559,8 @@ static int update_one(struct cache_tree *it,
 #endif
 	}
 
+	base_tree_release(&base_tree);
+
 	if (repair) {
 		struct object_id oid;
 		hash_object_file(the_hash_algo, buffer.buf, buffer.len,
@@ -458,9 +589,26 @@ static int update_one(struct cache_tree *it,
 	return i;
 }
 
+/*
+ * The tree HEAD points at, as the base for rebuilding the top-level
+ * tree of the repository's index when the cache-tree has no earlier
+ * version of it.
+ */
+static const struct object_id *head_tree_oid(struct index_state *istate,
+					      struct object_id *oid)
+{
+	if (istate != the_repository->index ||
+	    istate->cache_tree->entry_count >= 0 ||
+	    !is_null_oid(&istate->cache_tree->oid) ||
+	    repo_get_oid(the_repository, "HEAD^{tree}", oid))
+		return NULL;
+	return oid;
+}
+
 int cache_tree_update(struct index_state *istate, int flags)
 {
 	int skip, i;
+	struct object_id head;
 
 	i = verify_cache(istate, flags);
 
@@ -477,7 +625,7 @@ int cache_tree_update(struct index_state *istate, int flags)
 	trace2_region_enter("cache_tree", "update", the_repository);
 	begin_odb_transaction();
 	i = update_one(istate->cache_tree, istate->cache, istate->cache_nr,
-		       "", 0, &skip, flags);
+		       "", 0, head_tree_oid(istate, &head), &skip, flags);
 	end_odb_transaction();
 	trace2_region_leave("cache_tree", "update", the_repository);
 	trace_performance_leave("cache_tree_update");
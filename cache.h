@@ -352,6 +352,7 @@ struct index_state {
 	struct hashmap dir_hash;
 	struct object_id oid;
 	struct untracked_cache *untracked;
+	struct object_id untracked_oid;
 	char *fsmonitor_last_update;
 	struct ewah_bitmap *fsmonitor_dirty;
 	struct mem_pool *ce_mem_pool;
@@ -671,8 +672,10 @@ int path_inside_repo(const char *prefix, const char *path);
 
 int init_db(const char *git_dir, const char *real_git_dir,
 	    const char *template_dir, int hash_algo,
-	    const char *initial_branch, unsigned int flags);
-void initialize_repository_version(int hash_algo, int reinit);
+	    const char *ref_format, const char *initial_branch,
+	    unsigned int flags);
+void initialize_repository_version(int hash_algo, const char *ref_format,
+				   int reinit);
 
 void sanitize_stdfds(void);
 int daemonize(void);
@@ -1146,6 +1149,7 @@ struct repository_format {
 	int worktree_config;
 	int is_bare;
 	int hash_algo;
+	char *ref_storage_format; /* value of extensions.refstorage */
 	int sparse_index;
 	char *work_tree;
 	struct string_list unknown_extensions;
@@ -1248,6 +1252,7 @@ enum sharedrepo {
 	PERM_EVERYBODY      = 0664
 };
 int git_config_perm(const char *var, const char *value);
+int calc_shared_perm(int mode);
 int adjust_shared_perm(const char *path);
 
 /*
@@ -1715,6 +1720,8 @@ static inline void cache_def_clear(struct cache_def *cache)
 int has_symlink_leading_path(const char *name, int len);
 int threaded_has_symlink_leading_path(struct cache_def *, const char *, int);
 int check_leading_path(const char *name, int len, int warn_on_lstat_err);
+int threaded_check_leading_path(struct cache_def *cache, const char *name,
+				int len, int warn_on_lstat_err);
 int has_dirs_only_path(const char *name, int len, int prefix_len);
 void invalidate_lstat_cache(void);
 void schedule_dir_for_removal(const char *name, int len);
@@ -20,6 +20,7 @@
 #include "json-writer.h"
 #include "trace2.h"
 #include "chunk-format.h"
+#include "thread-utils.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -1575,12 +1576,150 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_trunc_large);
 }
 
+static void tally_bloom_filter(struct write_commit_graph_context *ctx,
+			       struct bloom_filter *filter,
+			       enum bloom_filter_computed computed)
+{
+	if (computed & BLOOM_COMPUTED) {
+		ctx->count_bloom_filter_computed++;
+		if (computed & BLOOM_TRUNC_EMPTY)
+			ctx->count_bloom_filter_trunc_empty++;
+		if (computed & BLOOM_TRUNC_LARGE)
+			ctx->count_bloom_filter_trunc_large++;
+	} else if (computed & BLOOM_NOT_COMPUTED)
+		ctx->count_bloom_filter_not_computed++;
+	ctx->total_bloom_filter_data_size += filter
+		? sizeof(unsigned char) * filter->len : 0;
+}
+
+struct bloom_work {
+	struct write_commit_graph_context *ctx;
+	struct commit **commits;
+	struct bloom_filter **filters;
+	enum bloom_filter_computed *computed;
+	uint32_t *todo;
+	uint32_t todo_nr;
+	uint32_t next;
+
+	pthread_mutex_t mutex;
+	struct progress *progress;
+	uint64_t progress_cnt;
+};
+
+static void *bloom_filter_thread(void *data)
+{
+	struct bloom_work *work = data;
+	struct write_commit_graph_context *ctx = work->ctx;
+
+	for (;;) {
+		uint32_t i;
+
+		pthread_mutex_lock(&work->mutex);
+		if (work->next >= work->todo_nr) {
+			pthread_mutex_unlock(&work->mutex);
+			break;
+		}
+		i = work->todo[work->next++];
+		pthread_mutex_unlock(&work->mutex);
+
+		work->filters[i] = get_or_compute_bloom_filter(ctx->r,
+							       work->commits[i],
+							       1,
+							       ctx->bloom_settings,
+							       &work->computed[i]);
+
+		pthread_mutex_lock(&work->mutex);
+		display_progress(work->progress, ++work->progress_cnt);
+		pthread_mutex_unlock(&work->mutex);
+	}
+
+	return NULL;
+}
+
+/*
+ * Compute the filters of "sorted_commits" using "nr_threads" threads.
+ *
+ * Which commits get a new filter is decided up front, in the same order
+ * as the serial loop in compute_bloom_filters() would, so that the result
+ * (including the effect of --max-new-filters) does not depend on the
+ * number of threads. Only the tree diffs themselves run in parallel.
+ */
+static void compute_bloom_filters_parallel(struct write_commit_graph_context *ctx,
+					   struct commit **sorted_commits,
+					   int max_new_filters,
+					   int nr_threads,
+					   struct progress *progress)
+{
+	struct bloom_work work = { 0 };
+	pthread_t *threads;
+	int nr_new = 0;
+	int i;
+
+	work.ctx = ctx;
+	work.commits = sorted_commits;
+	work.progress = progress;
+	CALLOC_ARRAY(work.filters, ctx->commits.nr);
+	CALLOC_ARRAY(work.computed, ctx->commits.nr);
+	ALLOC_ARRAY(work.todo, ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = sorted_commits[i];
+
+		work.filters[i] = get_or_compute_bloom_filter(ctx->r, c, 0,
+							      ctx->bloom_settings,
+							      &work.computed[i]);
+		if (work.filters[i] || nr_new >= max_new_filters) {
+			display_progress(progress, ++work.progress_cnt);
+			continue;
+		}
+
+		/* The workers must not parse commits themselves. */
+		repo_parse_commit(ctx->r, c);
+		work.todo[work.todo_nr++] = i;
+		nr_new++;
+	}
+
+	if (nr_threads > work.todo_nr)
+		nr_threads = work.todo_nr;
+
+	trace2_region_enter("commit-graph", "bloom-threads", ctx->r);
+	trace2_data_intmax("commit-graph", ctx->r, "bloom-threads/nr",
+			   nr_threads);
+
+	pthread_mutex_init(&work.mutex, NULL);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 bloom_filter_thread, &work);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i], NULL))
+			die(_("unable to join thread"));
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&work.mutex);
+	trace2_region_leave("commit-graph", "bloom-threads", ctx->r);
+
+	for (i = 0; i < ctx->commits.nr; i++)
+		tally_bloom_filter(ctx, work.filters[i], work.computed[i]);
+
+	free(threads);
+	free(work.filters);
+	free(work.computed);
+	free(work.todo);
+}
+
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
 	int max_new_filters;
+	int nr_threads = ctx->opts ? ctx->opts->threads : 1;
 
 	init_bloom_filters();
 
@@ -1600,26 +1739,28 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
-	for (i = 0; i < ctx->commits.nr; i++) {
-		enum bloom_filter_computed computed = 0;
-		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
-		if (computed & BLOOM_COMPUTED) {
-			ctx->count_bloom_filter_computed++;
-			if (computed & BLOOM_TRUNC_EMPTY)
-				ctx->count_bloom_filter_trunc_empty++;
-			if (computed & BLOOM_TRUNC_LARGE)
-				ctx->count_bloom_filter_trunc_large++;
-		} else if (computed & BLOOM_NOT_COMPUTED)
-			ctx->count_bloom_filter_not_computed++;
-		ctx->total_bloom_filter_data_size += filter
-			? sizeof(unsigned char) * filter->len : 0;
-		display_progress(progress, i + 1);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+
+	if (nr_threads > 1) {
+		compute_bloom_filters_parallel(ctx, sorted_commits,
+					       max_new_filters, nr_threads,
+					       progress);
+	} else {
+		for (i = 0; i < ctx->commits.nr; i++) {
+			enum bloom_filter_computed computed = 0;
+			struct commit *c = sorted_commits[i];
+			struct bloom_filter *filter = get_or_compute_bloom_filter(
+				ctx->r,
+				c,
+				ctx->count_bloom_filter_computed < max_new_filters,
+				ctx->bloom_settings,
+				&computed);
+			tally_bloom_filter(ctx, filter, computed);
+			display_progress(progress, i + 1);
+		}
 	}
 
 	if (trace2_is_enabled())
@@ -130,6 +130,12 @@ struct commit_graph_opts {
 	timestamp_t expire_time;
 	enum commit_graph_split_flags split_flags;
 	int max_new_filters;
+
+	/*
+	 * Number of threads used to compute changed-path Bloom filters;
+	 * 0 means one per CPU.
+	 */
+	int threads;
 };
 
 /*
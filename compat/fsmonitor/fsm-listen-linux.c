@@ -0,0 +1,698 @@
+#include "cache.h"
+#include "config.h"
+#include "fsmonitor.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "hashmap.h"
+#include "strmap.h"
+#include <sys/inotify.h>
+#include <poll.h>
+
+/*
+ * Linux does not have a recursive watch facility like FSEvents or
+ * ReadDirectoryChangesW(), so we set up one inotify watch per
+ * directory in the worktree and add (and remove) watches ourselves as
+ * directories come and go.
+ *
+ * We do not watch the contents of ".git/" (there is a lot of churn
+ * in there that we do not care about); we only watch the cookie
+ * directory within it so that clients can sync with the event stream.
+ * If ".git" is a file (and <gitdir> is external), the cookie directory
+ * within the external <gitdir> is watched instead.
+ *
+ * fanotify (with FAN_REPORT_DFID_NAME) could give us a single
+ * filesystem-wide mark, but it requires CAP_SYS_ADMIN and reports file
+ * handles rather than names for anything other than the directory
+ * entry itself, so it is not usable by a daemon that runs as the user.
+ */
+
+/*
+ * The set of events that we ask the kernel to report for each watched
+ * directory.  IN_ATTRIB is needed to see `touch` and `chmod` on an
+ * existing file; IN_CLOSE_WRITE is not needed since we already get
+ * IN_MODIFY for each write.
+ */
+#define WATCH_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | \
+		    IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DONT_FOLLOW | IN_EXCL_UNLINK | IN_ONLYDIR)
+
+/*
+ * Large enough to hold a batch of events with maximum-length names.
+ */
+#define EVENT_BUF_SIZE (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+enum watch_root {
+	WATCH_ROOT_WORKTREE = 0,
+	WATCH_ROOT_GITDIR,
+};
+
+struct watch_entry {
+	struct hashmap_entry ent; /* keyed by wd */
+	int wd;
+	enum watch_root root;
+	/*
+	 * The pathname of the watched directory relative to its root.
+	 * It is the empty string for the worktree root itself.
+	 */
+	char *path;
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+
+	struct hashmap watches_by_wd;
+	struct strmap watches_by_path; /* worktree-relative only */
+
+	int wd_root;
+
+	/*
+	 * GIT_TEST_FSMONITOR_INOTIFY_OVERFLOW names a directory whose
+	 * creation the test suite wants us to treat as lost in a queue
+	 * overflow.
+	 */
+	char *test_overflow_name;
+};
+
+static int watch_entry_cmp(const void *unused_cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *unused_keydata)
+{
+	const struct watch_entry *e1, *e2;
+
+	e1 = container_of(eptr, const struct watch_entry, ent);
+	e2 = container_of(entry_or_key, const struct watch_entry, ent);
+
+	return e1->wd != e2->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+
+	return hashmap_get_entry(&data->watches_by_wd, &key, ent, NULL);
+}
+
+static void remove_watch_entry(struct fsm_listen_data *data,
+			       struct watch_entry *w)
+{
+	hashmap_remove(&data->watches_by_wd, &w->ent, NULL);
+	if (w->root == WATCH_ROOT_WORKTREE &&
+	    strmap_get(&data->watches_by_path, w->path) == w)
+		strmap_remove(&data->watches_by_path, w->path, 0);
+	free(w->path);
+	free(w);
+}
+
+static void build_abs_path(struct fsmonitor_daemon_state *state,
+			   enum watch_root root, const char *rel,
+			   struct strbuf *out)
+{
+	strbuf_reset(out);
+	if (root == WATCH_ROOT_WORKTREE)
+		strbuf_addbuf(out, &state->path_worktree_watch);
+	else
+		strbuf_addbuf(out, &state->path_gitdir_watch);
+	if (*rel) {
+		strbuf_addch(out, '/');
+		strbuf_addstr(out, rel);
+	}
+}
+
+/*
+ * Add a watch on a single directory.
+ *
+ * Returns 0 if the watch was added (or if the directory disappeared
+ * before we could watch it).  Returns -1 on a hard error (such as
+ * running out of watches).
+ */
+static int add_watch(struct fsmonitor_daemon_state *state,
+		     enum watch_root root, const char *rel)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf abs = STRBUF_INIT;
+	struct watch_entry *w;
+	int wd;
+
+	build_abs_path(state, root, rel, &abs);
+	wd = inotify_add_watch(data->fd_inotify, abs.buf, WATCH_MASK);
+	if (wd < 0) {
+		int saved_errno = errno;
+
+		if (saved_errno == ENOENT || saved_errno == ENOTDIR) {
+			/* raced with a delete or rename */
+			strbuf_release(&abs);
+			return 0;
+		}
+
+		errno = saved_errno;
+		if (saved_errno == ENOSPC)
+			error(_("inotify watch limit reached while watching '%s';"
+				" consider raising fs.inotify.max_user_watches"),
+			      abs.buf);
+		else
+			error_errno(_("could not watch '%s'"), abs.buf);
+		strbuf_release(&abs);
+		return -1;
+	}
+	strbuf_release(&abs);
+
+	/*
+	 * inotify returns the existing descriptor if the inode is
+	 * already being watched (for example, after a rename that we
+	 * have not fully processed yet).  Just update the path.
+	 */
+	w = find_watch(data, wd);
+	if (w)
+		remove_watch_entry(data, w);
+
+	CALLOC_ARRAY(w, 1);
+	hashmap_entry_init(&w->ent, memhash(&wd, sizeof(wd)));
+	w->wd = wd;
+	w->root = root;
+	w->path = xstrdup(rel);
+	hashmap_add(&data->watches_by_wd, &w->ent);
+	if (root == WATCH_ROOT_WORKTREE)
+		strmap_put(&data->watches_by_path, w->path, w);
+
+	return 0;
+}
+
+/*
+ * Recursively add watches on the worktree directory `rel` and all of
+ * the directories below it.  If `batch` is non-NULL, we are adding a
+ * new directory after the fact, so report everything that we find in
+ * it, since it may have been created before our watch was in place.
+ */
+static int add_watch_recursive(struct fsmonitor_daemon_state *state,
+			       const char *rel,
+			       struct fsmonitor_batch **batch)
+{
+	struct strbuf abs = STRBUF_INIT;
+	struct strbuf child = STRBUF_INIT;
+	DIR *dir;
+	struct dirent *de;
+	int ret = 0;
+
+	if (add_watch(state, WATCH_ROOT_WORKTREE, rel))
+		return -1;
+
+	build_abs_path(state, WATCH_ROOT_WORKTREE, rel, &abs);
+	dir = opendir(abs.buf);
+	if (!dir) {
+		/* raced with a delete or rename */
+		strbuf_release(&abs);
+		return 0;
+	}
+
+	while ((de = readdir(dir))) {
+		int is_dir;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+
+		strbuf_reset(&child);
+		if (*rel) {
+			strbuf_addstr(&child, rel);
+			strbuf_addch(&child, '/');
+		}
+		strbuf_addstr(&child, de->d_name);
+
+		/* never descend into ".git/" */
+		if (fsmonitor_classify_path_workdir_relative(child.buf) !=
+		    IS_WORKDIR_PATH)
+			continue;
+
+		if (de->d_type == DT_UNKNOWN) {
+			struct stat st;
+
+			strbuf_addf(&abs, "/%s", de->d_name);
+			is_dir = !lstat(abs.buf, &st) && S_ISDIR(st.st_mode);
+			strbuf_setlen(&abs, abs.len - strlen(de->d_name) - 1);
+		} else {
+			is_dir = de->d_type == DT_DIR;
+		}
+
+		if (batch) {
+			if (!*batch)
+				*batch = fsmonitor_batch__new();
+			if (is_dir)
+				strbuf_addch(&child, '/');
+			fsmonitor_batch__add_path(*batch, child.buf);
+			if (is_dir)
+				strbuf_setlen(&child, child.len - 1);
+		}
+
+		if (is_dir && add_watch_recursive(state, child.buf, batch)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	closedir(dir);
+	strbuf_release(&abs);
+	strbuf_release(&child);
+	return ret;
+}
+
+/*
+ * Stop watching the worktree directory `rel` and everything below it
+ * (because it was moved away).  We drop our bookkeeping immediately
+ * and ignore the IN_IGNORED events that the kernel sends us later.
+ */
+static void remove_watch_recursive(struct fsm_listen_data *data,
+				   const char *rel)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct string_list victims = STRING_LIST_INIT_NODUP;
+	size_t len = strlen(rel);
+	int k;
+
+	/* the empty string is the worktree root, which contains everything */
+	strmap_for_each_entry(&data->watches_by_path, &iter, e) {
+		if (!len ||
+		    (!strncmp(e->key, rel, len) &&
+		     (!e->key[len] || e->key[len] == '/')))
+			string_list_append(&victims, "")->util = e->value;
+	}
+
+	for (k = 0; k < victims.nr; k++) {
+		struct watch_entry *w = victims.items[k].util;
+
+		inotify_rm_watch(data->fd_inotify, w->wd);
+		remove_watch_entry(data, w);
+	}
+
+	string_list_clear(&victims, 0);
+}
+
+static void add_workdir_path(struct fsmonitor_batch **batch,
+			     const struct strbuf *path, int is_dir)
+{
+	if (!*batch)
+		*batch = fsmonitor_batch__new();
+
+	if (is_dir) {
+		struct strbuf tmp = STRBUF_INIT;
+
+		strbuf_addbuf(&tmp, path);
+		strbuf_addch(&tmp, '/');
+		fsmonitor_batch__add_path(*batch, tmp.buf);
+		strbuf_release(&tmp);
+	} else {
+		fsmonitor_batch__add_path(*batch, path->buf);
+	}
+}
+
+/*
+ * Process a single inotify event.
+ * Return 1 if we should shutdown; -1 on a hard error.
+ */
+static int process_1_event(struct fsmonitor_daemon_state *state,
+			   const struct inotify_event *ev,
+			   struct fsmonitor_batch **batch,
+			   struct string_list *cookie_list,
+			   struct strbuf *path)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct watch_entry *w;
+	enum fsmonitor_path_type t;
+	int is_dir = !!(ev->mask & IN_ISDIR);
+	const char *slash;
+
+	w = find_watch(data, ev->wd);
+	if (!w)
+		return 0; /* stale event for a watch we already dropped */
+
+	if (ev->mask & IN_IGNORED) {
+		remove_watch_entry(data, w);
+		return 0;
+	}
+
+	if (ev->mask & IN_UNMOUNT) {
+		trace2_data_string("fsmonitor", NULL, "fsm-listen/unmount",
+				   w->path);
+		return 1;
+	}
+
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		if (w->wd == data->wd_root) {
+			trace2_data_string("fsmonitor", NULL,
+					   "fsm-listen/worktree",
+					   "removed or moved");
+			return 1;
+		}
+		/*
+		 * Otherwise the parent directory reports the delete or
+		 * move itself, so there is nothing to do here.
+		 */
+		return 0;
+	}
+
+	/*
+	 * Ignore any other events on the watched directory itself;
+	 * the watch on its parent reports them with a name.
+	 */
+	if (!ev->len || !*ev->name)
+		return 0;
+
+	strbuf_reset(path);
+	strbuf_addstr(path, w->path);
+	if (path->len)
+		strbuf_addch(path, '/');
+	strbuf_addstr(path, ev->name);
+
+	if (w->root == WATCH_ROOT_GITDIR)
+		t = fsmonitor_classify_path_gitdir_relative(path->buf);
+	else
+		t = fsmonitor_classify_path_workdir_relative(path->buf);
+
+	switch (t) {
+	case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+	case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+		/* special case cookie files within .git or gitdir */
+
+		/* Use just the filename of the cookie file. */
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			slash = find_last_dir_sep(path->buf);
+			string_list_append(cookie_list,
+					   slash ? slash + 1 : path->buf);
+		}
+		break;
+
+	case IS_INSIDE_DOT_GIT:
+	case IS_INSIDE_GITDIR:
+		/* ignore all other paths inside of .git or gitdir */
+		break;
+
+	case IS_DOT_GIT:
+		/* "<worktree>/.git" was deleted (or renamed away) */
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			trace2_data_string("fsmonitor", NULL,
+					   "fsm-listen/dotgit",
+					   "removed");
+			return 1;
+		}
+		break;
+
+	case IS_WORKDIR_PATH:
+		/* queue normal pathnames */
+		add_workdir_path(batch, path, is_dir);
+
+		if (!is_dir)
+			break;
+
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			if (add_watch_recursive(state, path->buf, batch))
+				return -1;
+		} else if (ev->mask & IN_MOVED_FROM) {
+			remove_watch_recursive(data, path->buf);
+		}
+		break;
+
+	case IS_GITDIR:
+	case IS_OUTSIDE_CONE:
+	default:
+		BUG("unexpected path classification '%d' for '%s'",
+		    t, path->buf);
+	}
+
+	return 0;
+}
+
+/*
+ * Watch the cookie directory inside <gitdir> (whether that is
+ * "<worktree>/.git" or an external <gitdir>).  The daemon created
+ * this directory before calling us.
+ */
+static int add_cookie_watch(struct fsmonitor_daemon_state *state)
+{
+	const char *rel;
+	struct strbuf cookie_dir = STRBUF_INIT;
+	int ret;
+
+	if (state->nr_paths_watching > 1) {
+		rel = state->path_cookie_prefix.buf +
+			state->path_gitdir_watch.len + 1;
+		strbuf_add(&cookie_dir, rel, strlen(rel) - 1);
+		ret = add_watch(state, WATCH_ROOT_GITDIR, cookie_dir.buf);
+	} else {
+		rel = state->path_cookie_prefix.buf +
+			state->path_worktree_watch.len + 1;
+		strbuf_add(&cookie_dir, rel, strlen(rel) - 1);
+		ret = add_watch(state, WATCH_ROOT_WORKTREE, cookie_dir.buf);
+	}
+
+	strbuf_release(&cookie_dir);
+	return ret;
+}
+
+/*
+ * Remember the watch descriptor of the worktree root, so that we notice
+ * when the root itself goes away.  Return -1 if the root is not being
+ * watched.
+ */
+static int set_root_watch(struct fsm_listen_data *data)
+{
+	struct watch_entry *root = strmap_get(&data->watches_by_path, "");
+
+	if (!root)
+		return -1;
+	data->wd_root = root->wd;
+	return 0;
+}
+
+/*
+ * The kernel event queue overflowed, so we have lost sync with the
+ * filesystem.  Directories may have been created (or moved in) while
+ * their events were being dropped, and those have no watch, so tear
+ * down all of the worktree watches and walk the worktree again before
+ * telling the daemon layer to force clients to do a full rescan.
+ *
+ * Return 1 if we should shutdown; -1 on a hard error (such as running
+ * out of watches).
+ */
+static int handle_overflow(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	trace2_data_string("fsmonitor", NULL, "fsm-listen/kernel", "overflow");
+
+	remove_watch_recursive(data, "");
+	if (add_watch_recursive(state, "", NULL) ||
+	    add_cookie_watch(state))
+		return -1;
+
+	fsmonitor_force_resync(state);
+
+	if (set_root_watch(data)) {
+		trace2_data_string("fsmonitor", NULL, "fsm-listen/worktree",
+				   "removed or moved");
+		return 1;
+	}
+
+	trace2_data_intmax("fsmonitor", NULL, "fsm-listen/watches",
+			   hashmap_get_size(&data->watches_by_wd));
+	return 0;
+}
+
+static int is_test_overflow(struct fsm_listen_data *data,
+			    const struct inotify_event *ev)
+{
+	return data->test_overflow_name &&
+		(ev->mask & (IN_CREATE | IN_ISDIR)) == (IN_CREATE | IN_ISDIR) &&
+		ev->len && !strcmp(ev->name, data->test_overflow_name);
+}
+
+/*
+ * Read and process one buffer-full of inotify events.
+ * Return 1 if we should shutdown; -1 on a hard error.
+ */
+static int process_events(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	char buf[EVENT_BUF_SIZE]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	ssize_t len;
+	char *p;
+	int ret = 0;
+
+	len = read(data->fd_inotify, buf, sizeof(buf));
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		return error_errno(_("could not read inotify events"));
+	}
+
+	for (p = buf; p < buf + len; ) {
+		const struct inotify_event *ev = (void *)p;
+
+		p += sizeof(*ev) + ev->len;
+
+		/*
+		 * If the kernel event queue overflowed, discard what
+		 * we have collected so far (it is relative to the token
+		 * that is about to be flushed) and resync.
+		 */
+		if ((ev->mask & IN_Q_OVERFLOW) || is_test_overflow(data, ev)) {
+			fsmonitor_batch__free_list(batch);
+			batch = NULL;
+			string_list_clear(&cookie_list, 0);
+			ret = handle_overflow(state);
+			if (ret)
+				break;
+			continue;
+		}
+
+		ret = process_1_event(state, ev, &batch, &cookie_list, &path);
+		if (ret)
+			break;
+	}
+
+	if (!ret) {
+		fsmonitor_publish(state, batch, &cookie_list);
+		batch = NULL;
+	}
+
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return ret;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	data->wd_root = -1;
+	data->test_overflow_name =
+		xstrdup_or_null(getenv("GIT_TEST_FSMONITOR_INOTIFY_OVERFLOW"));
+	hashmap_init(&data->watches_by_wd, watch_entry_cmp, NULL, 0);
+	strmap_init_with_options(&data->watches_by_path, NULL, 0);
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("could not initialize inotify"));
+		goto failed;
+	}
+
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create shutdown pipe"));
+		goto failed;
+	}
+
+	if (add_watch_recursive(state, "", NULL))
+		goto failed;
+	if (set_root_watch(data)) {
+		error(_("could not watch the worktree root"));
+		goto failed;
+	}
+
+	if (add_cookie_watch(state))
+		goto failed;
+
+	trace2_data_intmax("fsmonitor", NULL, "fsm-listen/watches",
+			   hashmap_get_size(&data->watches_by_wd));
+	return 0;
+
+failed:
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	strmap_clear(&data->watches_by_path, 0);
+	hashmap_for_each_entry(&data->watches_by_wd, &iter, w, ent)
+		free(w->path);
+	hashmap_clear_and_free(&data->watches_by_wd, struct watch_entry, ent);
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+	free(data->test_overflow_name);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	if (write_in_full(data->fd_stop[1], "x", 1) < 0)
+		warning_errno(_("could not signal the fsmonitor listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct pollfd pfd[2];
+	int result;
+
+	state->listen_error_code = 0;
+
+	pfd[0].fd = data->fd_stop[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = data->fd_inotify;
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("could not poll inotify descriptor"));
+			goto force_error_stop;
+		}
+
+		if (pfd[0].revents)
+			goto clean_shutdown;
+
+		if (!pfd[1].revents)
+			continue;
+
+		result = process_events(state);
+		if (result < 0)
+			goto force_error_stop;
+		if (result > 0)
+			goto force_shutdown;
+	}
+
+force_error_stop:
+	state->listen_error_code = -1;
+
+force_shutdown:
+	/*
+	 * Tell the IPC thead pool to stop (which completes the await
+	 * in the main thread (which will also signal this thread (if
+	 * we are still alive))).
+	 */
+	ipc_server_stop_async(state->ipc_server_data);
+
+clean_shutdown:
+	return;
+}
@@ -0,0 +1,35 @@
+#ifndef COMPAT_SIMD_H
+#define COMPAT_SIMD_H
+
+/*
+ * Support for hand-vectorized variants of hot loops.
+ *
+ * The vectorized functions are marked with SIMD_TARGET() so that only
+ * they are compiled for the extended instruction set, while the rest of
+ * the build keeps targeting the baseline. Callers must check with
+ * simd_cpu_supports() that the CPU can run them before calling them, and
+ * always keep a scalar version around for other CPUs, other compilers
+ * and builds with NO_SIMD.
+ */
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || \
+     (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+
+#include <immintrin.h>
+
+#define HAVE_X86_SIMD 1
+
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+
+/* "isa" is a string literal like "avx2", "sse4.2" or "popcnt". */
+#define simd_cpu_supports(isa) \
+	(__builtin_cpu_init(), __builtin_cpu_supports(isa))
+
+#else
+
+#define HAVE_X86_SIMD 0
+#define simd_cpu_supports(isa) 0
+
+#endif
+
+#endif /* COMPAT_SIMD_H */
@@ -39,6 +39,7 @@
 static int diff_detect_rename_default;
 static int diff_indent_heuristic = 1;
 static int diff_rename_limit_default = 1000;
+static int diff_rename_threads_default;
 static int diff_suppress_blank_empty;
 static int diff_use_color_default = -1;
 static int diff_color_moved_default;
@@ -436,6 +437,16 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		diff_rename_limit_default = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renamethreads")) {
+		int is_bool, v = git_config_bool_or_int(var, value, &is_bool);
+
+		if (is_bool)
+			v = v ? 0 : 1;
+		else if (v < 0)
+			return error(_("invalid value for '%s': %d"), var, v);
+		diff_rename_threads_default = v;
+		return 0;
+	}
 
 	if (userdiff_config(var, value) < 0)
 		return -1;
@@ -3337,6 +3348,16 @@ int diff_filespec_is_binary(struct repository *r,
 	return one->is_binary;
 }
 
+int diff_filespec_binary_hint(struct repository *r,
+			      struct diff_filespec *one)
+{
+	if (one->is_binary == -1) {
+		diff_filespec_load_driver(one, r->index);
+		return one->driver->binary;
+	}
+	return one->is_binary;
+}
+
 static const struct userdiff_funcname *
 diff_funcname_pattern(struct diff_options *o, struct diff_filespec *one)
 {
@@ -4580,6 +4601,7 @@ void repo_diff_setup(struct repository *r, struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->rename_threads = diff_rename_threads_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = diff_context_default;
 	options->interhunkcontext = diff_interhunk_context_default;
@@ -6836,7 +6858,7 @@ int diff_can_quit_early(struct diff_options *opt)
  * Submodule changes can be configured to be ignored separately for each path,
  * but that configuration can be overridden from the command line.
  */
-static int is_submodule_ignored(const char *path, struct diff_options *options)
+int is_submodule_ignored(const char *path, struct diff_options *options)
 {
 	int ignored = 0;
 	struct diff_flags orig_flags = options->flags;
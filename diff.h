@@ -311,6 +311,9 @@ struct diff_options {
 	int rename_score;
 	int rename_limit;
 
+	/* Threads scoring inexact rename candidates; 0 means one per CPU. */
+	int rename_threads;
+
 	int needed_rename_limit;
 	int degraded_cc_to_c;
 	int show_rename_progress;
@@ -500,6 +503,12 @@ void diff_set_mnemonic_prefix(struct diff_options *options, const char *a, const
 
 int diff_can_quit_early(struct diff_options *);
 
+/*
+ * Shall changes to the submodule at "path" be ignored, according to the
+ * options and the submodule configuration?
+ */
+int is_submodule_ignored(const char *path, struct diff_options *options);
+
 void diff_addremove(struct diff_options *,
 		    int addremove,
 		    unsigned mode,
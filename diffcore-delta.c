@@ -1,6 +1,9 @@
 #include "cache.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "rename-cache.h"
+#include "repository.h"
+#include "xdiff-interface.h"
 
 /*
  * Idea here is very simple.
@@ -121,6 +124,42 @@ static int spanhash_cmp(const void *a_, const void *b_)
 		a->hashval > b->hashval ? 1 : 0;
 }
 
+/*
+ * Remember the spanhash of a blob in the rename cache, together with
+ * what it takes to tell whether it still applies (see
+ * diffcore_count_lookup()).
+ */
+static void remember_spanhash(struct repository *r,
+			      struct diff_filespec *one,
+			      struct spanhash_top *hash,
+			      int is_text, int has_crlf)
+{
+	size_t i, nr = 0, sz = (size_t)1 << hash->alloc_log2;
+	unsigned flags = 0;
+	uint32_t *pairs;
+
+	prepare_repo_settings(r);
+	if (!r->settings.diff_rename_cache || !one->oid_valid)
+		return;
+
+	if (buffer_is_binary(one->data, one->size))
+		flags |= RENAME_CACHE_BINARY;
+	if (is_text)
+		flags |= RENAME_CACHE_TEXT;
+	if (has_crlf)
+		flags |= RENAME_CACHE_CRLF;
+
+	while (nr < sz && hash->data[nr].cnt)
+		nr++;
+	ALLOC_ARRAY(pairs, st_mult(nr, 2));
+	for (i = 0; i < nr; i++) {
+		pairs[2 * i] = hash->data[i].hashval;
+		pairs[2 * i + 1] = hash->data[i].cnt;
+	}
+	rename_cache_add(r, &one->oid, flags, pairs, nr);
+	free(pairs);
+}
+
 static struct spanhash_top *hash_chars(struct repository *r,
 				       struct diff_filespec *one)
 {
@@ -130,6 +169,7 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	unsigned char *buf = one->data;
 	unsigned int sz = one->size;
 	int is_text = !diff_filespec_is_binary(r, one);
+	int has_crlf = 0;
 
 	i = INITIAL_HASH_SIZE;
 	hash = xmalloc(st_add(sizeof(*hash),
@@ -146,8 +186,11 @@ static struct spanhash_top *hash_chars(struct repository *r,
 		sz--;
 
 		/* Ignore CR in CRLF sequence if text */
-		if (is_text && c == '\r' && sz && *buf == '\n')
-			continue;
+		if (c == '\r' && sz && *buf == '\n') {
+			has_crlf = 1;
+			if (is_text)
+				continue;
+		}
 
 		accum1 = (accum1 << 7) ^ (accum2 >> 25);
 		accum2 = (accum2 << 7) ^ (old_1 >> 25);
@@ -160,9 +203,61 @@ static struct spanhash_top *hash_chars(struct repository *r,
 		accum1 = accum2 = 0;
 	}
 	QSORT(hash->data, (size_t)1ul << hash->alloc_log2, spanhash_cmp);
+	remember_spanhash(r, one, hash, is_text, has_crlf);
 	return hash;
 }
 
+int diffcore_count_lookup(struct repository *r, struct diff_filespec *one)
+{
+	struct rename_fingerprint fp;
+	struct spanhash_top *hash;
+	int is_binary;
+	size_t i;
+
+	if (one->cnt_data)
+		return 1;
+	if (!one->oid_valid || !S_ISREG(one->mode) ||
+	    rename_cache_lookup(r, &one->oid, &fp))
+		return 0;
+
+	/*
+	 * CRs before LFs are ignored in text, so unless there are
+	 * none, the fingerprint is only good if we would treat the
+	 * blob the same way again, which may depend on attributes.
+	 */
+	is_binary = diff_filespec_binary_hint(r, one);
+	if (is_binary < 0)
+		is_binary = !!(fp.flags & RENAME_CACHE_BINARY);
+	if ((fp.flags & RENAME_CACHE_CRLF) &&
+	    is_binary == !!(fp.flags & RENAME_CACHE_TEXT))
+		return 0;
+
+	/*
+	 * The result is only ever read by diffcore_count_changes(),
+	 * which stops at the first empty slot, so no room is left for
+	 * adding to it.
+	 */
+	hash = xmalloc(st_add(sizeof(*hash),
+			      st_mult(sizeof(struct spanhash),
+				      st_add(fp.nr, 1))));
+	hash->alloc_log2 = 0;
+	hash->free = 0;
+	for (i = 0; i < fp.nr; i++) {
+		hash->data[i].hashval = get_be32(fp.pairs + 8 * i);
+		hash->data[i].cnt = get_be32(fp.pairs + 8 * i + 4);
+	}
+	hash->data[fp.nr].hashval = 0;
+	hash->data[fp.nr].cnt = 0;
+	one->cnt_data = hash;
+	return 1;
+}
+
+void diffcore_count_prepare(struct repository *r, struct diff_filespec *one)
+{
+	if (!one->cnt_data)
+		one->cnt_data = hash_chars(r, one);
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
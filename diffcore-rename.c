@@ -3,13 +3,16 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "object-store.h"
 #include "hashmap.h"
 #include "progress.h"
 #include "promisor-remote.h"
+#include "rename-cache.h"
 #include "strmap.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -122,6 +125,47 @@ static void inexact_prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation in count_similarity() would
+ * not have a divide-by-zero issue.
+ */
+static int too_different_in_size(unsigned long src_size,
+				 unsigned long dst_size,
+				 int minimum_score)
+{
+	uint64_t max_size = (src_size > dst_size) ? src_size : dst_size;
+	uint64_t base_size = (src_size < dst_size) ? src_size : dst_size;
+	uint64_t delta_size = max_size - base_size;
+
+	return max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE;
+}
+
+static int count_similarity(struct repository *r,
+			    struct diff_filespec *src,
+			    struct diff_filespec *dst)
+{
+	unsigned long max_size, src_copied, literal_added;
+
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+
+	if (diffcore_count_changes(r, src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   &src_copied, &literal_added))
+		return 0;
+
+	/* How similar are they?
+	 * what percentage of material in dst are from source?
+	 */
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
@@ -141,8 +185,6 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	int score;
 
 	/* We deal only with regular files.  Symlink renames are handled
 	 * only when they are exact matches --- in other words, no edits
@@ -169,41 +211,19 @@ static int estimate_similarity(struct repository *r,
 	    diff_populate_filespec(r, dst, dpf_opt))
 		return 0;
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (too_different_in_size(src->size, dst->size, minimum_score))
 		return 0;
 
 	dpf_opt->check_size_only = 0;
 
-	if (!src->cnt_data && diff_populate_filespec(r, src, dpf_opt))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(r, dst, dpf_opt))
+	if (!diffcore_count_lookup(r, src) &&
+	    diff_populate_filespec(r, src, dpf_opt))
 		return 0;
-
-	if (diffcore_count_changes(r, src, dst,
-				   &src->cnt_data, &dst->cnt_data,
-				   &src_copied, &literal_added))
+	if (!diffcore_count_lookup(r, dst) &&
+	    diff_populate_filespec(r, dst, dpf_opt))
 		return 0;
 
-	/* How similar are they?
-	 * what percentage of material in dst are from source?
-	 */
-	if (!dst->size)
-		score = 0; /* should not happen */
-	else
-		score = (int)(src_copied * MAX_SCORE / max_size);
-	return score;
+	return count_similarity(r, src, dst);
 }
 
 static void record_rename_pair(int dst_index, int src_index, int score)
@@ -1371,6 +1391,280 @@ void pool_diff_free_filepair(struct mem_pool *pool,
 	free_filespec_data(p->two);
 }
 
+/*
+ * Threaded inexact rename detection.
+ *
+ * Scoring a pair only compares the spanhashes ("cnt_data") of the two
+ * files, so once every file that can be scored has been loaded and
+ * hashed, the rows of the similarity matrix can be filled in by several
+ * threads at once. Loading the files reads objects, and may look at
+ * attributes and convert working tree files, none of which is
+ * thread-safe, so that part stays in the calling thread.
+ *
+ * Every row is still filled in by a single thread, going through the
+ * sources in order, so the matrix (and hence the renames found after
+ * it is sorted) is the same as without threads.
+ */
+#define RENAME_THREADS_MIN_PAIRS 10000
+#define RENAME_THREADS_ROWS_PER_CLAIM 8
+
+struct similarity_matrix {
+	struct repository *repo;
+	struct diff_score *mx;
+	int *row_dst; /* index in rename_dst of each row */
+	int nr_rows;
+	int minimum_score;
+	int skip_unmodified;
+
+	/* protected by "mutex" */
+	pthread_mutex_t mutex;
+	int next_row;
+	int rows_done;
+};
+
+static int has_similar_size(const unsigned long *sizes, int nr,
+			    unsigned long size, int minimum_score)
+{
+	int lo = 0, hi = nr;
+
+	/*
+	 * Whether a size is close enough only gets less likely the
+	 * further away the other size is, so checking the nearest
+	 * sizes on either side is enough.
+	 */
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (sizes[mi] < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return (lo < nr &&
+		!too_different_in_size(size, sizes[lo], minimum_score)) ||
+	       (lo > 0 &&
+		!too_different_in_size(size, sizes[lo - 1], minimum_score));
+}
+
+static int size_cmp(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static void prepare_similarity(struct repository *r,
+			       struct diff_filespec *one,
+			       struct diff_populate_filespec_options *dpf_opt)
+{
+	if (diffcore_count_lookup(r, one))
+		return;
+	dpf_opt->check_size_only = 0;
+	if (diff_populate_filespec(r, one, dpf_opt))
+		return;
+	diffcore_count_prepare(r, one);
+	diff_free_filespec_blob(one);
+}
+
+/*
+ * Load and hash every file that estimate_similarity() would get to,
+ * i.e. every regular file with a size close enough to that of some
+ * regular file on the other side. The rest may be left unread.
+ */
+static void prepare_similarity_matrix(struct similarity_matrix *sm,
+				      struct diff_populate_filespec_options *dpf_opt)
+{
+	struct repository *r = sm->repo;
+	unsigned long *src_sizes, *dst_sizes;
+	int src_nr = 0, dst_nr = 0;
+	int i;
+
+	ALLOC_ARRAY(src_sizes, rename_src_nr);
+	ALLOC_ARRAY(dst_sizes, sm->nr_rows);
+
+	dpf_opt->check_size_only = 1;
+	for (i = 0; i < sm->nr_rows; i++) {
+		struct diff_filespec *two = rename_dst[sm->row_dst[i]].p->two;
+
+		if (S_ISREG(two->mode) &&
+		    !diff_populate_filespec(r, two, dpf_opt))
+			dst_sizes[dst_nr++] = two->size;
+	}
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (sm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (S_ISREG(one->mode) &&
+		    !diff_populate_filespec(r, one, dpf_opt))
+			src_sizes[src_nr++] = one->size;
+	}
+	QSORT(src_sizes, src_nr, size_cmp);
+	QSORT(dst_sizes, dst_nr, size_cmp);
+
+	for (i = 0; i < sm->nr_rows; i++) {
+		struct diff_filespec *two = rename_dst[sm->row_dst[i]].p->two;
+
+		if (S_ISREG(two->mode) && !two->cnt_data &&
+		    has_similar_size(src_sizes, src_nr, two->size,
+				     sm->minimum_score))
+			prepare_similarity(r, two, dpf_opt);
+	}
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (sm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (S_ISREG(one->mode) && !one->cnt_data &&
+		    has_similar_size(dst_sizes, dst_nr, one->size,
+				     sm->minimum_score))
+			prepare_similarity(r, one, dpf_opt);
+	}
+
+	free(src_sizes);
+	free(dst_sizes);
+}
+
+/* Like estimate_similarity(), but only looks at what is prepared */
+static int estimate_prepared_similarity(struct repository *r,
+					struct diff_filespec *src,
+					struct diff_filespec *dst,
+					int minimum_score)
+{
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
+		return 0;
+	if (!src->cnt_data || !dst->cnt_data)
+		return 0; /* could not be read */
+	if (too_different_in_size(src->size, dst->size, minimum_score))
+		return 0;
+	return count_similarity(r, src, dst);
+}
+
+static void fill_similarity_row(struct similarity_matrix *sm, int row)
+{
+	int i = sm->row_dst[row];
+	struct diff_filespec *two = rename_dst[i].p->two;
+	struct diff_score *m = &sm->mx[row * NUM_CANDIDATE_PER_DST];
+	int j;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		if (sm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[j].p))
+			continue;
+
+		this_src.score = estimate_prepared_similarity(sm->repo,
+							      one, two,
+							      sm->minimum_score);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+	}
+}
+
+/* Claim a few rows to fill in; returns the number of rows claimed */
+static int claim_similarity_rows(struct similarity_matrix *sm,
+				 int done, int *row)
+{
+	int nr;
+
+	pthread_mutex_lock(&sm->mutex);
+	sm->rows_done += done;
+	*row = sm->next_row;
+	nr = sm->nr_rows - sm->next_row;
+	if (nr > RENAME_THREADS_ROWS_PER_CLAIM)
+		nr = RENAME_THREADS_ROWS_PER_CLAIM;
+	sm->next_row += nr;
+	pthread_mutex_unlock(&sm->mutex);
+
+	return nr;
+}
+
+static void *similarity_matrix_thread(void *data)
+{
+	struct similarity_matrix *sm = data;
+	int row, nr = 0;
+
+	while ((nr = claim_similarity_rows(sm, nr, &row)) > 0) {
+		int k;
+
+		for (k = 0; k < nr; k++)
+			fill_similarity_row(sm, row + k);
+	}
+	return NULL;
+}
+
+static int rename_threads(const struct diff_options *options,
+			  int num_destinations, int num_sources)
+{
+	int nr_threads = options->rename_threads;
+	int test_threads = git_env_ulong("GIT_TEST_RENAME_THREADS", 0);
+
+	if (!HAVE_THREADS)
+		return 1;
+	if (test_threads)
+		return test_threads;
+	if ((uint64_t)num_destinations * num_sources < RENAME_THREADS_MIN_PAIRS)
+		return 1;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > num_destinations)
+		nr_threads = num_destinations;
+	return nr_threads;
+}
+
+static void fill_similarity_matrix(struct similarity_matrix *sm,
+				   int nr_threads,
+				   struct diff_populate_filespec_options *dpf_opt,
+				   struct progress *progress,
+				   int num_sources)
+{
+	pthread_t *threads;
+	int i, row, nr = 0;
+
+	trace2_region_enter("diff", "prepare inexact renames", sm->repo);
+	prepare_similarity_matrix(sm, dpf_opt);
+	trace2_region_leave("diff", "prepare inexact renames", sm->repo);
+
+	trace2_data_intmax("diff", sm->repo, "inexact renames/threads",
+			   nr_threads);
+	pthread_mutex_init(&sm->mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads - 1);
+	for (i = 0; i < nr_threads - 1; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 similarity_matrix_thread, sm);
+		if (err)
+			die(_("unable to create threaded rename detection thread: %s"),
+			    strerror(err));
+	}
+
+	/* this thread helps out, and reports the progress */
+	while ((nr = claim_similarity_rows(sm, nr, &row)) > 0) {
+		int k, done;
+
+		for (k = 0; k < nr; k++)
+			fill_similarity_row(sm, row + k);
+
+		pthread_mutex_lock(&sm->mutex);
+		done = sm->rows_done + nr;
+		pthread_mutex_unlock(&sm->mutex);
+		display_progress(progress, (uint64_t)done * num_sources);
+	}
+
+	for (i = 0; i < nr_threads - 1; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&sm->mutex);
+}
+
 void diffcore_rename_extended(struct diff_options *options,
 			      struct mem_pool *pool,
 			      struct strintmap *relevant_sources,
@@ -1384,7 +1678,7 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
 	int i, j, rename_count, skip_unmodified = 0;
-	int num_destinations, dst_cnt;
+	int num_destinations, dst_cnt, nr_threads;
 	int num_sources, want_copies;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
@@ -1573,45 +1867,64 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	nr_threads = rename_threads(options, num_destinations, num_sources);
+	if (nr_threads > 1) {
+		struct similarity_matrix sm = {
+			.repo = options->repo,
+			.mx = mx,
+			.minimum_score = minimum_score,
+			.skip_unmodified = skip_unmodified,
+		};
+
+		ALLOC_ARRAY(sm.row_dst, num_destinations);
+		for (i = 0; i < rename_dst_nr; i++)
+			if (!rename_dst[i].is_rename)
+				sm.row_dst[sm.nr_rows++] = i;
+		fill_similarity_matrix(&sm, nr_threads, &dpf_options,
+				       progress, num_sources);
+		dst_cnt = sm.nr_rows;
+		free(sm.row_dst);
+	} else {
+		for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+			struct diff_filespec *two = rename_dst[i].p->two;
+			struct diff_score *m;
+
+			if (rename_dst[i].is_rename)
+				continue; /* exact or basename match already handled */
+
+			m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+			for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+				m[j].dst = -1;
+
+			for (j = 0; j < rename_src_nr; j++) {
+				struct diff_filespec *one = rename_src[j].p->one;
+				struct diff_score this_src;
+
+				assert(!one->rename_used || want_copies || break_idx);
+
+				if (skip_unmodified &&
+				    diff_unmodified_pair(rename_src[j].p))
+					continue;
+
+				this_src.score = estimate_similarity(options->repo,
+								     one, two,
+								     minimum_score,
+								     &dpf_options);
+				this_src.name_score = basename_same(one, two);
+				this_src.dst = i;
+				this_src.src = j;
+				record_if_better(m, &this_src);
+				/*
+				 * Once we run estimate_similarity,
+				 * We do not need the text anymore.
+				 */
+				diff_free_filespec_blob(one);
+				diff_free_filespec_blob(two);
+			}
+			dst_cnt++;
+			display_progress(progress,
+					 (uint64_t)dst_cnt * (uint64_t)num_sources);
 		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
 	}
 	stop_progress(&progress);
 
@@ -1624,6 +1937,7 @@ void diffcore_rename_extended(struct diff_options *options,
 		rename_count += find_renames(mx, dst_cnt, minimum_score, 1,
 					     &info, dirs_removed);
 	free(mx);
+	rename_cache_flush(options->repo, 0);
 	trace2_region_leave("diff", "inexact renames", options->repo);
 
  cleanup:
@@ -90,6 +90,12 @@ void diff_free_filespec_data(struct diff_filespec *);
 void diff_free_filespec_blob(struct diff_filespec *);
 int diff_filespec_is_binary(struct repository *, struct diff_filespec *);
 
+/*
+ * Like diff_filespec_is_binary(), but returns -1 instead of looking at
+ * the contents when the attributes do not tell.
+ */
+int diff_filespec_binary_hint(struct repository *, struct diff_filespec *);
+
 /**
  * This records a pair of `struct diff_filespec`; the filespec for a file in
  * the "old" set (i.e. preimage) is called `one`, and the filespec for a file
@@ -224,6 +230,22 @@ int diffcore_count_changes(struct repository *r,
 			   unsigned long *src_copied,
 			   unsigned long *literal_added);
 
+/*
+ * Fill in one->cnt_data from the (populated) contents of "one", so that
+ * diffcore_count_changes() does not need to look at the contents (or
+ * at attributes) again. Once both sides are prepared that way,
+ * diffcore_count_changes() only reads them, and can be called for
+ * different pairs from several threads at once.
+ */
+void diffcore_count_prepare(struct repository *r, struct diff_filespec *one);
+
+/*
+ * Fill in one->cnt_data from the rename cache (see rename-cache.h) if
+ * possible, without looking at the contents of "one". Returns 1 if
+ * one->cnt_data is available.
+ */
+int diffcore_count_lookup(struct repository *r, struct diff_filespec *one);
+
 /*
  * If filespec contains an OID and if that object is missing from the given
  * repository, add that OID to to_fetch.
@@ -18,6 +18,8 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "thread-utils.h"
+#include "list.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -35,8 +37,13 @@ enum path_treatment {
 /*
  * Support data structure for our opendir/readdir/closedir wrappers
  */
+struct dir_listing;
+
 struct cached_dir {
 	DIR *fdir;
+	/* read ahead by core.untrackedThreads workers, instead of `fdir` */
+	struct dir_listing *listing;
+	size_t listing_pos, listing_nr;
 	struct untracked_cache_dir *untracked;
 	int nr_files;
 	int nr_dirs;
@@ -2395,10 +2402,408 @@ static void add_untracked(struct untracked_cache_dir *dir, const char *name)
 	dir->untracked[dir->untracked_nr++] = xstrdup(name);
 }
 
+/*
+ * With core.untrackedThreads, worker threads read directories ahead of
+ * read_directory_recursive(): whenever the walk opens a directory, all
+ * of its subdirectories are queued, and the workers lstat() and list
+ * them in the order the walk is going to visit them. Everything else,
+ * i.e. the exclude patterns, the index lookups and the untracked cache
+ * updates, still happens on the main thread in the usual order, so the
+ * results do not depend on the number of threads.
+ *
+ * Only one level is read ahead: the walk decides whether to descend
+ * into a directory, so ignored trees are not read beyond their top.
+ */
+enum listing_state {
+	LISTING_QUEUED,
+	LISTING_RUNNING,
+	LISTING_DONE,
+};
+
+struct dir_listing {
+	struct hashmap_entry ent;
+	struct list_head queue;
+	enum listing_state state;
+	unsigned stat_only:1,	/* lstat() it, but do not read it */
+		 listed:1,	/* `names` and `types` are filled in */
+		 orphan:1;	/* dropped while a worker was reading it */
+
+	int lstat_ret, lstat_errno;
+	struct stat st;
+
+	int opendir_errno;
+	struct strbuf names;	/* NUL-terminated entry names */
+	unsigned char *types;
+	size_t nr, alloc;
+
+	char path[FLEX_ARRAY];	/* "" for the top of the worktree */
+};
+
+struct dir_prefetch {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct hashmap listings;
+	struct list_head queue;
+	int shutdown;
+
+	pthread_t *threads;
+	int nr_threads;
+
+	/* statistics, for trace2 */
+	intmax_t hit, wait, miss;
+};
+
+static int dir_listing_cmp(const void *cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata)
+{
+	const struct dir_listing *a, *b;
+
+	a = container_of(eptr, const struct dir_listing, ent);
+	b = container_of(entry_or_key, const struct dir_listing, ent);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct dir_listing *new_dir_listing(const char *path, size_t len)
+{
+	struct dir_listing *l;
+
+	FLEX_ALLOC_MEM(l, path, path, len);
+	hashmap_entry_init(&l->ent, strhash(l->path));
+	INIT_LIST_HEAD(&l->queue);
+	strbuf_init(&l->names, 0);
+	return l;
+}
+
+static void free_dir_listing(struct dir_listing *l)
+{
+	if (!l)
+		return;
+	strbuf_release(&l->names);
+	free(l->types);
+	free(l);
+}
+
+static void fill_dir_listing(struct dir_listing *l, int do_lstat)
+{
+	const char *path = *l->path ? l->path : ".";
+	struct dirent *de;
+	DIR *fdir;
+
+	if (do_lstat) {
+		l->lstat_ret = lstat(path, &l->st);
+		l->lstat_errno = l->lstat_ret ? errno : 0;
+	}
+	if (l->stat_only || l->listed)
+		return;
+
+	l->listed = 1;
+	fdir = opendir(path);
+	if (!fdir) {
+		l->opendir_errno = errno;
+		return;
+	}
+	while ((de = readdir_skip_dot_and_dotdot(fdir))) {
+		strbuf_addstr(&l->names, de->d_name);
+		strbuf_addch(&l->names, '\0');
+		ALLOC_GROW(l->types, l->nr + 1, l->alloc);
+		l->types[l->nr++] = DTYPE(de);
+	}
+	closedir(fdir);
+}
+
+static int listing_lstat(struct dir_listing *l, const char *path,
+			 struct stat *st)
+{
+	if (!l)
+		return lstat(path, st);
+	if (l->lstat_ret)
+		errno = l->lstat_errno;
+	else
+		memcpy(st, &l->st, sizeof(*st));
+	return l->lstat_ret;
+}
+
+static void *dir_prefetch_thread(void *data)
+{
+	struct dir_prefetch *p = data;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		struct dir_listing *l;
+
+		while (!p->shutdown && list_empty(&p->queue))
+			pthread_cond_wait(&p->work_cond, &p->mutex);
+		if (p->shutdown)
+			break;
+
+		l = list_first_entry(&p->queue, struct dir_listing, queue);
+		list_del_init(&l->queue);
+		l->state = LISTING_RUNNING;
+		pthread_mutex_unlock(&p->mutex);
+
+		fill_dir_listing(l, 1);
+
+		pthread_mutex_lock(&p->mutex);
+		l->state = LISTING_DONE;
+		if (l->orphan)
+			free_dir_listing(l);
+		else
+			pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+static void init_dir_prefetch(struct dir_struct *dir, struct repository *r)
+{
+	struct dir_prefetch *p;
+	int nr_threads, i;
+
+	if (!r)
+		return;
+	prepare_repo_settings(r);
+	nr_threads = r->settings.core_untracked_threads;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS || nr_threads <= 1)
+		return;
+
+	CALLOC_ARRAY(p, 1);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+	hashmap_init(&p->listings, dir_listing_cmp, NULL, 0);
+	INIT_LIST_HEAD(&p->queue);
+
+	p->nr_threads = nr_threads;
+	CALLOC_ARRAY(p->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&p->threads[i], NULL,
+					 dir_prefetch_thread, p);
+		if (err)
+			die(_("unable to create directory read-ahead thread: %s"),
+			    strerror(err));
+	}
+	dir->prefetch = p;
+}
+
+static void release_dir_prefetch(struct dir_struct *dir, struct repository *r)
+{
+	struct dir_prefetch *p = dir->prefetch;
+	struct hashmap_iter iter;
+	struct dir_listing *l;
+	int i;
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->shutdown = 1;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	for (i = 0; i < p->nr_threads; i++) {
+		int err = pthread_join(p->threads[i], NULL);
+		if (err)
+			die(_("unable to join directory read-ahead thread: %s"),
+			    strerror(err));
+	}
+
+	/* Whatever was left, no thread is running anymore. */
+	hashmap_for_each_entry(&p->listings, &iter, l, ent)
+		free_dir_listing(l);
+	hashmap_clear(&p->listings);
+
+	trace2_data_intmax("read_directory", r, "prefetch/hit", p->hit);
+	trace2_data_intmax("read_directory", r, "prefetch/wait", p->wait);
+	trace2_data_intmax("read_directory", r, "prefetch/miss", p->miss);
+
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->work_cond);
+	pthread_cond_destroy(&p->done_cond);
+	free(p->threads);
+	FREE_AND_NULL(dir->prefetch);
+}
+
+static size_t strip_trailing_slash(const char *path, size_t len)
+{
+	while (len && path[len - 1] == '/')
+		len--;
+	return len;
+}
+
+/*
+ * Take the listing of `path` out of the read-ahead queue, waiting for
+ * it if a worker is reading it right now, or reading it here if no
+ * worker got to it yet. Returns NULL if it was not queued at all.
+ */
+static struct dir_listing *claim_dir_listing(struct dir_prefetch *p,
+					     const char *path, size_t len)
+{
+	struct dir_listing *l;
+	char *key = xmemdupz(path, strip_trailing_slash(path, len));
+
+	pthread_mutex_lock(&p->mutex);
+	l = hashmap_get_entry_from_hash(&p->listings, strhash(key), key,
+					struct dir_listing, ent);
+	free(key);
+	if (!l) {
+		p->miss++;
+		pthread_mutex_unlock(&p->mutex);
+		return NULL;
+	}
+	hashmap_remove(&p->listings, &l->ent, NULL);
+
+	if (l->state == LISTING_QUEUED) {
+		list_del_init(&l->queue);
+		p->miss++;
+		pthread_mutex_unlock(&p->mutex);
+		fill_dir_listing(l, 1);
+		return l;
+	}
+
+	if (l->state == LISTING_RUNNING) {
+		p->wait++;
+		while (l->state != LISTING_DONE)
+			pthread_cond_wait(&p->done_cond, &p->mutex);
+	} else {
+		p->hit++;
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return l;
+}
+
+/* Find the cache entry of a subdirectory, without creating it. */
+static struct untracked_cache_dir *find_untracked_dir(struct untracked_cache_dir *dir,
+						      const char *name)
+{
+	int first = 0, last = dir->dirs_nr;
+
+	while (last > first) {
+		int next = first + ((last - first) >> 1);
+		int cmp = strcmp(name, dir->dirs[next]->name);
+
+		if (!cmp)
+			return dir->dirs[next];
+		if (cmp < 0)
+			last = next;
+		else
+			first = next + 1;
+	}
+	return NULL;
+}
+
+static void child_path(struct strbuf *sb, const char *base, size_t baselen,
+		       const char *name)
+{
+	strbuf_reset(sb);
+	baselen = strip_trailing_slash(base, baselen);
+	strbuf_add(sb, base, baselen);
+	if (baselen)
+		strbuf_addch(sb, '/');
+	strbuf_addstr(sb, name);
+}
+
+static int is_prefetch_candidate(const struct cached_dir *cdir, size_t i,
+				 const char *name)
+{
+	return cdir->listing->types[i] == DT_DIR &&
+		fspathcmp(name, ".git");
+}
+
+/*
+ * Queue the subdirectories of the directory `cdir` has just listed,
+ * ahead of anything that is already queued: the walk is depth-first,
+ * so they are needed before the rest.
+ */
+static void queue_subdirectories(struct dir_struct *dir,
+				 struct cached_dir *cdir,
+				 struct untracked_cache_dir *untracked,
+				 struct strbuf *path,
+				 const struct pathspec *pathspec)
+{
+	struct dir_prefetch *p = dir->prefetch;
+	struct list_head *pos = &p->queue;
+	struct strbuf sub = STRBUF_INIT;
+	const char *name = cdir->listing->names.buf;
+	size_t i;
+
+	pthread_mutex_lock(&p->mutex);
+	for (i = 0; i < cdir->listing->nr; name += strlen(name) + 1, i++) {
+		struct untracked_cache_dir *ucd = NULL;
+		struct dir_listing *l;
+
+		if (!is_prefetch_candidate(cdir, i, name))
+			continue;
+		child_path(&sub, path->buf, path->len, name);
+		if (simplify_away(sub.buf, sub.len, pathspec) ||
+		    hashmap_get_from_hash(&p->listings, strhash(sub.buf), sub.buf))
+			continue;
+
+		if (untracked)
+			ucd = find_untracked_dir(untracked, name);
+		/* Trusted without even an lstat(), see valid_cached_dir(). */
+		if (ucd && ucd->valid && dir->untracked->use_fsmonitor)
+			continue;
+
+		l = new_dir_listing(sub.buf, sub.len);
+		/* Likely to be served from the untracked cache. */
+		l->stat_only = ucd && ucd->valid;
+		hashmap_add(&p->listings, &l->ent);
+		list_add(&l->queue, pos);
+		pos = &l->queue;
+	}
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	strbuf_release(&sub);
+}
+
+/*
+ * Forget about the subdirectories of `cdir` the walk did not descend
+ * into, e.g. because they are ignored.
+ */
+static void drop_subdirectories(struct dir_struct *dir, struct cached_dir *cdir,
+				const char *base, size_t baselen)
+{
+	struct dir_prefetch *p = dir->prefetch;
+	struct strbuf sub = STRBUF_INIT;
+	const char *name = cdir->listing->names.buf;
+	size_t i;
+
+	pthread_mutex_lock(&p->mutex);
+	for (i = 0; i < cdir->listing->nr; name += strlen(name) + 1, i++) {
+		struct dir_listing *l;
+
+		if (!is_prefetch_candidate(cdir, i, name))
+			continue;
+		child_path(&sub, base, baselen, name);
+		l = hashmap_get_entry_from_hash(&p->listings, strhash(sub.buf),
+						sub.buf, struct dir_listing, ent);
+		if (!l)
+			continue;
+		hashmap_remove(&p->listings, &l->ent, NULL);
+		if (l->state == LISTING_RUNNING) {
+			l->orphan = 1;
+			continue;
+		}
+		list_del(&l->queue);
+		free_dir_listing(l);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	strbuf_release(&sub);
+}
+
 static int valid_cached_dir(struct dir_struct *dir,
 			    struct untracked_cache_dir *untracked,
 			    struct index_state *istate,
 			    struct strbuf *path,
+			    struct dir_listing *listing,
 			    int check_only)
 {
 	struct stat st;
@@ -2411,7 +2816,7 @@ static int valid_cached_dir(struct dir_struct *dir,
 	 */
 	refresh_fsmonitor(istate);
 	if (!(dir->untracked->use_fsmonitor && untracked->valid)) {
-		if (lstat(path->len ? path->buf : ".", &st)) {
+		if (listing_lstat(listing, path->len ? path->buf : ".", &st)) {
 			memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
 			return 0;
 		}
@@ -2451,20 +2856,39 @@ static int open_cached_dir(struct cached_dir *cdir,
 			   int check_only)
 {
 	const char *c_path;
+	struct dir_listing *listing = NULL;
 
 	memset(cdir, 0, sizeof(*cdir));
 	cdir->untracked = untracked;
-	if (valid_cached_dir(dir, untracked, istate, path, check_only))
+	if (dir->prefetch)
+		listing = claim_dir_listing(dir->prefetch, path->buf, path->len);
+	if (valid_cached_dir(dir, untracked, istate, path, listing, check_only)) {
+		free_dir_listing(listing);
 		return 0;
+	}
 	c_path = path->len ? path->buf : ".";
-	cdir->fdir = opendir(c_path);
-	if (!cdir->fdir)
+	if (dir->prefetch) {
+		if (!listing)
+			listing = new_dir_listing(path->buf,
+				strip_trailing_slash(path->buf, path->len));
+		listing->stat_only = 0;
+		fill_dir_listing(listing, 0);
+		if (listing->opendir_errno) {
+			errno = listing->opendir_errno;
+			free_dir_listing(listing);
+		} else {
+			cdir->listing = listing;
+		}
+	} else {
+		cdir->fdir = opendir(c_path);
+	}
+	if (!cdir->fdir && !cdir->listing)
 		warning_errno(_("could not open directory '%s'"), c_path);
 	if (dir->untracked) {
 		invalidate_directory(dir->untracked, untracked);
 		dir->untracked->dir_opened++;
 	}
-	if (!cdir->fdir)
+	if (!cdir->fdir && !cdir->listing)
 		return -1;
 	return 0;
 }
@@ -2473,6 +2897,19 @@ static int read_cached_dir(struct cached_dir *cdir)
 {
 	struct dirent *de;
 
+	if (cdir->listing) {
+		struct dir_listing *l = cdir->listing;
+
+		if (cdir->listing_nr >= l->nr) {
+			cdir->d_name = NULL;
+			cdir->d_type = DT_UNKNOWN;
+			return -1;
+		}
+		cdir->d_name = l->names.buf + cdir->listing_pos;
+		cdir->d_type = l->types[cdir->listing_nr++];
+		cdir->listing_pos += strlen(cdir->d_name) + 1;
+		return 0;
+	}
 	if (cdir->fdir) {
 		de = readdir_skip_dot_and_dotdot(cdir->fdir);
 		if (!de) {
@@ -2503,10 +2940,15 @@ static int read_cached_dir(struct cached_dir *cdir)
 	return -1;
 }
 
-static void close_cached_dir(struct cached_dir *cdir)
+static void close_cached_dir(struct dir_struct *dir, struct cached_dir *cdir,
+			     const char *base, int baselen)
 {
 	if (cdir->fdir)
 		closedir(cdir->fdir);
+	if (cdir->listing) {
+		drop_subdirectories(dir, cdir, base, baselen);
+		free_dir_listing(cdir->listing);
+	}
 	/*
 	 * We have gone through this directory and found no untracked
 	 * entries. Mark it valid.
@@ -2542,7 +2984,7 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 		if (dir->flags & DIR_SHOW_IGNORED)
 			break;
 		dir_add_name(dir, istate, path->buf, path->len);
-		if (cdir->fdir)
+		if (cdir->fdir || cdir->listing)
 			add_untracked(untracked, path->buf + baselen);
 		break;
 
@@ -2590,6 +3032,9 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 		goto out;
 	dir->visited_directories++;
 
+	if (cdir.listing)
+		queue_subdirectories(dir, &cdir, untracked, &path, pathspec);
+
 	if (untracked)
 		untracked->check_only = !!check_only;
 
@@ -2647,7 +3092,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 			/* abort early if maximum state has been reached */
 			if (dir_state == path_untracked) {
-				if (cdir.fdir)
+				if (cdir.fdir || cdir.listing)
 					add_untracked(untracked, path.buf + baselen);
 				break;
 			}
@@ -2659,7 +3104,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 						    istate, &path, baselen,
 						    pathspec, state);
 	}
-	close_cached_dir(&cdir);
+	close_cached_dir(dir, &cdir, base, baselen);
  out:
 	strbuf_release(&path);
 
@@ -2819,11 +3264,107 @@ static void new_untracked_cache(struct index_state *istate, int flags)
 	uc->dir_flags = flags >= 0 ? flags : new_untracked_cache_flags(istate);
 	set_untracked_ident(uc);
 	istate->untracked = uc;
+	oidclr(&istate->untracked_oid);
 	istate->cache_changed |= UNTRACKED_CHANGED;
 }
 
+/*
+ * Map $GIT_DIR/untracked.<oid>, which holds the data of an "UNTR"
+ * extension followed by its hash. The hash is the name of the file,
+ * so checking it (but not rehashing the data) is enough to catch a
+ * truncated or replaced file.
+ */
+static void *map_untracked_cache_file(const struct object_id *oid,
+				      size_t *size)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	const char *path = git_path("untracked.%s", oid_to_hex(oid));
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || xsize_t(st.st_size) <= hashsz) {
+		close(fd);
+		return NULL;
+	}
+	*size = xsize_t(st.st_size);
+	map = xmmap_gently(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	if (!hasheq((unsigned char *)map + *size - hashsz, oid->hash)) {
+		munmap(map, *size);
+		return NULL;
+	}
+	return map;
+}
+
+/*
+ * Check the ident of a cache that has not been read from its file yet,
+ * without parsing the rest of it.
+ */
+static int untracked_cache_file_has_ident(const struct object_id *oid)
+{
+	const char *ident = get_ident_string();
+	size_t ident_len = strlen(ident) + 1;
+	const unsigned char *next;
+	size_t size;
+	void *map;
+	int ret;
+
+	map = map_untracked_cache_file(oid, &size);
+	if (!map)
+		return 0;
+	next = map;
+	ret = decode_varint(&next) >= ident_len &&
+	      next + ident_len <= (unsigned char *)map + size &&
+	      !memcmp(next, ident, ident_len);
+	munmap(map, size);
+	return ret;
+}
+
+void prepare_untracked_cache(struct index_state *istate)
+{
+	size_t size;
+	void *map;
+
+	if (istate->untracked || is_null_oid(&istate->untracked_oid))
+		return;
+
+	trace2_region_enter("index", "read_untracked_cache", istate->repo);
+	map = map_untracked_cache_file(&istate->untracked_oid, &size);
+	if (map) {
+		istate->untracked = read_untracked_extension(map,
+					size - the_hash_algo->rawsz);
+		munmap(map, size);
+	}
+	trace2_region_leave("index", "read_untracked_cache", istate->repo);
+
+	if (!istate->untracked) {
+		/* like an unreadable "UNTR" extension, just drop it */
+		oidclr(&istate->untracked_oid);
+		istate->cache_changed |= UNTRACKED_CHANGED;
+	} else if (istate->fsmonitor_has_run_once) {
+		/*
+		 * refresh_fsmonitor() loads the cache itself when it has to
+		 * invalidate all of it.  Since it did not, it told us
+		 * about every change since the cache was written.
+		 */
+		istate->untracked->use_fsmonitor = 1;
+	}
+}
+
 void add_untracked_cache(struct index_state *istate)
 {
+	/* leave a matching cache in its file until somebody needs it */
+	if (!istate->untracked && !is_null_oid(&istate->untracked_oid) &&
+	    untracked_cache_file_has_ident(&istate->untracked_oid))
+		return;
+
+	prepare_untracked_cache(istate);
 	if (!istate->untracked) {
 		new_untracked_cache(istate, -1);
 	} else {
@@ -2836,9 +3377,10 @@ void add_untracked_cache(struct index_state *istate)
 
 void remove_untracked_cache(struct index_state *istate)
 {
-	if (istate->untracked) {
+	if (istate->untracked || !is_null_oid(&istate->untracked_oid)) {
 		free_untracked_cache(istate->untracked);
 		istate->untracked = NULL;
+		oidclr(&istate->untracked_oid);
 		istate->cache_changed |= UNTRACKED_CHANGED;
 	}
 }
@@ -3027,8 +3569,11 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		init_dir_prefetch(dir, istate->repo);
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+		release_dir_prefetch(dir, istate->repo);
+	}
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
@@ -3877,6 +4422,7 @@ static int invalidate_one_component(struct untracked_cache *uc,
 void untracked_cache_invalidate_path(struct index_state *istate,
 				     const char *path, int safe_path)
 {
+	prepare_untracked_cache(istate);
 	if (!istate->untracked || !istate->untracked->root)
 		return;
 	if (!safe_path && !verify_path(path, 0))
@@ -204,6 +204,8 @@ struct untracked_cache {
 	unsigned int use_fsmonitor : 1;
 };
 
+struct dir_prefetch;
+
 /**
  * structure is used to pass directory traversal options to the library and to
  * record the paths discovered. A single `struct dir_struct` is used regardless
@@ -340,6 +342,9 @@ struct dir_struct {
 	/* Stats about the traversal */
 	unsigned visited_paths;
 	unsigned visited_directories;
+
+	/* Directory read-ahead threads, see core.untrackedThreads */
+	struct dir_prefetch *prefetch;
 };
 
 #define DIR_INIT { 0 }
@@ -565,6 +570,13 @@ void write_untracked_extension(struct strbuf *out, struct untracked_cache *untra
 void add_untracked_cache(struct index_state *istate);
 void remove_untracked_cache(struct index_state *istate);
 
+/*
+ * With core.splitUntrackedCache, reading the index only remembers
+ * which file holds the untracked cache. Load it into istate->untracked
+ * before looking at it.
+ */
+void prepare_untracked_cache(struct index_state *istate);
+
 /*
  * Connect a worktree to a git directory by creating (or overwriting) a
  * '.git' file containing the location of the git directory. In the git
@@ -18,6 +18,7 @@
  */
 #include "cache.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
@@ -123,28 +124,20 @@ void bitmap_and_not(struct bitmap *self, struct bitmap *other)
 	const size_t count = (self->word_alloc < other->word_alloc) ?
 		self->word_alloc : other->word_alloc;
 
-	size_t i;
-
-	for (i = 0; i < count; ++i)
-		self->words[i] &= ~other->words[i];
+	ewah_words_and_not(self->words, other->words, count);
 }
 
 void bitmap_or(struct bitmap *self, const struct bitmap *other)
 {
-	size_t i;
-
 	bitmap_grow(self, other->word_alloc);
-	for (i = 0; i < other->word_alloc; i++)
-		self->words[i] |= other->words[i];
+	ewah_words_or(self->words, other->words, other->word_alloc);
 }
 
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	size_t i = 0, pointer = 0;
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -153,20 +146,35 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 			(self->word_alloc - original_size) * sizeof(eword_t));
 	}
 
-	ewah_iterator_init(&it, other);
-
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	/*
+	 * Walk the run-length words directly instead of expanding the
+	 * bitmap one word at a time with an ewah_iterator: runs of zeroes
+	 * can be skipped, runs of ones filled in bulk, and the literal
+	 * words that follow each marker are OR-ed in as one block.
+	 */
+	while (pointer < other->buffer_size) {
+		const eword_t *rlw = &other->buffer[pointer++];
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+
+		if (literals > other->buffer_size - pointer)
+			literals = other->buffer_size - pointer;
+
+		bitmap_grow(self, i + run + literals);
+
+		if (rlw_get_run_bit(rlw))
+			memset(self->words + i, 0xff, run * sizeof(eword_t));
+		i += run;
+
+		ewah_words_or(self->words + i, other->buffer + pointer, literals);
+		i += literals;
+		pointer += literals;
+	}
 }
 
 size_t bitmap_popcount(struct bitmap *self)
 {
-	size_t i, count = 0;
-
-	for (i = 0; i < self->word_alloc; ++i)
-		count += ewah_bit_popcount64(self->words[i]);
-
-	return count;
+	return ewah_words_popcount(self->words, self->word_alloc);
 }
 
 int bitmap_equals(struct bitmap *self, struct bitmap *other)
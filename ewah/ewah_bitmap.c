@@ -415,13 +415,19 @@ void ewah_xor(
 			rlw_j.rlw.literal_words);
 
 		if (literals) {
-			size_t k;
-
-			for (k = 0; k < literals; ++k) {
-				ewah_add(out,
-					rlw_i.buffer[rlw_i.literal_word_start + k] ^
-					rlw_j.buffer[rlw_j.literal_word_start + k]
-				);
+			eword_t xored[64];
+			size_t k, n;
+
+			for (k = 0; k < literals; k += n) {
+				size_t w;
+
+				n = min_size(literals - k, ARRAY_SIZE(xored));
+				ewah_words_xor(xored,
+					rlw_i.buffer + rlw_i.literal_word_start + k,
+					rlw_j.buffer + rlw_j.literal_word_start + k,
+					n);
+				for (w = 0; w < n; w++)
+					ewah_add(out, xored[w]);
 			}
 
 			rlwit_discard_first_words(&rlw_i, literals);
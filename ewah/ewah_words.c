@@ -0,0 +1,287 @@
+#include "git-compat-util.h"
+#include "ewok.h"
+#include "compat/simd.h"
+
+struct ewah_words_impl {
+	const char *name;
+	void (*or_fn)(eword_t *dst, const eword_t *src, size_t nr);
+	void (*and_not_fn)(eword_t *dst, const eword_t *src, size_t nr);
+	void (*xor_fn)(eword_t *dst, const eword_t *a, const eword_t *b,
+		       size_t nr);
+	size_t (*popcount_fn)(const eword_t *words, size_t nr);
+	int (*supported)(void);
+};
+
+static void or_scalar(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		dst[i] |= src[i];
+}
+
+static void and_not_scalar(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		dst[i] &= ~src[i];
+}
+
+static void xor_scalar(eword_t *dst, const eword_t *a, const eword_t *b,
+		       size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		dst[i] = a[i] ^ b[i];
+}
+
+static size_t popcount_scalar(const eword_t *words, size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; i++)
+		count += ewah_bit_popcount64(words[i]);
+
+	return count;
+}
+
+static int supported_scalar(void)
+{
+	return 1;
+}
+
+#if HAVE_X86_SIMD
+
+/*
+ * 128-bit variants. The logical operations only need SSE2, but we tie
+ * them to the SSE4.2 generation because the popcount needs POPCNT,
+ * which came with it.
+ */
+
+SIMD_TARGET("sse4.2,popcnt")
+static void or_sse42(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i = 0;
+
+	for (; i + 2 <= nr; i += 2) {
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(d, s));
+	}
+	for (; i < nr; i++)
+		dst[i] |= src[i];
+}
+
+SIMD_TARGET("sse4.2,popcnt")
+static void and_not_sse42(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i = 0;
+
+	for (; i + 2 <= nr; i += 2) {
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_andnot_si128(s, d));
+	}
+	for (; i < nr; i++)
+		dst[i] &= ~src[i];
+}
+
+SIMD_TARGET("sse4.2,popcnt")
+static void xor_sse42(eword_t *dst, const eword_t *a, const eword_t *b,
+		      size_t nr)
+{
+	size_t i = 0;
+
+	for (; i + 2 <= nr; i += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(x, y));
+	}
+	for (; i < nr; i++)
+		dst[i] = a[i] ^ b[i];
+}
+
+/*
+ * With POPCNT available, __builtin_popcountll() compiles to the
+ * instruction instead of the slow generic code that ewok.h warns about.
+ * Four independent sums keep more than one POPCNT in flight.
+ */
+SIMD_TARGET("sse4.2,popcnt")
+static size_t popcount_sse42(const eword_t *words, size_t nr)
+{
+	size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+	size_t i = 0;
+
+	for (; i + 4 <= nr; i += 4) {
+		c0 += __builtin_popcountll(words[i]);
+		c1 += __builtin_popcountll(words[i + 1]);
+		c2 += __builtin_popcountll(words[i + 2]);
+		c3 += __builtin_popcountll(words[i + 3]);
+	}
+	for (; i < nr; i++)
+		c0 += __builtin_popcountll(words[i]);
+
+	return c0 + c1 + c2 + c3;
+}
+
+static int supported_sse42(void)
+{
+	return simd_cpu_supports("sse4.2") && simd_cpu_supports("popcnt");
+}
+
+SIMD_TARGET("avx2,popcnt")
+static void or_avx2(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= nr; i += 4) {
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(d, s));
+	}
+	for (; i < nr; i++)
+		dst[i] |= src[i];
+}
+
+SIMD_TARGET("avx2,popcnt")
+static void and_not_avx2(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= nr; i += 4) {
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_andnot_si256(s, d));
+	}
+	for (; i < nr; i++)
+		dst[i] &= ~src[i];
+}
+
+SIMD_TARGET("avx2,popcnt")
+static void xor_avx2(eword_t *dst, const eword_t *a, const eword_t *b,
+		     size_t nr)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= nr; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(x, y));
+	}
+	for (; i < nr; i++)
+		dst[i] = a[i] ^ b[i];
+}
+
+/*
+ * Count the bits of each nibble with a 16-entry lookup table held in a
+ * register (VPSHUFB), then sum the bytes of each 64-bit lane with VPSADBW.
+ */
+SIMD_TARGET("avx2,popcnt")
+static size_t popcount_avx2(const eword_t *words, size_t nr)
+{
+	const __m256i lookup = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i acc = _mm256_setzero_si256();
+	uint64_t lanes[4];
+	size_t count, i = 0;
+
+	for (; i + 4 <= nr; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+		__m256i lo = _mm256_and_si256(v, low_mask);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+		__m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+						_mm256_shuffle_epi8(lookup, hi));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes,
+						_mm256_setzero_si256()));
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (; i < nr; i++)
+		count += __builtin_popcountll(words[i]);
+
+	return count;
+}
+
+static int supported_avx2(void)
+{
+	return simd_cpu_supports("avx2") && simd_cpu_supports("popcnt");
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/* Ordered from the most to the least preferred. */
+static const struct ewah_words_impl impls[] = {
+#if HAVE_X86_SIMD
+	{ "avx2", or_avx2, and_not_avx2, xor_avx2, popcount_avx2,
+	  supported_avx2 },
+	{ "sse4.2", or_sse42, and_not_sse42, xor_sse42, popcount_sse42,
+	  supported_sse42 },
+#endif
+	{ "scalar", or_scalar, and_not_scalar, xor_scalar, popcount_scalar,
+	  supported_scalar },
+};
+
+static const struct ewah_words_impl *impl;
+
+int ewah_words_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(impls); i++) {
+		if (name && strcmp(name, impls[i].name))
+			continue;
+		if (!impls[i].supported())
+			continue;
+		impl = &impls[i];
+		return 0;
+	}
+	return -1;
+}
+
+const char *ewah_words_impl_name(size_t i)
+{
+	return i < ARRAY_SIZE(impls) ? impls[i].name : NULL;
+}
+
+static inline const struct ewah_words_impl *get_impl(void)
+{
+	/*
+	 * Racing threads would all pick the same entry, so there is
+	 * no need to serialize this.
+	 */
+	if (!impl)
+		ewah_words_select(NULL);
+	return impl;
+}
+
+const char *ewah_words_current(void)
+{
+	return get_impl()->name;
+}
+
+void ewah_words_or(eword_t *dst, const eword_t *src, size_t nr)
+{
+	get_impl()->or_fn(dst, src, nr);
+}
+
+void ewah_words_and_not(eword_t *dst, const eword_t *src, size_t nr)
+{
+	get_impl()->and_not_fn(dst, src, nr);
+}
+
+void ewah_words_xor(eword_t *dst, const eword_t *a, const eword_t *b,
+		    size_t nr)
+{
+	get_impl()->xor_fn(dst, a, b, nr);
+}
+
+size_t ewah_words_popcount(const eword_t *words, size_t nr)
+{
+	return get_impl()->popcount_fn(words, nr);
+}
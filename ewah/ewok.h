@@ -162,6 +162,31 @@ void ewah_add_dirty_words(
 size_t ewah_add(struct ewah_bitmap *self, eword_t word);
 
 
+/**
+ * Word-array kernels behind the bitmap operations below and the literal
+ * runs of `ewah_xor`. On first use the fastest implementation that the
+ * CPU supports is picked (AVX2, SSE4.2 or plain scalar code).
+ */
+void ewah_words_or(eword_t *dst, const eword_t *src, size_t nr);
+void ewah_words_and_not(eword_t *dst, const eword_t *src, size_t nr);
+void ewah_words_xor(eword_t *dst, const eword_t *a, const eword_t *b,
+		    size_t nr);
+size_t ewah_words_popcount(const eword_t *words, size_t nr);
+
+/**
+ * Use the implementation called `name` from now on, or the best one if
+ * `name` is NULL. Return -1 if it is unknown or not supported by this
+ * CPU. Only meant for tests and benchmarks.
+ */
+int ewah_words_select(const char *name);
+
+/**
+ * The name of the i-th known implementation, or NULL past the end, and
+ * the name of the one in use.
+ */
+const char *ewah_words_impl_name(size_t i);
+const char *ewah_words_current(void);
+
 /**
  * Uncompressed, old-school bitmap that can be efficiently compressed
  * into an `ewah_bitmap`.
@@ -0,0 +1,454 @@
+#include "cache.h"
+#include "ewok.h"
+#include "roaring.h"
+
+/*
+ * Layout of a serialized bitmap (all integers in network byte order):
+ *
+ *   be32 bit_size, be32 nr_containers, be32 data_size
+ *   nr_containers x { be16 key, be16 type, be32 cardinality, be32 offset }
+ *   data_size bytes of container contents
+ *
+ * The directory is sorted by key, and "offset" is relative to the start
+ * of the container contents.
+ */
+#define ROARING_HEADER_SIZE 12
+#define ROARING_DIR_ENTRY_SIZE 12
+
+#define ROARING_ARRAY 1
+#define ROARING_BITSET 2
+#define ROARING_RUN 3
+
+#define CHUNK_BITS (1 << 16)
+#define CHUNK_WORDS (CHUNK_BITS / BITS_IN_EWORD)
+#define BITSET_SIZE (CHUNK_WORDS * sizeof(eword_t))
+
+static inline void put_be16(void *ptr, uint16_t value)
+{
+	unsigned char *p = ptr;
+	p[0] = value >> 8;
+	p[1] = value >> 0;
+}
+
+struct container {
+	uint16_t key;
+	uint16_t type;
+	uint32_t cardinality;
+	uint32_t offset;
+};
+
+static void read_container(const struct roaring_bitmap *self, uint32_t i,
+			   struct container *c)
+{
+	const unsigned char *p = self->directory + i * ROARING_DIR_ENTRY_SIZE;
+
+	c->key = get_be16(p);
+	c->type = get_be16(p + 2);
+	c->cardinality = get_be32(p + 4);
+	c->offset = get_be32(p + 8);
+}
+
+static size_t container_size(const struct container *c,
+			     const unsigned char *data, size_t data_size)
+{
+	switch (c->type) {
+	case ROARING_ARRAY:
+		return (size_t)c->cardinality * 2;
+	case ROARING_BITSET:
+		return BITSET_SIZE;
+	case ROARING_RUN:
+		if (data_size - c->offset < 2)
+			return SIZE_MAX;
+		return 2 + (size_t)get_be16(data + c->offset) * 4;
+	}
+	return SIZE_MAX;
+}
+
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map,
+			  size_t len)
+{
+	const unsigned char *ptr = map;
+	size_t dir_size;
+	uint32_t i;
+
+	if (len < ROARING_HEADER_SIZE)
+		return error("corrupt roaring bitmap: eof before header");
+
+	self->bit_size = get_be32(ptr);
+	self->nr_containers = get_be32(ptr + 4);
+	self->data_size = get_be32(ptr + 8);
+	ptr += ROARING_HEADER_SIZE;
+	len -= ROARING_HEADER_SIZE;
+
+	dir_size = st_mult(self->nr_containers, ROARING_DIR_ENTRY_SIZE);
+	if (len < dir_size || len - dir_size < self->data_size)
+		return error("corrupt roaring bitmap: eof in container data");
+
+	self->directory = ptr;
+	self->data = ptr + dir_size;
+
+	/*
+	 * Only check that the directory is sane, so that the containers
+	 * themselves are not paged in before they are needed.
+	 */
+	for (i = 0; i < self->nr_containers; i++) {
+		struct container c;
+		size_t size;
+
+		read_container(self, i, &c);
+
+		if (i) {
+			struct container prev;
+			read_container(self, i - 1, &prev);
+			if (c.key <= prev.key)
+				return error("corrupt roaring bitmap: unsorted containers");
+		}
+		if ((size_t)c.key * CHUNK_BITS >= self->bit_size)
+			return error("corrupt roaring bitmap: container out of range");
+		if (!c.cardinality || c.cardinality > CHUNK_BITS)
+			return error("corrupt roaring bitmap: bad cardinality");
+		if (c.offset > self->data_size)
+			return error("corrupt roaring bitmap: bad container offset");
+
+		size = container_size(&c, self->data, self->data_size);
+		if (size > self->data_size - c.offset)
+			return error("corrupt roaring bitmap: bad container %"PRIu32, i);
+	}
+
+	return ROARING_HEADER_SIZE + dir_size + self->data_size;
+}
+
+static int find_container(const struct roaring_bitmap *self, uint16_t key,
+			  struct container *c)
+{
+	uint32_t lo = 0, hi = self->nr_containers;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+
+		read_container(self, mi, c);
+		if (c->key == key)
+			return 1;
+		if (c->key < key)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+int roaring_get(const struct roaring_bitmap *self, size_t pos)
+{
+	struct container c;
+	const unsigned char *data;
+	uint16_t low = pos & (CHUNK_BITS - 1);
+
+	if (pos >= self->bit_size || !find_container(self, pos >> 16, &c))
+		return 0;
+
+	data = self->data + c.offset;
+
+	switch (c.type) {
+	case ROARING_ARRAY: {
+		uint32_t lo = 0, hi = c.cardinality;
+
+		while (lo < hi) {
+			uint32_t mi = lo + (hi - lo) / 2;
+			uint16_t v = get_be16(data + mi * 2);
+
+			if (v == low)
+				return 1;
+			if (v < low)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		return 0;
+	}
+	case ROARING_BITSET:
+		return (get_be64(data + (low / BITS_IN_EWORD) * sizeof(eword_t)) >>
+			(low % BITS_IN_EWORD)) & 1;
+	case ROARING_RUN: {
+		uint16_t nr = get_be16(data), j;
+
+		for (j = 0; j < nr; j++) {
+			uint32_t start = get_be16(data + 2 + j * 4);
+			uint32_t len = get_be16(data + 4 + j * 4) + 1;
+
+			if (low < start)
+				break;
+			if (low < start + len)
+				return 1;
+		}
+		return 0;
+	}
+	}
+	return 0;
+}
+
+size_t roaring_popcount(const struct roaring_bitmap *self)
+{
+	size_t count = 0;
+	uint32_t i;
+
+	for (i = 0; i < self->nr_containers; i++)
+		count += get_be32(self->directory + i * ROARING_DIR_ENTRY_SIZE + 4);
+
+	return count;
+}
+
+static void set_range(eword_t *words, size_t start, size_t end)
+{
+	size_t first = start / BITS_IN_EWORD, last = (end - 1) / BITS_IN_EWORD;
+	eword_t first_mask = ~(eword_t)0 << (start % BITS_IN_EWORD);
+	eword_t last_mask = ~(eword_t)0 >> (BITS_IN_EWORD - 1 - (end - 1) % BITS_IN_EWORD);
+
+	if (first == last) {
+		words[first] |= first_mask & last_mask;
+		return;
+	}
+
+	words[first] |= first_mask;
+	if (last > first + 1)
+		memset(words + first + 1, 0xff, (last - first - 1) * sizeof(eword_t));
+	words[last] |= last_mask;
+}
+
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other)
+{
+	size_t nr_words = DIV_ROUND_UP(other->bit_size, BITS_IN_EWORD);
+	uint32_t i;
+
+	if (self->word_alloc < nr_words) {
+		size_t old = self->word_alloc;
+		REALLOC_ARRAY(self->words, nr_words);
+		memset(self->words + old, 0, (nr_words - old) * sizeof(eword_t));
+		self->word_alloc = nr_words;
+	}
+
+	for (i = 0; i < other->nr_containers; i++) {
+		struct container c;
+		const unsigned char *data;
+		size_t base;
+
+		read_container(other, i, &c);
+		data = other->data + c.offset;
+		base = (size_t)c.key * CHUNK_BITS;
+
+		/*
+		 * roaring_read_mmap() made sure that every container starts
+		 * below bit_size, but a corrupt one may still have bits
+		 * beyond it; those are dropped.
+		 */
+		switch (c.type) {
+		case ROARING_ARRAY: {
+			uint32_t j;
+
+			for (j = 0; j < c.cardinality; j++) {
+				size_t pos = base + get_be16(data + j * 2);
+				if (pos < other->bit_size)
+					self->words[pos / BITS_IN_EWORD] |=
+						(eword_t)1 << (pos % BITS_IN_EWORD);
+			}
+			break;
+		}
+		case ROARING_BITSET: {
+			size_t j, nr = nr_words - base / BITS_IN_EWORD;
+			eword_t *dst = self->words + base / BITS_IN_EWORD;
+
+			if (nr > CHUNK_WORDS)
+				nr = CHUNK_WORDS;
+			for (j = 0; j < nr; j++)
+				dst[j] |= get_be64(data + j * sizeof(eword_t));
+			break;
+		}
+		case ROARING_RUN: {
+			uint16_t nr = get_be16(data), j;
+
+			for (j = 0; j < nr; j++) {
+				size_t start = base + get_be16(data + 2 + j * 4);
+				size_t end = start + get_be16(data + 4 + j * 4) + 1;
+
+				if (end > base + CHUNK_BITS)
+					end = base + CHUNK_BITS;
+				if (end > other->bit_size)
+					end = other->bit_size;
+				if (start < end)
+					set_range(self->words, start, end);
+			}
+			break;
+		}
+		}
+	}
+}
+
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *self)
+{
+	struct bitmap *bitmap;
+	size_t nr_words = DIV_ROUND_UP(self->bit_size, BITS_IN_EWORD);
+
+	bitmap = bitmap_word_alloc(nr_words ? nr_words : 1);
+	bitmap_or_roaring(bitmap, self);
+	return bitmap;
+}
+
+struct ewah_bitmap *roaring_to_ewah(const struct roaring_bitmap *self)
+{
+	struct bitmap *bitmap = roaring_to_bitmap(self);
+	struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+
+	bitmap_free(bitmap);
+	return ewah;
+}
+
+/* Return the first position >= pos in the chunk whose bit equals "bit". */
+static size_t chunk_find(const eword_t *words, size_t nr_words, size_t pos,
+			 int bit)
+{
+	size_t end = nr_words * BITS_IN_EWORD;
+
+	while (pos < end) {
+		eword_t w = words[pos / BITS_IN_EWORD];
+
+		if (!bit)
+			w = ~w;
+		w &= ~(eword_t)0 << (pos % BITS_IN_EWORD);
+		if (w)
+			return (pos & ~(size_t)(BITS_IN_EWORD - 1)) + ewah_bit_ctz64(w);
+		pos = (pos | (BITS_IN_EWORD - 1)) + 1;
+	}
+	return end;
+}
+
+static uint32_t chunk_runs(const eword_t *words, size_t nr_words)
+{
+	uint32_t runs = 0;
+	eword_t carry = 0;
+	size_t i;
+
+	/* A run starts at every set bit whose predecessor is clear. */
+	for (i = 0; i < nr_words; i++) {
+		runs += ewah_bit_popcount64(words[i] & ~((words[i] << 1) | carry));
+		carry = words[i] >> (BITS_IN_EWORD - 1);
+	}
+	return runs;
+}
+
+static void encode_container(struct strbuf *buf, const struct container *c,
+			     const eword_t *words, size_t nr_words)
+{
+	unsigned char be[8];
+	size_t pos, i;
+
+	switch (c->type) {
+	case ROARING_ARRAY:
+		for (pos = chunk_find(words, nr_words, 0, 1);
+		     pos < nr_words * BITS_IN_EWORD;
+		     pos = chunk_find(words, nr_words, pos + 1, 1)) {
+			put_be16(be, pos);
+			strbuf_add(buf, be, 2);
+		}
+		break;
+	case ROARING_BITSET:
+		for (i = 0; i < CHUNK_WORDS; i++) {
+			put_be64(be, i < nr_words ? words[i] : 0);
+			strbuf_add(buf, be, 8);
+		}
+		break;
+	case ROARING_RUN: {
+		size_t nr_runs_at = buf->len;
+		uint16_t nr_runs = 0;
+
+		strbuf_add(buf, be, 2);
+		pos = chunk_find(words, nr_words, 0, 1);
+		while (pos < nr_words * BITS_IN_EWORD) {
+			size_t end = chunk_find(words, nr_words, pos, 0);
+
+			put_be16(be, pos);
+			put_be16(be + 2, end - pos - 1);
+			strbuf_add(buf, be, 4);
+			nr_runs++;
+
+			pos = chunk_find(words, nr_words, end, 1);
+		}
+		put_be16((unsigned char *)buf->buf + nr_runs_at, nr_runs);
+		break;
+	}
+	}
+}
+
+int roaring_serialize_to(struct bitmap *bitmap,
+			 int (*write_fun)(void *out, const void *buf, size_t len),
+			 void *out)
+{
+	struct container *containers = NULL;
+	size_t nr = 0, alloc = 0;
+	size_t nr_words = bitmap->word_alloc, chunk, i;
+	struct strbuf data = STRBUF_INIT;
+	unsigned char hdr[ROARING_DIR_ENTRY_SIZE];
+	int ret = -1;
+
+	while (nr_words && !bitmap->words[nr_words - 1])
+		nr_words--;
+
+	if (nr_words * BITS_IN_EWORD > UINT32_MAX)
+		BUG("bitmap too large for roaring encoding");
+
+	for (chunk = 0; chunk * CHUNK_WORDS < nr_words; chunk++) {
+		const eword_t *words = bitmap->words + chunk * CHUNK_WORDS;
+		size_t chunk_words = nr_words - chunk * CHUNK_WORDS;
+		size_t card, runs, array_size, run_size;
+		struct container *c;
+
+		if (chunk_words > CHUNK_WORDS)
+			chunk_words = CHUNK_WORDS;
+
+		card = ewah_words_popcount(words, chunk_words);
+		if (!card)
+			continue;
+		runs = chunk_runs(words, chunk_words);
+
+		ALLOC_GROW(containers, nr + 1, alloc);
+		c = &containers[nr++];
+		c->key = chunk;
+		c->cardinality = card;
+		c->offset = data.len;
+
+		/* Pick whichever representation is the smallest. */
+		array_size = card * 2;
+		run_size = 2 + runs * 4;
+		if (array_size <= run_size && array_size < BITSET_SIZE)
+			c->type = ROARING_ARRAY;
+		else if (run_size < BITSET_SIZE)
+			c->type = ROARING_RUN;
+		else
+			c->type = ROARING_BITSET;
+
+		encode_container(&data, c, words, chunk_words);
+	}
+
+	put_be32(hdr, nr_words * BITS_IN_EWORD);
+	put_be32(hdr + 4, nr);
+	put_be32(hdr + 8, data.len);
+	if (write_fun(out, hdr, ROARING_HEADER_SIZE) != ROARING_HEADER_SIZE)
+		goto done;
+
+	for (i = 0; i < nr; i++) {
+		put_be16(hdr, containers[i].key);
+		put_be16(hdr + 2, containers[i].type);
+		put_be32(hdr + 4, containers[i].cardinality);
+		put_be32(hdr + 8, containers[i].offset);
+		if (write_fun(out, hdr, ROARING_DIR_ENTRY_SIZE) != ROARING_DIR_ENTRY_SIZE)
+			goto done;
+	}
+
+	if (write_fun(out, data.buf, data.len) != (int)data.len)
+		goto done;
+
+	ret = ROARING_HEADER_SIZE + nr * ROARING_DIR_ENTRY_SIZE + data.len;
+
+done:
+	strbuf_release(&data);
+	free(containers);
+	return ret;
+}
@@ -0,0 +1,71 @@
+#ifndef EWAH_ROARING_H
+#define EWAH_ROARING_H
+
+#include "ewok.h"
+
+/**
+ * Read-only Roaring bitmaps, as an alternative on-disk encoding to EWAH
+ * for the reachability bitmaps.
+ *
+ * The bit positions are split into chunks of 2^16 bits, keyed by their
+ * upper 16 bits. Each non-empty chunk is stored as a "container", in
+ * whichever of these three forms is the smallest:
+ *
+ *  - an array of the set positions (for sparse chunks),
+ *  - a plain bitset of 1024 words (for dense chunks),
+ *  - a list of runs of set bits (for chunks made of long runs).
+ *
+ * A directory of the containers precedes their contents, so a bitmap
+ * read from a file only needs its directory to be parsed up-front;
+ * containers are decoded when, and only if, they are accessed. Unlike
+ * with EWAH, reading a single bit or OR-ing a bitmap that covers only a
+ * few chunks does not require going through the whole bitmap. See
+ * Documentation/technical/bitmap-format.txt for the exact layout.
+ */
+struct roaring_bitmap {
+	const unsigned char *directory;
+	const unsigned char *data;
+	size_t data_size;
+	uint32_t nr_containers;
+	size_t bit_size;
+};
+
+/**
+ * Parse the header and container directory of a serialized Roaring
+ * bitmap at `map`, without copying it: `map` must stay valid as long as
+ * `self` is used. Returns the number of bytes the bitmap occupies, or -1
+ * if it is corrupt.
+ */
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map,
+			  size_t len);
+
+/**
+ * Serialize the uncompressed `bitmap` as a Roaring bitmap by calling
+ * `write_fun` on `out`. Returns the number of bytes written, or -1 on
+ * error.
+ */
+int roaring_serialize_to(struct bitmap *bitmap,
+			 int (*write_fun)(void *out, const void *buf, size_t len),
+			 void *out);
+
+/**
+ * Return whether the bit at `pos` is set, decoding only the container
+ * that holds it.
+ */
+int roaring_get(const struct roaring_bitmap *self, size_t pos);
+
+/**
+ * Return the number of set bits, from the container directory alone.
+ */
+size_t roaring_popcount(const struct roaring_bitmap *self);
+
+/**
+ * Set all the bits of `other` in `self`, touching only the words
+ * covered by the containers of `other`.
+ */
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other);
+
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *self);
+struct ewah_bitmap *roaring_to_ewah(const struct roaring_bitmap *self);
+
+#endif
@@ -59,6 +59,17 @@ struct fsmonitor_daemon_state {
 
 	struct ipc_server_data *ipc_server_data;
 	struct strbuf path_ipc;
+
+	/*
+	 * The lstat() data of the worktree paths that clients asked
+	 * about, kept until a filesystem event is published for them.
+	 * The generation is bumped whenever entries are dropped.
+	 * The entries are also grouped by their leading directories
+	 * in stat_cache_dirs.
+	 */
+	struct hashmap stat_cache;
+	struct hashmap stat_cache_dirs;
+	uint64_t stat_cache_generation;
 };
 
 /*
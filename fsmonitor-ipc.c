@@ -40,6 +40,12 @@ int fsmonitor_ipc__send_command(const char *command,
 	return -1;
 }
 
+int fsmonitor_ipc__stat_cache_query(const char **paths, size_t nr,
+				    struct fsmonitor_stat_cache_item *items)
+{
+	return -1;
+}
+
 #else
 
 int fsmonitor_ipc__is_supported(void)
@@ -168,4 +174,57 @@ int fsmonitor_ipc__send_command(const char *command,
 	return 0;
 }
 
+int fsmonitor_ipc__stat_cache_query(const char **paths, size_t nr,
+				    struct fsmonitor_stat_cache_item *items)
+{
+	struct ipc_client_connection *connection = NULL;
+	struct ipc_client_connect_options options
+		= IPC_CLIENT_CONNECT_OPTIONS_INIT;
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	enum ipc_active_state state;
+	size_t k;
+	int ret = -1;
+
+	options.wait_if_busy = 1;
+	options.wait_if_not_found = 0;
+
+	trace2_region_enter("fsm_client", "stat-cache", NULL);
+
+	state = ipc_client_try_connect(fsmonitor_ipc__get_path(), &options,
+				       &connection);
+	if (state != IPC_STATE__LISTENING)
+		goto done;
+
+	strbuf_addstr(&request, FSMONITOR_STAT_CACHE_COMMAND);
+	for (k = 0; k < nr; k++) {
+		strbuf_addch(&request, '\0');
+		strbuf_addstr(&request, paths[k]);
+	}
+
+	ret = ipc_client_send_command_to_connection(connection, request.buf,
+						    request.len, &answer);
+	ipc_client_close_connection(connection);
+
+	if (!ret && answer.len != st_mult(nr, sizeof(*items))) {
+		/*
+		 * The daemon sends an empty response when it cannot
+		 * guarantee that its cache is in sync with the filesystem.
+		 */
+		trace2_data_intmax("fsm_client", NULL,
+				   "stat-cache/response-length", answer.len);
+		ret = -1;
+	}
+	if (!ret)
+		memcpy(items, answer.buf, answer.len);
+
+done:
+	trace2_data_intmax("fsm_client", NULL, "stat-cache/paths", nr);
+	trace2_region_leave("fsm_client", "stat-cache", NULL);
+
+	strbuf_release(&request);
+	strbuf_release(&answer);
+	return ret;
+}
+
 #endif
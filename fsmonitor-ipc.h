@@ -45,4 +45,36 @@ int fsmonitor_ipc__send_query(const char *since_token,
 int fsmonitor_ipc__send_command(const char *command,
 				struct strbuf *answer);
 
+/*
+ * The command verb of a stat cache query.  The request is this verb
+ * followed by one or more worktree-relative pathnames, each of them
+ * preceded by a NUL.
+ */
+#define FSMONITOR_STAT_CACHE_COMMAND "stat-cache"
+
+/*
+ * The response to a stat cache query is an array of these, one for
+ * each requested path, in the order of the request.  `err` is the
+ * errno value of a failed lstat() on the path, or 0 if `st` holds the
+ * result of a successful one.  The daemon and its clients are the
+ * same Git binary, so `struct stat` is sent as-is.
+ */
+struct fsmonitor_stat_cache_item {
+	int err;
+	struct stat st;
+};
+
+/*
+ * Connect to a `git-fsmonitor--daemon` process via simple-ipc and ask
+ * for the lstat() data of the `nr` given worktree-relative paths.  The
+ * daemon answers from its in-memory cache of the paths that did not
+ * change since it last looked at them, and lstat()s the other ones.
+ * If no daemon is available, we DO NOT try to start one.
+ *
+ * Returns -1 if there is no daemon or if it could not give a complete
+ * and up-to-date answer; 0 on success, with `items` filled in.
+ */
+int fsmonitor_ipc__stat_cache_query(const char **paths, size_t nr,
+				    struct fsmonitor_stat_cache_item *items);
+
 #endif /* FSMONITOR_IPC_H */
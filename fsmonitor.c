@@ -459,7 +459,11 @@ void refresh_fsmonitor(struct index_state *istate)
 			count++;
 		}
 
-		/* Now mark the untracked cache for fsmonitor usage */
+		/*
+		 * Now mark the untracked cache for fsmonitor usage.  If
+		 * it is still in its own file, because none of the paths
+		 * above touched it, it is marked when it is loaded.
+		 */
 		if (istate->untracked)
 			istate->untracked->use_fsmonitor = 1;
 
@@ -494,6 +498,7 @@ void refresh_fsmonitor(struct index_state *istate)
 		if (is_cache_changed)
 			istate->cache_changed |= FSMONITOR_CHANGED;
 
+		prepare_untracked_cache(istate);
 		if (istate->untracked)
 			istate->untracked->use_fsmonitor = 0;
 	}
@@ -551,6 +556,7 @@ void add_fsmonitor(struct index_state *istate)
 			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
 
 		/* reset the untracked cache */
+		prepare_untracked_cache(istate);
 		if (istate->untracked) {
 			add_untracked_cache(istate);
 			istate->untracked->use_fsmonitor = 1;
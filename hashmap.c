@@ -15,14 +15,30 @@ unsigned int strhash(const char *str)
 	return hash;
 }
 
+/*
+ * ASCII upper-casing table for strihash() and memihash().  FNV consumes
+ * one byte at a time, so the case fold sits on the critical path of
+ * every case-insensitive lookup; a table load is cheaper than the
+ * compare and branch it replaces.
+ */
+#define R(x) (x), (x) + 1, (x) + 2, (x) + 3, (x) + 4, (x) + 5, (x) + 6, (x) + 7, \
+	(x) + 8, (x) + 9, (x) + 10, (x) + 11, (x) + 12, (x) + 13, (x) + 14, (x) + 15
+static const unsigned char icase_fold[256] = {
+	R(0x00), R(0x10), R(0x20), R(0x30), R(0x40), R(0x50),
+	0x60, 'A', 'B', 'C', 'D', 'E', 'F', 'G',
+	'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
+	'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W',
+	'X', 'Y', 'Z', 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+	R(0x80), R(0x90), R(0xa0), R(0xb0),
+	R(0xc0), R(0xd0), R(0xe0), R(0xf0)
+};
+#undef R
+
 unsigned int strihash(const char *str)
 {
 	unsigned int c, hash = FNV32_BASE;
-	while ((c = (unsigned char) *str++)) {
-		if (c >= 'a' && c <= 'z')
-			c -= 'a' - 'A';
-		hash = (hash * FNV32_PRIME) ^ c;
-	}
+	while ((c = (unsigned char) *str++))
+		hash = (hash * FNV32_PRIME) ^ icase_fold[c];
 	return hash;
 }
 
@@ -41,12 +57,8 @@ unsigned int memihash(const void *buf, size_t len)
 {
 	unsigned int hash = FNV32_BASE;
 	unsigned char *ucbuf = (unsigned char *) buf;
-	while (len--) {
-		unsigned int c = *ucbuf++;
-		if (c >= 'a' && c <= 'z')
-			c -= 'a' - 'A';
-		hash = (hash * FNV32_PRIME) ^ c;
-	}
+	while (len--)
+		hash = (hash * FNV32_PRIME) ^ icase_fold[*ucbuf++];
 	return hash;
 }
 
@@ -58,12 +70,8 @@ unsigned int memihash_cont(unsigned int hash_seed, const void *buf, size_t len)
 {
 	unsigned int hash = hash_seed;
 	unsigned char *ucbuf = (unsigned char *) buf;
-	while (len--) {
-		unsigned int c = *ucbuf++;
-		if (c >= 'a' && c <= 'z')
-			c -= 'a' - 'A';
-		hash = (hash * FNV32_PRIME) ^ c;
-	}
+	while (len--)
+		hash = (hash * FNV32_PRIME) ^ icase_fold[*ucbuf++];
 	return hash;
 }
 
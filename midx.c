@@ -34,6 +34,7 @@
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
 #define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
+#define MIDX_CHUNKID_BASE 0x42415345 /* "BASE" */
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
@@ -51,6 +52,24 @@ void get_midx_filename(struct strbuf *out, const char *object_dir)
 	strbuf_addf(out, "%s/pack/multi-pack-index", object_dir);
 }
 
+void get_midx_chain_dirname(struct strbuf *out, const char *object_dir)
+{
+	strbuf_addf(out, "%s/pack/multi-pack-index.d", object_dir);
+}
+
+void get_midx_chain_filename(struct strbuf *out, const char *object_dir)
+{
+	get_midx_chain_dirname(out, object_dir);
+	strbuf_addstr(out, "/multi-pack-index-chain");
+}
+
+void get_split_midx_filename(struct strbuf *out, const char *object_dir,
+			     const unsigned char *hash)
+{
+	get_midx_chain_dirname(out, object_dir);
+	strbuf_addf(out, "/multi-pack-index-%s.midx", hash_to_hex(hash));
+}
+
 void get_midx_rev_filename(struct strbuf *out, struct multi_pack_index *m)
 {
 	get_midx_filename(out, m->object_dir);
@@ -70,7 +89,23 @@ static int midx_read_oid_fanout(const unsigned char *chunk_start,
 	return 0;
 }
 
-struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+static int midx_read_base_midxs(const unsigned char *chunk_start,
+				size_t chunk_size, void *data)
+{
+	struct multi_pack_index *m = data;
+
+	if (chunk_size % m->hash_len) {
+		error(_("multi-pack-index base chunk is of the wrong size"));
+		return 1;
+	}
+	m->chunk_base_midxs = chunk_start;
+	m->num_base_midxs = chunk_size / m->hash_len;
+	return 0;
+}
+
+static struct multi_pack_index *load_multi_pack_index_one(const char *object_dir,
+							  const char *midx_name,
+							  int local)
 {
 	struct multi_pack_index *m = NULL;
 	int fd;
@@ -78,31 +113,26 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	size_t midx_size;
 	void *midx_map = NULL;
 	uint32_t hash_version;
-	struct strbuf midx_name = STRBUF_INIT;
 	uint32_t i;
 	const char *cur_pack_name;
 	struct chunkfile *cf = NULL;
 
-	get_midx_filename(&midx_name, object_dir);
-
-	fd = git_open(midx_name.buf);
+	fd = git_open(midx_name);
 
 	if (fd < 0)
 		goto cleanup_fail;
 	if (fstat(fd, &st)) {
-		error_errno(_("failed to read %s"), midx_name.buf);
+		error_errno(_("failed to read %s"), midx_name);
 		goto cleanup_fail;
 	}
 
 	midx_size = xsize_t(st.st_size);
 
 	if (midx_size < MIDX_MIN_SIZE) {
-		error(_("multi-pack-index file %s is too small"), midx_name.buf);
+		error(_("multi-pack-index file %s is too small"), midx_name);
 		goto cleanup_fail;
 	}
 
-	strbuf_release(&midx_name);
-
 	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
 
@@ -153,6 +183,9 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	if (git_env_bool("GIT_TEST_MIDX_READ_RIDX", 1))
 		pair_chunk(cf, MIDX_CHUNKID_REVINDEX, &m->chunk_revindex);
 
+	if (read_chunk(cf, MIDX_CHUNKID_BASE, midx_read_base_midxs, m) > 0)
+		goto cleanup_fail;
+
 	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
 
 	CALLOC_ARRAY(m->pack_names, m->num_packs);
@@ -178,7 +211,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 cleanup_fail:
 	free(m);
-	strbuf_release(&midx_name);
 	free_chunkfile(cf);
 	if (midx_map)
 		munmap(midx_map, midx_size);
@@ -187,6 +219,121 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	return NULL;
 }
 
+static int add_midx_to_chain(struct multi_pack_index *m,
+			     struct multi_pack_index *chain,
+			     struct object_id *oids,
+			     int n)
+{
+	struct multi_pack_index *cur = chain;
+
+	if (m->num_base_midxs != n) {
+		warning(_("multi-pack-index chain does not match"));
+		return 0;
+	}
+
+	while (n) {
+		n--;
+
+		if (!cur ||
+		    !hasheq(oids[n].hash, get_midx_checksum(cur)) ||
+		    !hasheq(oids[n].hash, m->chunk_base_midxs + m->hash_len * n)) {
+			warning(_("multi-pack-index chain does not match"));
+			return 0;
+		}
+
+		cur = cur->base_midx;
+	}
+
+	m->base_midx = chain;
+	if (chain) {
+		m->num_objects_in_base = chain->num_objects_in_base +
+					 chain->num_objects;
+		m->num_packs_in_base = chain->num_packs_in_base +
+				       chain->num_packs;
+	}
+
+	return 1;
+}
+
+static struct multi_pack_index *load_multi_pack_index_chain(const char *object_dir,
+							    int local)
+{
+	struct multi_pack_index *chain = NULL;
+	struct strbuf name = STRBUF_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct object_id *oids = NULL;
+	size_t oids_nr = 0, oids_alloc = 0;
+	FILE *fp;
+
+	get_midx_chain_filename(&name, object_dir);
+	fp = fopen(name.buf, "r");
+	if (!fp)
+		goto out;
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct multi_pack_index *m;
+
+		ALLOC_GROW(oids, oids_nr + 1, oids_alloc);
+		if (get_oid_hex(line.buf, &oids[oids_nr])) {
+			warning(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				line.buf);
+			goto invalid;
+		}
+
+		strbuf_reset(&name);
+		get_split_midx_filename(&name, object_dir, oids[oids_nr].hash);
+		m = load_multi_pack_index_one(object_dir, name.buf, local);
+		if (!m) {
+			warning(_("unable to find all multi-pack-index files"));
+			goto invalid;
+		}
+		m->incremental = 1;
+
+		if (!add_midx_to_chain(m, chain, oids, oids_nr)) {
+			close_midx(m);
+			goto invalid;
+		}
+		chain = m;
+		oids_nr++;
+	}
+
+	if (chain)
+		trace2_data_intmax("midx", the_repository, "load/num_layers",
+				   oids_nr);
+	goto out;
+
+invalid:
+	/*
+	 * A partial chain would claim to cover fewer packs than are
+	 * listed in the layers we could not load, which is harmless, but
+	 * also means that somebody is rewriting the chain under us. Fall
+	 * back to looking at the packs individually instead.
+	 */
+	close_midx(chain);
+	chain = NULL;
+out:
+	if (fp)
+		fclose(fp);
+	free(oids);
+	strbuf_release(&line);
+	strbuf_release(&name);
+	return chain;
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct strbuf midx_name = STRBUF_INIT;
+	struct multi_pack_index *m;
+
+	get_midx_filename(&midx_name, object_dir);
+	m = load_multi_pack_index_one(object_dir, midx_name.buf, local);
+	strbuf_release(&midx_name);
+
+	if (!m)
+		m = load_multi_pack_index_chain(object_dir, local);
+	return m;
+}
+
 void close_midx(struct multi_pack_index *m)
 {
 	uint32_t i;
@@ -195,6 +342,7 @@ void close_midx(struct multi_pack_index *m)
 		return;
 
 	close_midx(m->next);
+	close_midx(m->base_midx);
 
 	munmap((unsigned char *)m->data, m->data_len);
 
@@ -207,14 +355,56 @@ void close_midx(struct multi_pack_index *m)
 	free(m);
 }
 
+/* Find the layer of the chain "m" which contains the object at "pos". */
+static struct multi_pack_index *midx_for_object(struct multi_pack_index *m,
+						uint32_t pos)
+{
+	while (m && pos < m->num_objects_in_base)
+		m = m->base_midx;
+	if (!m)
+		BUG("position %"PRIu32" is out of range", pos);
+	return m;
+}
+
+/* Find the layer of the chain "m" which contains the given pack. */
+static struct multi_pack_index *midx_for_pack(struct multi_pack_index *m,
+					      uint32_t pack_int_id)
+{
+	while (m && pack_int_id < m->num_packs_in_base)
+		m = m->base_midx;
+	if (!m)
+		BUG("pack-int-id %"PRIu32" is out of range", pack_int_id);
+	return m;
+}
+
+static uint32_t total_midx_packs(struct multi_pack_index *m)
+{
+	return m->num_packs_in_base + m->num_packs;
+}
+
+uint32_t total_midx_objects(struct multi_pack_index *m)
+{
+	return m->num_objects_in_base + m->num_objects;
+}
+
+static const char *nth_midxed_pack_name(struct multi_pack_index *m,
+					uint32_t pack_int_id)
+{
+	m = midx_for_pack(m, pack_int_id);
+	return m->pack_names[pack_int_id - m->num_packs_in_base];
+}
+
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id)
 {
 	struct strbuf pack_name = STRBUF_INIT;
 	struct packed_git *p;
 
-	if (pack_int_id >= m->num_packs)
+	if (pack_int_id >= total_midx_packs(m))
 		die(_("bad pack-int-id: %u (%u total packs)"),
-		    pack_int_id, m->num_packs);
+		    pack_int_id, total_midx_packs(m));
+
+	m = midx_for_pack(m, pack_int_id);
+	pack_int_id -= m->num_packs_in_base;
 
 	if (m->packs[pack_int_id])
 		return 0;
@@ -236,19 +426,47 @@ int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t
 	return 0;
 }
 
+struct packed_git *nth_midxed_pack(struct multi_pack_index *m,
+				   uint32_t pack_int_id)
+{
+	m = midx_for_pack(m, pack_int_id);
+	return m->packs[pack_int_id - m->num_packs_in_base];
+}
+
+int bsearch_one_midx(const struct object_id *oid, struct multi_pack_index *m,
+		     uint32_t *result)
+{
+	int ret = bsearch_hash(oid->hash, m->chunk_oid_fanout,
+			       m->chunk_oid_lookup, the_hash_algo->rawsz,
+			       result);
+	if (result)
+		*result += m->num_objects_in_base;
+	return ret;
+}
+
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result)
 {
-	return bsearch_hash(oid->hash, m->chunk_oid_fanout, m->chunk_oid_lookup,
-			    the_hash_algo->rawsz, result);
+	/*
+	 * An object is indexed by at most one layer of a chain, so the
+	 * order in which we look at them does not matter. Start with the
+	 * most recent (and usually smallest) one.
+	 */
+	for (; m; m = m->base_midx)
+		if (bsearch_one_midx(oid, m, result))
+			return 1;
+	return 0;
 }
 
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n)
 {
-	if (n >= m->num_objects)
+	if (n >= total_midx_objects(m))
 		return NULL;
 
+	m = midx_for_object(m, n);
+	n -= m->num_objects_in_base;
+
 	oidread(oid, m->chunk_oid_lookup + m->hash_len * n);
 	return oid;
 }
@@ -258,6 +476,9 @@ off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	const unsigned char *offset_data;
 	uint32_t offset32;
 
+	m = midx_for_object(m, pos);
+	pos -= m->num_objects_in_base;
+
 	offset_data = m->chunk_object_offsets + (off_t)pos * MIDX_CHUNK_OFFSET_WIDTH;
 	offset32 = get_be32(offset_data + sizeof(uint32_t));
 
@@ -274,8 +495,12 @@ off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 
 uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
+	m = midx_for_object(m, pos);
+	pos -= m->num_objects_in_base;
+
 	return get_be32(m->chunk_object_offsets +
-			(off_t)pos * MIDX_CHUNK_OFFSET_WIDTH);
+			(off_t)pos * MIDX_CHUNK_OFFSET_WIDTH) +
+		m->num_packs_in_base;
 }
 
 int fill_midx_entry(struct repository * r,
@@ -290,14 +515,14 @@ int fill_midx_entry(struct repository * r,
 	if (!bsearch_midx(oid, m, &pos))
 		return 0;
 
-	if (pos >= m->num_objects)
+	if (pos >= total_midx_objects(m))
 		return 0;
 
 	pack_int_id = nth_midxed_pack_int_id(m, pos);
 
 	if (prepare_midx_pack(r, m, pack_int_id))
 		return 0;
-	p = m->packs[pack_int_id];
+	p = nth_midxed_pack(m, pack_int_id);
 
 	/*
 	* We are about to tell the caller where they can locate the
@@ -351,7 +576,8 @@ static int cmp_idx_or_pack_name(const char *idx_or_pack_name,
 	return strcmp(idx_or_pack_name, idx_name);
 }
 
-int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+static int midx_layer_contains_pack(struct multi_pack_index *m,
+				    const char *idx_or_pack_name)
 {
 	uint32_t first = 0, last = m->num_packs;
 
@@ -374,6 +600,14 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
 	return 0;
 }
 
+int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+{
+	for (; m; m = m->base_midx)
+		if (midx_layer_contains_pack(m, idx_or_pack_name))
+			return 1;
+	return 0;
+}
+
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
 {
 	struct multi_pack_index *m;
@@ -404,13 +638,14 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 
 static size_t write_midx_header(struct hashfile *f,
 				unsigned char num_chunks,
-				uint32_t num_packs)
+				uint32_t num_packs,
+				unsigned char num_base_midxs)
 {
 	hashwrite_be32(f, MIDX_SIGNATURE);
 	hashwrite_u8(f, MIDX_VERSION);
 	hashwrite_u8(f, oid_version(the_hash_algo));
 	hashwrite_u8(f, num_chunks);
-	hashwrite_u8(f, 0); /* unused */
+	hashwrite_u8(f, num_base_midxs);
 	hashwrite_be32(f, num_packs);
 
 	return MIDX_HEADER_SIZE;
@@ -457,6 +692,15 @@ struct write_midx_context {
 	int preferred_pack_idx;
 
 	struct string_list *to_include;
+
+	/*
+	 * When writing an incremental layer, "base_midx" is the (possibly
+	 * chained) multi-pack-index it is written on top of, and
+	 * "base_oids" lists the checksums of its layers, oldest first.
+	 */
+	struct multi_pack_index *base_midx;
+	struct object_id *base_oids;
+	uint32_t num_base_oids;
 };
 
 static void add_pack_to_midx(const char *full_path, size_t full_path_len,
@@ -483,6 +727,9 @@ static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 		 */
 		if (ctx->m && midx_contains_pack(ctx->m, file_name))
 			return;
+		else if (ctx->base_midx &&
+			 midx_contains_pack(ctx->base_midx, file_name))
+			return;
 		else if (ctx->to_include &&
 			 !string_list_has_string(ctx->to_include, file_name))
 			return;
@@ -837,6 +1084,18 @@ static int write_midx_revindex(struct hashfile *f,
 	return 0;
 }
 
+static int write_midx_base_midxs(struct hashfile *f,
+				 void *data)
+{
+	struct write_midx_context *ctx = data;
+	uint32_t i;
+
+	for (i = 0; i < ctx->num_base_oids; i++)
+		hashwrite(f, ctx->base_oids[i].hash, the_hash_algo->rawsz);
+
+	return 0;
+}
+
 struct midx_pack_order_data {
 	uint32_t nr;
 	uint32_t pack;
@@ -1072,6 +1331,12 @@ static int write_midx_bitmap(char *midx_name, unsigned char *midx_hash,
 	if (flags & MIDX_WRITE_BITMAP_HASH_CACHE)
 		options |= BITMAP_OPT_HASH_CACHE;
 
+	if (flags & MIDX_WRITE_BITMAP_LOOKUP_TABLE)
+		options |= BITMAP_OPT_LOOKUP_TABLE;
+
+	if (flags & MIDX_WRITE_BITMAP_ROARING)
+		options |= BITMAP_OPT_ROARING;
+
 	prepare_midx_packing_data(&pdata, ctx);
 
 	commits = find_commits_for_midx_bitmap(&commits_nr, refs_snapshot, ctx);
@@ -1143,19 +1408,108 @@ static struct multi_pack_index *lookup_multi_pack_index(struct repository *r,
 	return result;
 }
 
+static void add_midx_layer_packs(struct write_midx_context *ctx,
+				 struct multi_pack_index *m)
+{
+	struct strbuf pack_name = STRBUF_INIT;
+	uint32_t i;
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+
+		strbuf_reset(&pack_name);
+		strbuf_addf(&pack_name, "%s/pack/%s", m->object_dir,
+			    m->pack_names[i]);
+
+		p = add_packed_git(pack_name.buf, pack_name.len, 0);
+		if (!p || open_pack_index(p))
+			die(_("could not open index for %s"), pack_name.buf);
+
+		ALLOC_GROW(ctx->info, ctx->nr + 1, ctx->alloc);
+		ctx->info[ctx->nr].orig_pack_int_id = ctx->nr;
+		ctx->info[ctx->nr].pack_name = xstrdup(m->pack_names[i]);
+		ctx->info[ctx->nr].p = p;
+		ctx->info[ctx->nr].expired = 0;
+		ctx->nr++;
+	}
+
+	strbuf_release(&pack_name);
+}
+
+/*
+ * Decide which layers of the existing chain to fold into the new one.
+ * Like the commit-graph's split strategy, a layer is merged into the one
+ * above it unless it holds more than "split_size_multiple" times as many
+ * objects, keeping the chain logarithmic in the number of packs.
+ */
+static void midx_merge_strategy(struct write_midx_context *ctx,
+				int split_size_multiple)
+{
+	struct multi_pack_index *m;
+	uint64_t num_objects = 0;
+	uint32_t i;
+
+	if (split_size_multiple <= 0)
+		split_size_multiple = 2;
+
+	for (i = 0; i < ctx->nr; i++)
+		num_objects += ctx->info[i].p->num_objects;
+
+	while (ctx->base_midx &&
+	       ctx->base_midx->num_objects <= split_size_multiple * num_objects) {
+		add_midx_layer_packs(ctx, ctx->base_midx);
+		num_objects += ctx->base_midx->num_objects;
+		ctx->base_midx = ctx->base_midx->base_midx;
+	}
+
+	for (m = ctx->base_midx; m; m = m->base_midx)
+		ctx->num_base_oids++;
+	ALLOC_ARRAY(ctx->base_oids, ctx->num_base_oids);
+	i = ctx->num_base_oids;
+	for (m = ctx->base_midx; m; m = m->base_midx)
+		oidread(&ctx->base_oids[--i], get_midx_checksum(m));
+}
+
+/*
+ * Drop the entries that are already indexed by a lower layer of the chain,
+ * so that every object appears in exactly one layer.
+ */
+static void remove_base_midx_entries(struct write_midx_context *ctx)
+{
+	uint32_t i, nr = 0;
+
+	if (!ctx->base_midx)
+		return;
+
+	for (i = 0; i < ctx->entries_nr; i++) {
+		if (bsearch_midx(&ctx->entries[i].oid, ctx->base_midx, NULL))
+			continue;
+		ctx->entries[nr++] = ctx->entries[i];
+	}
+	ctx->entries_nr = nr;
+}
+
+static void clear_midx_chain(const char *object_dir,
+			     struct object_id *keep, uint32_t keep_nr);
+
 static int write_midx_internal(const char *object_dir,
 			       struct string_list *packs_to_include,
 			       struct string_list *packs_to_drop,
 			       const char *preferred_pack_name,
 			       const char *refs_snapshot,
+			       int split_size_multiple,
 			       unsigned flags)
 {
 	struct strbuf midx_name = STRBUF_INIT;
+	struct strbuf chain_name = STRBUF_INIT;
 	unsigned char midx_hash[GIT_MAX_RAWSZ];
 	uint32_t i;
 	struct hashfile *f = NULL;
 	struct lock_file lk;
 	struct write_midx_context ctx = { 0 };
+	struct multi_pack_index *existing = NULL;
+	int incremental = flags & MIDX_WRITE_INCREMENTAL;
+	int move_existing = 0;
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
 	int result = 0;
@@ -1172,7 +1526,37 @@ static int write_midx_internal(const char *object_dir,
 		 * packs to include, since all packs and objects are copied
 		 * blindly from an existing MIDX if one is present.
 		 */
-		ctx.m = lookup_multi_pack_index(the_repository, object_dir);
+		existing = lookup_multi_pack_index(the_repository, object_dir);
+	}
+
+	if (incremental) {
+		struct multi_pack_index *m;
+
+		if (flags & MIDX_WRITE_BITMAP) {
+			error(_("cannot write a multi-pack bitmap for an incremental multi-pack-index"));
+			result = 1;
+			goto cleanup;
+		}
+		flags &= ~MIDX_WRITE_REV_INDEX;
+
+		for (m = existing; m; m = m->base_midx) {
+			if (!midx_checksum_valid(m)) {
+				error(_("existing multi-pack-index is corrupt; "
+					"rewrite it without --incremental"));
+				result = 1;
+				goto cleanup;
+			}
+		}
+		ctx.base_midx = existing;
+		move_existing = existing && !existing->incremental;
+	} else if (existing && existing->incremental) {
+		/*
+		 * Flatten an existing chain; its layers are not reused
+		 * directly, since their pack-int-ids are layer-local.
+		 */
+		ctx.m = NULL;
+	} else {
+		ctx.m = existing;
 	}
 
 	if (ctx.m && !midx_checksum_valid(ctx.m)) {
@@ -1227,6 +1611,20 @@ static int write_midx_internal(const char *object_dir,
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &ctx);
 	stop_progress(&ctx.progress);
 
+	if (incremental) {
+		if (!ctx.nr)
+			goto cleanup; /* no new packs */
+
+		midx_merge_strategy(&ctx, split_size_multiple);
+
+		/*
+		 * The existing non-incremental multi-pack-index becomes the
+		 * base of the chain only if we keep it as a layer.
+		 */
+		if (move_existing && ctx.base_midx != existing)
+			move_existing = 0;
+	}
+
 	if ((ctx.m && ctx.nr == ctx.m->num_packs) &&
 	    !(packs_to_include || packs_to_drop)) {
 		struct bitmap_index *bitmap_git;
@@ -1315,6 +1713,7 @@ static int write_midx_internal(const char *object_dir,
 
 	ctx.entries = get_sorted_entries(ctx.m, ctx.info, ctx.nr, &ctx.entries_nr,
 					 ctx.preferred_pack_idx);
+	remove_base_midx_entries(&ctx);
 
 	ctx.large_offsets_needed = 0;
 	for (i = 0; i < ctx.entries_nr; i++) {
@@ -1393,15 +1792,34 @@ static int write_midx_internal(const char *object_dir,
 		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
-	hold_lock_file_for_update(&lk, midx_name.buf, LOCK_DIE_ON_ERROR);
-	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
-
 	if (ctx.nr - dropped_packs == 0) {
 		error(_("no pack files to index."));
 		result = 1;
 		goto cleanup;
 	}
 
+	if (incremental) {
+		int fd;
+
+		get_midx_chain_filename(&chain_name, object_dir);
+		if (safe_create_leading_directories(chain_name.buf))
+			die_errno(_("unable to create leading directories of %s"),
+				  chain_name.buf);
+
+		hold_lock_file_for_update(&lk, chain_name.buf, LOCK_DIE_ON_ERROR);
+
+		strbuf_reset(&midx_name);
+		get_midx_chain_dirname(&midx_name, object_dir);
+		strbuf_addstr(&midx_name, "/tmp_midx_XXXXXX");
+		fd = git_mkstemp_mode(midx_name.buf, 0444);
+		if (fd < 0)
+			die_errno(_("unable to create temporary multi-pack-index layer"));
+		f = hashfd(fd, midx_name.buf);
+	} else {
+		hold_lock_file_for_update(&lk, midx_name.buf, LOCK_DIE_ON_ERROR);
+		f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	}
+
 	if (!ctx.entries_nr) {
 		if (flags & MIDX_WRITE_BITMAP)
 			warning(_("refusing to write multi-pack .bitmap without any objects"));
@@ -1433,13 +1851,73 @@ static int write_midx_internal(const char *object_dir,
 			  write_midx_revindex);
 	}
 
-	write_midx_header(f, get_num_chunks(cf), ctx.nr - dropped_packs);
+	if (ctx.num_base_oids) {
+		if (ctx.num_base_oids > 255)
+			die(_("too many multi-pack-index layers"));
+		add_chunk(cf, MIDX_CHUNKID_BASE,
+			  (size_t)ctx.num_base_oids * the_hash_algo->rawsz,
+			  write_midx_base_midxs);
+	}
+
+	write_midx_header(f, get_num_chunks(cf), ctx.nr - dropped_packs,
+			  ctx.num_base_oids);
 	write_chunkfile(cf, &ctx);
 
 	finalize_hashfile(f, midx_hash, FSYNC_COMPONENT_PACK_METADATA,
 			  CSUM_FSYNC | CSUM_HASH_IN_STREAM);
 	free_chunkfile(cf);
 
+	if (incremental) {
+		struct strbuf final_name = STRBUF_INIT;
+		FILE *chainf = fdopen_lock_file(&lk, "w");
+
+		if (!chainf)
+			die_errno(_("unable to open multi-pack-index chain file"));
+
+		if (existing)
+			close_object_store(the_repository->objects);
+
+		/*
+		 * A non-incremental multi-pack-index would shadow the
+		 * chain; either make it the base layer or get rid of it.
+		 */
+		get_midx_filename(&final_name, object_dir);
+		if (move_existing) {
+			struct strbuf base_name = STRBUF_INIT;
+
+			get_split_midx_filename(&base_name, object_dir,
+						ctx.base_oids[0].hash);
+			if (rename(final_name.buf, base_name.buf))
+				die_errno(_("failed to move %s into the multi-pack-index chain"),
+					  final_name.buf);
+			strbuf_release(&base_name);
+		} else {
+			unlink_or_warn(final_name.buf);
+		}
+
+		strbuf_reset(&final_name);
+		get_split_midx_filename(&final_name, object_dir, midx_hash);
+		if (rename(midx_name.buf, final_name.buf))
+			die_errno(_("failed to rename temporary multi-pack-index layer"));
+		strbuf_release(&final_name);
+
+		for (i = 0; i < ctx.num_base_oids; i++)
+			fprintf(chainf, "%s\n", oid_to_hex(&ctx.base_oids[i]));
+		fprintf(chainf, "%s\n", hash_to_hex(midx_hash));
+
+		if (commit_lock_file(&lk) < 0)
+			die_errno(_("could not write multi-pack-index chain"));
+
+		REALLOC_ARRAY(ctx.base_oids, ctx.num_base_oids + 1);
+		oidread(&ctx.base_oids[ctx.num_base_oids], midx_hash);
+		clear_midx_chain(object_dir, ctx.base_oids, ctx.num_base_oids + 1);
+
+		/* Any bitmap or reverse index belonged to a replaced file. */
+		clear_midx_files_ext(object_dir, ".bitmap", NULL);
+		clear_midx_files_ext(object_dir, ".rev", NULL);
+		goto cleanup;
+	}
+
 	if (flags & MIDX_WRITE_REV_INDEX &&
 	    git_env_bool("GIT_TEST_MIDX_WRITE_REV", 0))
 		write_midx_reverse_index(midx_name.buf, midx_hash, &ctx);
@@ -1452,7 +1930,7 @@ static int write_midx_internal(const char *object_dir,
 		}
 	}
 
-	if (ctx.m)
+	if (existing)
 		close_object_store(the_repository->objects);
 
 	if (commit_lock_file(&lk) < 0)
@@ -1460,6 +1938,7 @@ static int write_midx_internal(const char *object_dir,
 
 	clear_midx_files_ext(object_dir, ".bitmap", midx_hash);
 	clear_midx_files_ext(object_dir, ".rev", midx_hash);
+	clear_midx_chain(object_dir, NULL, 0);
 
 cleanup:
 	for (i = 0; i < ctx.nr; i++) {
@@ -1474,7 +1953,9 @@ static int write_midx_internal(const char *object_dir,
 	free(ctx.entries);
 	free(ctx.pack_perm);
 	free(ctx.pack_order);
+	free(ctx.base_oids);
 	strbuf_release(&midx_name);
+	strbuf_release(&chain_name);
 
 	return result;
 }
@@ -1485,7 +1966,7 @@ int write_midx_file(const char *object_dir,
 		    unsigned flags)
 {
 	return write_midx_internal(object_dir, NULL, NULL, preferred_pack_name,
-				   refs_snapshot, flags);
+				   refs_snapshot, 0, flags);
 }
 
 int write_midx_file_only(const char *object_dir,
@@ -1495,7 +1976,16 @@ int write_midx_file_only(const char *object_dir,
 			 unsigned flags)
 {
 	return write_midx_internal(object_dir, packs_to_include, NULL,
-				   preferred_pack_name, refs_snapshot, flags);
+				   preferred_pack_name, refs_snapshot, 0, flags);
+}
+
+int write_midx_file_incremental(const char *object_dir,
+				int split_size_multiple,
+				unsigned flags)
+{
+	return write_midx_internal(object_dir, NULL, NULL, NULL, NULL,
+				   split_size_multiple,
+				   flags | MIDX_WRITE_INCREMENTAL);
 }
 
 struct clear_midx_data {
@@ -1536,6 +2026,58 @@ static void clear_midx_files_ext(const char *object_dir, const char *ext,
 	free(data.keep);
 }
 
+static void clear_midx_chain(const char *object_dir,
+			     struct object_id *keep, uint32_t keep_nr)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	size_t dirlen;
+	DIR *dir;
+
+	get_midx_chain_dirname(&path, object_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+	while ((de = readdir(dir))) {
+		const char *hex;
+		struct object_id oid;
+		uint32_t i;
+
+		if (!skip_prefix(de->d_name, "multi-pack-index-", &hex) ||
+		    !ends_with(hex, ".midx"))
+			continue;
+		if (keep_nr && !get_oid_hex(hex, &oid)) {
+			for (i = 0; i < keep_nr; i++)
+				if (oideq(&oid, &keep[i]))
+					break;
+			if (i < keep_nr)
+				continue;
+		}
+
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		if (unlink(path.buf))
+			die_errno(_("failed to remove %s"), path.buf);
+	}
+	closedir(dir);
+
+	if (!keep_nr) {
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, "multi-pack-index-chain");
+		if (unlink(path.buf) && errno != ENOENT)
+			die_errno(_("failed to remove %s"), path.buf);
+		strbuf_setlen(&path, dirlen - 1);
+		rmdir(path.buf);
+	}
+
+	strbuf_release(&path);
+}
+
 void clear_midx_file(struct repository *r)
 {
 	struct strbuf midx = STRBUF_INIT;
@@ -1552,6 +2094,7 @@ void clear_midx_file(struct repository *r)
 
 	clear_midx_files_ext(r->objects->odb->path, ".bitmap", NULL);
 	clear_midx_files_ext(r->objects->odb->path, ".rev", NULL);
+	clear_midx_chain(r->objects->odb->path, NULL, 0);
 
 	strbuf_release(&midx);
 }
@@ -1601,6 +2144,9 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	uint32_t i;
 	struct progress *progress = NULL;
 	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+
+	struct multi_pack_index *layer;
+	uint32_t num_objects;
 	verify_midx_error = 0;
 
 	if (!m) {
@@ -1614,17 +2160,26 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 			error(_("multi-pack-index file exists, but failed to parse"));
 			result = 1;
 		}
+
+		strbuf_reset(&filename);
+		get_midx_chain_filename(&filename, object_dir);
+
+		if (!result && !stat(filename.buf, &sb)) {
+			error(_("multi-pack-index chain exists, but failed to parse"));
+			result = 1;
+		}
 		strbuf_release(&filename);
 		return result;
 	}
 
-	if (!midx_checksum_valid(m))
-		midx_report(_("incorrect checksum"));
+	for (layer = m; layer; layer = layer->base_midx)
+		if (!midx_checksum_valid(layer))
+			midx_report(_("incorrect checksum"));
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_delayed_progress(_("Looking for referenced packfiles"),
-					  m->num_packs);
-	for (i = 0; i < m->num_packs; i++) {
+					  total_midx_packs(m));
+	for (i = 0; i < total_midx_packs(m); i++) {
 		if (prepare_midx_pack(r, m, i))
 			midx_report("failed to load pack in position %d", i);
 
@@ -1632,16 +2187,19 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	}
 	stop_progress(&progress);
 
-	for (i = 0; i < 255; i++) {
-		uint32_t oid_fanout1 = ntohl(m->chunk_oid_fanout[i]);
-		uint32_t oid_fanout2 = ntohl(m->chunk_oid_fanout[i + 1]);
+	for (layer = m; layer; layer = layer->base_midx) {
+		for (i = 0; i < 255; i++) {
+			uint32_t oid_fanout1 = ntohl(layer->chunk_oid_fanout[i]);
+			uint32_t oid_fanout2 = ntohl(layer->chunk_oid_fanout[i + 1]);
 
-		if (oid_fanout1 > oid_fanout2)
-			midx_report(_("oid fanout out of order: fanout[%d] = %"PRIx32" > %"PRIx32" = fanout[%d]"),
-				    i, oid_fanout1, oid_fanout2, i + 1);
+			if (oid_fanout1 > oid_fanout2)
+				midx_report(_("oid fanout out of order: fanout[%d] = %"PRIx32" > %"PRIx32" = fanout[%d]"),
+					    i, oid_fanout1, oid_fanout2, i + 1);
+		}
 	}
 
-	if (m->num_objects == 0) {
+	num_objects = total_midx_objects(m);
+	if (num_objects == 0) {
 		midx_report(_("the midx contains no oid"));
 		/*
 		 * Remaining tests assume that we have objects, so we can
@@ -1650,12 +2208,20 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 		goto cleanup;
 	}
 
+	/*
+	 * Objects are only sorted within a single layer of a chain, so
+	 * do not compare the last object of one layer with the first
+	 * object of the next.
+	 */
 	if (flags & MIDX_PROGRESS)
 		progress = start_sparse_progress(_("Verifying OID order in multi-pack-index"),
-						 m->num_objects - 1);
-	for (i = 0; i < m->num_objects - 1; i++) {
+						 num_objects - 1);
+	for (i = 0; i < num_objects - 1; i++) {
 		struct object_id oid1, oid2;
 
+		if (i + 1 == midx_for_object(m, i + 1)->num_objects_in_base)
+			continue;
+
 		nth_midxed_object_oid(&oid1, m, i);
 		nth_midxed_object_oid(&oid2, m, i + 1);
 
@@ -1673,31 +2239,31 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	 * each of the objects and only require 1 packfile to be open at a
 	 * time.
 	 */
-	ALLOC_ARRAY(pairs, m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
+	ALLOC_ARRAY(pairs, num_objects);
+	for (i = 0; i < num_objects; i++) {
 		pairs[i].pos = i;
 		pairs[i].pack_int_id = nth_midxed_pack_int_id(m, i);
 	}
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_sparse_progress(_("Sorting objects by packfile"),
-						 m->num_objects);
+						 num_objects);
 	display_progress(progress, 0); /* TODO: Measure QSORT() progress */
-	QSORT(pairs, m->num_objects, compare_pair_pos_vs_id);
+	QSORT(pairs, num_objects, compare_pair_pos_vs_id);
 	stop_progress(&progress);
 
 	if (flags & MIDX_PROGRESS)
-		progress = start_sparse_progress(_("Verifying object offsets"), m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
+		progress = start_sparse_progress(_("Verifying object offsets"), num_objects);
+	for (i = 0; i < num_objects; i++) {
 		struct object_id oid;
 		struct pack_entry e;
 		off_t m_offset, p_offset;
 
 		if (i > 0 && pairs[i-1].pack_int_id != pairs[i].pack_int_id &&
-		    m->packs[pairs[i-1].pack_int_id])
+		    nth_midxed_pack(m, pairs[i-1].pack_int_id))
 		{
-			close_pack_fd(m->packs[pairs[i-1].pack_int_id]);
-			close_pack_index(m->packs[pairs[i-1].pack_int_id]);
+			close_pack_fd(nth_midxed_pack(m, pairs[i-1].pack_int_id));
+			close_pack_index(nth_midxed_pack(m, pairs[i-1].pack_int_id));
 		}
 
 		nth_midxed_object_oid(&oid, m, pairs[i].pos);
@@ -1742,12 +2308,12 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 	if (!m)
 		return 0;
 
-	CALLOC_ARRAY(count, m->num_packs);
+	CALLOC_ARRAY(count, total_midx_packs(m));
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_delayed_progress(_("Counting referenced objects"),
-					  m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
+					  total_midx_objects(m));
+	for (i = 0; i < total_midx_objects(m); i++) {
 		int pack_int_id = nth_midxed_pack_int_id(m, i);
 		count[pack_int_id]++;
 		display_progress(progress, i + 1);
@@ -1756,8 +2322,9 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_delayed_progress(_("Finding and deleting unreferenced packfiles"),
-					  m->num_packs);
-	for (i = 0; i < m->num_packs; i++) {
+					  total_midx_packs(m));
+	for (i = 0; i < total_midx_packs(m); i++) {
+		struct packed_git *p;
 		char *pack_name;
 		display_progress(progress, i + 1);
 
@@ -1767,13 +2334,14 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 		if (prepare_midx_pack(r, m, i))
 			continue;
 
-		if (m->packs[i]->pack_keep)
+		p = nth_midxed_pack(m, i);
+		if (p->pack_keep)
 			continue;
 
-		pack_name = xstrdup(m->packs[i]->pack_name);
-		close_pack(m->packs[i]);
+		pack_name = xstrdup(p->pack_name);
+		close_pack(p);
 
-		string_list_insert(&packs_to_drop, m->pack_names[i]);
+		string_list_insert(&packs_to_drop, nth_midxed_pack_name(m, i));
 		unlink_pack_path(pack_name, 0);
 		free(pack_name);
 	}
@@ -1781,8 +2349,14 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 
 	free(count);
 
+	/*
+	 * A chain is rewritten as a single multi-pack-index from the
+	 * packs that remain on disk, so there is nothing left to drop.
+	 */
 	if (packs_to_drop.nr)
-		result = write_midx_internal(object_dir, NULL, &packs_to_drop, NULL, NULL, flags);
+		result = write_midx_internal(object_dir, NULL,
+					     m->incremental ? NULL : &packs_to_drop,
+					     NULL, NULL, 0, flags);
 
 	string_list_clear(&packs_to_drop, 0);
 
@@ -1818,10 +2392,10 @@ static int fill_included_packs_all(struct repository *r,
 
 	repo_config_get_bool(r, "repack.packkeptobjects", &pack_kept_objects);
 
-	for (i = 0; i < m->num_packs; i++) {
+	for (i = 0; i < total_midx_packs(m); i++) {
 		if (prepare_midx_pack(r, m, i))
 			continue;
-		if (!pack_kept_objects && m->packs[i]->pack_keep)
+		if (!pack_kept_objects && nth_midxed_pack(m, i)->pack_keep)
 			continue;
 
 		include_pack[i] = 1;
@@ -1838,32 +2412,33 @@ static int fill_included_packs_batch(struct repository *r,
 {
 	uint32_t i, packs_to_repack;
 	size_t total_size;
-	struct repack_info *pack_info = xcalloc(m->num_packs, sizeof(struct repack_info));
+	uint32_t num_packs = total_midx_packs(m);
+	struct repack_info *pack_info = xcalloc(num_packs, sizeof(struct repack_info));
 	int pack_kept_objects = 0;
 
 	repo_config_get_bool(r, "repack.packkeptobjects", &pack_kept_objects);
 
-	for (i = 0; i < m->num_packs; i++) {
+	for (i = 0; i < num_packs; i++) {
 		pack_info[i].pack_int_id = i;
 
 		if (prepare_midx_pack(r, m, i))
 			continue;
 
-		pack_info[i].mtime = m->packs[i]->mtime;
+		pack_info[i].mtime = nth_midxed_pack(m, i)->mtime;
 	}
 
-	for (i = 0; batch_size && i < m->num_objects; i++) {
+	for (i = 0; batch_size && i < total_midx_objects(m); i++) {
 		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
 		pack_info[pack_int_id].referenced_objects++;
 	}
 
-	QSORT(pack_info, m->num_packs, compare_by_mtime);
+	QSORT(pack_info, num_packs, compare_by_mtime);
 
 	total_size = 0;
 	packs_to_repack = 0;
-	for (i = 0; total_size < batch_size && i < m->num_packs; i++) {
+	for (i = 0; total_size < batch_size && i < num_packs; i++) {
 		int pack_int_id = pack_info[i].pack_int_id;
-		struct packed_git *p = m->packs[pack_int_id];
+		struct packed_git *p = nth_midxed_pack(m, pack_int_id);
 		size_t expected_size;
 
 		if (!p)
@@ -1914,7 +2489,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 	if (!m)
 		return 0;
 
-	CALLOC_ARRAY(include_pack, m->num_packs);
+	CALLOC_ARRAY(include_pack, total_midx_packs(m));
 
 	if (batch_size) {
 		if (fill_included_packs_batch(r, m, include_pack, batch_size))
@@ -1954,7 +2529,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 
 	cmd_in = xfdopen(cmd.in, "w");
 
-	for (i = 0; i < m->num_objects; i++) {
+	for (i = 0; i < total_midx_objects(m); i++) {
 		struct object_id oid;
 		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
 
@@ -1972,7 +2547,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 		goto cleanup;
 	}
 
-	result = write_midx_internal(object_dir, NULL, NULL, NULL, NULL, flags);
+	result = write_midx_internal(object_dir, NULL, NULL, NULL, NULL, 0, flags);
 
 cleanup:
 	free(include_pack);
@@ -12,6 +12,18 @@ struct repository;
 #define GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP \
 	"GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP"
 
+/*
+ * A multi-pack-index is either a single "multi-pack-index" file, or a
+ * chain of incremental layers stored in "multi-pack-index.d", each
+ * indexing only the packs that were new when it was written.
+ *
+ * For a chain, a "struct multi_pack_index" represents one layer and
+ * points to the layers below it via "base_midx". The functions below
+ * take the topmost layer and operate on the whole chain: object
+ * positions and pack-int-ids are global, i.e. those of a layer are
+ * offset by "num_objects_in_base" and "num_packs_in_base",
+ * respectively.
+ */
 struct multi_pack_index {
 	struct multi_pack_index *next;
 
@@ -37,6 +49,13 @@ struct multi_pack_index {
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
 	const unsigned char *chunk_revindex;
+	const unsigned char *chunk_base_midxs;
+	uint32_t num_base_midxs;
+
+	struct multi_pack_index *base_midx;
+	uint32_t num_objects_in_base;
+	uint32_t num_packs_in_base;
+	unsigned incremental : 1;
 
 	const char **pack_names;
 	struct packed_git **packs;
@@ -47,14 +66,31 @@ struct multi_pack_index {
 #define MIDX_WRITE_REV_INDEX (1 << 1)
 #define MIDX_WRITE_BITMAP (1 << 2)
 #define MIDX_WRITE_BITMAP_HASH_CACHE (1 << 3)
+#define MIDX_WRITE_BITMAP_LOOKUP_TABLE (1 << 4)
+#define MIDX_WRITE_INCREMENTAL (1 << 5)
+#define MIDX_WRITE_BITMAP_ROARING (1 << 6)
 
 const unsigned char *get_midx_checksum(struct multi_pack_index *m);
 void get_midx_filename(struct strbuf *out, const char *object_dir);
+void get_midx_chain_dirname(struct strbuf *out, const char *object_dir);
+void get_midx_chain_filename(struct strbuf *out, const char *object_dir);
+void get_split_midx_filename(struct strbuf *out, const char *object_dir,
+			     const unsigned char *hash);
 void get_midx_rev_filename(struct strbuf *out, struct multi_pack_index *m);
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
+struct packed_git *nth_midxed_pack(struct multi_pack_index *m, uint32_t pack_int_id);
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
+/* The number of objects in "m" and all of the layers below it. */
+uint32_t total_midx_objects(struct multi_pack_index *m);
+/*
+ * Like bsearch_midx(), but only look at the single layer "m". On failure,
+ * "result" is the (global) position at which "oid" would be inserted into
+ * that layer.
+ */
+int bsearch_one_midx(const struct object_id *oid, struct multi_pack_index *m,
+		     uint32_t *result);
 off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
 uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
@@ -65,13 +101,26 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
 /*
- * Variant of write_midx_file which writes a MIDX containing only the packs
- * specified in packs_to_include.
+ * write_midx_file() writes a single multi-pack-index covering all packs,
+ * replacing any incremental chain.
+ *
+ * write_midx_file_incremental() instead adds a new layer to the chain in
+ * "multi-pack-index.d" which only covers the packs that are not indexed
+ * yet. The new layer is merged with the layers below it for as long as
+ * those are not at least "split_size_multiple" times as large as it. An
+ * existing non-incremental multi-pack-index becomes the base of the chain.
  */
 int write_midx_file(const char *object_dir,
 		    const char *preferred_pack_name,
 		    const char *refs_snapshot,
 		    unsigned flags);
+int write_midx_file_incremental(const char *object_dir,
+				int split_size_multiple,
+				unsigned flags);
+/*
+ * Variant of write_midx_file which writes a MIDX containing only the packs
+ * specified in packs_to_include.
+ */
 int write_midx_file_only(const char *object_dir,
 			 struct string_list *packs_to_include,
 			 const char *preferred_pack_name,
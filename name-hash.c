@@ -693,6 +693,8 @@ void adjust_dirname_case(struct index_state *istate, char *name)
 {
 	const char *startPtr = name;
 	const char *ptr = startPtr;
+	const char *hashed = name;
+	unsigned int hash = memihash(name, 0);
 
 	lazy_init_name_hash(istate);
 	expand_to_path(istate, name, strlen(name), 0);
@@ -703,7 +705,15 @@ void adjust_dirname_case(struct index_state *istate, char *name)
 		if (*ptr == '/') {
 			struct dir_entry *dir;
 
-			dir = find_dir_entry(istate, name, ptr - name);
+			/*
+			 * Extend the hash of the previous leading directory
+			 * instead of rehashing the whole prefix; memihash()
+			 * folds case, so fixing up the case of a component
+			 * below does not invalidate it.
+			 */
+			hash = memihash_cont(hash, hashed, ptr - hashed);
+			hashed = ptr;
+			dir = find_dir_entry__hash(istate, name, ptr - name, hash);
 			if (dir) {
 				memcpy((void *)startPtr, dir->name + (startPtr - name), ptr - startPtr);
 				startPtr = ptr + 1;
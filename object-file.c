@@ -1514,6 +1514,7 @@ void enable_obj_read_lock(void)
 
 	obj_read_use_lock = 1;
 	init_recursive_mutex(&obj_read_mutex);
+	enable_delta_base_cache_locks();
 }
 
 void disable_obj_read_lock(void)
@@ -1523,6 +1524,7 @@ void disable_obj_read_lock(void)
 
 	obj_read_use_lock = 0;
 	pthread_mutex_destroy(&obj_read_mutex);
+	disable_delta_base_cache_locks();
 }
 
 int fetch_if_missing = 1;
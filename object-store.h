@@ -179,6 +179,13 @@ struct raw_object_store {
 	struct commit_graph *commit_graph;
 	unsigned commit_graph_attempted : 1; /* if loading has been attempted */
 
+	/*
+	 * private data
+	 *
+	 * should only be accessed directly by rename-cache.c
+	 */
+	struct rename_cache *rename_cache;
+
 	/*
 	 * private data
 	 *
@@ -9,6 +9,7 @@
 #include "alloc.h"
 #include "packfile.h"
 #include "commit-graph.h"
+#include "rename-cache.h"
 
 unsigned int get_max_object_index(void)
 {
@@ -544,6 +545,8 @@ void raw_object_store_clear(struct raw_object_store *o)
 	o->commit_graph = NULL;
 	o->commit_graph_attempted = 0;
 
+	rename_cache_clear(o);
+
 	free_object_directories(o);
 	o->odb_tail = NULL;
 	o->loaded_alternates = 0;
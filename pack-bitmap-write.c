@@ -9,6 +9,7 @@
 #include "pack-revindex.h"
 #include "pack.h"
 #include "pack-bitmap.h"
+#include "ewah/roaring.h"
 #include "hash-lookup.h"
 #include "pack-objects.h"
 #include "commit-reach.h"
@@ -636,9 +637,17 @@ static int hashwrite_ewah_helper(void *f, const void *buf, size_t len)
 /**
  * Write the bitmap index to disk
  */
-static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap)
+static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap,
+			       uint16_t options)
 {
-	if (ewah_serialize_to(bitmap, hashwrite_ewah_helper, f) < 0)
+	if (options & BITMAP_OPT_ROARING) {
+		struct bitmap *b = ewah_to_bitmap(bitmap);
+		int ret = roaring_serialize_to(b, hashwrite_ewah_helper, f);
+
+		bitmap_free(b);
+		if (ret < 0)
+			die("Failed to write bitmap index");
+	} else if (ewah_serialize_to(bitmap, hashwrite_ewah_helper, f) < 0)
 		die("Failed to write bitmap index");
 }
 
@@ -649,26 +658,87 @@ static const struct object_id *oid_access(size_t pos, const void *table)
 }
 
 static void write_selected_commits_v1(struct hashfile *f,
-				      struct pack_idx_entry **index,
-				      uint32_t index_nr)
+				      uint32_t *commit_positions,
+				      off_t *offsets,
+				      uint16_t options)
 {
 	int i;
 
 	for (i = 0; i < writer.selected_nr; ++i) {
 		struct bitmapped_commit *stored = &writer.selected[i];
 
-		int commit_pos =
-			oid_pos(&stored->commit->object.oid, index, index_nr, oid_access);
+		if (offsets)
+			offsets[i] = hashfile_total(f);
 
-		if (commit_pos < 0)
-			BUG("trying to write commit not in index");
-
-		hashwrite_be32(f, commit_pos);
+		hashwrite_be32(f, commit_positions[i]);
 		hashwrite_u8(f, stored->xor_offset);
 		hashwrite_u8(f, stored->flags);
 
-		dump_bitmap(f, stored->write_as);
+		dump_bitmap(f, stored->write_as, options);
+	}
+}
+
+static int table_cmp(const void *_va, const void *_vb, void *_data)
+{
+	uint32_t *commit_positions = _data;
+	uint32_t a = commit_positions[*(uint32_t *)_va];
+	uint32_t b = commit_positions[*(uint32_t *)_vb];
+
+	if (a > b)
+		return 1;
+	else if (a < b)
+		return -1;
+
+	return 0;
+}
+
+static void write_lookup_table(struct hashfile *f,
+			       uint32_t *commit_positions,
+			       off_t *offsets)
+{
+	uint32_t i;
+	uint32_t *table, *table_inv;
+
+	ALLOC_ARRAY(table, writer.selected_nr);
+	ALLOC_ARRAY(table_inv, writer.selected_nr);
+
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+
+	/*
+	 * The lookup table is ordered by commit position, so that readers
+	 * can binary search it. After sorting, table[j] = i means that
+	 * row j of the table describes the i'th stored bitmap, and
+	 * table_inv maps the other way around.
+	 */
+	QSORT_S(table, writer.selected_nr, table_cmp, commit_positions);
+
+	for (i = 0; i < writer.selected_nr; i++)
+		table_inv[table[i]] = i;
+
+	trace2_region_enter("pack-bitmap-write", "writing_lookup_table", the_repository);
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *selected = &writer.selected[table[i]];
+		uint32_t xor_offset = selected->xor_offset;
+		uint32_t xor_row;
+
+		/*
+		 * The XOR base is stored `xor_offset` entries before this
+		 * bitmap; point to the row describing it.
+		 */
+		if (xor_offset)
+			xor_row = table_inv[table[i] - xor_offset];
+		else
+			xor_row = BITMAP_NO_XOR_ROW;
+
+		hashwrite_be32(f, commit_positions[table[i]]);
+		hashwrite_be64(f, (uint64_t)offsets[table[i]]);
+		hashwrite_be32(f, xor_row);
 	}
+	trace2_region_leave("pack-bitmap-write", "writing_lookup_table", the_repository);
+
+	free(table);
+	free(table_inv);
 }
 
 static void write_hash_cache(struct hashfile *f,
@@ -693,10 +763,12 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 			  const char *filename,
 			  uint16_t options)
 {
-	static uint16_t default_version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct hashfile *f;
+	uint32_t *commit_positions = NULL;
+	off_t *offsets = NULL;
+	uint32_t i;
 
 	struct bitmap_disk_header header;
 
@@ -705,17 +777,51 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	f = hashfd(fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(options & BITMAP_OPT_ROARING ?
+			       BITMAP_VERSION_ROARING : BITMAP_VERSION_EWAH);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(writer.selected_nr);
 	hashcpy(header.checksum, writer.pack_checksum);
 
 	hashwrite(f, &header, sizeof(header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz);
-	dump_bitmap(f, writer.commits);
-	dump_bitmap(f, writer.trees);
-	dump_bitmap(f, writer.blobs);
-	dump_bitmap(f, writer.tags);
-	write_selected_commits_v1(f, index, index_nr);
+	dump_bitmap(f, writer.commits, options);
+	dump_bitmap(f, writer.trees, options);
+	dump_bitmap(f, writer.blobs, options);
+	dump_bitmap(f, writer.tags, options);
+	ALLOC_ARRAY(commit_positions, writer.selected_nr);
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[i];
+		int commit_pos = oid_pos(&stored->commit->object.oid, index, index_nr, oid_access);
+
+		if (commit_pos < 0)
+			BUG("trying to write commit not in index");
+
+		commit_positions[i] = commit_pos;
+	}
+
+	/*
+	 * Roaring bitmaps are read without being expanded, which XOR-ing
+	 * them against each other would defeat; store them all as-is.
+	 */
+	if (options & BITMAP_OPT_ROARING) {
+		for (i = 0; i < writer.selected_nr; i++) {
+			struct bitmapped_commit *stored = &writer.selected[i];
+
+			if (stored->write_as != stored->bitmap)
+				ewah_pool_free(stored->write_as);
+			stored->write_as = stored->bitmap;
+			stored->xor_offset = 0;
+		}
+	}
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		CALLOC_ARRAY(offsets, writer.selected_nr);
+
+	write_selected_commits_v1(f, commit_positions, offsets, options);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, commit_positions, offsets);
 
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
@@ -730,4 +836,6 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 		die_errno("unable to rename temporary bitmap file to '%s'", filename);
 
 	strbuf_release(&tmp_file);
+	free(commit_positions);
+	free(offsets);
 }
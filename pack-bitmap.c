@@ -7,6 +7,7 @@
 #include "list-objects.h"
 #include "pack.h"
 #include "pack-bitmap.h"
+#include "ewah/roaring.h"
 #include "pack-revindex.h"
 #include "pack-objects.h"
 #include "packfile.h"
@@ -25,6 +26,12 @@ struct stored_bitmap {
 	struct ewah_bitmap *root;
 	struct stored_bitmap *xor;
 	int flags;
+
+	/*
+	 * In Roaring-encoded indexes, the bitmap as read from the file;
+	 * `root` is then only filled in when an EWAH copy is asked for.
+	 */
+	struct roaring_bitmap *roaring;
 };
 
 /*
@@ -82,6 +89,13 @@ struct bitmap_index {
 	/* The checksum of the packfile or MIDX; points into map. */
 	const unsigned char *checksum;
 
+	/*
+	 * If not NULL, this points into the lookup table extension
+	 * (within the memory mapped region `map`), which allows loading
+	 * individual bitmaps on demand instead of all of them upfront.
+	 */
+	unsigned char *table_lookup;
+
 	/*
 	 * Extended index.
 	 *
@@ -104,6 +118,9 @@ struct bitmap_index {
 
 	/* Version of the bitmap index */
 	unsigned int version;
+
+	/* Whether the bitmaps are Roaring-encoded (BITMAP_OPT_ROARING) */
+	unsigned roaring : 1;
 };
 
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
@@ -111,6 +128,9 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 	struct ewah_bitmap *parent;
 	struct ewah_bitmap *composed;
 
+	if (st->roaring && !st->root)
+		st->root = roaring_to_ewah(st->roaring);
+
 	if (!st->xor)
 		return st->root;
 
@@ -147,6 +167,44 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 	return b;
 }
 
+static struct roaring_bitmap *read_roaring_1(struct bitmap_index *index)
+{
+	struct roaring_bitmap *r = xmalloc(sizeof(*r));
+
+	ssize_t bitmap_size = roaring_read_mmap(r,
+		index->map + index->map_pos,
+		index->map_size - index->map_pos);
+
+	if (bitmap_size < 0) {
+		error("Failed to load bitmap index (corrupted?)");
+		free(r);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+	return r;
+}
+
+/*
+ * The type bitmaps are only ever used as EWAH bitmaps, so convert
+ * them once and for all if the index is Roaring-encoded.
+ */
+static struct ewah_bitmap *read_type_bitmap(struct bitmap_index *index)
+{
+	struct roaring_bitmap *r;
+	struct ewah_bitmap *b;
+
+	if (!index->roaring)
+		return read_bitmap_1(index);
+
+	r = read_roaring_1(index);
+	if (!r)
+		return NULL;
+	b = roaring_to_ewah(r);
+	free(r);
+	return b;
+}
+
 static uint32_t bitmap_num_objects(struct bitmap_index *index)
 {
 	if (index->midx)
@@ -166,9 +224,12 @@ static int load_bitmap_header(struct bitmap_index *index)
 		return error("Corrupted bitmap index file (wrong header)");
 
 	index->version = ntohs(header->version);
-	if (index->version != 1)
+	if (index->version != BITMAP_VERSION_EWAH &&
+	    index->version != BITMAP_VERSION_ROARING)
 		return error("Unsupported version for bitmap index file (%d)", index->version);
 
+	index->entry_count = ntohl(header->entry_count);
+
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
@@ -179,15 +240,37 @@ static int load_bitmap_header(struct bitmap_index *index)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		if (flags & ~BITMAP_OPT_KNOWN)
+			return error(_("unsupported options for bitmap index file (0x%x)"),
+				     flags & ~BITMAP_OPT_KNOWN);
+
+		if (!(flags & BITMAP_OPT_ROARING) !=
+		    (index->version == BITMAP_VERSION_EWAH))
+			return error(_("corrupted bitmap index file (version %d "
+				       "does not match its bitmap encoding)"),
+				     index->version);
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			if (cache_size > index_end - index->map - header_size)
 				return error("corrupted bitmap index file (too short to fit hash cache)");
 			index->hashes = (void *)(index_end - cache_size);
 			index_end -= cache_size;
 		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			size_t table_size = st_mult(index->entry_count,
+						    BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH);
+			if (table_size > index_end - index->map - header_size)
+				return error(_("corrupted bitmap index file (too short to fit lookup table)"));
+			if (git_env_bool("GIT_TEST_READ_COMMIT_TABLE", 1))
+				index->table_lookup = (void *)(index_end - table_size);
+			index_end -= table_size;
+		}
+
+		if (flags & BITMAP_OPT_ROARING)
+			index->roaring = 1;
 	}
 
-	index->entry_count = ntohl(header->entry_count);
 	index->checksum = header->checksum;
 	index->map_pos += header_size;
 	return 0;
@@ -195,6 +278,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 					  struct ewah_bitmap *root,
+					  struct roaring_bitmap *roaring,
 					  const struct object_id *oid,
 					  struct stored_bitmap *xor_with,
 					  int flags)
@@ -205,6 +289,7 @@ static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 
 	stored = xmalloc(sizeof(struct stored_bitmap));
 	stored->root = root;
+	stored->roaring = roaring;
 	stored->xor = xor_with;
 	stored->flags = flags;
 	oidcpy(&stored->oid, oid);
@@ -254,6 +339,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	for (i = 0; i < index->entry_count; ++i) {
 		int xor_offset, flags;
 		struct ewah_bitmap *bitmap = NULL;
+		struct roaring_bitmap *roaring = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
 		struct object_id oid;
@@ -269,9 +355,18 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 			return error("corrupt ewah bitmap: commit index %u out of range",
 				     (unsigned)commit_idx_pos);
 
-		bitmap = read_bitmap_1(index);
-		if (!bitmap)
-			return -1;
+		if (index->roaring) {
+			if (xor_offset)
+				return error("Corrupted bitmap pack index "
+					     "(XOR'd Roaring bitmap)");
+			roaring = read_roaring_1(index);
+			if (!roaring)
+				return -1;
+		} else {
+			bitmap = read_bitmap_1(index);
+			if (!bitmap)
+				return -1;
+		}
 
 		if (xor_offset > MAX_XOR_OFFSET || xor_offset > i)
 			return error("Corrupted bitmap pack index");
@@ -284,7 +379,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		}
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
-			index, bitmap, &oid, xor_bitmap, flags);
+			index, bitmap, roaring, &oid, xor_bitmap, flags);
 	}
 
 	return 0;
@@ -320,6 +415,13 @@ static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
 
 	free(idx_name);
 
+	/* Bitmaps are only written for non-incremental MIDXs. */
+	if (midx->incremental) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
 	if (fd < 0)
 		return -1;
 
@@ -464,13 +566,17 @@ static int load_bitmap(struct bitmap_index *bitmap_git)
 	if (load_reverse_index(bitmap_git))
 		goto failed;
 
-	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->trees = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->blobs = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
+	if (!(bitmap_git->commits = read_type_bitmap(bitmap_git)) ||
+		!(bitmap_git->trees = read_type_bitmap(bitmap_git)) ||
+		!(bitmap_git->blobs = read_type_bitmap(bitmap_git)) ||
+		!(bitmap_git->tags = read_type_bitmap(bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(bitmap_git) < 0)
+	/*
+	 * With a lookup table, individual bitmaps are loaded on demand
+	 * by bitmap_for_commit().
+	 */
+	if (!bitmap_git->table_lookup && load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
 	return 0;
@@ -557,14 +663,237 @@ struct include_data {
 	struct bitmap *seen;
 };
 
-struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
-				      struct commit *commit)
+struct bitmap_lookup_table_triplet {
+	uint32_t commit_pos;
+	uint64_t offset;
+	uint32_t xor_row;
+};
+
+/*
+ * Fill `triplet` from row `pos` of the lookup table, whose rows are
+ * sorted by commit position. Returns 0 on success and -1 if the row
+ * is out of bounds.
+ */
+static int bitmap_lookup_table_get_triplet(struct bitmap_index *bitmap_git,
+					   uint32_t pos,
+					   struct bitmap_lookup_table_triplet *triplet)
+{
+	unsigned char *p;
+
+	if (pos >= bitmap_git->entry_count)
+		return error(_("corrupt bitmap lookup table: triplet position out of index"));
+
+	p = bitmap_git->table_lookup + st_mult(pos, BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH);
+
+	triplet->commit_pos = get_be32(p);
+	p += sizeof(uint32_t);
+	triplet->offset = get_be64(p);
+	p += sizeof(uint64_t);
+	triplet->xor_row = get_be32(p);
+	return 0;
+}
+
+static int triplet_cmp(const void *key, const void *p)
+{
+	uint32_t a = *(const uint32_t *)key;
+	uint32_t b = get_be32(p);
+
+	if (a > b)
+		return 1;
+	else if (a < b)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Find the row of the lookup table for the commit at `commit_pos` in
+ * the pack or MIDX index order. Returns 0 and stores the row in
+ * `result` on success, or -1 if the commit has no bitmap.
+ */
+static int bitmap_bsearch_triplet_by_pos(uint32_t commit_pos,
+					 struct bitmap_index *bitmap_git,
+					 uint32_t *result)
+{
+	unsigned char *found = bsearch(&commit_pos, bitmap_git->table_lookup,
+				       bitmap_git->entry_count,
+				       BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH,
+				       triplet_cmp);
+
+	if (!found)
+		return -1;
+
+	*result = (found - bitmap_git->table_lookup) / BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH;
+	return 0;
+}
+
+/*
+ * Find the position of `oid` in the pack or MIDX index order. Returns
+ * non-zero if the object was found.
+ */
+static int bitmap_bsearch_pos(struct bitmap_index *bitmap_git,
+			      const struct object_id *oid,
+			      uint32_t *result)
+{
+	if (bitmap_is_midx(bitmap_git))
+		return bsearch_midx(oid, bitmap_git->midx, result);
+	return bsearch_pack(oid, bitmap_git->pack, result);
+}
+
+/*
+ * Read and store the bitmap described by `triplet`, which is stored
+ * as an XOR against `xor_bitmap` (or not at all, if that is NULL).
+ */
+static struct stored_bitmap *load_bitmap_from_triplet(struct bitmap_index *bitmap_git,
+						      struct bitmap_lookup_table_triplet *triplet,
+						      struct stored_bitmap *xor_bitmap)
+{
+	struct ewah_bitmap *bitmap = NULL;
+	struct roaring_bitmap *roaring = NULL;
+	struct object_id oid;
+	uint32_t commit_idx_pos;
+	int flags;
+
+	if (triplet->offset > bitmap_git->map_size ||
+	    bitmap_git->map_size - triplet->offset < 6) {
+		error(_("corrupt ewah bitmap: truncated header for bitmap of commit at position %"PRIu32),
+		      triplet->commit_pos);
+		return NULL;
+	}
+
+	bitmap_git->map_pos = triplet->offset;
+	commit_idx_pos = read_be32(bitmap_git->map, &bitmap_git->map_pos);
+	/* The XOR offset is redundant with the lookup table's XOR row. */
+	read_u8(bitmap_git->map, &bitmap_git->map_pos);
+	flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
+
+	if (commit_idx_pos != triplet->commit_pos) {
+		error(_("corrupt bitmap lookup table: commit position mismatch"));
+		return NULL;
+	}
+	if (nth_bitmap_object_oid(bitmap_git, &oid, commit_idx_pos) < 0) {
+		error(_("corrupt ewah bitmap: commit index %u out of range"),
+		      (unsigned)commit_idx_pos);
+		return NULL;
+	}
+
+	if (bitmap_git->roaring) {
+		if (xor_bitmap) {
+			error(_("corrupt bitmap lookup table: XOR'd Roaring bitmap"));
+			return NULL;
+		}
+		roaring = read_roaring_1(bitmap_git);
+		if (!roaring)
+			return NULL;
+	} else {
+		bitmap = read_bitmap_1(bitmap_git);
+		if (!bitmap)
+			return NULL;
+	}
+
+	return store_bitmap(bitmap_git, bitmap, roaring, &oid, xor_bitmap, flags);
+}
+
+/*
+ * Load the bitmap of the commit at `commit_pos` using the lookup
+ * table, together with all bitmaps along its XOR chain that have not
+ * been loaded yet.
+ */
+static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_git,
+						    uint32_t commit_pos)
+{
+	struct bitmap_lookup_table_triplet triplet;
+	struct bitmap_lookup_table_triplet *chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+	struct stored_bitmap *xor_bitmap = NULL;
+	struct stored_bitmap *bitmap = NULL;
+	uint32_t row;
+
+	if (bitmap_bsearch_triplet_by_pos(commit_pos, bitmap_git, &row) < 0)
+		return NULL;
+	if (bitmap_lookup_table_get_triplet(bitmap_git, row, &triplet) < 0)
+		return NULL;
+
+	/*
+	 * Walk the XOR chain until we hit either a bitmap that is stored
+	 * as-is, or one that has been loaded before. Bitmaps are only XOR'd
+	 * against earlier ones, so a chain longer than the number of
+	 * entries means the table is corrupt.
+	 */
+	ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+	chain[chain_nr++] = triplet;
+
+	while (triplet.xor_row != BITMAP_NO_XOR_ROW) {
+		struct object_id xor_oid;
+		khiter_t hash_pos;
+
+		if (chain_nr > bitmap_git->entry_count) {
+			error(_("corrupt bitmap lookup table: xor chain exceeds entry count"));
+			goto done;
+		}
+		if (bitmap_lookup_table_get_triplet(bitmap_git, triplet.xor_row,
+						    &triplet) < 0)
+			goto done;
+		if (nth_bitmap_object_oid(bitmap_git, &xor_oid,
+					  triplet.commit_pos) < 0) {
+			error(_("corrupt ewah bitmap: commit index %u out of range"),
+			      (unsigned)triplet.commit_pos);
+			goto done;
+		}
+
+		hash_pos = kh_get_oid_map(bitmap_git->bitmaps, xor_oid);
+		if (hash_pos < kh_end(bitmap_git->bitmaps)) {
+			xor_bitmap = kh_value(bitmap_git->bitmaps, hash_pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = triplet;
+	}
+
+	/* Load the chain starting at its base. */
+	while (chain_nr) {
+		xor_bitmap = load_bitmap_from_triplet(bitmap_git,
+						      &chain[--chain_nr],
+						      xor_bitmap);
+		if (!xor_bitmap)
+			goto done;
+	}
+	bitmap = xor_bitmap;
+
+done:
+	free(chain);
+	return bitmap;
+}
+
+static struct stored_bitmap *stored_bitmap_for_commit(struct bitmap_index *bitmap_git,
+						      struct commit *commit)
 {
 	khiter_t hash_pos = kh_get_oid_map(bitmap_git->bitmaps,
 					   commit->object.oid);
-	if (hash_pos >= kh_end(bitmap_git->bitmaps))
+	if (hash_pos >= kh_end(bitmap_git->bitmaps)) {
+		uint32_t commit_pos;
+
+		if (!bitmap_git->table_lookup)
+			return NULL;
+
+		if (!bitmap_bsearch_pos(bitmap_git, &commit->object.oid,
+					&commit_pos))
+			return NULL;
+
+		return lazy_bitmap_for_commit(bitmap_git, commit_pos);
+	}
+	return kh_value(bitmap_git->bitmaps, hash_pos);
+}
+
+struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
+				      struct commit *commit)
+{
+	struct stored_bitmap *bitmap = stored_bitmap_for_commit(bitmap_git,
+								commit);
+	if (!bitmap)
 		return NULL;
-	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+	return lookup_stored_bitmap(bitmap);
 }
 
 static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
@@ -674,7 +1003,7 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      struct commit *commit,
 			      int bitmap_pos)
 {
-	struct ewah_bitmap *partial;
+	struct stored_bitmap *partial;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -682,9 +1011,12 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	partial = bitmap_for_commit(bitmap_git, commit);
+	partial = stored_bitmap_for_commit(bitmap_git, commit);
 	if (partial) {
-		bitmap_or_ewah(data->base, partial);
+		if (partial->roaring)
+			bitmap_or_roaring(data->base, partial->roaring);
+		else
+			bitmap_or_ewah(data->base, lookup_stored_bitmap(partial));
 		return 0;
 	}
 
@@ -737,15 +1069,22 @@ static int add_commit_to_bitmap(struct bitmap_index *bitmap_git,
 				struct bitmap **base,
 				struct commit *commit)
 {
-	struct ewah_bitmap *or_with = bitmap_for_commit(bitmap_git, commit);
+	struct stored_bitmap *or_with = stored_bitmap_for_commit(bitmap_git,
+								 commit);
 
 	if (!or_with)
 		return 0;
 
-	if (!*base)
-		*base = ewah_to_bitmap(or_with);
-	else
-		bitmap_or_ewah(*base, or_with);
+	if (or_with->roaring) {
+		if (!*base)
+			*base = roaring_to_bitmap(or_with->roaring);
+		else
+			bitmap_or_roaring(*base, or_with->roaring);
+	} else if (!*base) {
+		*base = ewah_to_bitmap(lookup_stored_bitmap(or_with));
+	} else {
+		bitmap_or_ewah(*base, lookup_stored_bitmap(or_with));
+	}
 
 	return 1;
 }
@@ -1760,6 +2099,15 @@ int test_bitmap_commits(struct repository *r)
 	if (!bitmap_git)
 		die("failed to load bitmap indexes");
 
+	/*
+	 * As this function is only used to print bitmap selected
+	 * commits, we don't have to read the commit table.
+	 */
+	if (bitmap_git->table_lookup) {
+		if (load_bitmap_entries_v1(bitmap_git) < 0)
+			die(_("failed to load bitmap indexes"));
+	}
+
 	kh_foreach(bitmap_git->bitmaps, oid, value, {
 		printf("%s\n", oid_to_hex(&oid));
 	});
@@ -1879,6 +2227,7 @@ void free_bitmap_index(struct bitmap_index *b)
 		struct stored_bitmap *sb;
 		kh_foreach_value(b->bitmaps, sb, {
 			ewah_pool_free(sb->root);
+			free(sb->roaring);
 			free(sb);
 		});
 	}
@@ -26,8 +26,29 @@ struct bitmap_disk_header {
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
+	BITMAP_OPT_ROARING = 32,
 };
 
+#define BITMAP_OPT_KNOWN (BITMAP_OPT_FULL_DAG | BITMAP_OPT_HASH_CACHE | \
+			  BITMAP_OPT_LOOKUP_TABLE | BITMAP_OPT_ROARING)
+
+/*
+ * Files with Roaring bitmaps (BITMAP_OPT_ROARING) are written as
+ * version 2, so that readers which only know EWAH reject them instead
+ * of misreading them.
+ */
+#define BITMAP_VERSION_EWAH 1
+#define BITMAP_VERSION_ROARING 2
+
+/*
+ * Each row of the lookup table consists of a 4-byte commit position,
+ * an 8-byte offset of the bitmap entry and a 4-byte row of the XOR
+ * base (or BITMAP_NO_XOR_ROW).
+ */
+#define BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH (sizeof(uint32_t) * 2 + sizeof(uint64_t))
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
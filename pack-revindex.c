@@ -302,6 +302,14 @@ int load_midx_revindex(struct multi_pack_index *m)
 	if (m->revindex_data)
 		return 0;
 
+	/*
+	 * Reverse indexes are only written for non-incremental MIDXs;
+	 * the RIDX chunk or .rev file of a single layer would not cover
+	 * the objects of the layers below it.
+	 */
+	if (m->incremental)
+		return error(_("no reverse index for an incremental multi-pack-index"));
+
 	if (m->chunk_revindex) {
 		/*
 		 * If the MIDX `m` has a `RIDX` chunk, then use its contents for
@@ -324,7 +332,7 @@ int load_midx_revindex(struct multi_pack_index *m)
 	get_midx_rev_filename(&revindex_name, m);
 
 	ret = load_revindex_from_disk(revindex_name.buf,
-				      m->num_objects,
+				      total_midx_objects(m),
 				      &m->revindex_map,
 				      &m->revindex_len);
 	if (ret)
@@ -410,7 +418,7 @@ uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos)
 {
 	if (!m->revindex_data)
 		BUG("pack_pos_to_midx: reverse index not yet loaded");
-	if (m->num_objects <= pos)
+	if (total_midx_objects(m) <= pos)
 		BUG("pack_pos_to_midx: out-of-bounds object at %"PRIu32, pos);
 	return get_be32(m->revindex_data + pos);
 }
@@ -467,7 +475,7 @@ int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
 
 	if (!m->revindex_data)
 		BUG("midx_to_pack_pos: reverse index not yet loaded");
-	if (m->num_objects <= at)
+	if (total_midx_objects(m) <= at)
 		BUG("midx_to_pack_pos: out-of-bounds object at %"PRIu32, at);
 
 	key.pack = nth_midxed_pack_int_id(m, at);
@@ -484,7 +492,7 @@ int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
 	 */
 	key.preferred_pack = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0));
 
-	found = bsearch(&key, m->revindex_data, m->num_objects,
+	found = bsearch(&key, m->revindex_data, total_midx_objects(m),
 			sizeof(*m->revindex_data), midx_pack_order_cmp);
 
 	if (!found)
@@ -873,7 +873,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!report_garbage)
 		return;
 
-	if (!strcmp(file_name, "multi-pack-index"))
+	if (!strcmp(file_name, "multi-pack-index") ||
+	    !strcmp(file_name, "multi-pack-index.d"))
 		return;
 	if (starts_with(file_name, "multi-pack-index") &&
 	    (ends_with(file_name, ".bitmap") || ends_with(file_name, ".rev")))
@@ -921,15 +922,17 @@ static void prepare_packed_git(struct repository *r);
  */
 unsigned long repo_approximate_object_count(struct repository *r)
 {
+	unsigned long count;
+
+	obj_read_lock();
 	if (!r->objects->approximate_object_count_valid) {
-		unsigned long count;
 		struct multi_pack_index *m;
 		struct packed_git *p;
 
 		prepare_packed_git(r);
 		count = 0;
 		for (m = get_multi_pack_index(r); m; m = m->next)
-			count += m->num_objects;
+			count += m->num_objects_in_base + m->num_objects;
 		for (p = r->objects->packed_git; p; p = p->next) {
 			if (open_pack_index(p))
 				continue;
@@ -938,7 +941,9 @@ unsigned long repo_approximate_object_count(struct repository *r)
 		r->objects->approximate_object_count = count;
 		r->objects->approximate_object_count_valid = 1;
 	}
-	return r->objects->approximate_object_count;
+	count = r->objects->approximate_object_count;
+	obj_read_unlock();
+	return count;
 }
 
 static void *get_next_packed_git(const void *p)
@@ -1059,7 +1064,7 @@ struct packed_git *get_all_packs(struct repository *r)
 	prepare_packed_git(r);
 	for (m = r->objects->multi_pack_index; m; m = m->next) {
 		uint32_t i;
-		for (i = 0; i < m->num_packs; i++)
+		for (i = 0; i < m->num_packs_in_base + m->num_packs; i++)
 			prepare_midx_pack(r, m, i);
 	}
 
@@ -1354,10 +1359,37 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
+/*
+ * The delta base cache is split into shards, each with its own hashmap
+ * and LRU list. All shards draw from the single delta_base_cache_limit
+ * budget: an insertion that pushes the total over it first evicts the
+ * least-recently-used entries of its own shard, then those of the other
+ * shards. When the object read lock is enabled, every shard is
+ * additionally protected by its own mutex, so that threads
+ * reconstructing objects from different bases can consult and fill the
+ * cache without contending with each other (or holding the object read
+ * lock while doing so).
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
+
+struct delta_base_cache_shard {
+	pthread_mutex_t mutex;
+	struct hashmap map;
+	struct list_head lru;
+
+	/* statistics, reported via trace2 at exit */
+	intmax_t hits;
+	intmax_t misses;
+	intmax_t evictions;
+};
+
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static int delta_base_cache_initialized;
+static int delta_base_cache_use_locks;
 
-static LIST_HEAD(delta_base_cache_lru);
+/* bytes cached over all shards, protected by delta_base_cached_mutex */
+static size_t delta_base_cached;
+static pthread_mutex_t delta_base_cached_mutex;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1382,22 +1414,6 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
-{
-	struct hashmap_entry entry, *e;
-	struct delta_base_cache_key key;
-
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	e = hashmap_get(&delta_base_cache, &entry, &key);
-	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
-}
-
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1421,82 +1437,284 @@ static int delta_base_cache_hash_cmp(const void *unused_cmp_data,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
+static void report_delta_base_cache_stats(void)
+{
+	intmax_t hits = 0, misses = 0, evictions = 0;
+	int i;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		hits += delta_base_cache[i].hits;
+		misses += delta_base_cache[i].misses;
+		evictions += delta_base_cache[i].evictions;
+	}
+
+	if (!hits && !misses)
+		return;
+
+	trace2_data_intmax("delta_base_cache", NULL, "hits", hits);
+	trace2_data_intmax("delta_base_cache", NULL, "misses", misses);
+	trace2_data_intmax("delta_base_cache", NULL, "evictions", evictions);
+}
+
+static void init_delta_base_cache(void)
+{
+	int i;
+
+	if (delta_base_cache_initialized)
+		return;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		hashmap_init(&delta_base_cache[i].map,
+			     delta_base_cache_hash_cmp, NULL, 0);
+		INIT_LIST_HEAD(&delta_base_cache[i].lru);
+	}
+	if (trace2_is_enabled())
+		atexit(report_delta_base_cache_stats);
+	delta_base_cache_initialized = 1;
+}
+
+void enable_delta_base_cache_locks(void)
+{
+	int i;
+
+	if (delta_base_cache_use_locks)
+		return;
+
+	/*
+	 * This is called before any other thread is started, so it is
+	 * also a safe place to set up the shards themselves.
+	 */
+	init_delta_base_cache();
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++)
+		pthread_mutex_init(&delta_base_cache[i].mutex, NULL);
+	pthread_mutex_init(&delta_base_cached_mutex, NULL);
+	delta_base_cache_use_locks = 1;
+}
+
+void disable_delta_base_cache_locks(void)
+{
+	int i;
+
+	if (!delta_base_cache_use_locks)
+		return;
+
+	delta_base_cache_use_locks = 0;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++)
+		pthread_mutex_destroy(&delta_base_cache[i].mutex);
+	pthread_mutex_destroy(&delta_base_cached_mutex);
+}
+
+/*
+ * Add "add" bytes to and remove "sub" bytes from the total size of the
+ * cache, and return the new total.
+ */
+static size_t update_delta_base_cached(size_t add, size_t sub)
+{
+	size_t ret;
+
+	if (delta_base_cache_use_locks)
+		pthread_mutex_lock(&delta_base_cached_mutex);
+	delta_base_cached += add;
+	delta_base_cached -= sub;
+	ret = delta_base_cached;
+	if (delta_base_cache_use_locks)
+		pthread_mutex_unlock(&delta_base_cached_mutex);
+	return ret;
+}
+
+static struct delta_base_cache_shard *lock_delta_base_cache_shard(
+		struct packed_git *p, off_t base_offset, unsigned int *hash)
+{
+	struct delta_base_cache_shard *shard;
+
+	init_delta_base_cache();
+
+	*hash = pack_entry_hash(p, base_offset);
+	shard = &delta_base_cache[*hash % DELTA_BASE_CACHE_SHARDS];
+	if (delta_base_cache_use_locks)
+		pthread_mutex_lock(&shard->mutex);
+	return shard;
+}
+
+static void unlock_delta_base_cache_shard(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_use_locks)
+		pthread_mutex_unlock(&shard->mutex);
+}
+
+/* The caller must hold the lock of "shard". */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   unsigned int hash,
+			   struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry entry, *e;
+	struct delta_base_cache_key key;
+
+	hashmap_entry_init(&entry, hash);
+	key.p = p;
+	key.base_offset = base_offset;
+	e = hashmap_get(&shard->map, &entry, &key);
+	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
+}
+
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	struct delta_base_cache_shard *shard;
+	unsigned int hash;
+	int ret;
+
+	shard = lock_delta_base_cache_shard(p, base_offset, &hash);
+	ret = !!get_delta_base_cache_entry(shard, hash, p, base_offset);
+	unlock_delta_base_cache_shard(shard);
+	return ret;
 }
 
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
- * should copy out any fields it wants before detaching.
+ * should copy out any fields it wants before detaching. The caller must
+ * hold the lock of "shard".
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
+	hashmap_remove(&shard->map, &ent->ent, &ent->key);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
+	update_delta_base_cached(0, ent->size);
 	free(ent);
 }
 
+/*
+ * Look up the base at "base_offset" in "p" and, if it is cached, remove
+ * it from the cache and hand its data over to the caller.
+ */
+static void *take_delta_base_cache_entry(struct packed_git *p,
+					 off_t base_offset,
+					 enum object_type *type,
+					 unsigned long *size)
+{
+	struct delta_base_cache_shard *shard;
+	struct delta_base_cache_entry *ent;
+	unsigned int hash;
+	void *data = NULL;
+
+	shard = lock_delta_base_cache_shard(p, base_offset, &hash);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		shard->hits++;
+		*type = ent->type;
+		*size = ent->size;
+		data = ent->data;
+		detach_delta_base_cache_entry(shard, ent);
+	} else {
+		shard->misses++;
+	}
+	unlock_delta_base_cache_shard(shard);
+	return data;
+}
+
 static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
+	unsigned int hash;
+	void *data = NULL;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
-		return unpack_entry(r, p, base_offset, type, base_size);
+	shard = lock_delta_base_cache_shard(p, base_offset, &hash);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		shard->hits++;
+		if (type)
+			*type = ent->type;
+		if (base_size)
+			*base_size = ent->size;
+		data = xmemdupz(ent->data, ent->size);
+	} else {
+		shard->misses++;
+	}
+	unlock_delta_base_cache_shard(shard);
 
-	if (type)
-		*type = ent->type;
-	if (base_size)
-		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	if (!data)
+		data = unpack_entry(r, p, base_offset, type, base_size);
+	return data;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static inline void release_delta_base_cache(struct delta_base_cache_shard *shard,
+					    struct delta_base_cache_entry *ent)
 {
 	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	detach_delta_base_cache_entry(shard, ent);
 }
 
 void clear_delta_base_cache(void)
+{
+	int i;
+
+	if (!delta_base_cache_initialized)
+		return;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		struct list_head *lru, *tmp;
+
+		if (delta_base_cache_use_locks)
+			pthread_mutex_lock(&shard->mutex);
+		list_for_each_safe(lru, tmp, &shard->lru) {
+			struct delta_base_cache_entry *entry =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			release_delta_base_cache(shard, entry);
+		}
+		if (delta_base_cache_use_locks)
+			pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+/*
+ * Release least-recently-used entries of "shard" until the whole cache
+ * fits into delta_base_cache_limit again. Returns 1 if it does. The
+ * caller must hold the lock of "shard".
+ */
+static int shrink_delta_base_cache_shard(struct delta_base_cache_shard *shard)
 {
 	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
+
+	list_for_each_safe(lru, tmp, &shard->lru) {
+		struct delta_base_cache_entry *f =
 			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+		if (update_delta_base_cached(0, 0) <= delta_base_cache_limit)
+			return 1;
+		release_delta_base_cache(shard, f);
+		shard->evictions++;
 	}
+	return update_delta_base_cached(0, 0) <= delta_base_cache_limit;
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
-	struct list_head *lru, *tmp;
+	unsigned int hash;
+	int fits, i;
+
+	shard = lock_delta_base_cache_shard(p, base_offset, &hash);
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
 	 * is unpacking the same object, in unpack_entry() (since its phases I
 	 * and III might run concurrently across multiple threads).
 	 */
-	if (in_delta_base_cache(p, base_offset)) {
+	if (get_delta_base_cache_entry(shard, hash, p, base_offset)) {
+		unlock_delta_base_cache_shard(shard);
 		free(base);
 		return;
 	}
 
-	delta_base_cached += base_size;
-
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
-	}
+	update_delta_base_cached(base_size, 0);
+	fits = shrink_delta_base_cache_shard(shard);
 
 	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
@@ -1504,12 +1722,29 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	list_add_tail(&ent->lru, &shard->lru);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, &ent->ent);
+	hashmap_entry_init(&ent->ent, hash);
+	hashmap_add(&shard->map, &ent->ent);
+
+	unlock_delta_base_cache_shard(shard);
+
+	/*
+	 * Our own shard did not hold enough old entries to make room, so
+	 * take them from the others. Only one shard lock is held at a
+	 * time, so this cannot deadlock against another thread doing the
+	 * same.
+	 */
+	for (i = 1; !fits && i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *other =
+			&delta_base_cache[(hash + i) % DELTA_BASE_CACHE_SHARDS];
+
+		if (delta_base_cache_use_locks)
+			pthread_mutex_lock(&other->mutex);
+		fits = shrink_delta_base_cache_shard(other);
+		if (delta_base_cache_use_locks)
+			pthread_mutex_unlock(&other->mutex);
+	}
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1697,14 +1932,9 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+
+		data = take_delta_base_cache_entry(p, curpos, &type, &size);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
@@ -1832,6 +2062,15 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		delta_data = unpack_compressed_entry(p, &w_curs, curpos, delta_size);
 
+		/*
+		 * Neither `base` (which we own until it is added to the
+		 * cache below) nor `delta_data` is reachable by other
+		 * threads, and the delta base cache has its own locking, so
+		 * let them use the object store while we reconstruct the
+		 * object.
+		 */
+		obj_read_unlock();
+
 		if (!delta_data) {
 			error("failed to unpack compressed delta "
 			      "at offset %"PRIuMAX" from %s",
@@ -1867,6 +2106,8 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		free(delta_data);
 		free(external_base);
+
+		obj_read_lock();
 	}
 
 	if (final_type)
@@ -94,6 +94,14 @@ void close_pack(struct packed_git *);
 void close_object_store(struct raw_object_store *o);
 void unuse_pack(struct pack_window **);
 void clear_delta_base_cache(void);
+
+/*
+ * Protect each shard of the delta base cache with its own mutex. This is
+ * done by enable_obj_read_lock(); the object read lock is no longer held
+ * while the cache is consulted or filled.
+ */
+void enable_delta_base_cache_locks(void);
+void disable_delta_base_cache_locks(void);
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
 /*
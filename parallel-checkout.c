@@ -15,12 +15,31 @@ struct pc_worker {
 	size_t next_item_to_complete, nr_items_to_complete;
 };
 
+/*
+ * When streaming, the items are sent to the workers in batches of this size
+ * as soon as they are enqueued. A worker is never given more than
+ * PC_STREAM_MAX_PENDING items it has not reported back yet, so that its
+ * results always fit in the pipe buffer and it never blocks on writing them
+ * while we are blocked on writing more items to it.
+ */
+#define PC_STREAM_BATCH_SIZE 16
+#define PC_STREAM_MAX_PENDING 64
+
 struct parallel_checkout {
 	enum pc_status status;
 	struct parallel_checkout_item *items; /* The parallel checkout queue. */
 	size_t nr, alloc;
 	struct progress *progress;
 	unsigned int *progress_cnt;
+
+	/* Streaming state. See init_parallel_checkout_streaming(). */
+	int streaming;
+	const struct checkout *state;
+	int num_workers, threshold;
+	struct pc_worker *workers; /* NULL until the workers are started. */
+	struct pollfd *pfds;
+	int active_workers;
+	size_t nr_sent;
 };
 
 static struct parallel_checkout parallel_checkout;
@@ -66,6 +85,33 @@ void init_parallel_checkout(void)
 	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
 }
 
+void init_parallel_checkout_streaming(const struct checkout *state,
+				      int num_workers, int threshold,
+				      struct progress *progress,
+				      unsigned int *progress_cnt)
+{
+	init_parallel_checkout();
+
+	/*
+	 * While streaming, the workers write their entries concurrently with
+	 * the entries that are checked out sequentially in the main process.
+	 * That is only safe if no two entries can end up in the same path,
+	 * which might happen on case-insensitive or normalizing filesystems.
+	 * There, the collisions must be detected and resolved after all the
+	 * sequential entries have been written, as run_parallel_checkout()
+	 * does when not streaming.
+	 */
+	if (num_workers <= 1 || ignore_case || precomposed_unicode == 1)
+		return;
+
+	parallel_checkout.streaming = 1;
+	parallel_checkout.state = state;
+	parallel_checkout.num_workers = num_workers;
+	parallel_checkout.threshold = threshold;
+	parallel_checkout.progress = progress;
+	parallel_checkout.progress_cnt = progress_cnt;
+}
+
 static void finish_parallel_checkout(void)
 {
 	if (parallel_checkout.status == PC_UNINITIALIZED)
@@ -143,6 +189,8 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 	}
 }
 
+static void stream_items(int send_all);
+
 int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca)
 {
 	struct parallel_checkout_item *pc_item;
@@ -161,6 +209,9 @@ int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca)
 	pc_item->id = parallel_checkout.nr;
 	parallel_checkout.nr++;
 
+	if (parallel_checkout.streaming)
+		stream_items(0);
+
 	return 0;
 }
 
@@ -450,13 +501,11 @@ static void send_batch(int fd, size_t start, size_t nr)
 	sigchain_pop(SIGPIPE);
 }
 
-static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
+static void start_workers(struct pc_worker *workers,
+			  const struct checkout *state, int num_workers,
+			  int stream)
 {
-	struct pc_worker *workers;
-	int i, workers_with_one_extra_item;
-	size_t base_batch_size, batch_beginning = 0;
-
-	ALLOC_ARRAY(workers, num_workers);
+	int i;
 
 	for (i = 0; i < num_workers; i++) {
 		struct child_process *cp = &workers[i].cp;
@@ -469,9 +518,21 @@ static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
 		strvec_push(&cp->args, "checkout--worker");
 		if (state->base_dir_len)
 			strvec_pushf(&cp->args, "--prefix=%s", state->base_dir);
+		if (stream)
+			strvec_push(&cp->args, "--stream");
 		if (start_command(cp))
 			die("failed to spawn checkout worker");
 	}
+}
+
+static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
+{
+	struct pc_worker *workers;
+	int i, workers_with_one_extra_item;
+	size_t base_batch_size, batch_beginning = 0;
+
+	ALLOC_ARRAY(workers, num_workers);
+	start_workers(workers, state, num_workers, 0);
 
 	base_batch_size = parallel_checkout.nr / num_workers;
 	workers_with_one_extra_item = parallel_checkout.nr % num_workers;
@@ -558,9 +619,20 @@ static void parse_and_save_result(const char *buffer, int len,
 
 	if (!worker->nr_items_to_complete)
 		BUG("received result from supposedly finished checkout worker");
-	if (res->id != worker->next_item_to_complete)
+	if (parallel_checkout.streaming) {
+		/*
+		 * Streaming workers write each batch in the order of the
+		 * blobs in the packs, so we can only check that the item
+		 * was sent and is still waiting for its result.
+		 */
+		if (res->id >= parallel_checkout.nr_sent ||
+		    parallel_checkout.items[res->id].status != PC_ITEM_PENDING)
+			BUG("unexpected item id from checkout worker (got %"PRIuMAX")",
+			    (uintmax_t)res->id);
+	} else if (res->id != worker->next_item_to_complete) {
 		BUG("unexpected item id from checkout worker (got %"PRIuMAX", exp %"PRIuMAX")",
 		    (uintmax_t)res->id, (uintmax_t)worker->next_item_to_complete);
+	}
 
 	worker->next_item_to_complete++;
 	worker->nr_items_to_complete--;
@@ -574,10 +646,59 @@ static void parse_and_save_result(const char *buffer, int len,
 		advance_progress_meter();
 }
 
-static void gather_results_from_workers(struct pc_worker *workers,
-					int num_workers)
+/*
+ * Wait up to `timeout` milliseconds (as in poll()) for results from the
+ * workers and save the ones that arrived. Return the number of workers
+ * that finished in the meantime.
+ */
+static int poll_workers(struct pc_worker *workers, struct pollfd *pfds,
+			int num_workers, int timeout)
 {
-	int i, active_workers = num_workers;
+	int i, finished = 0;
+	int nr = poll(pfds, num_workers, timeout);
+
+	if (nr < 0) {
+		if (errno == EINTR)
+			return 0;
+		die_errno("failed to poll checkout workers");
+	}
+
+	for (i = 0; i < num_workers && nr > 0; i++) {
+		struct pc_worker *worker = &workers[i];
+		struct pollfd *pfd = &pfds[i];
+
+		if (!pfd->revents)
+			continue;
+
+		if (pfd->revents & POLLIN) {
+			int len = packet_read(pfd->fd, packet_buffer,
+					      sizeof(packet_buffer), 0);
+
+			if (len < 0) {
+				BUG("packet_read() returned negative value");
+			} else if (!len) {
+				pfd->fd = -1;
+				finished++;
+			} else {
+				parse_and_save_result(packet_buffer, len,
+						      worker);
+			}
+		} else if (pfd->revents & POLLHUP) {
+			pfd->fd = -1;
+			finished++;
+		} else if (pfd->revents & (POLLNVAL | POLLERR)) {
+			die("error polling from checkout worker");
+		}
+
+		nr--;
+	}
+
+	return finished;
+}
+
+static struct pollfd *setup_pollfds(struct pc_worker *workers, int num_workers)
+{
+	int i;
 	struct pollfd *pfds;
 
 	CALLOC_ARRAY(pfds, num_workers);
@@ -585,48 +706,120 @@ static void gather_results_from_workers(struct pc_worker *workers,
 		pfds[i].fd = workers[i].cp.out;
 		pfds[i].events = POLLIN;
 	}
+	return pfds;
+}
 
-	while (active_workers) {
-		int nr = poll(pfds, num_workers, -1);
+static void gather_results_from_workers(struct pc_worker *workers,
+					int num_workers)
+{
+	int active_workers = num_workers;
+	struct pollfd *pfds = setup_pollfds(workers, num_workers);
 
-		if (nr < 0) {
-			if (errno == EINTR)
-				continue;
-			die_errno("failed to poll checkout workers");
-		}
+	while (active_workers)
+		active_workers -= poll_workers(workers, pfds, num_workers, -1);
 
-		for (i = 0; i < num_workers && nr > 0; i++) {
-			struct pc_worker *worker = &workers[i];
-			struct pollfd *pfd = &pfds[i];
-
-			if (!pfd->revents)
-				continue;
-
-			if (pfd->revents & POLLIN) {
-				int len = packet_read(pfd->fd, packet_buffer,
-						      sizeof(packet_buffer), 0);
-
-				if (len < 0) {
-					BUG("packet_read() returned negative value");
-				} else if (!len) {
-					pfd->fd = -1;
-					active_workers--;
-				} else {
-					parse_and_save_result(packet_buffer,
-							      len, worker);
-				}
-			} else if (pfd->revents & POLLHUP) {
-				pfd->fd = -1;
-				active_workers--;
-			} else if (pfd->revents & (POLLNVAL | POLLERR)) {
-				die("error polling from checkout worker");
-			}
+	free(pfds);
+}
 
-			nr--;
-		}
+/*
+ * Return the live streaming worker with the fewest items still to be
+ * written, or NULL if all of them have died.
+ */
+static struct pc_worker *least_busy_worker(void)
+{
+	struct pc_worker *best = NULL;
+	int i;
+
+	for (i = 0; i < parallel_checkout.num_workers; i++) {
+		struct pc_worker *worker = &parallel_checkout.workers[i];
+
+		if (parallel_checkout.pfds[i].fd < 0)
+			continue;
+		if (!best ||
+		    worker->nr_items_to_complete < best->nr_items_to_complete)
+			best = worker;
 	}
+	return best;
+}
 
-	free(pfds);
+static void poll_streaming_workers(int timeout)
+{
+	parallel_checkout.active_workers -=
+		poll_workers(parallel_checkout.workers, parallel_checkout.pfds,
+			     parallel_checkout.num_workers, timeout);
+}
+
+/*
+ * Send the enqueued items to the streaming workers in batches, starting
+ * the workers first if the queue has become large enough to be worth it.
+ * Unless `send_all` is set, a trailing partial batch is kept in the queue
+ * to be sent along with the next items.
+ */
+static void stream_items(int send_all)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+
+	if (!pc->workers) {
+		/*
+		 * Give each worker at least one full batch, so that small
+		 * checkouts use as many workers as before (or none at all)
+		 * and are written by run_parallel_checkout() in one go.
+		 */
+		if (pc->nr < (size_t)pc->num_workers * PC_STREAM_BATCH_SIZE ||
+		    pc->nr < pc->threshold)
+			return;
+
+		trace2_region_enter("pcheckout", "streaming", NULL);
+		CALLOC_ARRAY(pc->workers, pc->num_workers);
+		start_workers(pc->workers, pc->state, pc->num_workers, 1);
+		pc->pfds = setup_pollfds(pc->workers, pc->num_workers);
+		pc->active_workers = pc->num_workers;
+	}
+
+	while (pc->nr - pc->nr_sent >= PC_STREAM_BATCH_SIZE ||
+	       (send_all && pc->nr_sent < pc->nr)) {
+		size_t batch_size = pc->nr - pc->nr_sent;
+		struct pc_worker *worker;
+
+		if (batch_size > PC_STREAM_BATCH_SIZE)
+			batch_size = PC_STREAM_BATCH_SIZE;
+
+		/* Save whatever results are ready, without blocking. */
+		poll_streaming_workers(0);
+
+		while ((worker = least_busy_worker()) &&
+		       worker->nr_items_to_complete + batch_size > PC_STREAM_MAX_PENDING)
+			poll_streaming_workers(-1);
+		if (!worker)
+			die("all checkout workers exited before finishing");
+
+		send_batch(worker->cp.in, pc->nr_sent, batch_size);
+		worker->nr_items_to_complete += batch_size;
+		pc->nr_sent += batch_size;
+	}
+}
+
+static void finish_streaming(void)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+	int i;
+
+	stream_items(1);
+
+	/* Closing their input tells the workers that there are no more items. */
+	for (i = 0; i < pc->num_workers; i++) {
+		struct child_process *cp = &pc->workers[i].cp;
+		close(cp->in);
+		cp->in = -1;
+	}
+
+	while (pc->active_workers)
+		poll_streaming_workers(-1);
+
+	finish_workers(pc->workers, pc->num_workers);
+	FREE_AND_NULL(pc->pfds);
+	pc->workers = NULL;
+	trace2_region_leave("pcheckout", "streaming", NULL);
 }
 
 static void write_items_sequentially(struct checkout *state)
@@ -654,15 +847,22 @@ int run_parallel_checkout(struct checkout *state, int num_workers, int threshold
 	parallel_checkout.progress = progress;
 	parallel_checkout.progress_cnt = progress_cnt;
 
-	if (parallel_checkout.nr < num_workers)
-		num_workers = parallel_checkout.nr;
-
-	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
-		write_items_sequentially(state);
+	if (parallel_checkout.workers) {
+		finish_streaming();
 	} else {
-		struct pc_worker *workers = setup_workers(state, num_workers);
-		gather_results_from_workers(workers, num_workers);
-		finish_workers(workers, num_workers);
+		/* Also if the queue never grew large enough to start streaming. */
+		parallel_checkout.streaming = 0;
+
+		if (parallel_checkout.nr < num_workers)
+			num_workers = parallel_checkout.nr;
+
+		if (num_workers <= 1 || parallel_checkout.nr < threshold) {
+			write_items_sequentially(state);
+		} else {
+			struct pc_worker *workers = setup_workers(state, num_workers);
+			gather_results_from_workers(workers, num_workers);
+			finish_workers(workers, num_workers);
+		}
 	}
 
 	ret = handle_results(state);
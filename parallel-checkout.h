@@ -26,6 +26,21 @@ void get_parallel_checkout_configs(int *num_workers, int *threshold);
  */
 void init_parallel_checkout(void);
 
+/*
+ * Like init_parallel_checkout(), but once enough entries have been enqueued,
+ * start the workers and keep sending them the entries as they are enqueued,
+ * so that they are written while the caller is still going through the rest
+ * of the entries. `state`, `progress` and `progress_cnt` must stay valid
+ * until run_parallel_checkout() is called with them, which finishes the
+ * streaming and writes whatever is left. Streaming is not used when paths
+ * could collide, e.g. on case-insensitive filesystems; the entries are
+ * then only written by run_parallel_checkout(), as usual.
+ */
+void init_parallel_checkout_streaming(const struct checkout *state,
+				      int num_workers, int threshold,
+				      struct progress *progress,
+				      unsigned int *progress_cnt);
+
 /*
  * Return -1 if parallel checkout is currently not accepting entries or if the
  * entry is not eligible for parallel checkout. Otherwise, enqueue the entry
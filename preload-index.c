@@ -5,6 +5,7 @@
 #include "pathspec.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "config.h"
 #include "progress.h"
 #include "thread-utils.h"
@@ -97,6 +98,71 @@ static void *preload_thread(void *_data)
 	return NULL;
 }
 
+/*
+ * Ask the fsmonitor daemon for the lstat() data of all the entries that
+ * the threads below would lstat(), and use it to mark the unchanged ones
+ * up-to-date.  Returns -1 if the daemon did not answer, in which case
+ * the caller should lstat() the entries itself.
+ */
+static int preload_from_stat_cache(struct index_state *index,
+				   const struct pathspec *pathspec)
+{
+	struct cache_entry **ces = NULL;
+	const char **paths = NULL;
+	struct fsmonitor_stat_cache_item *items;
+	size_t i, nr = 0, alloc = 0;
+	int ret = 0;
+
+	for (i = 0; i < index->cache_nr; i++) {
+		struct cache_entry *ce = index->cache[i];
+
+		if (ce_stage(ce))
+			continue;
+		if (S_ISGITLINK(ce->ce_mode))
+			continue;
+		if (ce_uptodate(ce))
+			continue;
+		if (ce_skip_worktree(ce))
+			continue;
+		if (ce->ce_flags & CE_FSMONITOR_VALID)
+			continue;
+		if (pathspec && !ce_path_match(index, ce, pathspec, NULL))
+			continue;
+		if (has_symlink_leading_path(ce->name, ce_namelen(ce)))
+			continue;
+
+		ALLOC_GROW(ces, nr + 1, alloc);
+		ces[nr++] = ce;
+	}
+	if (!nr)
+		goto done;
+
+	ALLOC_ARRAY(paths, nr);
+	for (i = 0; i < nr; i++)
+		paths[i] = ces[i]->name;
+	ALLOC_ARRAY(items, nr);
+
+	ret = fsmonitor_ipc__stat_cache_query(paths, nr, items);
+	for (i = 0; !ret && i < nr; i++) {
+		struct cache_entry *ce = ces[i];
+
+		if (items[i].err)
+			continue;
+		if (ie_match_stat(index, ce, &items[i].st,
+				  CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+			continue;
+		ce_mark_uptodate(ce);
+		mark_fsmonitor_valid(index, ce);
+	}
+
+	free(items);
+	free(paths);
+done:
+	trace2_data_intmax("index", NULL, "preload/stat_cache", ret ? -1 : nr);
+	free(ces);
+	return ret;
+}
+
 void preload_index(struct index_state *index,
 		   const struct pathspec *pathspec,
 		   unsigned int refresh_flags)
@@ -118,6 +184,14 @@ void preload_index(struct index_state *index,
 
 	trace2_region_enter("index", "preload", NULL);
 
+	if (the_repository->gitdir)
+		prepare_repo_settings(the_repository);
+	if (the_repository->settings.core_fsmonitor_stat_cache &&
+	    !preload_from_stat_cache(index, pathspec)) {
+		trace2_region_leave("index", "preload", NULL);
+		return;
+	}
+
 	trace_performance_enter();
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
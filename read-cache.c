@@ -48,6 +48,7 @@
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
 #define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
+#define CACHE_EXT_UNTRACKED_LINK 0x554E544C /* "UNTL" */
 #define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
@@ -1860,6 +1861,11 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_UNTRACKED:
 		istate->untracked = read_untracked_extension(data, sz);
 		break;
+	case CACHE_EXT_UNTRACKED_LINK:
+		/* read lazily by prepare_untracked_cache() */
+		if (sz == the_hash_algo->rawsz)
+			oidread(&istate->untracked_oid, (const unsigned char *)data);
+		break;
 	case CACHE_EXT_FSMONITOR:
 		read_fsmonitor_extension(istate, data, sz);
 		break;
@@ -2175,6 +2181,7 @@ struct load_cache_entries_thread_data
 	int offset;
 	const char *mmap;
 	struct index_entry_offset_table *ieot;
+	struct cache_entry **previous_ce; /* v4 name preceding each ieot block */
 	int ieot_start;		/* starting index into the ieot array */
 	int ieot_blocks;	/* count of ieot entries to process */
 	unsigned long consumed;	/* return # of bytes in index file processed */
@@ -2192,14 +2199,99 @@ static void *load_cache_entries_thread(void *_data)
 	/* iterate across all ieot blocks assigned to this thread */
 	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
 		p->consumed += load_cache_entry_block(p->istate, p->ce_mem_pool,
-			p->offset, p->ieot->entries[i].nr, p->mmap, p->ieot->entries[i].offset, NULL);
+			p->offset, p->ieot->entries[i].nr, p->mmap, p->ieot->entries[i].offset,
+			p->previous_ce ? p->previous_ce[i] : NULL);
 		p->offset += p->ieot->entries[i].nr;
 	}
 	return NULL;
 }
 
+/*
+ * Without an IEOT extension we do not know where each thread should
+ * start loading, so walk the on-disk entries once to split them into
+ * "nr_blocks" blocks of about the same size.  This only decodes the
+ * name lengths, which is much cheaper than allocating and filling in
+ * the cache entries, and that is the part the threads share.
+ *
+ * A v4 entry only stores how its name differs from the previous one,
+ * so for a v4 index we also record in "previous_ce" a transient entry
+ * holding the name that precedes each block.
+ */
+static struct index_entry_offset_table *scan_cache_entry_offsets(struct index_state *istate,
+		const char *mmap, size_t mmap_size, unsigned long src_offset,
+		int nr_blocks, struct cache_entry ***previous_ce)
+{
+	struct index_entry_offset_table *ieot;
+	struct strbuf previous_name = STRBUF_INIT;
+	const unsigned hashsz = the_hash_algo->rawsz;
+	const size_t end = mmap_size - hashsz;
+	int i, block = 0, block_nr = DIV_ROUND_UP(istate->cache_nr, nr_blocks);
+
+	nr_blocks = DIV_ROUND_UP(istate->cache_nr, block_nr);
+	ieot = xcalloc(1, st_add(sizeof(*ieot),
+				 st_mult(nr_blocks, sizeof(struct index_entry_offset))));
+	ieot->nr = nr_blocks;
+	if (istate->version == 4)
+		CALLOC_ARRAY(*previous_ce, nr_blocks);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct ondisk_cache_entry *ondisk;
+		const uint16_t *flagsp;
+		const char *name;
+		unsigned int flags;
+		size_t len;
+
+		if (i == block * block_nr) {
+			ieot->entries[block].offset = src_offset;
+			ieot->entries[block].nr = i + block_nr > istate->cache_nr ?
+				istate->cache_nr - i : block_nr;
+			if (istate->version == 4 && i) {
+				struct cache_entry *ce;
+
+				ce = make_empty_transient_cache_entry(previous_name.len, NULL);
+				ce->ce_namelen = previous_name.len;
+				memcpy(ce->name, previous_name.buf, previous_name.len + 1);
+				(*previous_ce)[block] = ce;
+			}
+			block++;
+		}
+
+		if (src_offset + offsetof(struct ondisk_cache_entry, data) +
+		    ondisk_data_size(CE_EXTENDED, 0) > end)
+			die(_("index file corrupt"));
+		ondisk = (const struct ondisk_cache_entry *)(mmap + src_offset);
+		flagsp = (const uint16_t *)(ondisk->data + hashsz);
+		flags = get_be16(flagsp);
+		name = (const char *)(flagsp + ((flags & CE_EXTENDED) ? 2 : 1));
+
+		if (istate->version == 4) {
+			const unsigned char *cp = (const unsigned char *)name;
+			size_t strip_len = decode_varint(&cp);
+
+			if (previous_name.len < strip_len)
+				die(_("malformed name field in the index, near path '%s'"),
+				    previous_name.buf);
+			strbuf_setlen(&previous_name, previous_name.len - strip_len);
+			len = strlen((const char *)cp);
+			strbuf_add(&previous_name, cp, len);
+			src_offset = (const char *)cp - mmap + len + 1;
+		} else {
+			len = flags & CE_NAMEMASK;
+			if (len == CE_NAMEMASK)
+				len = strlen(name);
+			src_offset += ondisk_cache_entry_size(ondisk_data_size(flags, len));
+		}
+		if (src_offset > end)
+			die(_("index file corrupt"));
+	}
+
+	strbuf_release(&previous_name);
+	return ieot;
+}
+
 static unsigned long load_cache_entries_threaded(struct index_state *istate, const char *mmap, size_t mmap_size,
-						 int nr_threads, struct index_entry_offset_table *ieot)
+						 int nr_threads, struct index_entry_offset_table *ieot,
+						 struct cache_entry **previous_ce)
 {
 	int i, offset, ieot_blocks, ieot_start, err;
 	struct load_cache_entries_thread_data *data;
@@ -2230,6 +2322,7 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 		p->offset = offset;
 		p->mmap = mmap;
 		p->ieot = ieot;
+		p->previous_ce = previous_ce;
 		p->ieot_start = ieot_start;
 		p->ieot_blocks = ieot_blocks;
 
@@ -2296,8 +2389,9 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	size_t mmap_size;
 	struct load_index_extensions p;
 	size_t extension_offset = 0;
-	int nr_threads, cpus;
+	int nr_threads, cpus, i;
 	struct index_entry_offset_table *ieot = NULL;
+	struct cache_entry **previous_ce = NULL;
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -2378,8 +2472,22 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	if (extension_offset && nr_threads > 1)
 		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
 
+	/* Otherwise find the blocks by walking the entries. */
+	if (!ieot && nr_threads > 1 && istate->cache_nr > 1) {
+		ieot = scan_cache_entry_offsets(istate, mmap, mmap_size, src_offset,
+						nr_threads, &previous_ce);
+		trace2_data_intmax("index", the_repository, "read/scanned_blocks",
+				   ieot->nr);
+	}
+
 	if (ieot) {
-		src_offset += load_cache_entries_threaded(istate, mmap, mmap_size, nr_threads, ieot);
+		src_offset += load_cache_entries_threaded(istate, mmap, mmap_size,
+							  nr_threads, ieot, previous_ce);
+		if (previous_ce) {
+			for (i = 0; i < ieot->nr; i++)
+				discard_cache_entry(previous_ce[i]);
+			free(previous_ce);
+		}
 		free(ieot);
 	} else {
 		src_offset += load_all_cache_entries(istate, mmap, mmap_size, src_offset);
@@ -2540,6 +2648,7 @@ int discard_index(struct index_state *istate)
 	discard_split_index(istate);
 	free_untracked_cache(istate->untracked);
 	istate->untracked = NULL;
+	oidclr(&istate->untracked_oid);
 
 	if (istate->ce_mem_pool) {
 		mem_pool_discard(istate->ce_mem_pool, should_validate_cache_entries());
@@ -2725,8 +2834,8 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
-			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+static void ce_write_entry(struct strbuf *out, struct cache_entry *ce,
+			   struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
 {
 	int size;
 	unsigned int saved_namelen;
@@ -2744,9 +2853,9 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, ce->name, len);
-		hashwrite(f, padding, align_padding_size(size, len));
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, ce->name, len);
+		strbuf_add(out, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2760,10 +2869,10 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, to_remove_vi, prefix_size);
-		hashwrite(f, ce->name + common, ce_namelen(ce) - common);
-		hashwrite(f, padding, 1);
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, to_remove_vi, prefix_size);
+		strbuf_add(out, ce->name + common, ce_namelen(ce) - common);
+		strbuf_add(out, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2772,8 +2881,6 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 		ce->ce_namelen = saved_namelen;
 		ce->ce_flags &= ~CE_STRIP_NAME;
 	}
-
-	return 0;
 }
 
 /*
@@ -2874,6 +2981,133 @@ static int record_ieot(void)
 	return !git_config_get_index_threads(&val) && val != 1;
 }
 
+/*
+ * The cache entries are written out in chunks, which worker threads
+ * can format in parallel while the main thread hashes and writes the
+ * finished ones in order.
+ *
+ * With index v4, each name is compressed against the one written
+ * before it, so every chunk remembers which entry that is, and starts
+ * from the very state the serial loop would have had. The output is
+ * therefore the same whatever the number of threads.
+ */
+#define WRITE_CHUNK_ENTRIES (8192)
+
+struct write_chunk {
+	int start, end;		/* range of istate->cache to write */
+	int prev;		/* v4: entry written before `start`, or -1 */
+	int prev_len;		/* v4: length of its name as written */
+	unsigned ieot_start:1;	/* chunk starts a new IEOT block */
+	unsigned done:1;
+	int nr;			/* number of entries written */
+	struct strbuf out;
+};
+
+struct write_entries_data {
+	struct index_state *istate;
+	int version4;
+	struct write_chunk *chunks;
+	int chunks_nr, chunks_alloc;
+
+	/* threaded writes only */
+	int next;		/* next chunk to format */
+	int consumed;		/* number of chunks written out */
+	int window;		/* max number of chunks formatted ahead */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+};
+
+static void write_chunk_entries(struct write_entries_data *d,
+				struct write_chunk *c)
+{
+	struct cache_entry **cache = d->istate->cache;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name = NULL;
+	struct ondisk_cache_entry ondisk;
+	int i;
+
+	if (d->version4) {
+		previous_name = &previous_name_buf;
+		if (c->ieot_start)
+			/*
+			 * Matches the invalid first byte the serial loop
+			 * puts there at IEOT boundaries: nothing is in
+			 * common with the previous entry.
+			 */
+			strbuf_addchars(previous_name, 0, c->prev_len);
+		else if (c->prev >= 0)
+			strbuf_add(previous_name, cache[c->prev]->name,
+				   c->prev_len);
+	}
+
+	for (i = c->start; i < c->end; i++) {
+		if (cache[i]->ce_flags & CE_REMOVE)
+			continue;
+		ce_write_entry(&c->out, cache[i], previous_name, &ondisk);
+		c->nr++;
+	}
+
+	strbuf_release(&previous_name_buf);
+}
+
+static void *write_entries_thread(void *_data)
+{
+	struct write_entries_data *d = _data;
+
+	pthread_mutex_lock(&d->mutex);
+	while (d->next < d->chunks_nr) {
+		struct write_chunk *c;
+
+		/* Do not run too far ahead of the writer. */
+		if (d->next >= d->consumed + d->window) {
+			pthread_cond_wait(&d->work_cond, &d->mutex);
+			continue;
+		}
+
+		c = &d->chunks[d->next++];
+		pthread_mutex_unlock(&d->mutex);
+
+		write_chunk_entries(d, c);
+
+		pthread_mutex_lock(&d->mutex);
+		c->done = 1;
+		pthread_cond_signal(&d->done_cond);
+	}
+	pthread_mutex_unlock(&d->mutex);
+
+	return NULL;
+}
+
+static struct write_chunk *add_write_chunk(struct write_entries_data *d,
+					   int start, int prev, int prev_len)
+{
+	struct write_chunk *c;
+
+	if (d->chunks_nr)
+		d->chunks[d->chunks_nr - 1].end = start;
+
+	ALLOC_GROW(d->chunks, d->chunks_nr + 1, d->chunks_alloc);
+	c = &d->chunks[d->chunks_nr++];
+	memset(c, 0, sizeof(*c));
+	c->start = c->end = start;
+	c->prev = prev;
+	c->prev_len = prev_len;
+	strbuf_init(&c->out, 0);
+	return c;
+}
+
+static int write_untracked_cache_file(struct index_state *istate);
+
+static int split_untracked_cache(struct index_state *istate)
+{
+	if (!istate->untracked && is_null_oid(&istate->untracked_oid))
+		return 0;
+	if (!the_repository->gitdir)
+		return 0;
+	prepare_repo_settings(the_repository);
+	return the_repository->settings.core_split_untracked_cache;
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2892,14 +3126,15 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct cache_entry **cache = istate->cache;
 	int entries = istate->cache_nr;
 	struct stat st;
-	struct ondisk_cache_entry ondisk;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 	int drop_cache_tree = istate->drop_cache_tree;
 	off_t offset;
 	int csum_fsync_flag;
 	int ieot_entries = 1;
 	struct index_entry_offset_table *ieot = NULL;
-	int nr, nr_threads;
+	int nr, nr_threads, write_threads;
+	struct write_entries_data wd = { .istate = istate };
+	int chunk_entries, prev, prev_len;
+	pthread_t *threads = NULL;
 
 	f = hashfd(tempfile->fd, tempfile->filename.buf);
 
@@ -2963,10 +3198,19 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		}
 	}
 
-	offset = hashfile_total(f);
-
-	nr = 0;
-	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+	/*
+	 * Settle everything that needs to look outside of the entries
+	 * themselves first, and cut the entries into chunks that can
+	 * then be formatted independently.
+	 */
+	wd.version4 = hdr_version == 4;
+	chunk_entries = git_env_ulong("GIT_TEST_INDEX_WRITE_CHUNK",
+				      WRITE_CHUNK_ENTRIES);
+	if (chunk_entries < 1)
+		chunk_entries = 1;
+	prev = -1;
+	prev_len = 0;
+	add_write_chunk(&wd, 0, prev, prev_len);
 
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
@@ -2987,39 +3231,112 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 
 			drop_cache_tree = 1;
 		}
-		if (ieot && i && (i % ieot_entries == 0)) {
+		if (err)
+			break;
+
+		/*
+		 * If we have a V4 index, a new IEOT block must have
+		 * nothing in common with the previous entry.
+		 */
+		if (ieot && i && (i % ieot_entries == 0))
+			add_write_chunk(&wd, i, prev, prev_len)->ieot_start = 1;
+		else if (i - wd.chunks[wd.chunks_nr - 1].start >= chunk_entries)
+			add_write_chunk(&wd, i, prev, prev_len);
+
+		prev = i;
+		prev_len = (ce->ce_flags & CE_STRIP_NAME) ? 0 : ce_namelen(ce);
+	}
+	wd.chunks[wd.chunks_nr - 1].end = entries;
+
+	if (err) {
+		for (i = 0; i < wd.chunks_nr; i++)
+			strbuf_release(&wd.chunks[i].out);
+		free(wd.chunks);
+		free(ieot);
+		return err;
+	}
+
+	write_threads = nr_threads;
+	if (!write_threads) {
+		write_threads = istate->cache_nr / THREAD_COST;
+		if (write_threads > online_cpus())
+			write_threads = online_cpus();
+	}
+	if (write_threads > wd.chunks_nr)
+		write_threads = wd.chunks_nr;
+	if (!HAVE_THREADS || write_threads < 2)
+		write_threads = 0;
+
+	if (write_threads) {
+		wd.window = 4 * write_threads;
+		pthread_mutex_init(&wd.mutex, NULL);
+		pthread_cond_init(&wd.work_cond, NULL);
+		pthread_cond_init(&wd.done_cond, NULL);
+		CALLOC_ARRAY(threads, write_threads);
+		for (i = 0; i < write_threads; i++) {
+			int ret = pthread_create(&threads[i], NULL,
+						 write_entries_thread, &wd);
+			if (ret)
+				die(_("unable to create write_entries thread: %s"),
+				    strerror(ret));
+		}
+		trace2_data_intmax("index", the_repository, "write/threads",
+				   write_threads);
+	}
+
+	offset = hashfile_total(f);
+	nr = 0;
+
+	for (i = 0; i < wd.chunks_nr; i++) {
+		struct write_chunk *c = &wd.chunks[i];
+
+		if (write_threads) {
+			pthread_mutex_lock(&wd.mutex);
+			while (!c->done)
+				pthread_cond_wait(&wd.done_cond, &wd.mutex);
+			pthread_mutex_unlock(&wd.mutex);
+		} else {
+			write_chunk_entries(&wd, c);
+		}
+
+		if (c->ieot_start) {
 			ieot->entries[ieot->nr].nr = nr;
 			ieot->entries[ieot->nr].offset = offset;
 			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
 			nr = 0;
 
 			offset = hashfile_total(f);
 		}
-		if (ce_write_entry(f, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
-
-		if (err)
-			break;
-		nr++;
+		hashwrite(f, c->out.buf, c->out.len);
+		strbuf_release(&c->out);
+		nr += c->nr;
+
+		if (write_threads) {
+			pthread_mutex_lock(&wd.mutex);
+			wd.consumed = i + 1;
+			pthread_cond_broadcast(&wd.work_cond);
+			pthread_mutex_unlock(&wd.mutex);
+		}
 	}
 	if (ieot && nr) {
 		ieot->entries[ieot->nr].nr = nr;
 		ieot->entries[ieot->nr].offset = offset;
 		ieot->nr++;
 	}
-	strbuf_release(&previous_name_buf);
 
-	if (err) {
-		free(ieot);
-		return err;
+	if (write_threads) {
+		for (i = 0; i < write_threads; i++) {
+			int ret = pthread_join(threads[i], NULL);
+			if (ret)
+				die(_("unable to join write_entries thread: %s"),
+				    strerror(ret));
+		}
+		free(threads);
+		pthread_mutex_destroy(&wd.mutex);
+		pthread_cond_destroy(&wd.work_cond);
+		pthread_cond_destroy(&wd.done_cond);
 	}
+	free(wd.chunks);
 
 	offset = hashfile_total(f);
 
@@ -3087,7 +3404,16 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		if (err)
 			return -1;
 	}
-	if (!strip_extensions && istate->untracked) {
+	if (!strip_extensions && !split_untracked_cache(istate))
+		prepare_untracked_cache(istate); /* to write it inline */
+	if (!strip_extensions && split_untracked_cache(istate) &&
+	    !write_untracked_cache_file(istate)) {
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_UNTRACKED_LINK,
+					     the_hash_algo->rawsz) < 0;
+		hashwrite(f, istate->untracked_oid.hash, the_hash_algo->rawsz);
+		if (err)
+			return -1;
+	} else if (!strip_extensions && istate->untracked) {
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
@@ -3259,7 +3585,7 @@ static int should_delete_shared_index(const char *shared_index_path)
 	return 1;
 }
 
-static int clean_shared_index_files(const char *current_hex)
+static int clean_shared_index_files(const char *prefix, const char *current_hex)
 {
 	struct dirent *de;
 	DIR *dir = opendir(get_git_dir());
@@ -3270,7 +3596,7 @@ static int clean_shared_index_files(const char *current_hex)
 	while ((de = readdir(dir)) != NULL) {
 		const char *sha1_hex;
 		const char *shared_index_path;
-		if (!skip_prefix(de->d_name, "sharedindex.", &sha1_hex))
+		if (!skip_prefix(de->d_name, prefix, &sha1_hex))
 			continue;
 		if (!strcmp(sha1_hex, current_hex))
 			continue;
@@ -3313,12 +3639,75 @@ static int write_shared_index(struct index_state *istate,
 			      git_path("sharedindex.%s", oid_to_hex(&si->base->oid)));
 	if (!ret) {
 		oidcpy(&si->base_oid, &si->base->oid);
-		clean_shared_index_files(oid_to_hex(&si->base->oid));
+		clean_shared_index_files("sharedindex.",
+					 oid_to_hex(&si->base->oid));
 	}
 
 	return ret;
 }
 
+/*
+ * Store the untracked cache in $GIT_DIR/untracked.<hash>, named after
+ * the hash of its contents, so that an unchanged cache is not written
+ * again. Files that are no longer used expire like shared indexes.
+ * On success, istate->untracked_oid names the file.
+ */
+static int write_untracked_cache_file(struct index_state *istate)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct tempfile *temp;
+	struct object_id oid;
+	git_hash_ctx c;
+	char *path;
+	int ret = 0;
+
+	/* not read since the index was, so it is still in its file */
+	if (!istate->untracked) {
+		path = git_pathdup("untracked.%s",
+				   oid_to_hex(&istate->untracked_oid));
+		if (!check_and_freshen_file(path, 1)) {
+			oidclr(&istate->untracked_oid);
+			ret = -1;
+		}
+		free(path);
+		return ret;
+	}
+
+	write_untracked_extension(&sb, istate->untracked);
+	the_hash_algo->init_fn(&c);
+	the_hash_algo->update_fn(&c, sb.buf, sb.len);
+	the_hash_algo->final_oid_fn(&oid, &c);
+
+	path = git_pathdup("untracked.%s", oid_to_hex(&oid));
+	if (check_and_freshen_file(path, 1))
+		goto done;
+
+	/* Same initial permissions as the main .git/index file */
+	temp = mks_tempfile_sm(git_path("untracked_XXXXXX"), 0, 0666);
+	if (!temp) {
+		ret = error_errno(_("unable to create temporary untracked cache file"));
+		goto done;
+	}
+	if (write_in_full(get_tempfile_fd(temp), sb.buf, sb.len) < 0 ||
+	    write_in_full(get_tempfile_fd(temp), oid.hash,
+			  the_hash_algo->rawsz) < 0 ||
+	    adjust_shared_perm(get_tempfile_path(temp)) ||
+	    rename_tempfile(&temp, path)) {
+		ret = error_errno(_("unable to write untracked cache file '%s'"),
+				  path);
+		delete_tempfile(&temp);
+		goto done;
+	}
+	clean_shared_index_files("untracked.", oid_to_hex(&oid));
+
+done:
+	if (!ret)
+		oidcpy(&istate->untracked_oid, &oid);
+	free(path);
+	strbuf_release(&sb);
+	return ret;
+}
+
 static const int default_max_percent_split_change = 20;
 
 static int too_many_not_shared_entries(struct index_state *istate)
@@ -3565,6 +3954,8 @@ void move_index_extensions(struct index_state *dst, struct index_state *src)
 {
 	dst->untracked = src->untracked;
 	src->untracked = NULL;
+	oidcpy(&dst->untracked_oid, &src->untracked_oid);
+	oidclr(&src->untracked_oid);
 	dst->cache_tree = src->cache_tree;
 	src->cache_tree = NULL;
 }
@@ -119,6 +119,12 @@ int is_branch(const char *refname);
 
 int refs_init_db(struct strbuf *err);
 
+/*
+ * Return true if `name` is the name of a known reference storage
+ * backend, e.g. "files" or "reftable".
+ */
+int ref_storage_backend_exists(const char *name);
+
 /*
  * Return the peeled value of the oid currently being iterated via
  * for_each_ref(), etc. This is equivalent to calling:
@@ -0,0 +1,2188 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "../iterator.h"
+#include "../object.h"
+#include "../chdir-notify.h"
+#include "../strmap.h"
+#include "../dir.h"
+#include "../worktree.h"
+#include "../reftable/reftable-error.h"
+#include "../reftable/reftable-iterator.h"
+#include "../reftable/reftable-merged.h"
+#include "../reftable/reftable-record.h"
+#include "../reftable/reftable-stack.h"
+
+/*
+ * Used as a flag in ref_update::flags when the reference should be
+ * updated as part of a symref update of HEAD, so that we do not try to
+ * add another reflog update for HEAD (see split_head_update()).
+ */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+/*
+ * A single stack of tables, together with the directory it lives in.
+ */
+struct reftable_backend {
+	struct reftable_stack *stack;
+	char *dir;
+};
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitcommondir;
+
+	/*
+	 * The stack holding all shared references, which lives in
+	 * "$GIT_COMMON_DIR/reftable".
+	 */
+	struct reftable_backend main_backend;
+
+	/*
+	 * The stack holding per-worktree references and pseudorefs,
+	 * which lives in "$GIT_DIR/reftable". This points to
+	 * `main_backend` unless this store belongs to a linked worktree.
+	 */
+	struct reftable_backend *worktree_backend;
+
+	/*
+	 * Stacks of other worktrees, opened on demand when accessing
+	 * "worktrees/<id>/<pseudoref>". Keyed by the stack directory.
+	 */
+	struct strmap worktree_backends;
+
+	struct reftable_write_options write_options;
+};
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's
+ * store_flags to ensure the ref_store has all required capabilities.
+ * "caller" is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static void reftable_backend_init(struct reftable_backend *be,
+				  const char *dir,
+				  struct reftable_write_options opts)
+{
+	int ret;
+
+	be->dir = xstrdup(dir);
+	ret = reftable_new_stack(&be->stack, be->dir, opts);
+	if (ret)
+		die(_("unable to open reftable stack '%s': %s"),
+		    be->dir, reftable_error_str(ret));
+}
+
+static struct ref_store *reftable_ref_store_create(struct repository *repo,
+						   const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+	mode_t mask;
+
+	base_ref_store_init(ref_store, repo, gitdir, &refs_be_reftable);
+	refs->store_flags = flags;
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+	strmap_init(&refs->worktree_backends);
+
+	mask = umask(0);
+	umask(mask);
+	refs->write_options.hash_id = repo->hash_algo->format_id;
+	refs->write_options.default_permissions = calc_shared_perm(0666 & ~mask);
+	/*
+	 * We do our own refname and D/F conflict checks, and reflog
+	 * messages reach us already normalized.
+	 */
+	refs->write_options.skip_name_check = 1;
+	refs->write_options.exact_log_message = 1;
+
+	/*
+	 * The stacks remember their directories, so make them absolute
+	 * to be immune to chdir().
+	 */
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	strbuf_realpath_forgiving(&sb, sb.buf, 1);
+	reftable_backend_init(&refs->main_backend, sb.buf, refs->write_options);
+
+	if (strcmp(gitdir, refs->gitcommondir)) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", gitdir);
+		strbuf_realpath_forgiving(&sb, sb.buf, 1);
+		CALLOC_ARRAY(refs->worktree_backend, 1);
+		reftable_backend_init(refs->worktree_backend, sb.buf,
+				      refs->write_options);
+	} else {
+		refs->worktree_backend = &refs->main_backend;
+	}
+	strbuf_release(&sb);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->base.gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	return ref_store;
+}
+
+/*
+ * Return the stack that `refname` is stored in. If `stack_refname` is
+ * not NULL, it is set to the name of the reference inside that stack,
+ * which only differs from `refname` for "main-worktree/" and
+ * "worktrees/<id>/" pseudorefs.
+ */
+static struct reftable_backend *backend_for(struct reftable_ref_store *refs,
+					    const char *refname,
+					    const char **stack_refname)
+{
+	const char *wtname;
+	int wtname_len;
+	struct reftable_backend *be;
+	struct strbuf dir = STRBUF_INIT;
+
+	if (stack_refname)
+		*stack_refname = refname;
+
+	switch (ref_type(refname)) {
+	case REF_TYPE_PER_WORKTREE:
+	case REF_TYPE_PSEUDOREF:
+		return refs->worktree_backend;
+	case REF_TYPE_MAIN_PSEUDOREF:
+	case REF_TYPE_OTHER_PSEUDOREF:
+		if (parse_worktree_ref(refname, &wtname, &wtname_len,
+				       stack_refname))
+			BUG("refname %s is not an other-worktree ref", refname);
+		if (!wtname)
+			return &refs->main_backend;
+		break;
+	default:
+		return &refs->main_backend;
+	}
+
+	strbuf_addf(&dir, "%s/worktrees/%.*s/reftable", refs->gitcommondir,
+		    wtname_len, wtname);
+	strbuf_realpath_forgiving(&dir, dir.buf, 1);
+
+	if (!fspathcmp(dir.buf, refs->worktree_backend->dir)) {
+		be = refs->worktree_backend;
+	} else {
+		be = strmap_get(&refs->worktree_backends, dir.buf);
+		if (!be) {
+			CALLOC_ARRAY(be, 1);
+			reftable_backend_init(be, dir.buf, refs->write_options);
+			strmap_put(&refs->worktree_backends, dir.buf, be);
+		}
+	}
+
+	strbuf_release(&dir);
+	return be;
+}
+
+/*
+ * Returns true if `refname` is stored in the per-worktree stack
+ * rather than the shared one.
+ */
+static int is_worktree_ref(const char *refname)
+{
+	enum ref_type type = ref_type(refname);
+
+	return type == REF_TYPE_PER_WORKTREE || type == REF_TYPE_PSEUDOREF;
+}
+
+static int reload_backend(struct reftable_backend *be, struct strbuf *err)
+{
+	int ret = reftable_stack_reload(be->stack);
+
+	if (!ret)
+		return 0;
+	if (err)
+		strbuf_addf(err, _("unable to reload reftable stack '%s': %s"),
+			    be->dir, reftable_error_str(ret));
+	else
+		error(_("unable to reload reftable stack '%s': %s"),
+		      be->dir, reftable_error_str(ret));
+	return -1;
+}
+
+/*
+ * Read `refname` from `stack` as it is currently loaded. Returns 0 if
+ * the reference was found, a positive value if it does not exist and
+ * a negative value on error.
+ */
+static int read_ref_from_stack(struct reftable_stack *stack,
+			       const char *refname,
+			       struct object_id *oid,
+			       struct strbuf *referent,
+			       unsigned int *type)
+{
+	struct reftable_ref_record ref = { NULL };
+	int ret;
+
+	ret = reftable_stack_read_ref(stack, refname, &ref);
+	if (ret)
+		goto done;
+
+	switch (ref.value_type) {
+	case REFTABLE_REF_SYMREF:
+		strbuf_reset(referent);
+		strbuf_addstr(referent, ref.value.symref);
+		*type |= REF_ISSYMREF;
+		break;
+	case REFTABLE_REF_VAL1:
+	case REFTABLE_REF_VAL2:
+		oidread(oid, reftable_ref_record_val1(&ref));
+		break;
+	default:
+		BUG("unhandled reftable value type %d", ref.value_type);
+	}
+
+done:
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type,
+				 int *failure_errno)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_backend *be = backend_for(refs, refname, &refname);
+	int ret;
+
+	*type = 0;
+	if (reload_backend(be, NULL)) {
+		*failure_errno = EIO;
+		return -1;
+	}
+
+	ret = read_ref_from_stack(be->stack, refname, oid, referent, type);
+	if (ret) {
+		*failure_errno = ret > 0 ? ENOENT : EIO;
+		return -1;
+	}
+	return 0;
+}
+
+static int reftable_read_symbolic_ref(struct ref_store *ref_store,
+				      const char *refname,
+				      struct strbuf *referent)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_symbolic_ref");
+	struct reftable_backend *be = backend_for(refs, refname, &refname);
+	struct reftable_ref_record ref = { NULL };
+	int ret;
+
+	if (reload_backend(be, NULL))
+		return -1;
+
+	ret = reftable_stack_read_ref(be->stack, refname, &ref);
+	if (!ret && ref.value_type == REFTABLE_REF_SYMREF)
+		strbuf_addstr(referent, ref.value.symref);
+	else
+		ret = -1;
+
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+/*
+ * Returns true if `stack` has at least one reflog entry (including
+ * the marker written by create_reflog()) for `refname`.
+ */
+static int stack_has_log(struct reftable_stack *stack, const char *refname)
+{
+	struct reftable_log_record log = { NULL };
+	int ret = reftable_stack_read_log(stack, refname, &log);
+
+	reftable_log_record_release(&log);
+	return !ret;
+}
+
+/*
+ * Read all reflog entries of `refname`, newest first. Returns 0 on
+ * success and a negative reftable error code otherwise.
+ */
+static int read_logs(struct reftable_stack *stack, const char *refname,
+		     struct reftable_log_record **logs, size_t *logs_nr)
+{
+	struct reftable_merged_table *mt = reftable_stack_merged_table(stack);
+	struct reftable_iterator it = { NULL };
+	size_t logs_alloc = 0;
+	int ret;
+
+	*logs = NULL;
+	*logs_nr = 0;
+
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret) {
+		struct reftable_log_record log = { NULL };
+
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret || strcmp(log.refname, refname)) {
+			reftable_log_record_release(&log);
+			break;
+		}
+
+		ALLOC_GROW(*logs, *logs_nr + 1, logs_alloc);
+		(*logs)[(*logs_nr)++] = log;
+	}
+
+	reftable_iterator_destroy(&it);
+	return ret < 0 ? ret : 0;
+}
+
+static void free_logs(struct reftable_log_record *logs, size_t logs_nr)
+{
+	size_t i;
+
+	for (i = 0; i < logs_nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+}
+
+/*
+ * The reftable format has no notion of an empty reflog, so
+ * create_reflog() writes an entry with null old and new values to mark
+ * the reflog as existing. Such entries are never shown to callers.
+ */
+static int is_log_marker(const struct reftable_log_record *log)
+{
+	return hasheq(log->value.update.old_hash, null_oid()->hash) &&
+	       hasheq(log->value.update.new_hash, null_oid()->hash);
+}
+
+static int yield_log_record(const struct reftable_log_record *log,
+			    each_reflog_ent_fn fn, void *cb_data)
+{
+	struct object_id old_oid, new_oid;
+	struct strbuf committer = STRBUF_INIT;
+	struct strbuf msg = STRBUF_INIT;
+	int ret;
+
+	oidread(&old_oid, log->value.update.old_hash);
+	oidread(&new_oid, log->value.update.new_hash);
+	strbuf_addf(&committer, "%s <%s>", log->value.update.name,
+		    log->value.update.email);
+	/* The files backend hands out messages including the newline. */
+	strbuf_addf(&msg, "%s\n", log->value.update.message);
+
+	ret = fn(&old_oid, &new_oid, committer.buf, log->value.update.time,
+		 log->value.update.tz_offset, msg.buf, cb_data);
+
+	strbuf_release(&committer);
+	strbuf_release(&msg);
+	return ret;
+}
+
+/*
+ * The committer identity used for all reflog entries of a single
+ * table.
+ */
+struct reftable_ident {
+	char *name;
+	char *email;
+	uint64_t time;
+	int tz;
+};
+
+static void reftable_ident_init(struct reftable_ident *ident)
+{
+	const char *info = git_committer_info(0);
+	struct ident_split split;
+
+	if (split_ident_line(&split, info, strlen(info)))
+		BUG("unable to split committer ident '%s'", info);
+
+	ident->name = xmemdupz(split.name_begin,
+			       split.name_end - split.name_begin);
+	ident->email = xmemdupz(split.mail_begin,
+				split.mail_end - split.mail_begin);
+	ident->time = split.date_begin ?
+		parse_timestamp(split.date_begin, NULL, 10) : 0;
+	ident->tz = split.tz_begin ? strtol(split.tz_begin, NULL, 10) : 0;
+}
+
+static void reftable_ident_release(struct reftable_ident *ident)
+{
+	free(ident->name);
+	free(ident->email);
+}
+
+/*
+ * Fill in a log record for an update of `refname`. The record borrows
+ * all of its data from the arguments.
+ */
+static void fill_log_record(struct reftable_log_record *log,
+			    const struct reftable_ident *ident,
+			    const char *refname, uint64_t update_index,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid,
+			    const char *msg)
+{
+	memset(log, 0, sizeof(*log));
+	log->refname = (char *)refname;
+	log->update_index = update_index;
+	log->value_type = REFTABLE_LOG_UPDATE;
+	log->value.update.old_hash = (uint8_t *)old_oid->hash;
+	log->value.update.new_hash = (uint8_t *)new_oid->hash;
+	log->value.update.name = ident->name;
+	log->value.update.email = ident->email;
+	log->value.update.time = ident->time;
+	log->value.update.tz_offset = ident->tz;
+	log->value.update.message = (char *)(msg ? msg : "");
+}
+
+/*
+ * Fill in a deletion record that hides `existing` from readers.
+ */
+static void fill_log_tombstone(struct reftable_log_record *log,
+			       const struct reftable_log_record *existing)
+{
+	memset(log, 0, sizeof(*log));
+	log->refname = existing->refname;
+	log->update_index = existing->update_index;
+	log->value_type = REFTABLE_LOG_DELETION;
+}
+
+static void fill_ref_record(struct reftable_ref_record *ref,
+			    const char *refname, uint64_t update_index,
+			    const struct object_id *oid,
+			    const struct object_id *peeled)
+{
+	memset(ref, 0, sizeof(*ref));
+	ref->refname = (char *)refname;
+	ref->update_index = update_index;
+	if (is_null_oid(oid)) {
+		ref->value_type = REFTABLE_REF_DELETION;
+	} else if (peeled && !is_null_oid(peeled)) {
+		ref->value_type = REFTABLE_REF_VAL2;
+		ref->value.val2.value = (uint8_t *)oid->hash;
+		ref->value.val2.target_value = (uint8_t *)peeled->hash;
+	} else {
+		ref->value_type = REFTABLE_REF_VAL1;
+		ref->value.val1 = (uint8_t *)oid->hash;
+	}
+}
+
+static int should_write_log(struct reftable_stack *stack,
+			    const char *refname, unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ?
+			LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	if ((flags & REF_FORCE_CREATE_REFLOG) ||
+	    should_autocreate_reflog(refname))
+		return 1;
+	return stack_has_log(stack, refname);
+}
+
+/*
+ * A set of records to be written into a single new table.
+ */
+struct reftable_records {
+	struct reftable_ref_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record *logs;
+	size_t logs_nr, logs_alloc;
+	uint64_t update_index;
+};
+
+static struct reftable_ref_record *records_add_ref(struct reftable_records *r)
+{
+	ALLOC_GROW(r->refs, r->refs_nr + 1, r->refs_alloc);
+	return &r->refs[r->refs_nr++];
+}
+
+static struct reftable_log_record *records_add_log(struct reftable_records *r)
+{
+	ALLOC_GROW(r->logs, r->logs_nr + 1, r->logs_alloc);
+	return &r->logs[r->logs_nr++];
+}
+
+static void records_release(struct reftable_records *r)
+{
+	free(r->refs);
+	free(r->logs);
+}
+
+static int ref_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_ref_record *a = va, *b = vb;
+
+	return strcmp(a->refname, b->refname);
+}
+
+/*
+ * Log records within a table must be sorted by refname and then by
+ * decreasing update index.
+ */
+static int log_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a = va, *b = vb;
+	int cmp = strcmp(a->refname, b->refname);
+
+	if (cmp)
+		return cmp;
+	if (a->update_index > b->update_index)
+		return -1;
+	return a->update_index < b->update_index;
+}
+
+static int write_records(struct reftable_writer *writer, void *cb_data)
+{
+	struct reftable_records *r = cb_data;
+	size_t i;
+	int ret;
+
+	reftable_writer_set_limits(writer, r->update_index, r->update_index);
+
+	QSORT(r->refs, r->refs_nr, ref_record_cmp);
+	for (i = 0; i < r->refs_nr; i++) {
+		ret = reftable_writer_add_ref(writer, &r->refs[i]);
+		if (ret)
+			return ret;
+	}
+
+	QSORT(r->logs, r->logs_nr, log_record_cmp);
+	for (i = 0; i < r->logs_nr; i++) {
+		ret = reftable_writer_add_log(writer, &r->logs[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Take the lock of the stack in `be` so that no other process can
+ * modify it until the addition is either committed or destroyed. The
+ * stack is reloaded first so that we lock its latest state.
+ */
+static int lock_backend(struct reftable_backend *be,
+			struct reftable_addition **addition,
+			struct strbuf *err)
+{
+	int ret;
+
+	if (mkdir(be->dir, 0777) && errno != EEXIST) {
+		strbuf_addf(err, _("unable to create directory '%s': %s"),
+			    be->dir, strerror(errno));
+		return -1;
+	}
+	if (adjust_shared_perm(be->dir)) {
+		strbuf_addf(err, _("unable to set permissions of '%s'"),
+			    be->dir);
+		return -1;
+	}
+
+	if (reload_backend(be, err))
+		return -1;
+
+	ret = reftable_stack_new_addition(addition, be->stack);
+	if (ret == REFTABLE_LOCK_ERROR) {
+		strbuf_addf(err, _("unable to lock '%s/tables.list': "
+				   "another process may be updating references"),
+			    be->dir);
+		return -1;
+	} else if (ret) {
+		strbuf_addf(err, _("unable to lock '%s/tables.list': %s"),
+			    be->dir, reftable_error_str(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write the table produced by `write_table` to the locked stack and
+ * release the lock. Destroys `addition` in any case.
+ */
+static int commit_addition(struct reftable_backend *be,
+			   struct reftable_addition *addition,
+			   int (*write_table)(struct reftable_writer *, void *),
+			   void *arg, struct strbuf *err)
+{
+	int ret;
+
+	ret = reftable_addition_add(addition, write_table, arg);
+	if (!ret)
+		ret = reftable_addition_commit(addition);
+	reftable_addition_destroy(addition);
+	if (ret) {
+		strbuf_addf(err, _("unable to write to reftable stack '%s': %s"),
+			    be->dir, reftable_error_str(ret));
+		return -1;
+	}
+
+	/*
+	 * Every write adds a new table to the stack, so compact it to
+	 * keep the number of tables logarithmic in the number of
+	 * updates. Failing to do so is not fatal; it merely leaves more
+	 * tables around than necessary.
+	 */
+	reftable_stack_auto_compact(be->stack);
+	return 0;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+	struct ref_store *ref_store;
+	struct repository *repo;
+
+	/*
+	 * A private view of the stack, so that reloads and writes
+	 * happening while we iterate do not pull the tables out from
+	 * under us.
+	 */
+	struct reftable_stack *stack;
+	struct reftable_iterator iter;
+	struct reftable_ref_record ref;
+	struct object_id oid;
+	int err;
+
+	char *prefix;
+	unsigned int flags;
+
+	/*
+	 * In linked worktrees, each stack only contributes the
+	 * references it is responsible for.
+	 */
+	unsigned int worktree_only : 1,
+		     shared_only : 1;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ok = ITER_DONE;
+
+	while (!iter->err) {
+		unsigned int flags = 0;
+		int ret = reftable_iterator_next_ref(&iter->iter, &iter->ref);
+
+		if (ret < 0) {
+			ok = ITER_ERROR;
+			break;
+		}
+		if (ret > 0 || !starts_with(iter->ref.refname, iter->prefix))
+			break;
+
+		if (!starts_with(iter->ref.refname, "refs/"))
+			continue;
+		if (iter->worktree_only && !is_worktree_ref(iter->ref.refname))
+			continue;
+		if (iter->shared_only && is_worktree_ref(iter->ref.refname))
+			continue;
+
+		switch (iter->ref.value_type) {
+		case REFTABLE_REF_VAL1:
+		case REFTABLE_REF_VAL2:
+			oidread(&iter->oid, reftable_ref_record_val1(&iter->ref));
+			if (is_null_oid(&iter->oid))
+				flags |= REF_ISBROKEN;
+			break;
+		case REFTABLE_REF_SYMREF:
+			if (!refs_resolve_ref_unsafe(iter->ref_store,
+						     iter->ref.refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, (int *)&flags)) {
+				oidclr(&iter->oid);
+				flags |= REF_ISBROKEN;
+			}
+			flags |= REF_ISSYMREF;
+			break;
+		default:
+			BUG("unhandled reftable value type %d",
+			    iter->ref.value_type);
+		}
+
+		if (check_refname_format(iter->ref.refname,
+					 REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(iter->ref.refname))
+				die(_("refname is dangerous: %s"),
+				    iter->ref.refname);
+			oidclr(&iter->oid);
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if ((iter->flags & DO_FOR_EACH_OMIT_DANGLING_SYMREFS) &&
+		    (flags & REF_ISSYMREF) &&
+		    (flags & REF_ISBROKEN))
+			continue;
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(iter->ref.refname, iter->repo,
+					    &iter->oid, flags))
+			continue;
+
+		iter->base.refname = iter->ref.refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (iter->err)
+		ok = ITER_ERROR;
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->ref.value_type == REFTABLE_REF_VAL2) {
+		oidread(peeled, iter->ref.value.val2.target_value);
+		return 0;
+	}
+
+	return peel_object(&iter->oid, peeled) ? -1 : 0;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_ref_record_release(&iter->ref);
+	reftable_iterator_destroy(&iter->iter);
+	if (iter->stack)
+		reftable_stack_destroy(iter->stack);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	.advance = reftable_ref_iterator_advance,
+	.peel = reftable_ref_iterator_peel,
+	.abort = reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *ref_iterator_for_backend(
+		struct reftable_ref_store *refs,
+		struct reftable_backend *be,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_iterator *iter;
+	struct ref_iterator *ref_iterator;
+
+	CALLOC_ARRAY(iter, 1);
+	ref_iterator = &iter->base;
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+	iter->ref_store = &refs->base;
+	iter->repo = refs->base.repo;
+	iter->prefix = xstrdup(prefix);
+	iter->flags = flags;
+
+	iter->err = reftable_new_stack(&iter->stack, be->dir,
+				       refs->write_options);
+	if (!iter->err)
+		iter->err = reftable_merged_table_seek_ref(
+				reftable_stack_merged_table(iter->stack),
+				&iter->iter, prefix);
+	if (iter->err)
+		error(_("unable to read reftable stack '%s': %s"),
+		      be->dir, reftable_error_str(iter->err));
+
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct ref_iterator *worktree_iter, *main_iter;
+	struct reftable_ref_iterator *iter;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_downcast(ref_store, required_flags,
+				 "ref_iterator_begin");
+
+	worktree_iter = ref_iterator_for_backend(refs, refs->worktree_backend,
+						 prefix, flags);
+	iter = (struct reftable_ref_iterator *)worktree_iter;
+	if (flags & DO_FOR_EACH_PER_WORKTREE_ONLY)
+		iter->worktree_only = 1;
+	if (refs->worktree_backend == &refs->main_backend ||
+	    (flags & DO_FOR_EACH_PER_WORKTREE_ONLY))
+		return worktree_iter;
+
+	/*
+	 * In a linked worktree the per-worktree references come from
+	 * the worktree's own stack and all others from the shared one.
+	 */
+	iter->worktree_only = 1;
+	main_iter = ref_iterator_for_backend(refs, &refs->main_backend,
+					     prefix, flags);
+	((struct reftable_ref_iterator *)main_iter)->shared_only = 1;
+
+	return overlay_ref_iterator_begin(worktree_iter, main_iter);
+}
+
+struct reftable_transaction_update {
+	struct ref_update *update;
+	/* The name of the reference inside its stack. */
+	const char *refname;
+	/* The value of the reference before the transaction. */
+	struct object_id current_oid;
+	/* The peeled value of new_oid, or the null OID. */
+	struct object_id peeled;
+	unsigned int write_ref : 1,
+		     write_log : 1;
+};
+
+/*
+ * All updates of a transaction that go to the same stack.
+ */
+struct write_transaction_table_arg {
+	struct reftable_backend *be;
+	struct reftable_addition *addition;
+	struct reftable_transaction_update **updates;
+	size_t updates_nr, updates_alloc;
+};
+
+struct reftable_transaction_data {
+	struct write_transaction_table_arg *args;
+	size_t args_nr, args_alloc;
+};
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *tx_data = transaction->backend_data;
+	size_t i, j;
+
+	if (tx_data) {
+		for (i = 0; i < tx_data->args_nr; i++) {
+			struct write_transaction_table_arg *arg = &tx_data->args[i];
+
+			reftable_addition_destroy(arg->addition);
+			for (j = 0; j < arg->updates_nr; j++) {
+				arg->updates[j]->update->backend_data = NULL;
+				free(arg->updates[j]);
+			}
+			free(arg->updates);
+		}
+		free(tx_data->args);
+		free(tx_data);
+		transaction->backend_data = NULL;
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * Register `update` with the stack it is going to be written to,
+ * locking that stack if this is the first update for it.
+ */
+static int prepare_transaction_update(struct reftable_ref_store *refs,
+				      struct reftable_transaction_data *tx_data,
+				      struct ref_update *update,
+				      struct write_transaction_table_arg **out,
+				      struct strbuf *err)
+{
+	struct write_transaction_table_arg *arg = NULL;
+	struct reftable_transaction_update *tu;
+	const char *refname;
+	struct reftable_backend *be = backend_for(refs, update->refname,
+						  &refname);
+	size_t i;
+
+	for (i = 0; i < tx_data->args_nr; i++) {
+		if (tx_data->args[i].be == be) {
+			arg = &tx_data->args[i];
+			break;
+		}
+	}
+
+	if (!arg) {
+		struct reftable_addition *addition;
+
+		if (lock_backend(be, &addition, err))
+			return TRANSACTION_GENERIC_ERROR;
+
+		ALLOC_GROW(tx_data->args, tx_data->args_nr + 1,
+			   tx_data->args_alloc);
+		arg = &tx_data->args[tx_data->args_nr++];
+		memset(arg, 0, sizeof(*arg));
+		arg->be = be;
+		arg->addition = addition;
+	}
+
+	CALLOC_ARRAY(tu, 1);
+	tu->update = update;
+	tu->refname = refname;
+	update->backend_data = tu;
+
+	ALLOC_GROW(arg->updates, arg->updates_nr + 1, arg->updates_alloc);
+	arg->updates[arg->updates_nr++] = tu;
+
+	*out = arg;
+	return 0;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Split it into two updates:
+ * - The original update, but with REF_LOG_ONLY and REF_NO_DEREF set
+ * - A new, separate update for the referent reference
+ * Note that the new update will itself be subject to splitting when
+ * the iteration gets to it.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	/*
+	 * Change the symbolic ref update to log only. Also, it
+	 * doesn't need to check its old OID value, as that will be
+	 * done when new_update is processed.
+	 */
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+static int verify_new_object(struct ref_update *update, struct strbuf *err)
+{
+	struct object *o;
+
+	if (update->flags & REF_SKIP_OID_VERIFICATION)
+		return 0;
+
+	o = parse_object(the_repository, &update->new_oid);
+	if (!o) {
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "trying to write ref '%s' with nonexistent object %s",
+			    update->refname, update->refname,
+			    oid_to_hex(&update->new_oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(update->refname)) {
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "trying to write non-commit object %s to branch '%s'",
+			    update->refname, oid_to_hex(&update->new_oid),
+			    update->refname);
+		return -1;
+	}
+	return 0;
+}
+
+static int lock_ref_for_update(struct reftable_ref_store *refs,
+			       struct reftable_transaction_data *tx_data,
+			       struct ref_update *update,
+			       struct ref_transaction *transaction,
+			       const char *head_ref,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct write_transaction_table_arg *arg;
+	struct reftable_transaction_update *tu;
+	struct strbuf referent = STRBUF_INIT;
+	unsigned int type = 0;
+	int exists, ret;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			goto out;
+	}
+
+	ret = prepare_transaction_update(refs, tx_data, update, &arg, err);
+	if (ret)
+		goto out;
+	tu = update->backend_data;
+
+	ret = read_ref_from_stack(arg->be->stack, tu->refname,
+				  &tu->current_oid, &referent, &type);
+	if (ret < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': error reading reference",
+			    original_update_refname(update));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	exists = !ret;
+	ret = 0;
+
+	if (!exists) {
+		if ((update->flags & REF_HAVE_OLD) &&
+		    !is_null_oid(&update->old_oid)) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(update),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		if ((update->flags & REF_HAVE_NEW) &&
+		    !is_null_oid(&update->new_oid) &&
+		    !(update->flags & REF_LOG_ONLY) &&
+		    refs_verify_refname_available(&refs->base, update->refname,
+						  affected_refnames, NULL,
+						  &referent)) {
+			strbuf_addf(err, "cannot lock ref '%s': %s",
+				    original_update_refname(update),
+				    referent.buf);
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto out;
+		}
+	} else if (type & REF_ISSYMREF) {
+		if (update->flags & REF_NO_DEREF) {
+			/*
+			 * We won't be reading the referent as part of
+			 * the transaction, so we have to read it here
+			 * to record and possibly check old_oid:
+			 */
+			if (!refs_resolve_ref_unsafe(&refs->base,
+						     referent.buf, 0,
+						     &tu->current_oid, NULL)) {
+				oidclr(&tu->current_oid);
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			} else if (check_old_oid(update, &tu->current_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else {
+			/*
+			 * Create a new update for the reference this
+			 * symref is pointing at. Also, we will record
+			 * and verify old_oid for this update as part
+			 * of processing the split-off update, so we
+			 * don't have to do it here.
+			 */
+			ret = split_symref_update(update, referent.buf,
+						  transaction,
+						  affected_refnames, err);
+			if (ret)
+				goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (check_old_oid(update, &tu->current_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_transaction_update *parent_tu =
+				parent_update->backend_data;
+			oidcpy(&parent_tu->current_oid, &tu->current_oid);
+		}
+	}
+
+	if (update->flags & REF_LOG_ONLY) {
+		tu->write_log = 1;
+	} else if (!(update->flags & REF_HAVE_NEW)) {
+		; /* only verifying the old value */
+	} else if (is_null_oid(&update->new_oid)) {
+		tu->write_ref = exists;
+	} else if (exists && !(type & REF_ISSYMREF) &&
+		   oideq(&tu->current_oid, &update->new_oid)) {
+		/*
+		 * The reference already has the desired value, so we
+		 * don't need to write it.
+		 */
+	} else {
+		if (verify_new_object(update, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		if (peel_object(&update->new_oid, &tu->peeled) != PEEL_PEELED)
+			oidclr(&tu->peeled);
+		tu->write_ref = 1;
+		tu->write_log = 1;
+	}
+
+out:
+	strbuf_release(&referent);
+	return ret;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_data *tx_data;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	CALLOC_ARRAY(tx_data, 1);
+	transaction->backend_data = tx_data;
+
+	/*
+	 * Fail if a refname appears more than once in the
+	 * transaction. (If we end up splitting up any updates using
+	 * split_symref_update() or split_head_update(), those
+	 * functions will check that the new updates don't have the
+	 * same refname as any existing ones.)
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * Special hack: If a branch is updated directly and HEAD
+	 * points to it (may happen on the remote side of a push
+	 * for example) then logically the HEAD reflog should be
+	 * updated too.
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/*
+	 * Acquire the locks of all affected stacks and check the old
+	 * values while holding them. Note that transaction->nr may
+	 * grow as symref updates get split up.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = lock_ref_for_update(refs, tx_data,
+					  transaction->updates[i],
+					  transaction, head_ref,
+					  &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int write_transaction_table(struct reftable_writer *writer,
+				   void *cb_data)
+{
+	struct write_transaction_table_arg *arg = cb_data;
+	struct reftable_stack *stack = arg->be->stack;
+	struct reftable_records records = { 0 };
+	struct reftable_log_record *existing = NULL;
+	size_t existing_nr = 0, existing_alloc = 0;
+	struct reftable_ident ident;
+	size_t i, j;
+	int ret = 0;
+
+	records.update_index = reftable_stack_next_update_index(stack);
+	reftable_ident_init(&ident);
+
+	for (i = 0; i < arg->updates_nr; i++) {
+		struct reftable_transaction_update *tu = arg->updates[i];
+		struct ref_update *u = tu->update;
+
+		if (tu->write_ref)
+			fill_ref_record(records_add_ref(&records), tu->refname,
+					records.update_index, &u->new_oid,
+					&tu->peeled);
+
+		if (tu->write_ref && is_null_oid(&u->new_oid)) {
+			/* Deleting a reference also deletes its reflog. */
+			struct reftable_log_record *logs;
+			size_t logs_nr;
+
+			ret = read_logs(stack, tu->refname, &logs, &logs_nr);
+			if (ret)
+				goto done;
+			ALLOC_GROW(existing, existing_nr + logs_nr,
+				   existing_alloc);
+			COPY_ARRAY(existing + existing_nr, logs, logs_nr);
+			existing_nr += logs_nr;
+			free(logs);
+		} else if (tu->write_log &&
+			   should_write_log(stack, tu->refname, u->flags)) {
+			fill_log_record(records_add_log(&records), &ident,
+					tu->refname, records.update_index,
+					&tu->current_oid, &u->new_oid, u->msg);
+		}
+	}
+
+	for (j = 0; j < existing_nr; j++)
+		fill_log_tombstone(records_add_log(&records), &existing[j]);
+
+	ret = write_records(writer, &records);
+
+done:
+	free_logs(existing, existing_nr);
+	records_release(&records);
+	reftable_ident_release(&ident);
+	return ret;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_transaction_data *tx_data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	reftable_downcast(ref_store, 0, "ref_transaction_finish");
+
+	for (i = 0; tx_data && i < tx_data->args_nr; i++) {
+		struct write_transaction_table_arg *arg = &tx_data->args[i];
+		struct reftable_addition *addition = arg->addition;
+
+		arg->addition = NULL;
+		if (commit_addition(arg->be, addition, write_transaction_table,
+				    arg, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			break;
+		}
+	}
+
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	int ret = reftable_transaction_prepare(ref_store, transaction, err);
+
+	if (ret)
+		return ret;
+	return reftable_transaction_finish(ref_store, transaction, err);
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	safe_create_dir(refs->main_backend.dir, 1);
+
+	/*
+	 * Git decides whether a directory is a repository by looking
+	 * for "HEAD" and "refs/", among others. The latter is created
+	 * by our caller; create a HEAD that does not point anywhere
+	 * valid, so that older versions of Git also recognize the
+	 * repository but refuse to work with it.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->base.gitdir);
+	if (!file_exists(sb.buf)) {
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+		adjust_shared_perm(sb.buf);
+	}
+
+	strbuf_release(&sb);
+	return 0;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct reftable_backend *backends[2];
+	size_t i, nr = 0;
+	int ret = 0;
+
+	backends[nr++] = &refs->main_backend;
+	if (refs->worktree_backend != &refs->main_backend)
+		backends[nr++] = refs->worktree_backend;
+
+	for (i = 0; i < nr; i++) {
+		int err;
+
+		if (reload_backend(backends[i], NULL)) {
+			ret = -1;
+			continue;
+		}
+		err = reftable_stack_compact_all(backends[i]->stack, NULL);
+		if (err)
+			ret = error(_("unable to compact reftable stack '%s': %s"),
+				    backends[i]->dir, reftable_error_str(err));
+	}
+
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname,
+				  const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	const char *stack_refname;
+	struct reftable_backend *be = backend_for(refs, refname, &stack_refname);
+	struct reftable_addition *addition;
+	struct reftable_records records = { 0 };
+	struct reftable_ref_record *ref;
+	struct reftable_ident ident = { 0 };
+	struct object_id old_oid, new_oid;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (lock_backend(be, &addition, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	records.update_index = reftable_stack_next_update_index(be->stack);
+	ref = records_add_ref(&records);
+	memset(ref, 0, sizeof(*ref));
+	ref->refname = (char *)stack_refname;
+	ref->update_index = records.update_index;
+	ref->value_type = REFTABLE_REF_SYMREF;
+	ref->value.symref = (char *)target;
+
+	if (logmsg &&
+	    should_write_log(be->stack, stack_refname, 0) &&
+	    refs_resolve_ref_unsafe(ref_store, target, RESOLVE_REF_READING,
+				    &new_oid, NULL)) {
+		if (!refs_resolve_ref_unsafe(ref_store, refname, 0,
+					     &old_oid, NULL))
+			oidclr(&old_oid);
+		reftable_ident_init(&ident);
+		fill_log_record(records_add_log(&records), &ident,
+				stack_refname, records.update_index,
+				&old_oid, &new_oid, logmsg);
+	}
+
+	if (commit_addition(be, addition, write_records, &records, &err))
+		ret = error("%s", err.buf);
+
+out:
+	reftable_ident_release(&ident);
+	records_release(&records);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	struct string_list_item *item;
+	int ret;
+
+	reftable_downcast(ref_store, REF_STORE_WRITE, "delete_refs");
+
+	if (!refnames->nr)
+		return 0;
+
+	/*
+	 * Since we don't check the references' old_oids, the
+	 * individual updates can't fail, so we can pack all of the
+	 * updates into a single transaction.
+	 */
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		return -1;
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err)) {
+			warning(_("could not delete reference %s: %s"),
+				item->string, err.buf);
+			strbuf_reset(&err);
+		}
+	}
+
+	ret = ref_transaction_commit(transaction, &err);
+
+	if (ret) {
+		if (refnames->nr == 1)
+			error(_("could not delete reference %s: %s"),
+			      refnames->items[0].string, err.buf);
+		else
+			error(_("could not delete references: %s"), err.buf);
+	}
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	const char *old_stack_refname, *new_stack_refname;
+	struct reftable_backend *be =
+		backend_for(refs, oldrefname, &old_stack_refname);
+	struct reftable_addition *addition = NULL;
+	struct reftable_records records = { 0 };
+	struct reftable_log_record *old_logs = NULL, *new_logs = NULL;
+	size_t old_logs_nr = 0, new_logs_nr = 0, i, j;
+	struct reftable_ident ident = { 0 };
+	struct object_id orig_oid, peeled;
+	struct strbuf referent = STRBUF_INIT;
+	struct strbuf err = STRBUF_INIT;
+	unsigned int type = 0;
+	int ret;
+
+	if (backend_for(refs, newrefname, &new_stack_refname) != be) {
+		ret = error(_("cannot %s '%s' to '%s': "
+			      "they are stored in different worktrees"),
+			    copy ? "copy" : "rename", oldrefname, newrefname);
+		goto out;
+	}
+
+	if (lock_backend(be, &addition, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	ret = read_ref_from_stack(be->stack, old_stack_refname, &orig_oid,
+				  &referent, &type);
+	if (ret) {
+		ret = error("refname %s not found", oldrefname);
+		goto out;
+	}
+	if (type & REF_ISSYMREF) {
+		if (copy)
+			ret = error("refname %s is a symbolic ref, copying it is not supported",
+				    oldrefname);
+		else
+			ret = error("refname %s is a symbolic ref, renaming it is not supported",
+				    oldrefname);
+		goto out;
+	}
+
+	strbuf_reset(&referent);
+	{
+		struct string_list skip = STRING_LIST_INIT_NODUP;
+
+		/* A copy keeps the old reference, so it may still conflict. */
+		if (!copy)
+			string_list_insert(&skip, oldrefname);
+		ret = refs_verify_refname_available(ref_store, newrefname,
+						    NULL, &skip, &referent);
+		string_list_clear(&skip, 0);
+		if (ret) {
+			ret = error("%s", referent.buf);
+			goto out;
+		}
+	}
+
+	if (read_logs(be->stack, old_stack_refname, &old_logs, &old_logs_nr) ||
+	    read_logs(be->stack, new_stack_refname, &new_logs, &new_logs_nr)) {
+		ret = error(_("unable to read reflogs of '%s' and '%s'"),
+			    oldrefname, newrefname);
+		goto out;
+	}
+
+	records.update_index = reftable_stack_next_update_index(be->stack);
+	reftable_ident_init(&ident);
+
+	if (peel_object(&orig_oid, &peeled) != PEEL_PEELED)
+		oidclr(&peeled);
+	fill_ref_record(records_add_ref(&records), new_stack_refname,
+			records.update_index, &orig_oid, &peeled);
+	/*
+	 * The new reference takes over the reflog of the old one, with
+	 * an entry for the rename on top. Any reflog the new reference
+	 * previously had is discarded; entries that are not overwritten
+	 * by copies of the old reflog need explicit deletion records.
+	 * Renaming a reference to itself only adds that entry.
+	 */
+	if (strcmp(old_stack_refname, new_stack_refname)) {
+		if (!copy)
+			fill_ref_record(records_add_ref(&records),
+					old_stack_refname, records.update_index,
+					null_oid(), NULL);
+
+		for (i = 0; i < old_logs_nr; i++) {
+			struct reftable_log_record *log =
+				records_add_log(&records);
+
+			*log = old_logs[i];
+			log->refname = (char *)new_stack_refname;
+			if (!copy)
+				fill_log_tombstone(records_add_log(&records),
+						   &old_logs[i]);
+		}
+		for (i = 0, j = 0; i < new_logs_nr; i++) {
+			/* Both lists are sorted by decreasing update index. */
+			while (j < old_logs_nr &&
+			       old_logs[j].update_index > new_logs[i].update_index)
+				j++;
+			if (j < old_logs_nr &&
+			    old_logs[j].update_index == new_logs[i].update_index)
+				continue;
+			fill_log_tombstone(records_add_log(&records),
+					   &new_logs[i]);
+		}
+	}
+	if (old_logs_nr || should_write_log(be->stack, new_stack_refname, 0))
+		fill_log_record(records_add_log(&records), &ident,
+				new_stack_refname, records.update_index,
+				&orig_oid, &orig_oid, logmsg);
+
+	if (commit_addition(be, addition, write_records, &records, &err))
+		ret = error(_("unable to %s '%s' to '%s': %s"),
+			    copy ? "copy" : "rename", oldrefname,
+			    newrefname, err.buf);
+	addition = NULL;
+
+out:
+	reftable_addition_destroy(addition);
+	free_logs(old_logs, old_logs_nr);
+	free_logs(new_logs, new_logs_nr);
+	reftable_ident_release(&ident);
+	records_release(&records);
+	strbuf_release(&referent);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 1);
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+	struct ref_store *ref_store;
+
+	/* A private view of the stack, see reftable_ref_iterator. */
+	struct reftable_stack *stack;
+	struct reftable_iterator iter;
+	struct reftable_log_record log;
+	struct strbuf last_name;
+	struct object_id oid;
+	int err;
+
+	unsigned int worktree_only : 1,
+		     shared_only : 1;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	int ok = ITER_DONE;
+
+	while (!iter->err) {
+		int flags;
+		int ret = reftable_iterator_next_log(&iter->iter, &iter->log);
+
+		if (ret < 0) {
+			ok = ITER_ERROR;
+			break;
+		}
+		if (ret > 0)
+			break;
+
+		/* Only yield each reflog once. */
+		if (iter->last_name.len &&
+		    !strcmp(iter->log.refname, iter->last_name.buf))
+			continue;
+		strbuf_reset(&iter->last_name);
+		strbuf_addstr(&iter->last_name, iter->log.refname);
+
+		if (iter->worktree_only && !is_worktree_ref(iter->log.refname))
+			continue;
+		if (iter->shared_only && is_worktree_ref(iter->log.refname))
+			continue;
+
+		if (!refs_resolve_ref_unsafe(iter->ref_store,
+					     iter->last_name.buf, 0,
+					     &iter->oid, &flags)) {
+			error("bad ref for %s", iter->last_name.buf);
+			continue;
+		}
+
+		iter->base.refname = iter->last_name.buf;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (iter->err)
+		ok = ITER_ERROR;
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	reftable_log_record_release(&iter->log);
+	reftable_iterator_destroy(&iter->iter);
+	if (iter->stack)
+		reftable_stack_destroy(iter->stack);
+	strbuf_release(&iter->last_name);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	.advance = reftable_reflog_iterator_advance,
+	.peel = reftable_reflog_iterator_peel,
+	.abort = reftable_reflog_iterator_abort
+};
+
+static struct reftable_reflog_iterator *reflog_iterator_for_backend(
+		struct reftable_ref_store *refs,
+		struct reftable_backend *be)
+{
+	struct reftable_reflog_iterator *iter;
+
+	CALLOC_ARRAY(iter, 1);
+	base_ref_iterator_init(&iter->base, &reftable_reflog_iterator_vtable, 1);
+	iter->ref_store = &refs->base;
+	strbuf_init(&iter->last_name, 0);
+
+	iter->err = reftable_new_stack(&iter->stack, be->dir,
+				       refs->write_options);
+	if (!iter->err)
+		iter->err = reftable_merged_table_seek_log(
+				reftable_stack_merged_table(iter->stack),
+				&iter->iter, "");
+	if (iter->err)
+		error(_("unable to read reftable stack '%s': %s"),
+		      be->dir, reftable_error_str(iter->err));
+
+	return iter;
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+	struct reftable_reflog_iterator *worktree_iter, *main_iter;
+
+	worktree_iter = reflog_iterator_for_backend(refs, refs->worktree_backend);
+	if (refs->worktree_backend == &refs->main_backend)
+		return &worktree_iter->base;
+
+	worktree_iter->worktree_only = 1;
+	main_iter = reflog_iterator_for_backend(refs, &refs->main_backend);
+	main_iter->shared_only = 1;
+
+	return overlay_ref_iterator_begin(&worktree_iter->base,
+					  &main_iter->base);
+}
+
+static int for_each_reflog_ent_internal(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data,
+					int reverse)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct reftable_backend *be = backend_for(refs, refname, &refname);
+	struct reftable_log_record *logs;
+	size_t logs_nr, i;
+	int ret;
+
+	if (reload_backend(be, NULL))
+		return -1;
+	if (read_logs(be->stack, refname, &logs, &logs_nr))
+		return error(_("unable to read reflog of '%s'"), refname);
+
+	/* The entries come newest first. */
+	for (i = 0, ret = 0; i < logs_nr && !ret; i++) {
+		struct reftable_log_record *log =
+			&logs[reverse ? i : logs_nr - i - 1];
+
+		if (!is_log_marker(log))
+			ret = yield_log_record(log, fn, cb_data);
+	}
+
+	free_logs(logs, logs_nr);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	return for_each_reflog_ent_internal(ref_store, refname, fn, cb_data, 0);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	return for_each_reflog_ent_internal(ref_store, refname, fn, cb_data, 1);
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_backend *be = backend_for(refs, refname, &refname);
+
+	if (reload_backend(be, NULL))
+		return 0;
+	return stack_has_log(be->stack, refname);
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct reftable_backend *be = backend_for(refs, refname, &refname);
+	struct reftable_addition *addition;
+	struct reftable_records records = { 0 };
+	struct reftable_ident ident;
+	int ret = 0;
+
+	if (lock_backend(be, &addition, err))
+		return -1;
+
+	if (stack_has_log(be->stack, refname)) {
+		reftable_addition_destroy(addition);
+		return 0;
+	}
+
+	records.update_index = reftable_stack_next_update_index(be->stack);
+	reftable_ident_init(&ident);
+	fill_log_record(records_add_log(&records), &ident, refname,
+			records.update_index, null_oid(), null_oid(), NULL);
+
+	if (commit_addition(be, addition, write_records, &records, err))
+		ret = -1;
+
+	reftable_ident_release(&ident);
+	records_release(&records);
+	return ret;
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct reftable_backend *be = backend_for(refs, refname, &refname);
+	struct reftable_addition *addition;
+	struct reftable_records records = { 0 };
+	struct reftable_log_record *logs = NULL;
+	size_t logs_nr = 0, i;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (lock_backend(be, &addition, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (read_logs(be->stack, refname, &logs, &logs_nr)) {
+		reftable_addition_destroy(addition);
+		ret = error(_("unable to read reflog of '%s'"), refname);
+		goto out;
+	}
+
+	records.update_index = reftable_stack_next_update_index(be->stack);
+	for (i = 0; i < logs_nr; i++)
+		fill_log_tombstone(records_add_log(&records), &logs[i]);
+
+	if (commit_addition(be, addition, write_records, &records, &err))
+		ret = error("%s", err.buf);
+
+out:
+	free_logs(logs, logs_nr);
+	records_release(&records);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname,
+				  unsigned int expire_flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	const char *stack_refname;
+	struct reftable_backend *be = backend_for(refs, refname, &stack_refname);
+	struct reftable_addition *addition = NULL;
+	struct reftable_records records = { 0 };
+	struct reftable_log_record *logs = NULL;
+	struct object_id *rewritten_oids = NULL;
+	size_t logs_nr = 0, i;
+	struct object_id oid, last_kept_oid, peeled;
+	struct reftable_ident ident = { 0 };
+	struct strbuf err = STRBUF_INIT;
+	int rewrite = !!(expire_flags & EXPIRE_REFLOGS_REWRITE);
+	size_t kept = 0;
+	int ret = 0;
+
+	/*
+	 * Holding the lock of the stack also protects the reference
+	 * itself, which we might need to update if --updateref was
+	 * specified.
+	 */
+	if (lock_backend(be, &addition, &err)) {
+		ret = error("cannot lock ref '%s': %s", refname, err.buf);
+		goto out;
+	}
+
+	if (read_logs(be->stack, stack_refname, &logs, &logs_nr)) {
+		ret = error(_("unable to read reflog of '%s'"), refname);
+		goto out;
+	}
+	if (!logs_nr)
+		goto out;
+
+	if (!refs_resolve_ref_unsafe(ref_store, refname, 0, &oid, NULL))
+		oidclr(&oid);
+
+	records.update_index = reftable_stack_next_update_index(be->stack);
+	CALLOC_ARRAY(rewritten_oids, logs_nr);
+	oidclr(&last_kept_oid);
+
+	(*prepare_fn)(refname, &oid, policy_cb_data);
+	/* Entries are passed to the callback oldest first. */
+	for (i = logs_nr; i--; ) {
+		struct reftable_log_record *log = &logs[i];
+		struct object_id old_oid, new_oid, *ooid;
+		struct strbuf committer = STRBUF_INIT;
+		struct strbuf msg = STRBUF_INIT;
+		int prune;
+
+		if (is_log_marker(log)) {
+			kept++;
+			continue;
+		}
+
+		oidread(&old_oid, log->value.update.old_hash);
+		oidread(&new_oid, log->value.update.new_hash);
+		ooid = rewrite ? &last_kept_oid : &old_oid;
+
+		strbuf_addf(&committer, "%s <%s>", log->value.update.name,
+			    log->value.update.email);
+		strbuf_addf(&msg, "%s\n", log->value.update.message);
+		prune = should_prune_fn(ooid, &new_oid, committer.buf,
+					log->value.update.time,
+					log->value.update.tz_offset,
+					msg.buf, policy_cb_data);
+		strbuf_release(&committer);
+		strbuf_release(&msg);
+
+		if (prune) {
+			fill_log_tombstone(records_add_log(&records), log);
+			continue;
+		}
+
+		if (!oideq(ooid, &old_oid)) {
+			struct reftable_log_record *rewritten =
+				records_add_log(&records);
+
+			oidcpy(&rewritten_oids[i], ooid);
+			*rewritten = *log;
+			rewritten->value.update.old_hash =
+				rewritten_oids[i].hash;
+		}
+		oidcpy(&last_kept_oid, &new_oid);
+		kept++;
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	/* An expired reflog continues to exist, albeit empty. */
+	if (!kept) {
+		reftable_ident_init(&ident);
+		fill_log_record(records_add_log(&records), &ident,
+				stack_refname, records.update_index,
+				null_oid(), null_oid(), NULL);
+	}
+
+	if (expire_flags & EXPIRE_REFLOGS_DRY_RUN)
+		goto out;
+
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic
+	 * reference's reflog. Nor can we update a reference if there
+	 * are no remaining reflog entries.
+	 */
+	if ((expire_flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !is_null_oid(&last_kept_oid)) {
+		struct strbuf referent = STRBUF_INIT;
+		struct object_id current;
+		unsigned int type = 0;
+
+		if (!read_ref_from_stack(be->stack, stack_refname, &current,
+					 &referent, &type) &&
+		    !(type & REF_ISSYMREF)) {
+			if (peel_object(&last_kept_oid, &peeled) != PEEL_PEELED)
+				oidclr(&peeled);
+			fill_ref_record(records_add_ref(&records), stack_refname,
+					records.update_index, &last_kept_oid,
+					&peeled);
+		}
+		strbuf_release(&referent);
+	}
+
+	if (commit_addition(be, addition, write_records, &records, &err))
+		ret = error("%s", err.buf);
+	addition = NULL;
+
+out:
+	reftable_addition_destroy(addition);
+	free_logs(logs, logs_nr);
+	free(rewritten_oids);
+	reftable_ident_release(&ident);
+	records_release(&records);
+	strbuf_release(&err);
+	return ret;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	.next = NULL,
+	.name = "reftable",
+	.init = reftable_ref_store_create,
+	.init_db = reftable_init_db,
+	.transaction_prepare = reftable_transaction_prepare,
+	.transaction_finish = reftable_transaction_finish,
+	.transaction_abort = reftable_transaction_abort,
+	.initial_transaction_commit = reftable_initial_transaction_commit,
+
+	.pack_refs = reftable_pack_refs,
+	.create_symref = reftable_create_symref,
+	.delete_refs = reftable_delete_refs,
+	.rename_ref = reftable_rename_ref,
+	.copy_ref = reftable_copy_ref,
+
+	.iterator_begin = reftable_ref_iterator_begin,
+	.read_raw_ref = reftable_read_raw_ref,
+	.read_symbolic_ref = reftable_read_symbolic_ref,
+
+	.reflog_iterator_begin = reftable_reflog_iterator_begin,
+	.for_each_reflog_ent = reftable_for_each_reflog_ent,
+	.for_each_reflog_ent_reverse = reftable_for_each_reflog_ent_reverse,
+	.reflog_exists = reftable_reflog_exists,
+	.create_reflog = reftable_create_reflog,
+	.delete_reflog = reftable_delete_reflog,
+	.reflog_expire = reftable_reflog_expire
+};
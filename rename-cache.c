@@ -0,0 +1,620 @@
+#include "cache.h"
+#include "rename-cache.h"
+#include "chunk-format.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "hash-lookup.h"
+#include "object-store.h"
+#include "oidmap.h"
+#include "repository.h"
+
+#define RENAME_CACHE_SIGNATURE 0x5350414e /* "SPAN" */
+#define RENAME_CACHE_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define RENAME_CACHE_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define RENAME_CACHE_CHUNKID_INDEX 0x53494458 /* "SIDX" */
+#define RENAME_CACHE_CHUNKID_PAIRS 0x53444154 /* "SDAT" */
+
+#define RENAME_CACHE_VERSION 1
+#define RENAME_CACHE_HEADER_SIZE 8
+#define RENAME_CACHE_FANOUT_SIZE (4 * 256)
+#define RENAME_CACHE_MIN_SIZE (RENAME_CACHE_HEADER_SIZE + \
+			       5 * CHUNK_TOC_ENTRY_SIZE + \
+			       RENAME_CACHE_FANOUT_SIZE)
+
+#define RENAME_CACHE_PAIR_SIZE 8
+#define RENAME_CACHE_INDEX_WIDTH 8
+
+/*
+ * Do not bother writing a new file for just a few fingerprints, but
+ * do not keep too many of them in memory either.
+ */
+#define RENAME_CACHE_MIN_FLUSH 32
+#define RENAME_CACHE_MAX_PENDING_PAIRS (8 * 1024 * 1024)
+
+struct rename_cache_file {
+	char *path;
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_blobs;
+	uint32_t num_pairs;
+
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_index;
+	const unsigned char *chunk_pairs;
+};
+
+struct pending_fingerprint {
+	struct oidmap_entry ent;
+	unsigned flags;
+	size_t nr;
+	unsigned char pairs[FLEX_ARRAY]; /* network byte order */
+};
+
+struct rename_cache {
+	struct rename_cache_file **files;
+	size_t files_nr, files_alloc;
+	unsigned loaded : 1;
+
+	struct oidmap pending;
+	size_t pending_nr;
+	size_t pending_pairs;
+
+	/* statistics, reported via trace2 by rename_cache_flush() */
+	intmax_t hits;
+	intmax_t misses;
+};
+
+static void rename_cache_dir(struct repository *r, struct strbuf *path)
+{
+	strbuf_addf(path, "%s/info/rename-cache", r->objects->odb->path);
+}
+
+static int is_rename_cache_file(const char *name)
+{
+	const char *rest;
+
+	return skip_prefix(name, "cache-", &rest) &&
+	       ends_with(rest, ".spans");
+}
+
+struct chunk_ref {
+	const unsigned char *start;
+	size_t size;
+};
+
+static int read_chunk_ref(const unsigned char *chunk_start,
+			  size_t chunk_size, void *data)
+{
+	struct chunk_ref *ref = data;
+
+	ref->start = chunk_start;
+	ref->size = chunk_size;
+	return 0;
+}
+
+static struct rename_cache_file *parse_rename_cache_file(const char *path,
+							 const unsigned char *data,
+							 size_t data_len)
+{
+	const size_t hashsz = the_hash_algo->rawsz;
+	struct rename_cache_file *f = NULL;
+	struct chunk_ref fanout = { 0 }, lookup = { 0 };
+	struct chunk_ref index = { 0 }, pairs = { 0 };
+	struct chunkfile *cf;
+	uint32_t num_blobs;
+
+	if (data_len < RENAME_CACHE_MIN_SIZE + hashsz ||
+	    get_be32(data) != RENAME_CACHE_SIGNATURE ||
+	    data[4] != RENAME_CACHE_VERSION ||
+	    data[5] != oid_version(the_hash_algo))
+		return NULL;
+
+	cf = init_chunkfile(NULL);
+	if (read_table_of_contents(cf, data, data_len,
+				   RENAME_CACHE_HEADER_SIZE, data[6]))
+		goto done;
+
+	read_chunk(cf, RENAME_CACHE_CHUNKID_OIDFANOUT, read_chunk_ref, &fanout);
+	read_chunk(cf, RENAME_CACHE_CHUNKID_OIDLOOKUP, read_chunk_ref, &lookup);
+	read_chunk(cf, RENAME_CACHE_CHUNKID_INDEX, read_chunk_ref, &index);
+	read_chunk(cf, RENAME_CACHE_CHUNKID_PAIRS, read_chunk_ref, &pairs);
+
+	if (fanout.size != RENAME_CACHE_FANOUT_SIZE)
+		goto done;
+	num_blobs = get_be32(fanout.start + RENAME_CACHE_FANOUT_SIZE - 4);
+	if (lookup.size != st_mult(num_blobs, hashsz) ||
+	    index.size != st_mult(num_blobs, RENAME_CACHE_INDEX_WIDTH) ||
+	    pairs.size % RENAME_CACHE_PAIR_SIZE ||
+	    pairs.size / RENAME_CACHE_PAIR_SIZE > UINT32_MAX)
+		goto done;
+
+	CALLOC_ARRAY(f, 1);
+	f->path = xstrdup(path);
+	f->data = data;
+	f->data_len = data_len;
+	f->num_blobs = num_blobs;
+	f->num_pairs = pairs.size / RENAME_CACHE_PAIR_SIZE;
+	f->chunk_oid_fanout = (const uint32_t *)fanout.start;
+	f->chunk_oid_lookup = lookup.start;
+	f->chunk_index = index.start;
+	f->chunk_pairs = pairs.start;
+
+done:
+	free_chunkfile(cf);
+	return f;
+}
+
+static void load_rename_cache_file(struct rename_cache *rc, const char *path)
+{
+	struct rename_cache_file *f;
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return;
+	}
+	data = xmmap(NULL, xsize_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	f = parse_rename_cache_file(path, data, xsize_t(st.st_size));
+	if (!f) {
+		warning(_("ignoring corrupt rename cache file '%s'"), path);
+		munmap(data, xsize_t(st.st_size));
+		return;
+	}
+	ALLOC_GROW(rc->files, rc->files_nr + 1, rc->files_alloc);
+	rc->files[rc->files_nr++] = f;
+}
+
+static void free_rename_cache_file(struct rename_cache_file *f)
+{
+	munmap((void *)f->data, f->data_len);
+	free(f->path);
+	free(f);
+}
+
+static struct rename_cache *get_rename_cache(struct repository *r)
+{
+	struct rename_cache *rc;
+
+	prepare_repo_settings(r);
+	if (!r->settings.diff_rename_cache)
+		return NULL;
+
+	rc = r->objects->rename_cache;
+	if (!rc) {
+		CALLOC_ARRAY(rc, 1);
+		oidmap_init(&rc->pending, 0);
+		r->objects->rename_cache = rc;
+	}
+
+	if (!rc->loaded) {
+		struct strbuf path = STRBUF_INIT;
+		size_t baselen;
+		struct dirent *de;
+		DIR *dir;
+
+		rename_cache_dir(r, &path);
+		dir = opendir(path.buf);
+		strbuf_addch(&path, '/');
+		baselen = path.len;
+		while (dir && (de = readdir_skip_dot_and_dotdot(dir))) {
+			if (!is_rename_cache_file(de->d_name))
+				continue;
+			strbuf_setlen(&path, baselen);
+			strbuf_addstr(&path, de->d_name);
+			load_rename_cache_file(rc, path.buf);
+		}
+		if (dir)
+			closedir(dir);
+		strbuf_release(&path);
+		rc->loaded = 1;
+	}
+	return rc;
+}
+
+static int get_fingerprint(struct rename_cache_file *f, uint32_t pos,
+			   struct rename_fingerprint *fp)
+{
+	const unsigned char *ix = f->chunk_index +
+				  st_mult(pos, RENAME_CACHE_INDEX_WIDTH);
+	uint32_t start = pos ? get_be32(ix - 4) : 0;
+	uint32_t end = get_be32(ix + 4);
+
+	if (end < start || end > f->num_pairs)
+		return -1;
+	fp->flags = get_be32(ix);
+	fp->nr = end - start;
+	fp->pairs = f->chunk_pairs + st_mult(start, RENAME_CACHE_PAIR_SIZE);
+	return 0;
+}
+
+static int lookup_in_file(struct rename_cache_file *f,
+			  const struct object_id *oid,
+			  struct rename_fingerprint *fp)
+{
+	uint32_t pos;
+
+	if (!bsearch_hash(oid->hash, f->chunk_oid_fanout, f->chunk_oid_lookup,
+			  the_hash_algo->rawsz, &pos))
+		return -1;
+	return get_fingerprint(f, pos, fp);
+}
+
+int rename_cache_lookup(struct repository *r, const struct object_id *oid,
+			struct rename_fingerprint *fp)
+{
+	struct rename_cache *rc = get_rename_cache(r);
+	struct pending_fingerprint *p;
+	size_t i;
+
+	if (!rc)
+		return -1;
+
+	for (i = 0; i < rc->files_nr; i++) {
+		if (!lookup_in_file(rc->files[i], oid, fp)) {
+			rc->hits++;
+			return 0;
+		}
+	}
+
+	p = oidmap_get(&rc->pending, oid);
+	if (!p) {
+		rc->misses++;
+		return -1;
+	}
+	rc->hits++;
+	fp->flags = p->flags;
+	fp->nr = p->nr;
+	fp->pairs = p->pairs;
+	return 0;
+}
+
+void rename_cache_add(struct repository *r, const struct object_id *oid,
+		      unsigned flags, const uint32_t *pairs, size_t nr)
+{
+	struct rename_cache *rc = get_rename_cache(r);
+	struct pending_fingerprint *p;
+	size_t i;
+
+	if (!rc || oidmap_get(&rc->pending, oid))
+		return;
+	if (rc->pending_pairs + nr > RENAME_CACHE_MAX_PENDING_PAIRS)
+		return;
+
+	p = xmalloc(st_add(sizeof(*p), st_mult(nr, RENAME_CACHE_PAIR_SIZE)));
+	oidcpy(&p->ent.oid, oid);
+	p->flags = flags;
+	p->nr = nr;
+	for (i = 0; i < nr; i++) {
+		put_be32(p->pairs + i * RENAME_CACHE_PAIR_SIZE, pairs[2 * i]);
+		put_be32(p->pairs + i * RENAME_CACHE_PAIR_SIZE + 4,
+			 pairs[2 * i + 1]);
+	}
+	oidmap_put(&rc->pending, p);
+	rc->pending_nr++;
+	rc->pending_pairs += nr;
+}
+
+struct write_entry {
+	struct object_id oid;
+	struct rename_fingerprint fp;
+};
+
+struct write_context {
+	struct write_entry *entries;
+	size_t nr;
+};
+
+static int write_entry_cmp(const void *a_, const void *b_)
+{
+	const struct write_entry *a = a_;
+	const struct write_entry *b = b_;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static int write_chunk_oid_fanout(struct hashfile *f, void *data)
+{
+	struct write_context *ctx = data;
+	size_t i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		while (count < ctx->nr &&
+		       ctx->entries[count].oid.hash[0] <= i)
+			count++;
+		hashwrite_be32(f, count);
+	}
+	return 0;
+}
+
+static int write_chunk_oid_lookup(struct hashfile *f, void *data)
+{
+	struct write_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->nr; i++)
+		hashwrite(f, ctx->entries[i].oid.hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static int write_chunk_index(struct hashfile *f, void *data)
+{
+	struct write_context *ctx = data;
+	uint32_t end = 0;
+	size_t i;
+
+	for (i = 0; i < ctx->nr; i++) {
+		end += ctx->entries[i].fp.nr;
+		hashwrite_be32(f, ctx->entries[i].fp.flags);
+		hashwrite_be32(f, end);
+	}
+	return 0;
+}
+
+static int write_chunk_pairs(struct hashfile *f, void *data)
+{
+	struct write_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->nr; i++)
+		hashwrite(f, ctx->entries[i].fp.pairs,
+			  st_mult(ctx->entries[i].fp.nr, RENAME_CACHE_PAIR_SIZE));
+	return 0;
+}
+
+/*
+ * Sort the entries, drop duplicates (keeping the first one) and limit
+ * the total number of pairs to what the index can address.
+ */
+static void prepare_entries(struct write_context *ctx)
+{
+	size_t i, nr = 0;
+	uint64_t total = 0;
+
+	STABLE_QSORT(ctx->entries, ctx->nr, write_entry_cmp);
+	for (i = 0; i < ctx->nr; i++) {
+		if (nr && oideq(&ctx->entries[nr - 1].oid, &ctx->entries[i].oid))
+			continue;
+		if (total + ctx->entries[i].fp.nr > UINT32_MAX)
+			continue;
+		total += ctx->entries[i].fp.nr;
+		ctx->entries[nr++] = ctx->entries[i];
+	}
+	ctx->nr = nr;
+}
+
+static int write_rename_cache_file(struct repository *r,
+				   struct write_context *ctx,
+				   struct strbuf *final_path)
+{
+	const size_t hashsz = the_hash_algo->rawsz;
+	unsigned char file_hash[GIT_MAX_RAWSZ];
+	struct strbuf tmp_path = STRBUF_INIT;
+	struct chunkfile *cf;
+	struct hashfile *f;
+	uint64_t pairs_size = 0;
+	size_t i;
+	int fd;
+
+	prepare_entries(ctx);
+	for (i = 0; i < ctx->nr; i++)
+		pairs_size += ctx->entries[i].fp.nr * RENAME_CACHE_PAIR_SIZE;
+
+	rename_cache_dir(r, &tmp_path);
+	strbuf_addstr(&tmp_path, "/tmp_cache_XXXXXX");
+	if (safe_create_leading_directories(tmp_path.buf)) {
+		error(_("unable to create leading directories of %s"),
+		      tmp_path.buf);
+		strbuf_release(&tmp_path);
+		return -1;
+	}
+	fd = git_mkstemp_mode(tmp_path.buf, 0444);
+	if (fd < 0) {
+		error_errno(_("unable to create temporary rename cache file"));
+		strbuf_release(&tmp_path);
+		return -1;
+	}
+	if (adjust_shared_perm(tmp_path.buf)) {
+		error(_("unable to adjust shared permissions for '%s'"),
+		      tmp_path.buf);
+		close(fd);
+		goto fail;
+	}
+
+	f = hashfd(fd, tmp_path.buf);
+	cf = init_chunkfile(f);
+	add_chunk(cf, RENAME_CACHE_CHUNKID_OIDFANOUT, RENAME_CACHE_FANOUT_SIZE,
+		  write_chunk_oid_fanout);
+	add_chunk(cf, RENAME_CACHE_CHUNKID_OIDLOOKUP, st_mult(hashsz, ctx->nr),
+		  write_chunk_oid_lookup);
+	add_chunk(cf, RENAME_CACHE_CHUNKID_INDEX,
+		  st_mult(RENAME_CACHE_INDEX_WIDTH, ctx->nr),
+		  write_chunk_index);
+	add_chunk(cf, RENAME_CACHE_CHUNKID_PAIRS, pairs_size,
+		  write_chunk_pairs);
+
+	hashwrite_be32(f, RENAME_CACHE_SIGNATURE);
+	hashwrite_u8(f, RENAME_CACHE_VERSION);
+	hashwrite_u8(f, oid_version(the_hash_algo));
+	hashwrite_u8(f, get_num_chunks(cf));
+	hashwrite_u8(f, 0); /* unused */
+
+	write_chunkfile(cf, ctx);
+	finalize_hashfile(f, file_hash, FSYNC_COMPONENT_NONE,
+			  CSUM_HASH_IN_STREAM | CSUM_CLOSE);
+	free_chunkfile(cf);
+
+	rename_cache_dir(r, final_path);
+	strbuf_addf(final_path, "/cache-%s.spans", hash_to_hex(file_hash));
+	if (rename(tmp_path.buf, final_path->buf)) {
+		error_errno(_("unable to rename '%s' to '%s'"),
+			    tmp_path.buf, final_path->buf);
+		goto fail;
+	}
+	strbuf_release(&tmp_path);
+	return 0;
+
+fail:
+	unlink(tmp_path.buf);
+	strbuf_release(&tmp_path);
+	return -1;
+}
+
+static void add_pending_entries(struct rename_cache *rc,
+				struct write_context *ctx, size_t *alloc)
+{
+	struct oidmap_iter iter;
+	struct pending_fingerprint *p;
+
+	oidmap_iter_init(&rc->pending, &iter);
+	while ((p = oidmap_iter_next(&iter))) {
+		struct write_entry *e;
+
+		ALLOC_GROW(ctx->entries, ctx->nr + 1, *alloc);
+		e = &ctx->entries[ctx->nr++];
+		oidcpy(&e->oid, &p->ent.oid);
+		e->fp.flags = p->flags;
+		e->fp.nr = p->nr;
+		e->fp.pairs = p->pairs;
+	}
+}
+
+static void clear_pending(struct rename_cache *rc)
+{
+	oidmap_free(&rc->pending, 1);
+	oidmap_init(&rc->pending, 0);
+	rc->pending_nr = 0;
+	rc->pending_pairs = 0;
+}
+
+void rename_cache_flush(struct repository *r, int force)
+{
+	struct rename_cache *rc = get_rename_cache(r);
+	struct write_context ctx = { 0 };
+	struct strbuf path = STRBUF_INIT;
+	size_t alloc = 0;
+
+	if (!rc)
+		return;
+	if (rc->hits || rc->misses) {
+		trace2_data_intmax("diff", r, "rename cache/hits", rc->hits);
+		trace2_data_intmax("diff", r, "rename cache/misses", rc->misses);
+		rc->hits = rc->misses = 0;
+	}
+	if (!rc->pending_nr ||
+	    (!force && rc->pending_nr < RENAME_CACHE_MIN_FLUSH))
+		return;
+
+	trace2_region_enter("diff", "write rename cache", r);
+	add_pending_entries(rc, &ctx, &alloc);
+	if (!write_rename_cache_file(r, &ctx, &path))
+		load_rename_cache_file(rc, path.buf);
+	trace2_data_intmax("diff", r, "rename cache/written", ctx.nr);
+	trace2_region_leave("diff", "write rename cache", r);
+
+	/*
+	 * The fingerprints are now in the new file; if it could not be
+	 * written, there is no point in trying again and again.
+	 */
+	clear_pending(rc);
+	free(ctx.entries);
+	strbuf_release(&path);
+}
+
+int rename_cache_count_files(struct repository *r)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir;
+	int count = 0;
+
+	rename_cache_dir(r, &path);
+	dir = opendir(path.buf);
+	strbuf_release(&path);
+	if (!dir)
+		return 0;
+	while ((de = readdir_skip_dot_and_dotdot(dir)))
+		if (is_rename_cache_file(de->d_name))
+			count++;
+	closedir(dir);
+	return count;
+}
+
+int rename_cache_compact(struct repository *r)
+{
+	struct rename_cache *rc = get_rename_cache(r);
+	struct write_context ctx = { 0 };
+	struct strbuf path = STRBUF_INIT;
+	size_t alloc = 0, i, nr;
+	uint32_t pos;
+	int ret = 0;
+
+	if (!rc)
+		return 0;
+	if (!rc->files_nr && !rc->pending_nr)
+		return 0;
+
+	for (i = 0; i < rc->files_nr; i++) {
+		struct rename_cache_file *f = rc->files[i];
+
+		for (pos = 0; pos < f->num_blobs; pos++) {
+			struct write_entry *e;
+
+			ALLOC_GROW(ctx.entries, ctx.nr + 1, alloc);
+			e = &ctx.entries[ctx.nr];
+			oidread(&e->oid, f->chunk_oid_lookup +
+					 st_mult(pos, the_hash_algo->rawsz));
+			if (!get_fingerprint(f, pos, &e->fp))
+				ctx.nr++;
+		}
+	}
+	add_pending_entries(rc, &ctx, &alloc);
+
+	/* forget about blobs that have since been pruned */
+	for (i = nr = 0; i < ctx.nr; i++)
+		if (has_object(r, &ctx.entries[i].oid, 0))
+			ctx.entries[nr++] = ctx.entries[i];
+	ctx.nr = nr;
+
+	if (ctx.nr && write_rename_cache_file(r, &ctx, &path)) {
+		ret = -1;
+		goto done;
+	}
+
+	for (i = 0; i < rc->files_nr; i++) {
+		if (strcmp(rc->files[i]->path, path.buf))
+			unlink_or_warn(rc->files[i]->path);
+		free_rename_cache_file(rc->files[i]);
+	}
+	rc->files_nr = 0;
+	clear_pending(rc);
+	load_rename_cache_file(rc, path.buf);
+
+done:
+	free(ctx.entries);
+	strbuf_release(&path);
+	return ret;
+}
+
+void rename_cache_clear(struct raw_object_store *o)
+{
+	struct rename_cache *rc = o->rename_cache;
+	size_t i;
+
+	if (!rc)
+		return;
+
+	for (i = 0; i < rc->files_nr; i++)
+		free_rename_cache_file(rc->files[i]);
+	free(rc->files);
+	oidmap_free(&rc->pending, 1);
+	FREE_AND_NULL(o->rename_cache);
+}
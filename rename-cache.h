@@ -0,0 +1,72 @@
+#ifndef RENAME_CACHE_H
+#define RENAME_CACHE_H
+
+#include "git-compat-util.h"
+
+struct object_id;
+struct raw_object_store;
+struct repository;
+
+/*
+ * The rename cache remembers the fingerprints ("spanhashes", see
+ * diffcore-delta.c) that inexact rename detection computes for blobs,
+ * so that comparing the same blobs again (e.g. in every step of a
+ * rebase across a large refactoring) does not need to read and hash
+ * them again. It is enabled with the `diff.renameCache` configuration
+ * variable and lives in "$GIT_OBJECT_DIRECTORY/info/rename-cache/".
+ *
+ * A fingerprint is a list of (hash value, count) pairs sorted by hash
+ * value. The pairs are stored as 32-bit integers in network byte order.
+ */
+
+/* the blob looks binary when sniffed with buffer_is_binary() */
+#define RENAME_CACHE_BINARY	(1u << 0)
+/* the fingerprint was computed treating the blob as text */
+#define RENAME_CACHE_TEXT	(1u << 1)
+/* the blob has CRLF line endings, so the two differ */
+#define RENAME_CACHE_CRLF	(1u << 2)
+
+struct rename_fingerprint {
+	unsigned flags;
+	size_t nr; /* number of pairs */
+	const unsigned char *pairs;
+};
+
+/*
+ * Look up the fingerprint of a blob. Returns 0 and fills in "fp" if it
+ * is known, -1 otherwise. The pairs stay valid until the object store
+ * is closed.
+ */
+int rename_cache_lookup(struct repository *r, const struct object_id *oid,
+			struct rename_fingerprint *fp);
+
+/*
+ * Remember the fingerprint of a blob. "pairs" holds "nr" pairs in host
+ * byte order. Nothing is written until rename_cache_flush().
+ */
+void rename_cache_add(struct repository *r, const struct object_id *oid,
+		      unsigned flags, const uint32_t *pairs, size_t nr);
+
+/*
+ * Write out the fingerprints remembered so far into a new cache file,
+ * unless there are only a few of them and "force" is not given, in
+ * which case they are kept around for the next call. Fingerprints that
+ * are still pending when the object store is cleared are dropped.
+ *
+ * The lookups made since the last call are reported via trace2.
+ */
+void rename_cache_flush(struct repository *r, int force);
+
+/* Count the cache files, for "git maintenance run --auto". */
+int rename_cache_count_files(struct repository *r);
+
+/*
+ * Combine all cache files into a single one, dropping the fingerprints
+ * of blobs that are no longer in the repository.
+ */
+int rename_cache_compact(struct repository *r);
+
+/* Free the cache of the object store, without writing anything. */
+void rename_cache_clear(struct raw_object_store *o);
+
+#endif
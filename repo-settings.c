@@ -18,6 +18,7 @@ void prepare_repo_settings(struct repository *r)
 	int value;
 	char *strval;
 	int manyfiles;
+	int is_bool;
 
 	if (!r->gitdir)
 		BUG("Cannot add settings for uninitialized repository");
@@ -28,6 +29,7 @@ void prepare_repo_settings(struct repository *r)
 	/* Defaults */
 	r->settings.index_version = -1;
 	r->settings.core_untracked_cache = UNTRACKED_CACHE_KEEP;
+	r->settings.core_untracked_threads = 1;
 	r->settings.fetch_negotiation_algorithm = FETCH_NEGOTIATION_CONSECUTIVE;
 
 	/* Booleans config or default, cascades to other settings */
@@ -75,6 +77,9 @@ void prepare_repo_settings(struct repository *r)
 	repo_cfg_bool(r, "pack.usesparse", &r->settings.pack_use_sparse, 1);
 	repo_cfg_bool(r, "core.multipackindex", &r->settings.core_multi_pack_index, 1);
 	repo_cfg_bool(r, "index.sparse", &r->settings.sparse_index, 0);
+	repo_cfg_bool(r, "diff.renamecache", &r->settings.diff_rename_cache, 0);
+	repo_cfg_bool(r, "core.fsmonitorstatcache", &r->settings.core_fsmonitor_stat_cache, 0);
+	repo_cfg_bool(r, "core.splituntrackedcache", &r->settings.core_split_untracked_cache, 0);
 
 	/*
 	 * The GIT_TEST_MULTI_PACK_INDEX variable is special in that
@@ -106,6 +111,22 @@ void prepare_repo_settings(struct repository *r)
 		free(strval);
 	}
 
+	if (!repo_config_get_bool_or_int(r, "core.untrackedthreads",
+					 &is_bool, &value)) {
+		if (is_bool)
+			r->settings.core_untracked_threads = value ? 0 : 1;
+		else if (value < 0)
+			die(_("invalid value for '%s': %d"),
+			    "core.untrackedThreads", value);
+		else
+			r->settings.core_untracked_threads = value;
+	}
+	value = git_env_ulong("GIT_TEST_UNTRACKED_THREADS", 0);
+	if (value)
+		r->settings.core_untracked_threads = value;
+	if (git_env_bool("GIT_TEST_SPLIT_UNTRACKED_CACHE", 0))
+		r->settings.core_split_untracked_cache = 1;
+
 	if (!repo_config_get_string(r, "fetch.negotiationalgorithm", &strval)) {
 		int fetch_default = r->settings.fetch_negotiation_algorithm;
 		if (!strcasecmp(strval, "skipping"))
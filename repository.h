@@ -37,9 +37,14 @@ struct repo_settings {
 	int sparse_index;
 
 	struct fsmonitor_settings *fsmonitor; /* lazily loaded */
+	int core_fsmonitor_stat_cache;
 
 	int index_version;
 	enum untracked_cache_setting core_untracked_cache;
+	int core_untracked_threads;
+	int core_split_untracked_cache;
+
+	int diff_rename_cache;
 
 	int pack_use_sparse;
 	enum fetch_negotiation_setting fetch_negotiation_algorithm;
@@ -149,6 +154,12 @@ struct repository {
 	/* Repository's current hash algorithm, as serialized on disk. */
 	const struct git_hash_algo *hash_algo;
 
+	/*
+	 * Name of the backend the references are stored in, as serialized
+	 * on disk. NULL means the default "files" backend.
+	 */
+	char *ref_storage_format;
+
 	/* A unique-id for tracing purposes. */
 	int trace2_repo_id;
 
@@ -184,6 +195,7 @@ void repo_set_gitdir(struct repository *repo, const char *root,
 		     const struct set_gitdir_args *extra_args);
 void repo_set_worktree(struct repository *repo, const char *path);
 void repo_set_hash_algo(struct repository *repo, int algo);
+void repo_set_ref_storage_format(struct repository *repo, const char *format);
 void initialize_the_repository(void);
 int repo_init(struct repository *r, const char *gitdir, const char *worktree);
 
@@ -33,6 +33,8 @@
 #include "bloom.h"
 #include "json-writer.h"
 #include "list-objects-filter-options.h"
+#include "list.h"
+#include "thread-utils.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -610,7 +612,11 @@ static struct commit *one_relevant_parent(const struct rev_info *revs,
 #define REV_TREE_NEW		1	/* Only new files */
 #define REV_TREE_OLD		2	/* Only files removed */
 #define REV_TREE_DIFFERENT	3	/* Mixed changes */
-static int tree_difference = REV_TREE_SAME;
+
+struct tree_difference {
+	int remove_empty_trees;
+	int result;
+};
 
 static void file_add_remove(struct diff_options *options,
 		    int addremove, unsigned mode,
@@ -619,10 +625,10 @@ static void file_add_remove(struct diff_options *options,
 		    const char *fullpath, unsigned dirty_submodule)
 {
 	int diff = addremove == '+' ? REV_TREE_NEW : REV_TREE_OLD;
-	struct rev_info *revs = options->change_fn_data;
+	struct tree_difference *td = options->change_fn_data;
 
-	tree_difference |= diff;
-	if (!revs->remove_empty_trees || tree_difference != REV_TREE_NEW)
+	td->result |= diff;
+	if (!td->remove_empty_trees || td->result != REV_TREE_NEW)
 		options->flags.has_changes = 1;
 }
 
@@ -634,10 +640,374 @@ static void file_change(struct diff_options *options,
 		 const char *fullpath,
 		 unsigned old_dirty_submodule, unsigned new_dirty_submodule)
 {
-	tree_difference = REV_TREE_DIFFERENT;
+	struct tree_difference *td = options->change_fn_data;
+
+	td->result = REV_TREE_DIFFERENT;
 	options->flags.has_changes = 1;
 }
 
+/*
+ * Compare two trees using the "pruning" diff options "opt" and return
+ * one of the REV_TREE_* values above. A NULL "old_oid" stands for the
+ * empty tree.
+ *
+ * All the state of the comparison lives on the stack and in "opt", so
+ * this can be called from several threads at once, as long as each of
+ * them has its own copy of the diff options.
+ */
+static int compute_tree_difference(struct diff_options *opt,
+				   int remove_empty_trees,
+				   const struct object_id *old_oid,
+				   const struct object_id *new_oid)
+{
+	struct tree_difference td = {
+		.remove_empty_trees = remove_empty_trees,
+		.result = REV_TREE_SAME,
+	};
+
+	opt->change_fn_data = &td;
+	opt->flags.has_changes = 0;
+	diff_tree_oid(old_oid, new_oid, "", opt);
+	opt->change_fn_data = NULL;
+
+	return td.result;
+}
+
+/*
+ * Tree-diff prefetching.
+ *
+ * Without changed-path Bloom filters, history simplification runs one
+ * tree diff per commit and parent, one after the other, in the thread
+ * that walks the history. With "--tree-diff-threads=<n>", commits are
+ * handed to a pool of worker threads as soon as they are queued for the
+ * walk, and the workers compare their trees with those of their parents
+ * while the walk is still busy with newer commits. By the time the walk
+ * gets to such a commit, rev_compare_tree() usually only needs to pick
+ * up the result.
+ *
+ * The result of a comparison depends on nothing but the two tree ids
+ * and the (fixed) pruning options, so results are keyed by the pair of
+ * trees and it does not matter if the walk later rewrites parents or
+ * stops being interested in a commit: a stale result is never used, it
+ * just wastes some work.
+ */
+enum tree_diff_state {
+	TREE_DIFF_QUEUED,
+	TREE_DIFF_RUNNING,
+	TREE_DIFF_DONE,
+};
+
+struct tree_diff_entry {
+	struct hashmap_entry ent;
+	struct list_head queue;
+	struct object_id old_oid; /* null for the empty tree */
+	struct object_id new_oid;
+	enum tree_diff_state state;
+	int result;
+};
+
+struct tree_diff_worker {
+	struct tree_diff_prefetch *pf;
+	struct diff_options opt;
+	pthread_t thread;
+};
+
+struct tree_diff_prefetch {
+	struct repository *repo;
+	int remove_empty_trees;
+
+	struct tree_diff_worker *workers;
+	int nr_workers;
+
+	/* everything below is protected by "mutex" */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct hashmap entries;
+	struct list_head queue;
+	int queue_nr;
+	int queue_max;
+	int stop;
+
+	/* whether we turned on the object read lock ourselves */
+	unsigned enabled_obj_read_lock : 1;
+
+	/* statistics, only touched by the walking thread */
+	unsigned hit, wait, miss;
+};
+
+static int tree_diff_entry_cmp(const void *cmp_data,
+			       const struct hashmap_entry *eptr,
+			       const struct hashmap_entry *entry_or_key,
+			       const void *keydata)
+{
+	const struct tree_diff_entry *a, *b;
+
+	a = container_of(eptr, const struct tree_diff_entry, ent);
+	b = container_of(entry_or_key, const struct tree_diff_entry, ent);
+
+	return !oideq(&a->old_oid, &b->old_oid) ||
+	       !oideq(&a->new_oid, &b->new_oid);
+}
+
+static void tree_diff_entry_init(struct tree_diff_entry *e,
+				 const struct object_id *old_oid,
+				 const struct object_id *new_oid)
+{
+	oidcpy(&e->old_oid, old_oid ? old_oid : null_oid());
+	oidcpy(&e->new_oid, new_oid);
+	hashmap_entry_init(&e->ent, oidhash(&e->new_oid) ^
+				    (oidhash(&e->old_oid) * 31));
+}
+
+static void *tree_diff_worker_thread(void *data)
+{
+	struct tree_diff_worker *w = data;
+	struct tree_diff_prefetch *pf = w->pf;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		struct tree_diff_entry *e;
+		int result;
+
+		while (!pf->stop && list_empty(&pf->queue))
+			pthread_cond_wait(&pf->work_cond, &pf->mutex);
+		if (pf->stop)
+			break;
+
+		e = list_first_entry(&pf->queue, struct tree_diff_entry, queue);
+		list_del_init(&e->queue);
+		pf->queue_nr--;
+		e->state = TREE_DIFF_RUNNING;
+		pthread_mutex_unlock(&pf->mutex);
+
+		result = compute_tree_difference(&w->opt, pf->remove_empty_trees,
+						 is_null_oid(&e->old_oid) ?
+						 NULL : &e->old_oid,
+						 &e->new_oid);
+
+		pthread_mutex_lock(&pf->mutex);
+		e->result = result;
+		e->state = TREE_DIFF_DONE;
+		pthread_cond_broadcast(&pf->done_cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	return NULL;
+}
+
+static void init_tree_diff_prefetch(struct rev_info *revs)
+{
+	struct tree_diff_prefetch *pf;
+	int i;
+
+	if (!HAVE_THREADS || revs->tree_diff_threads <= 1 || !revs->prune ||
+	    revs->tree_diff_prefetch)
+		return;
+	/* The first-parent comparisons are answered by the filters. */
+	if (revs->bloom_keys_nr)
+		return;
+	/* Attribute lookups done by pathspec matching are not thread-safe. */
+	if (revs->pruning.pathspec.magic & PATHSPEC_ATTR)
+		return;
+
+	CALLOC_ARRAY(pf, 1);
+	pf->repo = revs->repo;
+	pf->remove_empty_trees = revs->remove_empty_trees;
+	pf->nr_workers = revs->tree_diff_threads;
+	pf->queue_max = 64 * pf->nr_workers;
+	INIT_LIST_HEAD(&pf->queue);
+	hashmap_init(&pf->entries, tree_diff_entry_cmp, NULL, 0);
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->work_cond, NULL);
+	pthread_cond_init(&pf->done_cond, NULL);
+
+	pf->enabled_obj_read_lock = !obj_read_use_lock;
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(pf->workers, pf->nr_workers);
+	for (i = 0; i < pf->nr_workers; i++) {
+		struct tree_diff_worker *w = &pf->workers[i];
+		int err;
+
+		w->pf = pf;
+		memcpy(&w->opt, &revs->pruning, sizeof(w->opt));
+		err = pthread_create(&w->thread, NULL,
+				     tree_diff_worker_thread, w);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	trace2_data_intmax("revision", revs->repo,
+			   "tree-diff-prefetch/threads", pf->nr_workers);
+	revs->tree_diff_prefetch = pf;
+}
+
+/*
+ * Stop the workers and free the prefetcher. Comparisons that have not
+ * been started yet are dropped; the workers only finish the ones they
+ * are running, which still use the pathspec in "revs->pruning".
+ */
+static void release_tree_diff_prefetch(struct rev_info *revs)
+{
+	struct tree_diff_prefetch *pf = revs->tree_diff_prefetch;
+	int i;
+
+	if (!pf)
+		return;
+	revs->tree_diff_prefetch = NULL;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->stop = 1;
+	INIT_LIST_HEAD(&pf->queue);
+	pf->queue_nr = 0;
+	pthread_cond_broadcast(&pf->work_cond);
+	pthread_mutex_unlock(&pf->mutex);
+
+	for (i = 0; i < pf->nr_workers; i++)
+		if (pthread_join(pf->workers[i].thread, NULL))
+			die(_("unable to join thread"));
+
+	if (pf->enabled_obj_read_lock)
+		disable_obj_read_lock();
+
+	trace2_data_intmax("revision", pf->repo, "tree-diff-prefetch/hit",
+			   pf->hit);
+	trace2_data_intmax("revision", pf->repo, "tree-diff-prefetch/wait",
+			   pf->wait);
+	trace2_data_intmax("revision", pf->repo, "tree-diff-prefetch/miss",
+			   pf->miss);
+
+	hashmap_clear_and_free(&pf->entries, struct tree_diff_entry, ent);
+	pthread_cond_destroy(&pf->work_cond);
+	pthread_cond_destroy(&pf->done_cond);
+	pthread_mutex_destroy(&pf->mutex);
+	free(pf->workers);
+	free(pf);
+}
+
+static void queue_tree_diff(struct tree_diff_prefetch *pf,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid)
+{
+	struct tree_diff_entry key, *e;
+
+	tree_diff_entry_init(&key, old_oid, new_oid);
+
+	pthread_mutex_lock(&pf->mutex);
+	if (pf->queue_nr < pf->queue_max &&
+	    !hashmap_get(&pf->entries, &key.ent, NULL)) {
+		CALLOC_ARRAY(e, 1);
+		tree_diff_entry_init(e, old_oid, new_oid);
+		e->state = TREE_DIFF_QUEUED;
+		hashmap_add(&pf->entries, &e->ent);
+		list_add_tail(&e->queue, &pf->queue);
+		pf->queue_nr++;
+		pthread_cond_signal(&pf->work_cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+/*
+ * Queue the comparisons that try_to_simplify_commit() is going to need
+ * for "commit", which has just been added to the list of commits to walk.
+ */
+static void prefetch_tree_diffs(struct rev_info *revs, struct commit *commit)
+{
+	struct commit_list *p;
+	struct tree *tree;
+
+	if (!revs->tree_diff_prefetch ||
+	    (commit->object.flags & UNINTERESTING))
+		return;
+
+	tree = get_commit_tree(commit);
+	if (!tree)
+		return;
+
+	if (!commit->parents) {
+		queue_tree_diff(revs->tree_diff_prefetch, NULL, &tree->object.oid);
+		return;
+	}
+	if (!revs->dense && !commit->parents->next)
+		return;
+
+	for (p = commit->parents; p; p = p->next) {
+		struct tree *t;
+
+		if (repo_parse_commit_gently(revs->repo, p->item, 1) < 0)
+			break;
+		t = get_commit_tree(p->item);
+		if (t)
+			queue_tree_diff(revs->tree_diff_prefetch,
+					&t->object.oid, &tree->object.oid);
+		if (revs->first_parent_only)
+			break;
+	}
+}
+
+/*
+ * Return the prefetched result of comparing the two trees, waiting for
+ * it if a worker is busy computing it, or -1 if the comparison has not
+ * been started yet. Either way, the entry is dropped.
+ */
+static int tree_diff_prefetch_result(struct tree_diff_prefetch *pf,
+				     const struct object_id *old_oid,
+				     const struct object_id *new_oid)
+{
+	struct tree_diff_entry key, *e;
+	int result = -1;
+
+	tree_diff_entry_init(&key, old_oid, new_oid);
+
+	pthread_mutex_lock(&pf->mutex);
+	e = hashmap_get_entry(&pf->entries, &key, ent, NULL);
+	if (!e) {
+		pf->miss++;
+		goto out;
+	}
+
+	switch (e->state) {
+	case TREE_DIFF_QUEUED:
+		/* Not started yet; doing it ourselves is quicker. */
+		list_del(&e->queue);
+		pf->queue_nr--;
+		pf->miss++;
+		break;
+	case TREE_DIFF_RUNNING:
+		pf->wait++;
+		while (e->state != TREE_DIFF_DONE)
+			pthread_cond_wait(&pf->done_cond, &pf->mutex);
+		result = e->result;
+		break;
+	case TREE_DIFF_DONE:
+		pf->hit++;
+		result = e->result;
+		break;
+	}
+	hashmap_remove(&pf->entries, &e->ent, NULL);
+	free(e);
+
+out:
+	pthread_mutex_unlock(&pf->mutex);
+	return result;
+}
+
+static int rev_tree_difference(struct rev_info *revs,
+			       const struct object_id *old_oid,
+			       const struct object_id *new_oid)
+{
+	if (revs->tree_diff_prefetch) {
+		int result = tree_diff_prefetch_result(revs->tree_diff_prefetch,
+						       old_oid, new_oid);
+		if (result >= 0)
+			return result;
+	}
+
+	return compute_tree_difference(&revs->pruning, revs->remove_empty_trees,
+				       old_oid, new_oid);
+}
+
 static int bloom_filter_atexit_registered;
 static unsigned int count_bloom_filter_maybe;
 static unsigned int count_bloom_filter_definitely_not;
@@ -788,6 +1158,7 @@ static int rev_compare_tree(struct rev_info *revs,
 	struct tree *t1 = get_commit_tree(parent);
 	struct tree *t2 = get_commit_tree(commit);
 	int bloom_ret = 1;
+	int ret;
 
 	if (!t1)
 		return REV_TREE_NEW;
@@ -819,15 +1190,13 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	tree_difference = REV_TREE_SAME;
-	revs->pruning.flags.has_changes = 0;
-	diff_tree_oid(&t1->object.oid, &t2->object.oid, "", &revs->pruning);
+	ret = rev_tree_difference(revs, &t1->object.oid, &t2->object.oid);
 
 	if (!nth_parent)
-		if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+		if (bloom_ret == 1 && ret == REV_TREE_SAME)
 			count_bloom_filter_false_positive++;
 
-	return tree_difference;
+	return ret;
 }
 
 static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit)
@@ -837,11 +1206,7 @@ static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit)
 	if (!t1)
 		return 0;
 
-	tree_difference = REV_TREE_SAME;
-	revs->pruning.flags.has_changes = 0;
-	diff_tree_oid(NULL, &t1->object.oid, "", &revs->pruning);
-
-	return tree_difference == REV_TREE_SAME;
+	return rev_tree_difference(revs, NULL, &t1->object.oid) == REV_TREE_SAME;
 }
 
 struct treesame_state {
@@ -1187,6 +1552,7 @@ static int process_parents(struct rev_info *revs, struct commit *commit,
 				commit_list_insert_by_date(p, list);
 			if (queue)
 				prio_queue_put(queue, p);
+			prefetch_tree_diffs(revs, p);
 		}
 		if (revs->first_parent_only)
 			break;
@@ -1839,7 +2205,6 @@ void repo_init_revisions(struct repository *r,
 	revs->pruning.flags.quick = 1;
 	revs->pruning.add_remove = file_add_remove;
 	revs->pruning.change = file_change;
-	revs->pruning.change_fn_data = revs;
 	revs->sort_order = REV_SORT_IN_GRAPH_ORDER;
 	revs->dense = 1;
 	revs->prefix = prefix;
@@ -2480,6 +2845,13 @@ static int handle_revision_opt(struct rev_info *revs, int argc, const char **arg
 		revs->full_diff = 1;
 	} else if (!strcmp(arg, "--show-pulls")) {
 		revs->show_pulls = 1;
+	} else if ((argcount = parse_long_opt("tree-diff-threads", argv, &optarg))) {
+		if (strtol_i(optarg, 10, &revs->tree_diff_threads) < 0 ||
+		    revs->tree_diff_threads < 0)
+			die(_("invalid number of threads specified (%s)"), optarg);
+		if (!revs->tree_diff_threads)
+			revs->tree_diff_threads = online_cpus();
+		return argcount;
 	} else if (!strcmp(arg, "--full-history")) {
 		revs->simplify_history = 0;
 	} else if (!strcmp(arg, "--relative-date")) {
@@ -2963,6 +3335,8 @@ void release_revisions(struct rev_info *revs)
 	date_mode_release(&revs->date_mode);
 	release_revisions_mailmap(revs->mailmap);
 	free_grep_patterns(&revs->grep_filter);
+	/* the prefetch workers use "pruning", so stop them first */
+	release_tree_diff_prefetch(revs);
 	/* TODO (need to handle "no_free"): diff_free(&revs->diffopt) */
 	diff_free(&revs->pruning);
 	reflog_walk_info_release(revs->reflog_info);
@@ -3664,6 +4038,12 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
+	init_tree_diff_prefetch(revs);
+	if (revs->tree_diff_prefetch) {
+		struct commit_list *p;
+		for (p = revs->commits; p; p = p->next)
+			prefetch_tree_diffs(revs, p->item);
+	}
 	if (revs->limited) {
 		if (limit_list(revs) < 0)
 			return -1;
@@ -4255,6 +4635,7 @@ struct commit *get_revision(struct rev_info *revs)
 		reversed = NULL;
 		while ((c = get_revision_internal(revs)))
 			commit_list_insert(c, &reversed);
+		release_tree_diff_prefetch(revs);
 		revs->commits = reversed;
 		revs->reverse = 0;
 		revs->reverse_output_stage = 1;
@@ -4274,6 +4655,8 @@ struct commit *get_revision(struct rev_info *revs)
 		free_saved_parents(revs);
 		free_commit_list(revs->previous_parents);
 		revs->previous_parents = NULL;
+		/* the walk is over, so no prefetched diff will be used */
+		release_tree_diff_prefetch(revs);
 	}
 	return c;
 }
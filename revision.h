@@ -82,6 +82,7 @@ struct rev_cmdline_info {
 
 struct oidset;
 struct topo_walk_info;
+struct tree_diff_prefetch;
 
 struct rev_info {
 	/* Starting list */
@@ -323,6 +324,14 @@ struct rev_info {
 	 */
 	struct bloom_filter_settings *bloom_filter_settings;
 
+	/*
+	 * Number of threads comparing trees for history simplification
+	 * ahead of the walk ("--tree-diff-threads"); 0 and 1 both mean
+	 * that the walk does it all by itself.
+	 */
+	int tree_diff_threads;
+	struct tree_diff_prefetch *tree_diff_prefetch;
+
 	/* misc. flags related to '--no-kept-objects' */
 	unsigned keep_pack_cache_flags;
 
@@ -53,6 +53,7 @@ int cmd__dump_untracked_cache(int ac, const char **av)
 	setup_git_directory();
 	if (read_cache() < 0)
 		die("unable to read index file");
+	prepare_untracked_cache(&the_index);
 	uc = the_index.untracked;
 	if (!uc) {
 		printf("no untracked cache\n");
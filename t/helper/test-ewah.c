@@ -0,0 +1,313 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "ewah/ewok.h"
+#include "ewah/roaring.h"
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static eword_t rng(void)
+{
+	/* xorshift64*; deterministic so that failures can be reproduced */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Fill "words" with a mix of empty, full and random words, in runs, so
+ * that the EWAH encoding of the result has both kinds of runs as well as
+ * literal words.
+ */
+static void fill_words(eword_t *words, size_t nr)
+{
+	size_t i = 0;
+
+	while (i < nr) {
+		size_t run = rng() % 8 + 1;
+		int kind = rng() % 3;
+
+		for (; run && i < nr; run--, i++)
+			words[i] = kind == 0 ? 0 : kind == 1 ? ~(eword_t)0 : rng();
+	}
+}
+
+static struct bitmap *random_bitmap(size_t nr)
+{
+	struct bitmap *b = bitmap_word_alloc(nr ? nr : 1);
+	fill_words(b->words, nr);
+	return b;
+}
+
+static int check_kernels(const char *name)
+{
+	static const size_t sizes[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 31, 64, 65, 1000 };
+	eword_t a[1024 + 3], b[1024 + 3], expect[1024 + 3], actual[1024 + 3];
+	size_t s, off;
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		for (off = 0; off < 4; off++) {
+			size_t nr = sizes[s], e_pop, a_pop;
+
+			fill_words(a, nr + off);
+			fill_words(b, nr + off);
+
+			ewah_words_select("scalar");
+			COPY_ARRAY(expect, a, nr + off);
+			ewah_words_or(expect + off, b + off, nr);
+			if (ewah_words_select(name) < 0)
+				return -1;
+			COPY_ARRAY(actual, a, nr + off);
+			ewah_words_or(actual + off, b + off, nr);
+			if (memcmp(expect, actual, (nr + off) * sizeof(eword_t)))
+				return error("%s: or of %"PRIuMAX" words at offset %"PRIuMAX,
+					     name, (uintmax_t)nr, (uintmax_t)off);
+
+			ewah_words_select("scalar");
+			COPY_ARRAY(expect, a, nr + off);
+			ewah_words_and_not(expect + off, b + off, nr);
+			ewah_words_select(name);
+			COPY_ARRAY(actual, a, nr + off);
+			ewah_words_and_not(actual + off, b + off, nr);
+			if (memcmp(expect, actual, (nr + off) * sizeof(eword_t)))
+				return error("%s: and-not of %"PRIuMAX" words at offset %"PRIuMAX,
+					     name, (uintmax_t)nr, (uintmax_t)off);
+
+			ewah_words_select("scalar");
+			ewah_words_xor(expect + off, a + off, b, nr);
+			e_pop = ewah_words_popcount(a + off, nr);
+			ewah_words_select(name);
+			ewah_words_xor(actual + off, a + off, b, nr);
+			a_pop = ewah_words_popcount(a + off, nr);
+			if (memcmp(expect + off, actual + off, nr * sizeof(eword_t)))
+				return error("%s: xor of %"PRIuMAX" words at offset %"PRIuMAX,
+					     name, (uintmax_t)nr, (uintmax_t)off);
+			if (e_pop != a_pop)
+				return error("%s: popcount of %"PRIuMAX" words at offset %"PRIuMAX,
+					     name, (uintmax_t)nr, (uintmax_t)off);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Check the operations that mix compressed and uncompressed bitmaps
+ * against a plain expansion through ewah_iterator.
+ */
+static int check_bitmaps(const char *name)
+{
+	size_t nr;
+
+	if (ewah_words_select(name) < 0)
+		return -1;
+
+	for (nr = 1; nr < 300; nr += 37) {
+		struct bitmap *x = random_bitmap(nr), *y = random_bitmap(nr / 2 + 1);
+		struct ewah_bitmap *ex = bitmap_to_ewah(x), *ey = bitmap_to_ewah(y);
+		struct ewah_bitmap *exy = ewah_new();
+		struct bitmap *expect = bitmap_dup(y), *actual = bitmap_dup(y);
+		struct bitmap *xored;
+		struct ewah_iterator it;
+		eword_t word;
+		size_t i = 0;
+		int ret = 0;
+
+		ewah_iterator_init(&it, ex);
+		while (ewah_iterator_next(&word, &it)) {
+			if (i >= expect->word_alloc) {
+				REALLOC_ARRAY(expect->words, i + 1);
+				expect->words[i] = 0;
+				expect->word_alloc = i + 1;
+			}
+			expect->words[i++] |= word;
+		}
+		bitmap_or_ewah(actual, ex);
+		if (!bitmap_equals(expect, actual))
+			ret = error("%s: bitmap_or_ewah of %"PRIuMAX" words",
+				    name, (uintmax_t)nr);
+
+		ewah_xor(ex, ey, exy);
+		xored = ewah_to_bitmap(exy);
+		for (i = 0; !ret && i < nr; i++) {
+			eword_t want = x->words[i] ^
+				(i < y->word_alloc ? y->words[i] : 0);
+			if ((i < xored->word_alloc ? xored->words[i] : 0) != want)
+				ret = error("%s: ewah_xor of %"PRIuMAX" words",
+					    name, (uintmax_t)nr);
+		}
+
+		bitmap_free(x);
+		bitmap_free(y);
+		bitmap_free(expect);
+		bitmap_free(actual);
+		bitmap_free(xored);
+		ewah_free(ex);
+		ewah_free(ey);
+		ewah_free(exy);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int write_strbuf(void *out, const void *buf, size_t len)
+{
+	strbuf_add(out, buf, len);
+	return len;
+}
+
+/*
+ * Round-trip bitmaps through the Roaring encoding. The three shapes
+ * make the writer pick each of the container types: sparse chunks are
+ * stored as arrays, random ones as bitsets and runs of full words as
+ * runs.
+ */
+static int check_roaring(const char *name)
+{
+	static const size_t sizes[] = { 1, 7, 1024, 1025, 3000 };
+	size_t s, shape;
+
+	if (ewah_words_select(name) < 0)
+		return -1;
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		for (shape = 0; shape < 3; shape++) {
+			size_t nr = sizes[s], i, pos;
+			struct bitmap *b = bitmap_word_alloc(nr), *back;
+			struct bitmap *ored = random_bitmap(nr / 3 + 1);
+			struct bitmap *expect = bitmap_dup(ored);
+			struct roaring_bitmap r;
+			struct strbuf buf = STRBUF_INIT;
+			int ret = 0;
+
+			if (shape == 0) {
+				for (i = 0; i < nr; i++)
+					bitmap_set(b, rng() % (nr * BITS_IN_EWORD));
+			} else if (shape == 1) {
+				fill_words(b->words, nr);
+			} else {
+				for (i = 0; i < nr; i++)
+					b->words[i] = (i / 16) % 2 ? ~(eword_t)0 : 0;
+				b->words[nr - 1] |= (eword_t)1 << 63;
+			}
+
+			if (roaring_serialize_to(b, write_strbuf, &buf) != buf.len ||
+			    roaring_read_mmap(&r, buf.buf, buf.len) != buf.len)
+				ret = error("%s: roaring encoding of %"PRIuMAX" words",
+					    name, (uintmax_t)nr);
+
+			if (!ret) {
+				back = roaring_to_bitmap(&r);
+				if (!bitmap_equals(b, back) ||
+				    roaring_popcount(&r) != bitmap_popcount(b))
+					ret = error("%s: roaring round-trip of %"PRIuMAX" words",
+						    name, (uintmax_t)nr);
+				bitmap_free(back);
+			}
+
+			for (pos = 0; !ret && pos < nr * BITS_IN_EWORD; pos += 13) {
+				if (roaring_get(&r, pos) != bitmap_get(b, pos))
+					ret = error("%s: roaring_get(%"PRIuMAX")",
+						    name, (uintmax_t)pos);
+			}
+
+			if (!ret) {
+				bitmap_or(expect, b);
+				bitmap_or_roaring(ored, &r);
+				if (!bitmap_equals(expect, ored))
+					ret = error("%s: bitmap_or_roaring of %"PRIuMAX" words",
+						    name, (uintmax_t)nr);
+			}
+
+			strbuf_release(&buf);
+			bitmap_free(b);
+			bitmap_free(ored);
+			bitmap_free(expect);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_verify(void)
+{
+	const char *name;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; (name = ewah_words_impl_name(i)); i++) {
+		if (ewah_words_select(name) < 0) {
+			printf("%s: unsupported\n", name);
+			continue;
+		}
+		if (check_kernels(name) || check_bitmaps(name) ||
+		    check_roaring(name))
+			ret = 1;
+		else
+			printf("%s: ok\n", name);
+	}
+
+	return ret;
+}
+
+#define SPEED_WORDS (1 << 14)
+#define SPEED_NS (1000 * 1000 * 1000ULL / 2)
+
+static void report(const char *op, uint64_t iters, uint64_t elapsed)
+{
+	double words = (double)iters * SPEED_WORDS;
+	printf("  %-10s %8.0f Mwords/s\n", op, words * 1000 / elapsed);
+}
+
+static int cmd_speed(void)
+{
+	eword_t *a, *b, *out;
+	const char *name;
+	size_t i;
+
+	ALLOC_ARRAY(a, SPEED_WORDS);
+	ALLOC_ARRAY(b, SPEED_WORDS);
+	ALLOC_ARRAY(out, SPEED_WORDS);
+	fill_words(a, SPEED_WORDS);
+	fill_words(b, SPEED_WORDS);
+
+	for (i = 0; (name = ewah_words_impl_name(i)); i++) {
+		uint64_t start, iters;
+
+		if (ewah_words_select(name) < 0)
+			continue;
+		printf("%s:\n", name);
+
+#define TIME(op, expr) \
+		for (iters = 0, start = getnanotime(); \
+		     getnanotime() - start < SPEED_NS; iters++) \
+			expr; \
+		report(op, iters, getnanotime() - start)
+
+		TIME("or", ewah_words_or(out, a, SPEED_WORDS));
+		TIME("and-not", ewah_words_and_not(out, b, SPEED_WORDS));
+		TIME("xor", ewah_words_xor(out, a, b, SPEED_WORDS));
+		TIME("popcount", ewah_words_popcount(a, SPEED_WORDS));
+#undef TIME
+	}
+
+	free(a);
+	free(b);
+	free(out);
+	return 0;
+}
+
+int cmd__ewah(int argc, const char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "verify"))
+		return cmd_verify();
+	if (argc == 2 && !strcmp(argv[1], "speed"))
+		return cmd_speed();
+
+	usage("\ttest-tool ewah verify\n"
+	      "\ttest-tool ewah speed");
+}
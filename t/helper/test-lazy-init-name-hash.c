@@ -9,6 +9,7 @@ static int dump;
 static int perf;
 static int analyze;
 static int analyze_step;
+static int lookup;
 
 /*
  * Dump the contents of the "dir" and "name" hash tables to stdout.
@@ -101,6 +102,61 @@ static uint64_t time_runs(int try_threaded)
 	return avg;
 }
 
+/*
+ * Build the hash tables once (with the threaded code if "try_threaded")
+ * and then time case-insensitive lookups of every index entry (and its
+ * leading directories) "count" times, using an upper-cased copy of each
+ * name.
+ */
+static void time_lookups(int try_threaded)
+{
+	uint64_t t0, t1;
+	uint64_t sum = 0;
+	struct strbuf buf = STRBUF_INIT;
+	int found;
+	int nr_threads_used;
+	int i, k;
+
+	read_cache();
+	nr_threads_used = test_lazy_init_name_hash(&the_index, try_threaded);
+	if (try_threaded && !nr_threads_used)
+		die("non-threaded code path used");
+
+	for (i = 0; i < count; i++) {
+		found = 0;
+		t0 = getnanotime();
+		for (k = 0; k < the_index.cache_nr; k++) {
+			const struct cache_entry *ce = the_index.cache[k];
+			size_t j;
+
+			strbuf_reset(&buf);
+			strbuf_add(&buf, ce->name, ce_namelen(ce));
+			for (j = 0; j < buf.len; j++)
+				buf.buf[j] = toupper(buf.buf[j]);
+
+			if (index_file_exists(&the_index, buf.buf, buf.len, 1))
+				found++;
+			adjust_dirname_case(&the_index, buf.buf);
+		}
+		t1 = getnanotime();
+		sum += (t1 - t0);
+
+		printf("%f %d lookup %s %d\n",
+			   ((double)(t1 - t0))/1000000000,
+			   the_index.cache_nr,
+			   nr_threads_used ? "multi" : "single", found);
+		fflush(stdout);
+	}
+
+	if (count > 1)
+		printf("avg %f lookup %s\n",
+			   (double)(sum / count)/1000000000,
+			   nr_threads_used ? "multi" : "single");
+
+	strbuf_release(&buf);
+	discard_cache();
+}
+
 /*
  * Try a series of runs varying the "istate->cache_nr" and
  * try to find a good value for the multi-threaded criteria.
@@ -189,6 +245,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		"test-tool lazy-init-name-hash -a a [--step s] [-c c]",
 		"test-tool lazy-init-name-hash (-s | -m) [-c c]",
 		"test-tool lazy-init-name-hash -s -m [-c c]",
+		"test-tool lazy-init-name-hash -l [-s | -m] [-c c]",
 		NULL
 	};
 	struct option options[] = {
@@ -199,6 +256,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		OPT_BOOL('p', "perf", &perf, "compare single vs multi"),
 		OPT_INTEGER('a', "analyze", &analyze, "analyze different multi sizes"),
 		OPT_INTEGER(0, "step", &analyze_step, "analyze step factor"),
+		OPT_BOOL('l', "lookup", &lookup, "time case-insensitive lookups"),
 		OPT_END(),
 	};
 	const char *prefix;
@@ -249,6 +307,13 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		return 0;
 	}
 
+	if (lookup) {
+		if (single && multi)
+			die("cannot use both single and multi with lookup");
+		time_lookups(multi);
+		return 0;
+	}
+
 	if (!single && !multi)
 		die("require either -s or -m or both");
 
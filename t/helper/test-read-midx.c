@@ -16,6 +16,17 @@ static int read_midx_file(const char *object_dir, int show_objects)
 	if (!m)
 		return 1;
 
+	if (m->incremental) {
+		struct multi_pack_index *layer;
+		uint32_t num_layers = 0;
+
+		for (layer = m; layer; layer = layer->base_midx)
+			num_layers++;
+		printf("chain: %"PRIu32" layers, %"PRIu32" packs and %"PRIu32" objects in base\n",
+		       num_layers, m->num_packs_in_base,
+		       m->num_objects_in_base);
+	}
+
 	printf("header: %08x %d %d %d %d\n",
 	       m->signature,
 	       m->version,
@@ -35,6 +46,8 @@ static int read_midx_file(const char *object_dir, int show_objects)
 		printf(" object-offsets");
 	if (m->chunk_large_offsets)
 		printf(" large-offsets");
+	if (m->chunk_base_midxs)
+		printf(" base-midxs");
 
 	printf("\nnum_objects: %d\n", m->num_objects);
 
@@ -48,7 +61,8 @@ static int read_midx_file(const char *object_dir, int show_objects)
 		struct object_id oid;
 		struct pack_entry e;
 
-		for (i = 0; i < m->num_objects; i++) {
+		for (i = m->num_objects_in_base;
+		     i < m->num_objects_in_base + m->num_objects; i++) {
 			nth_midxed_object_oid(&oid, m, i);
 			fill_midx_entry(the_repository, &oid, &e, m);
 
@@ -28,4 +28,9 @@ test_perf 'log -S' '
 	git log --raw -Sfoo >/dev/null
 '
 
+# many threads sharing the cache
+test_perf 'cat-file --batch --threads' '
+	git cat-file --batch-all-objects --batch --threads=0 >/dev/null
+'
+
 test_done
@@ -53,4 +53,12 @@ test_perf REPO_BIG_ENOUGH_FOR_MULTI "multi-threaded, $desc" "
 	test-tool lazy-init-name-hash --multi --count=$count
 "
 
+test_perf "lookups, single-threaded, $desc" "
+	test-tool lazy-init-name-hash --lookup --single --count=$count
+"
+
+test_perf REPO_BIG_ENOUGH_FOR_MULTI "lookups, multi-threaded, $desc" "
+	test-tool lazy-init-name-hash --lookup --multi --count=$count
+"
+
 test_done
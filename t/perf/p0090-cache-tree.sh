@@ -0,0 +1,43 @@
+#!/bin/sh
+
+test_description="Tests performance of cache-tree updates in wide directories"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+nr_files=${GIT_PERF_WIDE_DIR_FILES:-100000}
+
+test_expect_success "setup $nr_files files in one directory" '
+	blob_a=$(echo a | git hash-object -w --stdin) &&
+	blob_b=$(echo b | git hash-object -w --stdin) &&
+	echo $blob_a >blob-a &&
+	echo $blob_b >blob-b &&
+	awk -v blob=$blob_a -v nr=$nr_files "BEGIN {
+		for (i = 0; i < nr; i++)
+			printf \"100644 %s\\twide/file-%06d\\n\", blob, i
+	}" | git update-index --index-info &&
+	git commit -q -m wide
+'
+
+# Each run flips one entry between two blobs, so that every commit has
+# to write the wide tree again.
+test_perf "commit one changed entry in a wide directory" '
+	if test "$(git rev-parse :wide/file-000042)" = "$(cat blob-a)"
+	then
+		blob=$(cat blob-b)
+	else
+		blob=$(cat blob-a)
+	fi &&
+	git update-index --cacheinfo 100644,$blob,wide/file-000042 &&
+	git commit -q -m change
+'
+
+test_perf "write-tree after one changed entry in a wide directory" '
+	git update-index --cacheinfo 100644,$(cat blob-a),wide/file-000017 &&
+	git write-tree &&
+	git update-index --cacheinfo 100644,$(cat blob-b),wide/file-000017 &&
+	git write-tree
+'
+
+test_done
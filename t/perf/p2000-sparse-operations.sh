@@ -123,5 +123,9 @@ test_perf_on_all git blame $SPARSE_CONE/f3/a
 test_perf_on_all git read-tree -mu HEAD
 test_perf_on_all git checkout-index -f --all
 test_perf_on_all git update-index --add --remove $SPARSE_CONE/a
+test_perf_on_all "git rm -f $SPARSE_CONE/a && git checkout HEAD -- $SPARSE_CONE/a"
+test_perf_on_all "git mv $SPARSE_CONE/a $SPARSE_CONE/c && git mv $SPARSE_CONE/c $SPARSE_CONE/a"
+test_perf_on_all git grep --cached bogus -- f2/f1
+test_perf_on_all "git stash push -- $SPARSE_CONE/a && git stash pop"
 
 test_done
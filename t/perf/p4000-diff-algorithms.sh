@@ -26,4 +26,25 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_expect_success 'setup large generated files' '
+	test_seq 200000 | sed "s/.*/generated_& = &;/" >large-a &&
+	sed "/000 = /s/^/changed /" <large-a >large-b &&
+	test_seq 5000 | sed -e "s/.*/&,&,&,&,&,&,&,&/" \
+		-e "s/.*/&,&,&,&,&,&,&,&/" -e "s/.*/&,&,&,&,&,&,&,&/" >wide-a &&
+	sed "/^[0-9]*00,/s/^/changed /" <wide-a >wide-b
+'
+
+for algo in myers patience histogram
+do
+	test_perf "diff large generated file ($algo)" "
+		test_expect_code 1 git diff --no-index --diff-algorithm=$algo \
+			large-a large-b >/dev/null
+	"
+
+	test_perf "diff file with long lines ($algo)" "
+		test_expect_code 1 git diff --no-index --diff-algorithm=$algo \
+			wide-a wide-b >/dev/null
+	"
+done
+
 test_done
@@ -277,4 +277,52 @@ test_expect_success 'switching trees does not invalidate shared index' '
 	)
 '
 
+test_expect_success 'trees rebuilt from HEAD match trees written from scratch' '
+	git init rebuild &&
+	(
+		cd rebuild &&
+		mkdir -p wide/sub &&
+		for i in $(test_seq 20)
+		do
+			echo $i >wide/file-$i &&
+			echo $i >wide/sub/file-$i || return 1
+		done &&
+		git add wide &&
+		git commit -m wide &&
+
+		echo changed >wide/file-3 &&
+		git rm -q wide/file-7 wide/sub/file-1 &&
+		echo new >wide/file-30 &&
+		echo new >wide/sub/file-0 &&
+		test_chmod +x wide/file-9 &&
+		git add wide &&
+		git write-tree >actual &&
+
+		git ls-files -s >entries &&
+		rm .git/index &&
+		git update-index --index-info <entries &&
+		git update-ref -d HEAD &&
+		git write-tree >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'trees rebuilt from HEAD do not copy non-canonical modes' '
+	git init odd-mode &&
+	(
+		cd odd-mode &&
+		blob=$(echo content | git hash-object -w --stdin) &&
+		odd=$(printf "100664 file\0$(echo $blob | hex2oct)" |
+		      git hash-object -t tree -w --stdin --literally) &&
+		commit=$(git commit-tree -m odd $odd) &&
+		git update-ref HEAD $commit &&
+		git update-index --add --cacheinfo 100644,$blob,file &&
+		git update-index --add --cacheinfo 100644,$blob,other &&
+		git write-tree >actual &&
+		printf "100644 file\0$(echo $blob | hex2oct)100644 other\0$(echo $blob | hex2oct)" |
+			git hash-object -t tree --stdin >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -0,0 +1,302 @@
+#!/bin/sh
+
+test_description='reftable reference backend'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+INVALID_OID=$(test_oid 001)
+
+test_expect_success 'init: creates basic reftable structures' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	test_path_is_dir repo/.git/reftable &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryformatversion >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: HEAD file points to invalid branch' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	echo "ref: refs/heads/.invalid" >expect &&
+	test_cmp expect repo/.git/HEAD &&
+	echo refs/heads/main >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: honors GIT_DEFAULT_REF_FORMAT' '
+	test_when_finished "rm -rf repo" &&
+	GIT_DEFAULT_REF_FORMAT=reftable git init repo &&
+	test_path_is_dir repo/.git/reftable
+'
+
+test_expect_success 'init: rejects unknown ref format' '
+	test_must_fail git init --ref-format=bogus repo 2>err &&
+	test_i18ngrep "unknown ref storage format ${SQ}bogus${SQ}" err
+'
+
+test_expect_success 'init: refuses to switch formats on reinit' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	test_must_fail git init --ref-format=files repo 2>err &&
+	test_i18ngrep "different reference storage format" err &&
+	git init repo
+'
+
+test_expect_success 'setup' '
+	git init --ref-format=reftable repo &&
+	test_commit -C repo A &&
+	test_commit -C repo B
+'
+
+test_expect_success 'ref transaction: basic updates are visible' '
+	git -C repo update-ref refs/heads/topic A &&
+	git -C repo rev-parse A >expect &&
+	git -C repo rev-parse refs/heads/topic >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing repo/.git/refs/heads/topic
+'
+
+test_expect_success 'ref transaction: old value is verified' '
+	test_must_fail git -C repo update-ref refs/heads/topic B B 2>err &&
+	test_i18ngrep "but expected" err &&
+	git -C repo update-ref refs/heads/topic B A &&
+	test_must_fail git -C repo update-ref --create-reflog refs/heads/topic A $ZERO_OID 2>err &&
+	test_i18ngrep "reference already exists" err
+'
+
+test_expect_success 'ref transaction: nonexistent objects are rejected' '
+	test_must_fail git -C repo update-ref refs/heads/broken $INVALID_OID 2>err &&
+	test_i18ngrep "nonexistent object" err
+'
+
+test_expect_success 'ref transaction: D/F conflicts are detected' '
+	test_must_fail git -C repo update-ref refs/heads/topic/sub A 2>err &&
+	test_i18ngrep "${SQ}refs/heads/topic${SQ} exists" err &&
+	test_must_fail git -C repo update-ref refs/heads A 2>err
+'
+
+test_expect_success 'ref transaction: multiple updates are atomic' '
+	cat >input <<-EOF &&
+	start
+	create refs/heads/multi-1 $(git -C repo rev-parse A)
+	create refs/heads/multi-2 $(git -C repo rev-parse B)
+	prepare
+	commit
+	EOF
+	git -C repo update-ref --stdin <input &&
+	git -C repo show-ref --verify refs/heads/multi-1 &&
+	git -C repo show-ref --verify refs/heads/multi-2 &&
+
+	cat >input <<-EOF &&
+	create refs/heads/multi-3 $(git -C repo rev-parse A)
+	update refs/heads/multi-1 $(git -C repo rev-parse B) $(git -C repo rev-parse B)
+	EOF
+	test_must_fail git -C repo update-ref --stdin <input &&
+	test_must_fail git -C repo show-ref --verify refs/heads/multi-3
+'
+
+test_expect_success 'ref transaction: symref updates go through to the target' '
+	git -C repo checkout -b symref-target A &&
+	git -C repo update-ref HEAD B &&
+	git -C repo rev-parse B >expect &&
+	git -C repo rev-parse refs/heads/symref-target >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog show -n1 --format=%H HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo checkout main
+'
+
+test_expect_success 'for-each-ref: lists refs in order with prefix' '
+	cat >expect <<-EOF &&
+	refs/heads/multi-1
+	refs/heads/multi-2
+	EOF
+	git -C repo for-each-ref --format="%(refname)" "refs/heads/multi-*" >actual &&
+	test_cmp expect actual &&
+	git -C repo for-each-ref --format="%(refname)" >all &&
+	sort all >sorted &&
+	test_cmp sorted all
+'
+
+test_expect_success 'for-each-ref: peeled values of annotated tags' '
+	git -C repo tag -a -m annotated annotated A &&
+	git -C repo rev-parse A >expect &&
+	git -C repo for-each-ref --format="%(*objectname)" refs/tags/annotated >actual &&
+	test_cmp expect actual &&
+	git -C repo pack-refs --all &&
+	echo "$(git -C repo rev-parse A) refs/tags/annotated^{}" >expect &&
+	git -C repo show-ref -d refs/tags/annotated >out &&
+	grep "\\^{}" out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'delete: removes ref and reflog' '
+	git -C repo update-ref --create-reflog refs/heads/doomed A &&
+	git -C repo reflog exists refs/heads/doomed &&
+	git -C repo update-ref -d refs/heads/doomed &&
+	test_must_fail git -C repo show-ref --verify refs/heads/doomed &&
+	test_must_fail git -C repo reflog exists refs/heads/doomed
+'
+
+test_expect_success 'delete: many refs at once' '
+	git -C repo branch del-1 A &&
+	git -C repo branch del-2 A &&
+	git -C repo branch -D del-1 del-2 &&
+	test_must_fail git -C repo show-ref --verify refs/heads/del-1 &&
+	test_must_fail git -C repo show-ref --verify refs/heads/del-2
+'
+
+test_expect_success 'reflog: entries are recorded oldest to newest' '
+	git -C repo update-ref -m first refs/heads/logged A &&
+	git -C repo update-ref -m second refs/heads/logged B &&
+	cat >expect <<-EOF &&
+	logged@{0} second
+	logged@{1} first
+	EOF
+	git -C repo reflog show --format="%gd %gs" logged >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reflog: expire prunes entries' '
+	git -C repo reflog expire --expire=all refs/heads/logged &&
+	git -C repo reflog show logged >actual &&
+	test_must_be_empty actual &&
+	git -C repo reflog exists refs/heads/logged
+'
+
+test_expect_success 'reflog: delete removes single entries' '
+	git -C repo update-ref -m one refs/heads/dropped A &&
+	git -C repo update-ref -m two refs/heads/dropped B &&
+	git -C repo reflog delete refs/heads/dropped@{1} &&
+	echo "dropped@{0} two" >expect &&
+	git -C repo reflog show --format="%gd %gs" dropped >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rename: moves ref and reflog' '
+	git -C repo branch -m dropped renamed &&
+	test_must_fail git -C repo show-ref --verify refs/heads/dropped &&
+	git -C repo rev-parse B >expect &&
+	git -C repo rev-parse refs/heads/renamed >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo reflog exists refs/heads/dropped &&
+	git -C repo reflog show --format=%gs renamed >actual &&
+	cat >expect <<-EOF &&
+	Branch: renamed refs/heads/dropped to refs/heads/renamed
+	two
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'copy: keeps the original' '
+	git -C repo branch -c renamed copied &&
+	git -C repo rev-parse renamed >expect &&
+	git -C repo rev-parse copied >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog exists refs/heads/renamed
+'
+
+test_expect_success 'pack-refs: compacts tables into one' '
+	test_line_count -gt 1 repo/.git/reftable/tables.list &&
+	git -C repo pack-refs &&
+	test_line_count = 1 repo/.git/reftable/tables.list &&
+	git -C repo rev-parse B >expect &&
+	git -C repo rev-parse renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'auto-compaction keeps the number of tables small' '
+	test_when_finished "rm -rf compact" &&
+	git init --ref-format=reftable compact &&
+	test_commit -C compact --no-tag initial &&
+	for i in $(test_seq 20)
+	do
+		git -C compact update-ref refs/heads/branch-$i HEAD || return 1
+	done &&
+	test_line_count -lt 10 compact/.git/reftable/tables.list
+'
+
+test_expect_success 'symbolic-ref: create and read' '
+	git -C repo symbolic-ref refs/heads/sym refs/heads/renamed &&
+	echo refs/heads/renamed >expect &&
+	git -C repo symbolic-ref refs/heads/sym >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse refs/heads/renamed >expect &&
+	git -C repo rev-parse refs/heads/sym >actual &&
+	test_cmp expect actual &&
+	git -C repo symbolic-ref -d refs/heads/sym
+'
+
+test_expect_success 'pseudorefs are stored in the tables' '
+	git -C repo update-ref ORIG_HEAD A &&
+	test_path_is_missing repo/.git/ORIG_HEAD &&
+	git -C repo rev-parse A >expect &&
+	git -C repo rev-parse ORIG_HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'worktree: refs are shared, HEAD is not' '
+	git -C repo worktree add ../wt -b wt-branch A &&
+	test_path_is_dir repo/.git/worktrees/wt/reftable &&
+	git -C wt update-ref refs/heads/from-wt B &&
+	git -C repo rev-parse B >expect &&
+	git -C repo rev-parse refs/heads/from-wt >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/main >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/wt-branch >expect &&
+	git -C wt symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse worktrees/wt/HEAD >actual &&
+	git -C repo rev-parse wt-branch >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'worktree: per-worktree refs stay private' '
+	git -C wt update-ref refs/bisect/private A &&
+	test_must_fail git -C repo rev-parse --verify -q refs/bisect/private &&
+	git -C wt for-each-ref --format="%(refname)" refs/bisect >actual &&
+	echo refs/bisect/private >expect &&
+	test_cmp expect actual &&
+	git -C wt for-each-ref --format="%(refname)" refs/heads/from-wt >actual &&
+	echo refs/heads/from-wt >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone: honors GIT_DEFAULT_REF_FORMAT' '
+	test_when_finished "rm -rf clone" &&
+	GIT_DEFAULT_REF_FORMAT=reftable git clone repo clone &&
+	echo reftable >expect &&
+	git -C clone config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse main >expect &&
+	git -C clone rev-parse origin/main >actual &&
+	test_cmp expect actual &&
+	git -C clone rev-parse main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch: updates many refs' '
+	test_when_finished "rm -rf clone" &&
+	for i in $(test_seq 200)
+	do
+		echo "create refs/heads/many-$i $(git -C repo rev-parse A)" || return 1
+	done >input &&
+	git -C repo update-ref --stdin <input &&
+	git init --ref-format=reftable clone &&
+	git -C clone fetch ../repo "refs/heads/*:refs/remotes/origin/*" &&
+	git -C clone for-each-ref "refs/remotes/origin/many-*" >actual &&
+	test_line_count = 200 actual
+'
+
+test_done
@@ -1093,4 +1093,80 @@ test_expect_success 'batch-command flush without --buffer' '
 	grep "^fatal:.*flush is only for --buffer mode.*" err
 '
 
+test_expect_success 'setup repository with deltas for --threads' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 20)
+		do
+			test_seq $i 100 >file &&
+			printf "\000binary %d\n" $i >>file &&
+			git add file &&
+			git commit -q -m "commit $i" || return 1
+		done &&
+		ln -s file link &&
+		git add link &&
+		git commit -q -m symlink &&
+		git repack -adf --depth=10 &&
+		git rev-list --objects --all >objs &&
+		cut -d" " -f1 objs >input &&
+		cat >>input <<-EOF
+		$ZERO_OID
+		HEAD:nonexistent
+		HEAD:link
+		HEAD~1:file extra text
+		EOF
+	)
+'
+
+for opts in "--batch" "--batch-check" \
+	"--batch-check=%(objectname)_%(deltabase)_%(objectsize:disk)_%(rest)" \
+	"--batch --buffer" "--batch --follow-symlinks"
+do
+	test_expect_success "--threads matches serial output: $opts" '
+		git -C threads cat-file $opts <threads/input >expect &&
+		git -C threads cat-file $opts --threads=4 <threads/input >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success '--threads streams large blobs in order' '
+	git -C threads cat-file --batch <threads/input >expect &&
+	git -C threads -c core.bigFileThreshold=64 \
+		cat-file --batch --threads=3 <threads/input >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--threads with --batch-all-objects' '
+	git -C threads cat-file --batch-all-objects --batch >expect &&
+	git -C threads cat-file --batch-all-objects --batch --threads=3 >actual &&
+	test_cmp expect actual &&
+	git -C threads cat-file --batch-all-objects --unordered \
+		--batch-check >expect &&
+	git -C threads cat-file --batch-all-objects --unordered \
+		--batch-check --threads=3 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--threads with a tiny delta base cache' '
+	git -C threads cat-file --batch <threads/input >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git -C threads \
+		-c core.deltaBaseCacheLimit=4k \
+		cat-file --batch --threads=4 <threads/input >actual &&
+	test_cmp expect actual &&
+	grep "\"category\":\"delta_base_cache\",\"key\":\"hits\"" trace.event &&
+	grep "\"category\":\"delta_base_cache\",\"key\":\"evictions\"" trace.event
+'
+
+test_expect_success '--threads option compatibility' '
+	test_expect_code 129 git cat-file --threads=2 -t HEAD 2>err &&
+	grep "requires a batch mode" err &&
+	test_expect_code 129 git cat-file --batch --textconv --threads=2 </dev/null 2>err &&
+	grep "cannot be used together" err &&
+	test_expect_code 129 git cat-file --batch-command --threads=2 </dev/null 2>err &&
+	grep "cannot be used together" err &&
+	test_must_fail git cat-file --batch --threads=-1 </dev/null 2>err &&
+	grep "invalid number of threads" err
+'
+
 test_done
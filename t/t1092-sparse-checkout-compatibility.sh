@@ -1577,6 +1577,73 @@ test_expect_success 'sparse index is not expanded: read-tree' '
 	ensure_not_expanded read-tree --prefix=deep/deeper2 -u deepest
 '
 
+test_expect_success 'rm, mv and grep with sparse directories' '
+	init_repos &&
+
+	test_all_match git grep --cached a &&
+	test_all_match git grep --cached a -- folder1 "deep/*" &&
+	test_all_match git grep --cached -c -e "^" -- "folder*/0" &&
+	test_sparse_match git grep a &&
+
+	test_all_match git -C deep grep --cached a &&
+	test_all_match git -C deep grep --cached a -- deeper2 ../folder1 &&
+
+	test_all_match git mv deep/a deep/moved &&
+	test_all_match git mv deep/deeper1 deep/deeper3 &&
+	test_all_match git status --porcelain=v2 &&
+
+	test_all_match git rm -f deep/moved &&
+	test_all_match git rm -r --cached "deep/deeper3/*" &&
+	test_all_match git status --porcelain=v2 &&
+
+	test_all_match git rm -r --sparse folder1 &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'am with sparse directories' '
+	init_repos &&
+
+	git -C full-checkout format-patch --stdout \
+		base..update-deep >update-deep.patch &&
+	git -C full-checkout format-patch --stdout \
+		base..update-folder1 >update-folder1.patch &&
+
+	test_all_match git am ../update-deep.patch &&
+	test_all_match git am ../update-folder1.patch &&
+	test_all_match git log --stat -2 &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'sparse index is not expanded: rm, mv, grep, am' '
+	init_repos &&
+
+	ensure_not_expanded grep --cached a &&
+	ensure_not_expanded grep --cached a -- folder1 &&
+	ensure_not_expanded grep a &&
+
+	ensure_not_expanded mv deep/a deep/moved &&
+	ensure_not_expanded mv deep/deeper1 deep/deeper3 &&
+	! ensure_not_expanded mv --sparse folder1/a deep/from-folder1 &&
+
+	init_repos &&
+	ensure_not_expanded rm deep/a &&
+	ensure_not_expanded rm -r --cached "deep/deeper1/*" &&
+	ensure_not_expanded ! rm -r folder1 &&
+	! ensure_not_expanded rm --sparse folder1/a &&
+
+	init_repos &&
+	ensure_not_expanded diff-index HEAD &&
+	ensure_not_expanded diff-index --cached HEAD &&
+	git -C full-checkout format-patch --stdout \
+		base..update-deep >update-deep.patch &&
+	ensure_not_expanded apply --cached --check ../update-deep.patch &&
+	ensure_not_expanded am ../update-deep.patch &&
+
+	echo >>sparse-index/deep/a &&
+	ensure_not_expanded stash push -- deep/a &&
+	ensure_not_expanded stash pop
+'
+
 test_expect_success 'ls-files' '
 	init_repos &&
 
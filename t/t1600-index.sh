@@ -103,4 +103,76 @@ test_expect_success 'index version config precedence' '
 	test_index_version 0 true 2 2
 '
 
+test_expect_success 'setup for threaded index writes' '
+	rm -f .git/index &&
+	for d in a-dir b-dir c-dir/d c-dir/e
+	do
+		mkdir -p $d &&
+		for i in $(test_seq 40)
+		do
+			echo "$d $i" >$d/file-with-a-long-name-$i || return 1
+		done
+	done &&
+	test-tool chmtime =-60 a-dir/* b-dir/* c-dir/d/* c-dir/e/* &&
+	git add a-dir b-dir c-dir/d &&
+	git add -N c-dir/e
+'
+
+for version in 3 4
+do
+	test_expect_success "threaded index writes are byte-identical (v$version)" '
+		(
+			# the test picks its own number of threads
+			sane_unset GIT_TEST_INDEX_THREADS &&
+			git update-index --index-version $version &&
+			for ieot in true false
+			do
+				GIT_TEST_INDEX_WRITE_CHUNK=100000 git -c index.threads=4 \
+					-c index.recordOffsetTable=$ieot \
+					update-index --force-write-index &&
+				test-tool index-version <.git/index >actual &&
+				echo $version >expect &&
+				test_cmp expect actual &&
+				cp .git/index expect.index &&
+
+				for chunk in 1 7 50
+				do
+					rm -f trace.event &&
+					GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+					GIT_TEST_INDEX_WRITE_CHUNK=$chunk \
+						git -c index.threads=4 \
+						-c index.recordOffsetTable=$ieot \
+						update-index --force-write-index &&
+					grep "\"key\":\"write/threads\",\"value\":\"4\"" trace.event &&
+					test_cmp_bin expect.index .git/index &&
+					git -c index.threads=4 ls-files -s >actual &&
+					git -c index.threads=1 ls-files -s >expect &&
+					test_cmp expect actual || exit 1
+				done
+			done
+		)
+	'
+done
+
+for version in 2 3 4
+do
+	test_expect_success "threaded index reads without IEOT (v$version)" '
+		(
+			# the test picks its own number of threads
+			sane_unset GIT_TEST_INDEX_THREADS &&
+			git update-index --index-version $version &&
+			git -c index.threads=1 update-index --force-write-index &&
+			git -c index.threads=1 ls-files --debug >expect &&
+			for threads in 2 3 7
+			do
+				rm -f trace.event &&
+				GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+					git -c index.threads=$threads ls-files --debug >actual &&
+				grep "\"key\":\"read/scanned_blocks\",\"value\":\"$threads\"" trace.event &&
+				test_cmp expect actual || exit 1
+			done
+		)
+	'
+done
+
 test_done
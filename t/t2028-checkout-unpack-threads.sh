@@ -0,0 +1,139 @@
+#!/bin/sh
+
+test_description='unpack_trees() with checkout.unpackThreads
+
+Switch between branches with the top-level directories unpacked in
+parallel, and make sure the index, the working tree and the errors are
+the same as when they are unpacked one after the other.
+'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_UNPACK_THREADS
+
+# Run "git $@" in the "serial" and "threaded" clones, with and without
+# threads, and check that both end up in the same state.
+test_unpack_threads () {
+	git -C serial -c checkout.unpackThreads=1 "$@" \
+		>serial.out 2>serial.err
+	echo $? >serial.code &&
+	git -C threaded -c checkout.unpackThreads=4 "$@" \
+		>threaded.out 2>threaded.err
+	echo $? >threaded.code &&
+	test_cmp serial.code threaded.code &&
+	test_cmp serial.out threaded.out &&
+	test_cmp serial.err threaded.err &&
+	git -C serial ls-files -s >serial.index &&
+	git -C threaded ls-files -s >threaded.index &&
+	test_cmp serial.index threaded.index &&
+	git -C serial status --porcelain --ignored >serial.status &&
+	git -C threaded status --porcelain --ignored >threaded.status &&
+	test_cmp serial.status threaded.status &&
+	(cd serial && find . -path ./.git -prune -o -print | sort) >serial.files &&
+	(cd threaded && find . -path ./.git -prune -o -print | sort) >threaded.files &&
+	test_cmp serial.files threaded.files
+}
+
+test_expect_success 'setup' '
+	git init src &&
+	(
+		cd src &&
+		for d in a b c d e f
+		do
+			mkdir -p $d/sub &&
+			echo $d >$d/file &&
+			echo $d >$d/sub/file || return 1
+		done &&
+		echo top >top &&
+		echo ignored >.gitignore &&
+		git add . &&
+		git commit -m one &&
+
+		git checkout -b two &&
+		git rm -r b &&
+		echo b >b &&
+		git rm c/sub/file &&
+		echo c >c/sub &&
+		echo changed >>d/file &&
+		echo new >e/new &&
+		mkdir g &&
+		echo g >g/file &&
+		echo changed >top &&
+		git add . &&
+		git commit -m two
+	) &&
+	git clone src serial &&
+	git clone src threaded
+'
+
+test_expect_success 'switching branches' '
+	test_unpack_threads checkout two &&
+	test_unpack_threads checkout main &&
+	test_unpack_threads checkout two &&
+	test_unpack_threads checkout -f main
+'
+
+test_expect_success 'local changes in the way of a switch' '
+	for r in serial threaded
+	do
+		echo dirty >$r/d/file &&
+		echo dirty >$r/b/sub/file &&
+		echo untracked >$r/e/new &&
+		echo untracked >$r/g || return 1
+	done &&
+	test_unpack_threads checkout two &&
+	test_unpack_threads checkout -m two
+'
+
+test_expect_success 'reset --hard' '
+	for r in serial threaded
+	do
+		git -C $r checkout -f -B scratch main &&
+		echo ignored >$r/f/sub/ignored &&
+		echo untracked >$r/a/untracked || return 1
+	done &&
+	test_unpack_threads reset --hard two &&
+	test_unpack_threads reset --hard main &&
+	echo dirty >serial/d/file &&
+	echo dirty >threaded/d/file &&
+	test_unpack_threads reset --keep two &&
+	test_unpack_threads reset --merge two
+'
+
+test_expect_success 'threads are only used for the top-level directories' '
+	git -C threaded checkout -f main &&
+	GIT_TRACE2_PERF="$(pwd)/trace" \
+		git -C threaded -c checkout.unpackThreads=2 checkout two &&
+	grep "parallel/threads:2" trace &&
+	grep "parallel/jobs:7" trace
+'
+
+test_expect_success 'index entries outside of the trees and next to directories' '
+	(
+		cd src &&
+		git checkout -b three two &&
+		mkdir h &&
+		echo h >h/file &&
+		echo h >h-1 &&
+		echo h >h.c &&
+		git add . &&
+		git commit -m three
+	) &&
+	for r in serial threaded
+	do
+		git -C $r checkout -f two &&
+		git -C $r fetch origin three:three &&
+		echo added >$r/0-added &&
+		echo added >$r/c/added &&
+		echo added >$r/h-2 &&
+		git -C $r add 0-added c/added h-2 || return 1
+	done &&
+	test_unpack_threads checkout three &&
+	test_unpack_threads checkout two &&
+	test_unpack_threads checkout three
+'
+
+test_done
@@ -226,4 +226,44 @@ test_expect_success SYMLINKS 'parallel checkout checks for symlinks in leading d
 	)
 '
 
+# Enough entries to give each of the 2 workers a full batch, so that they are
+# started while the entries are still being enqueued and fed the rest of them
+# as they come.
+test_expect_success 'parallel checkout streams entries to the workers' '
+	set_checkout_config 2 0 &&
+	git init streaming &&
+	(
+		cd streaming &&
+		mkdir dir &&
+		test_ln_s_add dir/f1 link &&
+		for i in $(test_seq 1 100)
+		do
+			echo "content $i" >dir/f$i || return 1
+		done &&
+		echo "* text=auto" >.gitattributes &&
+		printf "crlf\r\n" >crlf &&
+		git add . &&
+		git commit -m files &&
+		rm -rf dir crlf link &&
+
+		GIT_TRACE2_EVENT="$TRASH_DIRECTORY/checkout.event" \
+		test_checkout_workers 2 git checkout --force HEAD &&
+		grep "\"region_enter\".*\"category\":\"pcheckout\",\"label\":\"streaming\"" ../checkout.event &&
+		git diff-index --exit-code HEAD &&
+		test_cmp_bin dir/f1 link &&
+		grep "content 42" dir/f42
+	) &&
+	verify_checkout streaming
+'
+
+test_expect_success 'clone streams entries to the workers' '
+	set_checkout_config 2 0 &&
+	GIT_TRACE2_EVENT="$(pwd)/clone.event" \
+	test_checkout_workers 2 git clone streaming streaming_clone &&
+	grep "\"region_enter\".*\"category\":\"pcheckout\",\"label\":\"streaming\"" clone.event &&
+	verify_checkout streaming_clone &&
+	rm -rf streaming_clone/.git streaming/.git &&
+	git diff --no-index streaming streaming_clone
+'
+
 test_done
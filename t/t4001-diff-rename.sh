@@ -286,4 +286,129 @@ test_expect_success 'basename similarity vs best similarity' '
 	test_cmp expected actual
 '
 
+test_expect_success 'threaded rename detection finds the same renames' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq $i $((i + 20)) >file$i || return 1
+		done &&
+		printf "\0binary" >binary &&
+		git add . &&
+		git commit -m base &&
+
+		for i in $(test_seq 1 40)
+		do
+			git mv file$i moved$i &&
+			echo edit >>moved$i || return 1
+		done &&
+		test_seq 100 120 >new &&
+		printf "\0binary\n" >binary &&
+		git add . &&
+		git commit -m rename &&
+
+		for opt in -M -C "-C -C" "-B -M"
+		do
+			GIT_TEST_RENAME_THREADS=1 \
+				git diff-tree -r $opt HEAD^ HEAD >serial &&
+			GIT_TEST_RENAME_THREADS=4 \
+				git diff-tree -r $opt HEAD^ HEAD >threaded &&
+			test_cmp serial threaded || return 1
+		done &&
+		grep -c "R[0-9]*	file[0-9]*	moved" serial >count &&
+		echo 40 >expect &&
+		test_cmp expect count
+	)
+'
+
+test_expect_success 'rename cache finds the same renames' '
+	(
+		cd threads &&
+		for i in $(test_seq 1 40)
+		do
+			printf "file $i line %d\r\n" $(test_seq 1 20) >crlf$i || return 1
+		done &&
+		git add crlf* &&
+		git commit -m crlf &&
+		for i in $(test_seq 1 40)
+		do
+			cp crlf$i crlf$i.orig || return 1
+		done &&
+		for i in $(test_seq 1 40)
+		do
+			git mv crlf$i moved-crlf$i &&
+			tr -d "\015" <crlf$i.orig >moved-crlf$i || return 1
+		done &&
+		git commit -a -m "move crlf" &&
+
+		git diff-tree -r -M HEAD^ HEAD >expect &&
+		git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		ls .git/objects/info/rename-cache/cache-*.spans >files &&
+		test_line_count = 1 files &&
+
+		GIT_TRACE2_PERF="$(pwd)/trace" \
+			git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		! grep "write rename cache" trace &&
+
+		# CRLF only matches LF in text
+		grep "R[0-9]*	crlf1	moved-crlf1" expect &&
+		echo "crlf* -diff" >.gitattributes &&
+		git diff-tree -r -M HEAD^ HEAD >expect &&
+		! grep "R[0-9]*	crlf1	moved-crlf1" expect &&
+		git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'rename cache keeps a few fingerprints in memory' '
+	git init few-renames &&
+	(
+		cd few-renames &&
+		for i in 1 2 3
+		do
+			test_seq 1 $((i * 10)) >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m files &&
+		for i in 1 2 3
+		do
+			git mv file$i moved$i &&
+			echo change >>moved$i || return 1
+		done &&
+		git commit -a -m moved &&
+
+		git diff-tree -r -M HEAD^ HEAD >expect &&
+		git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing .git/objects/info/rename-cache &&
+
+		cat expect expect >expect.twice &&
+		printf "%s %s\n" $(git rev-parse HEAD HEAD^) >pairs &&
+		cat pairs pairs |
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c diff.renameCache=true diff-tree --stdin \
+			--no-commit-id -r -M >actual &&
+		test_cmp expect.twice actual &&
+		grep "\"key\":\"rename cache/misses\",\"value\":\"6\"" trace &&
+		grep "\"key\":\"rename cache/hits\",\"value\":\"6\"" trace &&
+		test_path_is_missing .git/objects/info/rename-cache
+	)
+'
+
+test_expect_success 'corrupt rename cache files are ignored' '
+	(
+		cd threads &&
+		rm .gitattributes &&
+		git diff-tree -r -M HEAD^ HEAD >expect &&
+		echo garbage >.git/objects/info/rename-cache/cache-0.spans &&
+		git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD \
+			>actual 2>err &&
+		test_cmp expect actual &&
+		test_i18ngrep "ignoring corrupt rename cache file" err
+	)
+'
+
 test_done
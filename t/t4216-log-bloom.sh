@@ -404,4 +404,54 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+test_expect_success 'Bloom filters computed in threads match serial ones' '
+	test_when_finished "rm -f serial" &&
+	rm -f .git/objects/info/commit-graph &&
+	git commit-graph write --reachable --changed-paths --threads=1 &&
+	mv .git/objects/info/commit-graph serial &&
+	for n in 2 4
+	do
+		git commit-graph write --reachable --changed-paths \
+			--threads=$n &&
+		test_cmp_bin serial .git/objects/info/commit-graph &&
+		rm -f .git/objects/info/commit-graph || return 1
+	done &&
+	test_config commitGraph.threads 3 &&
+	git commit-graph write --reachable --changed-paths &&
+	test_cmp_bin serial .git/objects/info/commit-graph
+'
+
+test_expect_success 'threaded Bloom generation respects limits' '
+	(
+		cd limits &&
+		rm -fr .git/objects/info/commit-graph \
+			.git/objects/info/commit-graphs &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c commitGraph.maxNewFilters=2 commit-graph write \
+				--reachable --changed-paths --threads=4 &&
+		test_filter_computed 2 trace.event &&
+		test_filter_not_computed 3 trace.event &&
+		test_region commit-graph bloom-threads trace.event &&
+
+		for threads in 1 4
+		do
+			rm -fr .git/objects/info/commit-graph \
+				.git/objects/info/commit-graphs &&
+			rm -f trace.event &&
+			GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=2 \
+				GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git commit-graph write --reachable \
+					--changed-paths --threads=$threads &&
+			test_filter_computed 5 trace.event &&
+			test_filter_trunc_large 2 trace.event || return 1
+		done
+	)
+'
+
+test_expect_success 'commit-graph write rejects negative --threads' '
+	test_must_fail git commit-graph write --reachable --threads=-1 2>err &&
+	grep "invalid number of threads" err
+'
+
 test_done
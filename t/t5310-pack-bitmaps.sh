@@ -26,6 +26,12 @@ has_any () {
 	grep -Ff "$1" "$2"
 }
 
+test_expect_success 'EWAH word kernels agree with the scalar code' '
+	test-tool ewah verify >out &&
+	grep "^scalar: ok$" out &&
+	! grep -v -e ": ok$" -e ": unsupported$" out
+'
+
 setup_bitmap_history
 
 test_expect_success 'setup writing bitmaps during repack' '
@@ -425,4 +431,116 @@ test_expect_success 'complains about multiple pack bitmaps' '
 	)
 '
 
+test_expect_success 'pack.writeBitmapLookupTable writes a lookup table' '
+	git repack -adb &&
+	test-tool bitmap list-commits | sort >without &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c pack.writeBitmapLookupTable=true repack -adb &&
+	grep "\"label\":\"writing_lookup_table\"" trace &&
+	test-tool bitmap list-commits | sort >with &&
+	test_cmp without with
+'
+
+test_expect_success 'bitmaps can be loaded lazily from the lookup table' '
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap other &&
+	for range in "--all" "HEAD" "other ^second" "second~5..other"
+	do
+		git rev-list --objects --no-object-names $range | sort >expect &&
+		git rev-list --objects --no-object-names --use-bitmap-index $range |
+			sort >actual &&
+		test_cmp expect actual &&
+		GIT_TEST_READ_COMMIT_TABLE=0 \
+			git rev-list --objects --no-object-names --use-bitmap-index $range |
+			sort >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'repack reuses bitmaps read via the lookup table' '
+	test_commit lookup-table-reuse &&
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	git rev-list --test-bitmap HEAD
+'
+
+bitmap_options () {
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	printf "%d" "0x$(od -An -tx1 -j6 -N2 "$bitmap" | tr -d " \n")"
+}
+
+bitmap_version () {
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	printf "%d" "0x$(od -An -tx1 -j4 -N2 "$bitmap" | tr -d " \n")"
+}
+
+# overwrite two bytes of the bitmap at offset $1 with the value $2
+patch_bitmap_u16 () {
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	chmod +w "$bitmap" &&
+	printf "\\$(printf %03o $(($2 >> 8)))\\$(printf %03o $(($2 & 255)))" |
+		dd of="$bitmap" bs=1 seek=$1 conv=notrunc 2>/dev/null
+}
+
+test_expect_success 'pack.writeBitmapRoaring writes Roaring bitmaps' '
+	git repack -adb &&
+	test $(( $(bitmap_options) & 32 )) = 0 &&
+	test $(bitmap_version) = 1 &&
+	test-tool bitmap list-commits | sort >without &&
+	git -c pack.writeBitmapRoaring=true repack -adb &&
+	test $(( $(bitmap_options) & 32 )) = 32 &&
+	test $(bitmap_version) = 2 &&
+	test-tool bitmap list-commits | sort >with &&
+	test_cmp without with
+'
+
+for lookup in false true
+do
+	test_expect_success "Roaring bitmaps give the same results (lookup table: $lookup)" '
+		git -c pack.writeBitmapRoaring=true \
+			-c pack.writeBitmapLookupTable=$lookup repack -adb &&
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --test-bitmap other &&
+		for range in "--all" "HEAD" "other ^second" "second~5..other"
+		do
+			git rev-list --objects --no-object-names $range | sort >expect &&
+			git rev-list --objects --no-object-names --use-bitmap-index $range |
+				sort >actual &&
+			test_cmp expect actual &&
+			git rev-list --count $range >expect &&
+			git rev-list --count --use-bitmap-index $range >actual &&
+			test_cmp expect actual &&
+			git rev-list --objects --no-object-names --filter=blob:none $range |
+				sort >expect &&
+			git rev-list --objects --no-object-names --filter=blob:none \
+				--use-bitmap-index $range | sort >actual &&
+			test_cmp expect actual || return 1
+		done
+	'
+done
+
+test_expect_success 'Roaring bitmaps are not read as version 1' '
+	test_when_finished "git repack -adb" &&
+	git -c pack.writeBitmapRoaring=true repack -adb &&
+	patch_bitmap_u16 4 1 &&
+	test_must_fail git rev-list --test-bitmap HEAD 2>err &&
+	test_i18ngrep "does not match its bitmap encoding" err
+'
+
+test_expect_success 'bitmaps with unknown options are rejected' '
+	test_when_finished "git repack -adb" &&
+	git repack -adb &&
+	patch_bitmap_u16 6 $(( $(bitmap_options) | 256 )) &&
+	test_must_fail git rev-list --test-bitmap HEAD 2>err &&
+	test_i18ngrep "unsupported options for bitmap index file (0x100)" err
+'
+
+test_expect_success 'repack reuses Roaring bitmaps' '
+	test_commit roaring-reuse &&
+	git -c pack.writeBitmapRoaring=true repack -adb &&
+	git rev-list --test-bitmap HEAD &&
+	git repack -adb &&
+	test $(( $(bitmap_options) & 32 )) = 0 &&
+	git rev-list --test-bitmap HEAD
+'
+
 test_done
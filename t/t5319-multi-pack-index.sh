@@ -911,6 +911,162 @@ test_expect_success 'load reverse index when missing .idx, .pack' '
 	)
 '
 
+midx_chain=$objdir/pack/multi-pack-index.d/multi-pack-index-chain
+
+# add_pack <name> <count> creates a pack with <count> new blobs
+add_pack () {
+	for i in $(test_seq $2)
+	do
+		echo "$1 $i" | git hash-object -w --stdin || return 1
+	done >"$1.objs" &&
+	git pack-objects --quiet $objdir/pack/pack <"$1.objs" &&
+	git prune-packed &&
+	rm "$1.objs"
+}
+
+test_expect_success 'setup incremental chain' '
+	git init chain &&
+	(
+		cd chain &&
+		git config core.multiPackIndex true &&
+		add_pack a 40 &&
+		git multi-pack-index write &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+		test_path_is_missing $midx_chain
+	)
+'
+
+test_expect_success 'incremental write without new packs does nothing' '
+	(
+		cd chain &&
+		git multi-pack-index write --incremental &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+		test_path_is_missing $midx_chain
+	)
+'
+
+test_expect_success 'incremental write adds a layer on top of the midx' '
+	(
+		cd chain &&
+		old=$(test-tool read-midx --checksum $objdir) &&
+		add_pack b 10 &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing $objdir/pack/multi-pack-index &&
+		test_line_count = 2 $midx_chain &&
+		echo $old >expect &&
+		head -n 1 $midx_chain >actual &&
+		test_cmp expect actual &&
+		test_path_is_file $objdir/pack/multi-pack-index.d/multi-pack-index-$old.midx &&
+
+		test-tool read-midx $objdir >actual &&
+		grep "^chain: 2 layers, 1 packs and 40 objects in base" actual &&
+		grep "^chunks: .* base-midxs" actual &&
+		grep "^num_objects: 10" actual &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'objects are found through every layer' '
+	(
+		cd chain &&
+		add_pack c 3 &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 3 $midx_chain &&
+		git count-objects -v >count &&
+		grep "^in-pack: 53" count &&
+		grep "^garbage: 0" count &&
+		for name in a b c
+		do
+			echo "$name 1" | git hash-object --stdin >oid &&
+			git cat-file -e $(cat oid) &&
+			git rev-parse --disambiguate=$(cut -c1-8 oid) >actual &&
+			test_cmp oid actual || return 1
+		done &&
+		GIT_TEST_MULTI_PACK_INDEX=0 git fsck &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'small layers are merged into larger ones' '
+	(
+		cd chain &&
+		add_pack d 5 &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $midx_chain &&
+		test-tool read-midx $objdir >actual &&
+		grep "^num_objects: 18" actual &&
+		git multi-pack-index verify &&
+
+		add_pack e 12 &&
+		git multi-pack-index write --incremental --size-multiple=1 &&
+		test_line_count = 3 $midx_chain &&
+		ls $objdir/pack/multi-pack-index.d/*.midx >layers &&
+		test_line_count = 3 layers &&
+
+		add_pack f 100 &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 1 $midx_chain &&
+		ls $objdir/pack/multi-pack-index.d/*.midx >layers &&
+		test_line_count = 1 layers &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'incremental write is incompatible with bitmaps' '
+	(
+		cd chain &&
+		test_must_fail git multi-pack-index write --incremental --bitmap 2>err &&
+		grep "cannot be used together" err &&
+		test_must_fail git multi-pack-index write --size-multiple=3 2>err &&
+		grep "requires" err
+	)
+'
+
+test_expect_success 'a broken chain is ignored' '
+	(
+		cd chain &&
+		cp $midx_chain chain.bak &&
+		echo $ZERO_OID >>$midx_chain &&
+		test_must_fail test-tool read-midx $objdir 2>err &&
+		grep "unable to find all multi-pack-index files" err &&
+		git count-objects -v >count &&
+		grep "^in-pack: 170" count &&
+		test_must_fail git multi-pack-index verify 2>err &&
+		grep "chain exists, but failed to parse" err &&
+		mv chain.bak $midx_chain &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'expire and repack flatten the chain' '
+	(
+		cd chain &&
+		add_pack g 2 &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $midx_chain &&
+		git multi-pack-index repack --batch-size=0 &&
+		git multi-pack-index expire &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+		test_path_is_missing $objdir/pack/multi-pack-index.d &&
+		ls $objdir/pack/*.idx >packs &&
+		test_line_count = 1 packs &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'full write replaces the chain' '
+	(
+		cd chain &&
+		add_pack h 2 &&
+		git multi-pack-index write --incremental &&
+		test_path_is_file $midx_chain &&
+		git multi-pack-index write &&
+		test_path_is_file $objdir/pack/multi-pack-index &&
+		test_path_is_missing $objdir/pack/multi-pack-index.d &&
+		git multi-pack-index verify
+	)
+'
+
 test_expect_success 'usage shown without sub-command' '
 	test_expect_code 129 git multi-pack-index 2>err &&
 	! test_i18ngrep "unrecognized subcommand" err
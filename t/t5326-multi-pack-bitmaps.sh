@@ -307,4 +307,56 @@ test_expect_success 'graceful fallback when missing reverse index' '
 	)
 '
 
+test_expect_success 'multi-pack bitmap with lookup table' '
+	rm -fr repo &&
+	git init repo &&
+	test_when_finished "rm -fr repo" &&
+	(
+		cd repo &&
+
+		test_commit_bulk 64 &&
+		git repack -d &&
+		test_commit_bulk --start=65 64 &&
+		git repack -d &&
+
+		git config pack.writeBitmapLookupTable true &&
+		git multi-pack-index write --bitmap &&
+
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --objects --no-object-names HEAD~70..HEAD |
+			sort >expect &&
+		git rev-list --objects --no-object-names --use-bitmap-index \
+			HEAD~70..HEAD | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'multi-pack bitmap with Roaring bitmaps' '
+	rm -fr repo &&
+	git init repo &&
+	test_when_finished "rm -fr repo" &&
+	(
+		cd repo &&
+
+		test_commit_bulk 64 &&
+		git repack -d &&
+		test_commit_bulk --start=65 64 &&
+		git repack -d &&
+
+		git config pack.writeBitmapRoaring true &&
+		git multi-pack-index write --bitmap &&
+
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --objects --no-object-names HEAD~70..HEAD |
+			sort >expect &&
+		git rev-list --objects --no-object-names --use-bitmap-index \
+			HEAD~70..HEAD | sort >actual &&
+		test_cmp expect actual &&
+
+		git rev-list --count HEAD~70..HEAD >expect &&
+		git rev-list --count --use-bitmap-index HEAD~70..HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -142,6 +142,18 @@ check_result 'I B A' --date-order -- file
 check_result 'I B A' --author-date-order -- file
 check_result 'H' --first-parent -- another-file
 check_result 'H' --first-parent --topo-order -- another-file
+check_result 'K I H E C B A' --full-history --tree-diff-threads=4 -- file
+check_result 'I E C B A' --simplify-merges --tree-diff-threads=4 -- file
+check_result 'I B A' --tree-diff-threads=4 -- file
+check_result 'I B A' --topo-order --tree-diff-threads=0 -- file
+check_result 'H' --first-parent --tree-diff-threads=4 -- another-file
+check_result 'I' -n1 --tree-diff-threads=4 -- file
+check_result 'A B I' --reverse --tree-diff-threads=4 -- file
+
+test_expect_success 'log --tree-diff-threads rejects negative values' '
+	test_must_fail git log --tree-diff-threads=-1 -- file 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
 
 check_result 'L K I H G B A' --first-parent L
 check_result 'F E D C' --exclude-first-parent-only F ^L
@@ -248,6 +260,9 @@ check_result 'N R X M B A I' --simplify-merges --topo-order --show-pulls -- file
 check_result 'R X M B A I' --simplify-merges --topo-order -- file
 check_result 'N M A I' --first-parent -- file
 check_result 'N M A I' --first-parent --show-pulls -- file
+check_result 'N R X I' --show-pulls --tree-diff-threads=3 -- file
+check_result 'N R X M B A I' --simplify-merges --topo-order --show-pulls \
+	--tree-diff-threads=3 -- file
 
 # --ancestry-path implies --full-history
 check_result 'P O N R M' --topo-order \
@@ -61,12 +61,13 @@ get_relevant_traces () {
 	# From the GIT_TRACE2_PERF data of the form
 	#    $TIME $FILE:$LINE | d0 | main | data | r1 | ? | ? | read_directo | $RELEVANT_STAT
 	# extract the $RELEVANT_STAT fields.  We don't care about region_enter
-	# or region_leave, or stats for things outside read_directory.
+	# or region_leave, or stats for things outside read_directory,
+	# nor about the directory read-ahead (see GIT_TEST_UNTRACKED_THREADS).
 	INPUT_FILE=$1
 	OUTPUT_FILE=$2
 	grep data.*read_directo $INPUT_FILE |
 	    cut -d "|" -f 9 |
-	    grep -v visited \
+	    grep -v -e visited -e prefetch/ \
 	    >"$OUTPUT_FILE"
 }
 
@@ -985,4 +986,130 @@ test_expect_success '"status" after file replacement should be clean with UC=fal
 	status_is_clean
 '
 
+
+test_expect_success 'setup worktree for core.untrackedThreads' '
+	cd .. &&
+	git init worktree-threads &&
+	cd worktree-threads &&
+	mkdir -p tracked/sub untracked/deep/er ignored/x/y &&
+	echo t >tracked/file &&
+	echo t >tracked/sub/file &&
+	git add tracked &&
+	git commit -m first &&
+	printf "ignored/\n*.o\n!keep.o\n" >.gitignore &&
+	echo u >untracked/deep/er/file &&
+	echo u >tracked/sub/untracked &&
+	echo i >ignored/x/y/file &&
+	echo o >tracked/sub/file.o &&
+	echo o >tracked/sub/keep.o &&
+	git init nested &&
+	echo n >nested/file &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		mkdir -p wide/$i/dir &&
+		echo $i >wide/$i/dir/file || return 1
+	done
+'
+
+for uc in false true
+do
+	test_expect_success "core.untrackedThreads gives the same results (UC=$uc)" '
+		git config core.untrackedCache $uc &&
+		for args in "status --porcelain" \
+			    "status --porcelain -uall" \
+			    "status --porcelain -uall --ignored" \
+			    "status --porcelain --ignored=matching" \
+			    "clean -n -d -x" \
+			    "ls-files -o --directory"
+		do
+			GIT_TEST_UNTRACKED_THREADS=0 \
+				git -c core.untrackedThreads=1 $args >../threads.expect &&
+			git -c core.untrackedThreads=4 $args >../threads.actual &&
+			test_cmp ../threads.expect ../threads.actual &&
+			git -c core.untrackedThreads=4 $args >../threads.actual &&
+			test_cmp ../threads.expect ../threads.actual || return 1
+		done
+	'
+done
+
+test_expect_success 'core.untrackedThreads reads directories ahead' '
+	git config core.untrackedCache false &&
+	GIT_TRACE2_EVENT="$(pwd)/../trace.event" GIT_TEST_UNTRACKED_THREADS=0 \
+		git -c core.untrackedThreads=1 status --porcelain -uall &&
+	! grep "\"key\":\"prefetch/" ../trace.event &&
+	rm ../trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/../trace.event" \
+		git -c core.untrackedThreads=4 status --porcelain -uall &&
+	grep "\"key\":\"prefetch/hit\"" ../trace.event
+'
+
+test_expect_success 'core.untrackedThreads rejects negative values' '
+	test_must_fail git -c core.untrackedThreads=-1 status 2>err &&
+	test_i18ngrep "invalid value for .core.untrackedThreads." err
+'
+
+test_expect_success 'core.splitUntrackedCache stores the cache in a file' '
+	sane_unset GIT_TEST_SPLIT_UNTRACKED_CACHE &&
+	git config core.untrackedCache false &&
+	git status --porcelain &&
+	rm -f .git/untracked.* &&
+	git config core.untrackedCache true &&
+	git status --porcelain >../split.expect &&
+	test-tool dump-untracked-cache >../dump.expect &&
+	ls .git >../gitdir &&
+	! grep "^untracked\." ../gitdir &&
+
+	git config core.splitUntrackedCache true &&
+	git config core.untrackedCache false &&
+	git status --porcelain &&
+	git config core.untrackedCache true &&
+	git status --porcelain >../split.actual &&
+	test_cmp ../split.expect ../split.actual &&
+	git status --porcelain >../split.actual &&
+	test_cmp ../split.expect ../split.actual &&
+	ls .git >../gitdir &&
+	grep "^untracked\." ../gitdir &&
+	test-tool dump-untracked-cache >../dump.actual &&
+	test_cmp ../dump.expect ../dump.actual
+'
+
+test_expect_success 'untracked cache file is only read when needed' '
+	echo t >tracked/new &&
+	git add tracked/new &&
+	ls .git/untracked.* >../files.expect &&
+	GIT_TRACE2_EVENT="$(pwd)/../trace.event" git write-tree &&
+	! grep "read_untracked_cache" ../trace.event &&
+	rm ../trace.event &&
+	ls .git/untracked.* >../files.actual &&
+	test_cmp ../files.expect ../files.actual &&
+	GIT_TRACE2_EVENT="$(pwd)/../trace.event" git status --porcelain &&
+	grep "read_untracked_cache" ../trace.event &&
+	rm ../trace.event
+'
+
+test_expect_success 'missing untracked cache file is dropped' '
+	git status --porcelain >../split.expect &&
+	rm .git/untracked.* &&
+	test-tool dump-untracked-cache >../dump.actual &&
+	echo "no untracked cache" >../dump.expect &&
+	test_cmp ../dump.expect ../dump.actual &&
+	git status --porcelain >../split.actual &&
+	test_cmp ../split.expect ../split.actual &&
+	git status --porcelain >../split.actual &&
+	test_cmp ../split.expect ../split.actual &&
+	ls .git/untracked.*
+'
+
+test_expect_success 'untracked cache moves back into the index' '
+	git config core.splitUntrackedCache false &&
+	echo t >tracked/newer &&
+	git add tracked/newer &&
+	rm .git/untracked.* &&
+	test-tool dump-untracked-cache >../dump.actual &&
+	! grep "no untracked cache" ../dump.actual &&
+	iuc status --porcelain >../split.expect &&
+	git status --porcelain >../split.actual &&
+	test_cmp ../split.expect ../split.actual
+'
+
 test_done
@@ -477,4 +477,27 @@ test_expect_success 'status succeeds with sparse index' '
 	)
 '
 
+test_expect_success 'split untracked cache is only read when needed' '
+	test_when_finished "rm -rf split-uc" &&
+	git init split-uc &&
+	(
+		cd split-uc &&
+		test_commit one &&
+		git config core.untrackedCache true &&
+		git config core.splitUntrackedCache true &&
+		test_hook --clobber fsmonitor-test <<-\EOF &&
+			printf "last_update_token\0"
+		EOF
+		git config core.fsmonitor .git/hooks/fsmonitor-test &&
+		git status &&
+		git status &&
+
+		GIT_TRACE2_EVENT="$(pwd)/diff.trace" git diff &&
+		! grep "read_untracked_cache" diff.trace &&
+
+		GIT_TRACE2_EVENT="$(pwd)/status.trace" git status &&
+		grep "read_untracked_cache" status.trace
+	)
+'
+
 test_done
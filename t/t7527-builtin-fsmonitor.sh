@@ -571,6 +571,98 @@ test_expect_success 'flush cached data' '
 	grep "file_3" actual_q3
 '
 
+# On Linux, a directory created while the inotify queue overflowed has
+# no watch; the daemon must walk the worktree again when it resyncs.
+# GIT_TEST_FSMONITOR_INOTIFY_OVERFLOW makes the listener treat the
+# creation of a directory with that name as an overflow that lost it.
+
+test_lazy_prereq INOTIFY '
+	test "$(uname -s)" = Linux
+'
+
+test_expect_success INOTIFY 'queue overflow rewatches the worktree' '
+	test_when_finished "stop_daemon_delete_repo test_overflow" &&
+
+	git init test_overflow &&
+
+	(
+		GIT_TEST_FSMONITOR_INOTIFY_OVERFLOW=lost &&
+		export GIT_TEST_FSMONITOR_INOTIFY_OVERFLOW &&
+		start_daemon -C test_overflow --tk true
+	) &&
+
+	mkdir test_overflow/lost &&
+
+	# The overflow forces a resync, which changes the <token_id>.
+	test-tool -C test_overflow fsmonitor-client query --token "builtin:test_00000001:0" >actual_0 &&
+	nul_to_q <actual_0 >actual_q0 &&
+	grep "^builtin:test_00000002:0Q/Q$" actual_q0 &&
+
+	>test_overflow/lost/file &&
+
+	test-tool -C test_overflow fsmonitor-client query --token "builtin:test_00000002:0" >actual_1 &&
+	nul_to_q <actual_1 >actual_q1 &&
+	grep "lost/file" actual_q1
+'
+
+# With core.fsmonitorStatCache, the preload step asks the daemon for the
+# lstat() data of the index entries, and the daemon answers the second
+# request from its cache, except for the paths that changed in between.
+
+test_expect_success 'stat cache answers preload_index()' '
+	test_when_finished "stop_daemon_delete_repo test_stat_cache" &&
+
+	git init test_stat_cache &&
+	(
+		cd test_stat_cache &&
+		mkdir dir &&
+		for i in 1 2 3 4 5 6
+		do
+			echo $i >file_$i &&
+			echo $i >dir/file_$i || return 1
+		done &&
+		git add . &&
+		git commit -m initial
+	) &&
+
+	start_daemon -C test_stat_cache --t2 "$PWD/.git/trace_stat_cache" &&
+
+	test_config -C test_stat_cache core.fsmonitorStatCache true &&
+	test_config -C test_stat_cache core.preloadIndex true &&
+
+	GIT_TEST_PRELOAD_INDEX=1 GIT_TRACE2_EVENT="$PWD/.git/trace_client_1" \
+		git -C test_stat_cache diff --name-only >actual_1 &&
+	test_must_be_empty actual_1 &&
+	have_t2_data_event index preload/stat_cache <.git/trace_client_1 &&
+	grep "stat-cache/count/hits:0$" .git/trace_stat_cache &&
+
+	echo changed >test_stat_cache/file_2 &&
+	rm test_stat_cache/dir/file_3 &&
+	mv test_stat_cache/dir test_stat_cache/dir.old &&
+	mkdir test_stat_cache/dir &&
+	echo changed >test_stat_cache/dir/file_1 &&
+
+	GIT_TEST_PRELOAD_INDEX=1 \
+		git -C test_stat_cache diff --name-only >actual_2 &&
+	cat >expect_2 <<-\EOF &&
+	dir/file_1
+	dir/file_2
+	dir/file_3
+	dir/file_4
+	dir/file_5
+	dir/file_6
+	file_2
+	EOF
+	test_cmp expect_2 actual_2 &&
+
+	# The unchanged top-level files are answered from the cache.
+	grep "stat-cache/count/hits:5$" .git/trace_stat_cache &&
+
+	GIT_TEST_PRELOAD_INDEX=1 git -C test_stat_cache -c core.fsmonitorStatCache=false \
+		diff --name-only >actual_3 &&
+	test_cmp expect_2 actual_3
+'
+
 # The next few test cases create repos where the .git directory is NOT
 # inside the one of the working directory.  That is, where .git is a file
 # that points to a directory elsewhere.  This happens for submodules and
@@ -394,6 +394,50 @@ test_expect_success 'pack-refs task' '
 	test_subcommand git pack-refs --all --prune <pack-refs.txt
 '
 
+test_expect_success 'rename-cache task' '
+	git init rename-cache &&
+	(
+		cd rename-cache &&
+		git config diff.renameCache true &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq $i $((i + 20)) >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		for step in 1 3
+		do
+			for f in file*
+			do
+				echo $step >>$f || return 1
+			done &&
+			git commit -a -m "edit $step" &&
+			git mv file$step moved$step &&
+			echo moved >>moved$step &&
+			git add moved$step &&
+			git rm -q file$((step + 1)) &&
+			git commit -m "move $step" &&
+			git diff-tree -r -C --find-copies-harder HEAD^ HEAD >/dev/null ||
+			return 1
+		done &&
+		ls .git/objects/info/rename-cache/cache-*.spans >files &&
+		test_line_count = 2 files &&
+		git diff-tree -r -C --find-copies-harder HEAD^ HEAD >expect &&
+
+		git -c maintenance.rename-cache.auto=3 maintenance run --auto &&
+		ls .git/objects/info/rename-cache/cache-*.spans >files &&
+		test_line_count = 2 files &&
+
+		git maintenance run --task=rename-cache &&
+		ls .git/objects/info/rename-cache/cache-*.spans >files &&
+		test_line_count = 1 files &&
+		GIT_TRACE2_PERF="$(pwd)/trace" \
+			git diff-tree -r -C --find-copies-harder HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		! grep "write rename cache" trace
+	)
+'
+
 test_expect_success '--auto and --schedule incompatible' '
 	test_must_fail git maintenance run --auto --schedule=daily 2>err &&
 	test_i18ngrep "at most one" err
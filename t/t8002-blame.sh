@@ -129,6 +129,45 @@ test_expect_success '--exclude-promisor-objects does not BUG-crash' '
 	test_must_fail git blame --exclude-promisor-objects one
 '
 
+test_expect_success 'threaded blame gives the same output' '
+	git init threads &&
+	(
+		cd threads &&
+		test_seq 1 200 >file &&
+		git add file &&
+		test_tick &&
+		git commit -m initial &&
+		for i in $(test_seq 1 20)
+		do
+			sed -e "s/^$((i * 7))\$/changed $i/" \
+			    -e "$((i * 3))a\\
+inserted $i" file >file.new &&
+			mv file.new file &&
+			test_tick &&
+			git commit -q -a -m "change $i" || return 1
+		done &&
+		git checkout -b side HEAD~10 &&
+		sed -e "s/^1\$/side/" file >file.new &&
+		mv file.new file &&
+		test_tick &&
+		git commit -a -m side &&
+		git checkout main &&
+		test_tick &&
+		git merge side &&
+		git mv file renamed &&
+		test_tick &&
+		git commit -m rename &&
+		echo uncommitted >>renamed &&
+
+		git -c blame.threads=1 blame --porcelain renamed >expect &&
+		GIT_TEST_BLAME_THREADS=3 git blame --porcelain renamed >actual &&
+		test_cmp expect actual &&
+		git -c blame.threads=1 blame -w -M --first-parent renamed >expect &&
+		GIT_TEST_BLAME_THREADS=3 git blame -w -M --first-parent renamed >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success 'blame with uncommitted edits in partial clone does not crash' '
 	git init server &&
 	echo foo >server/file.txt &&
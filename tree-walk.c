@@ -5,6 +5,7 @@
 #include "tree.h"
 #include "pathspec.h"
 #include "json-writer.h"
+#include "thread-utils.h"
 
 static const char *get_mode(const char *str, unsigned int *modep)
 {
@@ -170,9 +171,58 @@ int tree_entry_gently(struct tree_desc *desc, struct name_entry *entry)
 
 static int traverse_trees_atexit_registered;
 static int traverse_trees_count;
-static int traverse_trees_cur_depth;
 static int traverse_trees_max_depth;
 
+static int traverse_trees_use_lock;
+static pthread_mutex_t traverse_trees_mutex;
+
+static struct traverse_info dummy_traverse_info;
+
+void enable_traverse_trees_lock(void)
+{
+	if (traverse_trees_use_lock)
+		return;
+
+	traverse_trees_use_lock = 1;
+	pthread_mutex_init(&traverse_trees_mutex, NULL);
+}
+
+void disable_traverse_trees_lock(void)
+{
+	if (!traverse_trees_use_lock)
+		return;
+
+	traverse_trees_use_lock = 0;
+	pthread_mutex_destroy(&traverse_trees_mutex);
+}
+
+/*
+ * How deep "info" is in the traversal it belongs to. This is derived
+ * from the chain of traverse_info rather than counted as traverse_trees()
+ * recurses, so that each thread traversing trees gets its own depth.
+ */
+static int traverse_info_depth(const struct traverse_info *info)
+{
+	int depth = 1;
+
+	for (; info->prev && info->prev != &dummy_traverse_info; info = info->prev)
+		depth++;
+	return depth;
+}
+
+static void update_traverse_trees_statistics(const struct traverse_info *info)
+{
+	int depth = traverse_info_depth(info);
+
+	if (traverse_trees_use_lock)
+		pthread_mutex_lock(&traverse_trees_mutex);
+	traverse_trees_count++;
+	if (depth > traverse_trees_max_depth)
+		traverse_trees_max_depth = depth;
+	if (traverse_trees_use_lock)
+		pthread_mutex_unlock(&traverse_trees_mutex);
+}
+
 static void trace2_traverse_trees_statistics_atexit(void)
 {
 	struct json_writer jw = JSON_WRITER_INIT;
@@ -190,7 +240,6 @@ static void trace2_traverse_trees_statistics_atexit(void)
 void setup_traverse_info(struct traverse_info *info, const char *base)
 {
 	size_t pathlen = strlen(base);
-	static struct traverse_info dummy;
 
 	memset(info, 0, sizeof(*info));
 	if (pathlen && base[pathlen-1] == '/')
@@ -199,7 +248,7 @@ void setup_traverse_info(struct traverse_info *info, const char *base)
 	info->name = base;
 	info->namelen = pathlen;
 	if (pathlen)
-		info->prev = &dummy;
+		info->prev = &dummy_traverse_info;
 
 	if (trace2_is_enabled() && !traverse_trees_atexit_registered) {
 		atexit(trace2_traverse_trees_statistics_atexit);
@@ -441,11 +490,7 @@ int traverse_trees(struct index_state *istate,
 	int interesting = 1;
 	char *traverse_path;
 
-	traverse_trees_count++;
-	traverse_trees_cur_depth++;
-
-	if (traverse_trees_cur_depth > traverse_trees_max_depth)
-		traverse_trees_max_depth = traverse_trees_cur_depth;
+	update_traverse_trees_statistics(info);
 
 	if (n >= ARRAY_SIZE(entry))
 		BUG("traverse_trees() called with too many trees (%d)", n);
@@ -547,7 +592,6 @@ int traverse_trees(struct index_state *istate,
 	info->traverse_path = NULL;
 	strbuf_release(&base);
 
-	traverse_trees_cur_depth--;
 	return error;
 }
 
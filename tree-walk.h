@@ -108,6 +108,14 @@ typedef int (*traverse_callback_t)(int n, unsigned long mask, unsigned long dirm
  */
 int traverse_trees(struct index_state *istate, int n, struct tree_desc *t, struct traverse_info *info);
 
+/**
+ * traverse_trees() keeps statistics for trace2 in global variables. Call
+ * `enable_traverse_trees_lock()` before traversing trees from several
+ * threads at once, and `disable_traverse_trees_lock()` once they are done.
+ */
+void enable_traverse_trees_lock(void);
+void disable_traverse_trees_lock(void);
+
 enum get_oid_result get_tree_entry_follow_symlinks(struct repository *r, struct object_id *tree_oid, const char *name, struct object_id *result, struct strbuf *result_path, unsigned short *mode);
 
 /**
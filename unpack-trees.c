@@ -466,7 +466,8 @@ static int check_updates(struct unpack_trees_options *o,
 
 	enable_delayed_checkout(&state);
 	if (pc_workers > 1)
-		init_parallel_checkout();
+		init_parallel_checkout_streaming(&state, pc_workers, pc_threshold,
+						 progress, &cnt);
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -584,6 +585,85 @@ static int warn_conflicted_path(struct index_state *istate,
 	return count;
 }
 
+/*
+ * With checkout.unpackThreads, the one- and two-way merges hand each
+ * top-level directory over to a pool of threads, which unpack it exactly
+ * as unpack_callback() would have, into an index of their own. Once the
+ * top-level traversal is over, these are merged into o->result, and the
+ * paths each directory rejected are put back where they would have been
+ * rejected had it been unpacked in place.
+ *
+ * This works because everything that happens to a path only involves
+ * the index entries and the working tree files sharing its top-level
+ * directory. The state that is shared nevertheless (the cache-tree and
+ * the untracked cache being invalidated, the exclude patterns, the
+ * attributes needed to check file contents, ...) is only accessed with
+ * p->mutex held, see unpack_trees_lock().
+ *
+ * The index entries of a directory are contiguous, and belong to the
+ * thread unpacking it from the moment it is queued: it only looks at
+ * the range [cache_bottom, cache_end) of o->src_index, and the main
+ * thread moves its own o->cache_bottom past that range. Nobody else
+ * reads the CE_UNPACKED flags the thread sets on these entries until
+ * the threads are joined.
+ */
+struct unpack_trees_job {
+	int n;
+	unsigned long mask, dirmask;
+	struct name_entry names[MAX_UNPACK_TREES];
+	int cache_bottom, cache_end;
+
+	/* How many paths were rejected before this directory, per type */
+	int rejects_pos[NB_UNPACK_TREES_WARNING_TYPES];
+
+	struct index_state result;
+	struct string_list unpack_rejects[NB_UNPACK_TREES_WARNING_TYPES];
+	int ret;
+};
+
+struct unpack_trees_parallel {
+	/*
+	 * The options and the traversal as they were when the threads
+	 * were started: the main thread keeps updating its own copy.
+	 */
+	struct unpack_trees_options o;
+	struct traverse_info info;
+	pthread_mutex_t mutex;
+
+	pthread_mutex_t queue_mutex;
+	pthread_cond_t queue_cond;
+	struct unpack_trees_job **jobs;
+	int nr_jobs, alloc_jobs, next_job;
+	int queue_done;
+
+	pthread_t *threads;
+	int nr_threads;
+	struct cache_def lstat_cache;
+
+	/* o->cache_bottom when the top-level traversal started */
+	int cache_bottom;
+};
+
+/*
+ * One past the last entry of o->src_index this thread may look at.
+ */
+static inline int cache_end(const struct unpack_trees_options *o)
+{
+	return o->job ? o->job->cache_end : o->src_index->cache_nr;
+}
+
+static inline void unpack_trees_lock(struct unpack_trees_options *o)
+{
+	if (o->parallel)
+		pthread_mutex_lock(&o->parallel->mutex);
+}
+
+static inline void unpack_trees_unlock(struct unpack_trees_options *o)
+{
+	if (o->parallel)
+		pthread_mutex_unlock(&o->parallel->mutex);
+}
+
 static inline int call_unpack_fn(const struct cache_entry * const *src,
 				 struct unpack_trees_options *o)
 {
@@ -597,10 +677,10 @@ static void mark_ce_used(struct cache_entry *ce, struct unpack_trees_options *o)
 {
 	ce->ce_flags |= CE_UNPACKED;
 
-	if (o->cache_bottom < o->src_index->cache_nr &&
+	if (o->cache_bottom < cache_end(o) &&
 	    o->src_index->cache[o->cache_bottom] == ce) {
 		int bottom = o->cache_bottom;
-		while (bottom < o->src_index->cache_nr &&
+		while (bottom < cache_end(o) &&
 		       o->src_index->cache[bottom]->ce_flags & CE_UNPACKED)
 			bottom++;
 		o->cache_bottom = bottom;
@@ -637,7 +717,7 @@ static void mark_ce_used_same_name(struct cache_entry *ce,
 	int len = ce_namelen(ce);
 	int pos;
 
-	for (pos = locate_in_src_index(ce, o); pos < index->cache_nr; pos++) {
+	for (pos = locate_in_src_index(ce, o); pos < cache_end(o); pos++) {
 		struct cache_entry *next = index->cache[pos];
 		if (len != ce_namelen(next) ||
 		    memcmp(ce->name, next->name, len))
@@ -724,7 +804,7 @@ static int switch_cache_bottom(struct traverse_info *info)
 	if (pos < -1)
 		o->cache_bottom = -2 - pos;
 	else if (pos < 0)
-		o->cache_bottom = o->src_index->cache_nr;
+		o->cache_bottom = cache_end(o);
 	return ret;
 }
 
@@ -738,7 +818,7 @@ static int all_trees_same_as_cache_tree(int n, unsigned long dirmask,
 					struct traverse_info *info)
 {
 	struct unpack_trees_options *o = info->data;
-	int i;
+	int i, ret;
 
 	if (!o->merge || dirmask != ((1 << n) - 1))
 		return 0;
@@ -747,7 +827,10 @@ static int all_trees_same_as_cache_tree(int n, unsigned long dirmask,
 		if (!are_same_oid(names, names + i))
 			return 0;
 
-	return cache_tree_matches_traversal(o->src_index->cache_tree, names, info);
+	unpack_trees_lock(o);
+	ret = cache_tree_matches_traversal(o->src_index->cache_tree, names, info);
+	unpack_trees_unlock(o);
+	return ret;
 }
 
 static int index_pos_by_traverse_info(struct name_entry *names,
@@ -1173,7 +1256,7 @@ static int find_cache_pos(struct traverse_info *info,
 	struct index_state *index = o->src_index;
 	int pfxlen = info->pathlen;
 
-	for (pos = o->cache_bottom; pos < index->cache_nr; pos++) {
+	for (pos = o->cache_bottom; pos < cache_end(o); pos++) {
 		const struct cache_entry *ce = index->cache[pos];
 		const char *ce_name, *ce_slash;
 		int cmp, ce_len;
@@ -1489,6 +1572,301 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 	return mask;
 }
 
+static int unpack_trees_threads(struct unpack_trees_options *o)
+{
+	int threads = git_env_ulong("GIT_TEST_UNPACK_THREADS", 0);
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	/*
+	 * The other merge functions look at more than the entries of a
+	 * single path (e.g. threeway_merge() and its o->nontrivial_merge),
+	 * and errors must be collected rather than reported as they are
+	 * found, for them to come out in the usual order.
+	 */
+	if ((o->fn != oneway_merge && o->fn != twoway_merge) ||
+	    !o->merge || o->diff_index_cached || o->prefix || o->pathspec ||
+	    o->debug_unpack || !(o->show_all_errors || o->quiet) ||
+	    !o->skip_sparse_checkout || o->src_index->sparse_index ||
+	    o->src_index->split_index || should_update_submodules())
+		return 1;
+
+	if (!threads && git_config_get_int("checkout.unpackthreads", &threads))
+		threads = 1;
+	if (threads < 1)
+		threads = online_cpus();
+	return threads;
+}
+
+static void run_unpack_trees_job(struct unpack_trees_parallel *p,
+				 struct unpack_trees_job *job,
+				 struct cache_def *lstat_cache)
+{
+	struct unpack_trees_options o = p->o;
+	struct traverse_info info = p->info;
+
+	o.cache_bottom = job->cache_bottom;
+	o.job = job;
+	o.result = job->result;
+	COPY_ARRAY(o.unpack_rejects, job->unpack_rejects,
+		   NB_UNPACK_TREES_WARNING_TYPES);
+	o.lstat_cache = lstat_cache;
+	info.data = &o;
+
+	job->ret = unpack_callback(job->n, job->mask, job->dirmask,
+				   job->names, &info);
+
+	job->result = o.result;
+	COPY_ARRAY(job->unpack_rejects, o.unpack_rejects,
+		   NB_UNPACK_TREES_WARNING_TYPES);
+}
+
+static void *unpack_trees_thread(void *data)
+{
+	struct unpack_trees_parallel *p = data;
+	struct cache_def lstat_cache = CACHE_DEF_INIT;
+
+	while (1) {
+		struct unpack_trees_job *job;
+
+		pthread_mutex_lock(&p->queue_mutex);
+		while (p->next_job == p->nr_jobs && !p->queue_done)
+			pthread_cond_wait(&p->queue_cond, &p->queue_mutex);
+		if (p->next_job == p->nr_jobs) {
+			pthread_mutex_unlock(&p->queue_mutex);
+			break;
+		}
+		job = p->jobs[p->next_job++];
+		pthread_mutex_unlock(&p->queue_mutex);
+
+		run_unpack_trees_job(p, job, &lstat_cache);
+	}
+
+	cache_def_clear(&lstat_cache);
+	return NULL;
+}
+
+static int index_pos_from(struct index_state *istate,
+			  const char *name, int namelen)
+{
+	int pos = index_name_pos(istate, name, namelen);
+	return pos < 0 ? -pos - 1 : pos;
+}
+
+static int unpack_callback_parallel(int n, unsigned long mask,
+				    unsigned long dirmask,
+				    struct name_entry *names,
+				    struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	struct unpack_trees_parallel *p = o->parallel;
+	struct index_state *index = o->src_index;
+	const struct name_entry *name = names;
+	struct unpack_trees_job *job;
+	struct strbuf path = STRBUF_INIT;
+	int i, start, dir, end;
+
+	if (!dirmask)
+		return unpack_callback(n, mask, dirmask, names, info);
+
+	/*
+	 * The entries of the job are those named "path" or "path/...".
+	 * Names like "path-1" sort in between the two when they exist:
+	 * the range is not the job's alone then, so unpack it here.
+	 */
+	while (!name->mode)
+		name++;
+	strbuf_add(&path, name->path, name->pathlen);
+	start = index_pos_from(index, path.buf, path.len);
+	strbuf_addch(&path, '/');
+	dir = index_pos_from(index, path.buf, path.len);
+	path.buf[path.len - 1] = '/' + 1;
+	end = index_pos_from(index, path.buf, path.len);
+	strbuf_release(&path);
+
+	if (o->cache_bottom > start ||
+	    (start < dir && ce_namelen(index->cache[dir - 1]) != name->pathlen))
+		return unpack_callback(n, mask, dirmask, names, info);
+
+	CALLOC_ARRAY(job, 1);
+	job->n = n;
+	job->mask = mask;
+	job->dirmask = dirmask;
+	COPY_ARRAY(job->names, names, n);
+	job->cache_bottom = start;
+	job->cache_end = end;
+	o->cache_bottom = end;
+	job->result.initialized = 1;
+	job->result.timestamp = o->result.timestamp;
+	job->result.version = o->result.version;
+	for (i = 0; i < NB_UNPACK_TREES_WARNING_TYPES; i++) {
+		job->rejects_pos[i] = o->unpack_rejects[i].nr;
+		string_list_init_nodup(&job->unpack_rejects[i]);
+		job->unpack_rejects[i].strdup_strings =
+			o->unpack_rejects[i].strdup_strings;
+	}
+
+	pthread_mutex_lock(&p->queue_mutex);
+	ALLOC_GROW(p->jobs, p->nr_jobs + 1, p->alloc_jobs);
+	p->jobs[p->nr_jobs++] = job;
+	pthread_cond_signal(&p->queue_cond);
+	pthread_mutex_unlock(&p->queue_mutex);
+
+	return mask;
+}
+
+static void start_unpack_trees_parallel(struct unpack_trees_options *o,
+					 const struct traverse_info *info,
+					 int threads)
+{
+	struct unpack_trees_parallel *p;
+	int i, err;
+
+	CALLOC_ARRAY(p, 1);
+	p->cache_bottom = o->cache_bottom;
+	p->info = *info;
+	p->info.traverse_path = "";
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_mutex_init(&p->queue_mutex, NULL);
+	pthread_cond_init(&p->queue_cond, NULL);
+
+	/*
+	 * read_directory() uses the default lstat cache, with p->mutex
+	 * held, so this thread needs one of its own, too.
+	 */
+	strbuf_init(&p->lstat_cache.path, 0);
+	o->lstat_cache = &p->lstat_cache;
+	o->parallel = p;
+	p->o = *o;
+
+	enable_obj_read_lock();
+	enable_traverse_trees_lock();
+
+	CALLOC_ARRAY(p->threads, threads);
+	for (i = 0; i < threads; i++) {
+		err = pthread_create(&p->threads[i], NULL,
+				     unpack_trees_thread, p);
+		if (err)
+			die(_("unable to create unpack-trees thread: %s"),
+			    strerror(err));
+		p->nr_threads++;
+	}
+}
+
+static int cmp_cache_entry_ptrs(const void *a_, const void *b_)
+{
+	const struct cache_entry *a = *(const struct cache_entry **)a_;
+	const struct cache_entry *b = *(const struct cache_entry **)b_;
+
+	return cache_name_stage_compare(a->name, ce_namelen(a), ce_stage(a),
+					b->name, ce_namelen(b), ce_stage(b));
+}
+
+static void merge_unpack_trees_results(struct unpack_trees_options *o,
+				       struct unpack_trees_parallel *p)
+{
+	struct index_state *result = &o->result;
+	int i, e, nr = result->cache_nr;
+
+	for (i = 0; i < p->nr_jobs; i++)
+		nr += p->jobs[i]->result.cache_nr;
+	ALLOC_GROW(result->cache, nr, result->cache_alloc);
+
+	for (i = 0; i < p->nr_jobs; i++) {
+		struct index_state *slice = &p->jobs[i]->result;
+
+		COPY_ARRAY(result->cache + result->cache_nr, slice->cache,
+			   slice->cache_nr);
+		result->cache_nr += slice->cache_nr;
+		result->cache_changed |= slice->cache_changed;
+		if (slice->ce_mem_pool) {
+			if (!result->ce_mem_pool) {
+				CALLOC_ARRAY(result->ce_mem_pool, 1);
+				mem_pool_init(result->ce_mem_pool, 0);
+			}
+			mem_pool_combine(result->ce_mem_pool, slice->ce_mem_pool);
+		}
+		slice->cache_nr = 0;
+		discard_index(slice);
+	}
+
+	/* The entries may now be in a different order: rehash them. */
+	free_name_hash(result);
+	for (i = 0; i < result->cache_nr; i++)
+		result->cache[i]->ce_flags &= ~CE_HASHED;
+	QSORT(result->cache, result->cache_nr, cmp_cache_entry_ptrs);
+
+	for (e = 0; e < NB_UNPACK_TREES_WARNING_TYPES; e++) {
+		struct string_list *rejects = &o->unpack_rejects[e];
+		struct string_list merged = STRING_LIST_INIT_NODUP;
+		int j = 0, k;
+
+		merged.strdup_strings = rejects->strdup_strings;
+		for (i = 0; i < p->nr_jobs; i++) {
+			struct unpack_trees_job *job = p->jobs[i];
+
+			for (; j < job->rejects_pos[e]; j++)
+				string_list_append_nodup(&merged,
+							 rejects->items[j].string);
+			for (k = 0; k < job->unpack_rejects[e].nr; k++)
+				string_list_append_nodup(&merged,
+							 job->unpack_rejects[e].items[k].string);
+			free(job->unpack_rejects[e].items);
+		}
+		for (; j < rejects->nr; j++)
+			string_list_append_nodup(&merged, rejects->items[j].string);
+		free(rejects->items);
+		*rejects = merged;
+	}
+}
+
+static int finish_unpack_trees_parallel(struct unpack_trees_options *o)
+{
+	struct unpack_trees_parallel *p = o->parallel;
+	int i, ret = 0;
+
+	pthread_mutex_lock(&p->queue_mutex);
+	p->queue_done = 1;
+	pthread_cond_broadcast(&p->queue_cond);
+	pthread_mutex_unlock(&p->queue_mutex);
+
+	for (i = 0; i < p->nr_threads; i++)
+		pthread_join(p->threads[i], NULL);
+
+	/*
+	 * Go back to the index entries that were skipped when queuing
+	 * the jobs, for the left-over ones to be unpacked.
+	 */
+	o->cache_bottom = p->cache_bottom;
+
+	disable_traverse_trees_lock();
+	disable_obj_read_lock();
+
+	for (i = 0; i < p->nr_jobs; i++)
+		if (p->jobs[i]->ret < 0)
+			ret = -1;
+	merge_unpack_trees_results(o, p);
+
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "parallel/threads", p->nr_threads);
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "parallel/jobs", p->nr_jobs);
+
+	for (i = 0; i < p->nr_jobs; i++)
+		free(p->jobs[i]);
+	free(p->jobs);
+	free(p->threads);
+	cache_def_clear(&p->lstat_cache);
+	pthread_cond_destroy(&p->queue_cond);
+	pthread_mutex_destroy(&p->queue_mutex);
+	pthread_mutex_destroy(&p->mutex);
+	free(p);
+	o->parallel = NULL;
+	o->lstat_cache = NULL;
+	return ret;
+}
+
 static int clear_ce_flags_1(struct index_state *istate,
 			    struct cache_entry **cache, int nr,
 			    struct strbuf *prefix,
@@ -1863,6 +2241,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len) {
 		const char *prefix = o->prefix ? o->prefix : "";
 		struct traverse_info info;
+		int threads;
 
 		setup_traverse_info(&info, prefix);
 		info.fn = unpack_callback;
@@ -1887,9 +2266,17 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 			}
 		}
 
+		threads = unpack_trees_threads(o);
+		if (threads > 1) {
+			start_unpack_trees_parallel(o, &info, threads);
+			info.fn = unpack_callback_parallel;
+		}
+
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
 		ret = traverse_trees(o->src_index, len, t, &info);
+		if (o->parallel && finish_unpack_trees_parallel(o) < 0)
+			ret = -1;
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
@@ -2111,7 +2498,11 @@ static int verify_uptodate_1(const struct cache_entry *ce,
 
 	if (!lstat(ce->name, &st)) {
 		int flags = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE;
-		unsigned changed = ie_match_stat(o->src_index, ce, &st, flags);
+		unsigned changed;
+
+		unpack_trees_lock(o);
+		changed = ie_match_stat(o->src_index, ce, &st, flags);
+		unpack_trees_unlock(o);
 
 		if (submodule_from_ce(ce)) {
 			int r = check_submodule_move_head(ce,
@@ -2170,8 +2561,10 @@ static void invalidate_ce_path(const struct cache_entry *ce,
 {
 	if (!ce)
 		return;
+	unpack_trees_lock(o);
 	cache_tree_invalidate_path(o->src_index, ce->name);
 	untracked_cache_invalidate_path(o->src_index, ce->name, 1);
+	unpack_trees_unlock(o);
 }
 
 /*
@@ -2204,7 +2597,11 @@ static int verify_clean_subdirectory(const struct cache_entry *ce,
 
 	if (S_ISGITLINK(ce->ce_mode)) {
 		struct object_id oid;
-		int sub_head = resolve_gitlink_ref(ce->name, "HEAD", &oid);
+		int sub_head;
+
+		unpack_trees_lock(o);
+		sub_head = resolve_gitlink_ref(ce->name, "HEAD", &oid);
+		unpack_trees_unlock(o);
 		/*
 		 * If we are not going to update the submodule, then
 		 * we don't care.
@@ -2249,7 +2646,9 @@ static int verify_clean_subdirectory(const struct cache_entry *ce,
 	memset(&d, 0, sizeof(d));
 	if (o->dir)
 		d.exclude_per_dir = o->dir->exclude_per_dir;
+	unpack_trees_lock(o);
 	i = read_directory(&d, o->src_index, pathbuf, namelen+1, NULL);
+	unpack_trees_unlock(o);
 	dir_clear(&d);
 	free(pathbuf);
 	if (i)
@@ -2274,9 +2673,13 @@ static int verify_clean_subdirectory(const struct cache_entry *ce,
 static int icase_exists(struct unpack_trees_options *o, const char *name, int len, struct stat *st)
 {
 	const struct cache_entry *src;
+	int ret;
 
+	unpack_trees_lock(o);
 	src = index_file_exists(o->src_index, name, len, 1);
-	return src && !ie_match_stat(o->src_index, src, st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE);
+	ret = src && !ie_match_stat(o->src_index, src, st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE);
+	unpack_trees_unlock(o);
+	return ret;
 }
 
 enum absent_checking_type {
@@ -2291,6 +2694,7 @@ static int check_ok_to_remove(const char *name, int len, int dtype,
 			      struct unpack_trees_options *o)
 {
 	const struct cache_entry *result;
+	int excluded = 0;
 
 	/*
 	 * It may be that the 'lstat()' succeeded even though
@@ -2302,8 +2706,12 @@ static int check_ok_to_remove(const char *name, int len, int dtype,
 	if (ignore_case && icase_exists(o, name, len, st))
 		return 0;
 
-	if (o->dir &&
-	    is_excluded(o->dir, o->src_index, name, &dtype))
+	if (o->dir) {
+		unpack_trees_lock(o);
+		excluded = is_excluded(o->dir, o->src_index, name, &dtype);
+		unpack_trees_unlock(o);
+	}
+	if (excluded)
 		/*
 		 * ce->name is explicitly excluded, so it is Ok to
 		 * overwrite it.
@@ -2365,7 +2773,11 @@ static int verify_absent_1(const struct cache_entry *ce,
 		return 0;
 	}
 
-	len = check_leading_path(ce->name, ce_namelen(ce), 0);
+	if (o->lstat_cache)
+		len = threaded_check_leading_path(o->lstat_cache, ce->name,
+						  ce_namelen(ce), 0);
+	else
+		len = check_leading_path(ce->name, ce_namelen(ce), 0);
 	if (!len)
 		return 0;
 	else if (len > 0) {
@@ -2906,9 +3318,14 @@ int oneway_merge(const struct cache_entry * const *src,
 		if (o->reset && o->update && !ce_uptodate(old) && !ce_skip_worktree(old) &&
 			!(old->ce_flags & CE_FSMONITOR_VALID)) {
 			struct stat st;
-			if (lstat(old->name, &st) ||
-			    ie_match_stat(o->src_index, old, &st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE))
+			if (lstat(old->name, &st))
 				update |= CE_UPDATE;
+			else {
+				unpack_trees_lock(o);
+				if (ie_match_stat(o->src_index, old, &st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE))
+					update |= CE_UPDATE;
+				unpack_trees_unlock(o);
+			}
 		}
 		if (o->update && S_ISGITLINK(old->ce_mode) &&
 		    should_update_submodules() && !verify_uptodate(old, o))
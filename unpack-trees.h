@@ -11,6 +11,8 @@
 struct cache_entry;
 struct unpack_trees_options;
 struct pattern_list;
+struct unpack_trees_parallel;
+struct unpack_trees_job;
 
 typedef int (*merge_fn_t)(const struct cache_entry * const *src,
 		struct unpack_trees_options *options);
@@ -97,6 +99,9 @@ struct unpack_trees_options {
 
 	struct pattern_list *pl; /* for internal use */
 	struct dir_struct *dir; /* for internal use only */
+	struct unpack_trees_parallel *parallel; /* for internal use only */
+	struct unpack_trees_job *job; /* for internal use only */
+	struct cache_def *lstat_cache; /* for internal use only */
 	struct checkout_metadata meta;
 };
 
@@ -774,6 +774,7 @@ static void wt_status_collect_untracked(struct wt_status *s)
 		if (s->show_ignored_mode == SHOW_MATCHING_IGNORED)
 			dir.flags |= DIR_SHOW_IGNORED_TOO_MODE_MATCHING;
 	} else {
+		prepare_untracked_cache(istate);
 		dir.untracked = istate->untracked;
 	}
 
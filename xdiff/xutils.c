@@ -249,20 +249,58 @@ int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
 	return 1;
 }
 
+/*
+ * Hash "size" bytes eight at a time. The values are only ever compared
+ * with each other by the same process, so they need not be the same on
+ * every platform.
+ */
+static unsigned long xdl_hash_bytes(char const *ptr, long size) {
+	uint64_t ha = 5381 + (uint64_t) size;
+	uint64_t w;
+
+	for (; size >= 8; ptr += 8, size -= 8) {
+		memcpy(&w, ptr, 8);
+		ha = (ha ^ w) * 0x9e3779b97f4a7c15ULL;
+		ha ^= ha >> 32;
+	}
+	if (size) {
+		w = 0;
+		memcpy(&w, ptr, size);
+		ha = (ha ^ w) * 0x9e3779b97f4a7c15ULL;
+		ha ^= ha >> 32;
+	}
+	return (unsigned long) (ha ^ (ha >> 29));
+}
+
+/*
+ * Find the end of the record starting at "ptr"; memchr() is usually
+ * vectorized by the C library, picking the best instructions the CPU
+ * offers at run time.
+ */
+static char const *xdl_record_end(char const *ptr, char const *top) {
+	char const *eol = memchr(ptr, '\n', top - ptr);
+
+	return eol ? eol : top;
+}
+
 static unsigned long xdl_hash_record_with_whitespace(char const **data,
 		char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
-	int cr_at_eol_only = (flags & XDF_WHITESPACE_FLAGS) == XDF_IGNORE_CR_AT_EOL;
+
+	if ((flags & XDF_WHITESPACE_FLAGS) == XDF_IGNORE_CR_AT_EOL) {
+		char const *eol = xdl_record_end(ptr, top);
+		long size = eol - ptr;
+
+		/* do not ignore CR at the end of an incomplete line */
+		if (eol < top && size && ptr[size - 1] == '\r')
+			size--;
+		*data = eol < top ? eol + 1 : eol;
+		return xdl_hash_bytes(ptr, size);
+	}
 
 	for (; ptr < top && *ptr != '\n'; ptr++) {
-		if (cr_at_eol_only) {
-			/* do not ignore CR at the end of an incomplete line */
-			if (*ptr == '\r' &&
-			    (ptr + 1 < top && ptr[1] == '\n'))
-				continue;
-		}
-		else if (XDL_ISSPACE(*ptr)) {
+		if (XDL_ISSPACE(*ptr)) {
 			const char *ptr2 = ptr;
 			int at_eol;
 			while (ptr + 1 < top && XDL_ISSPACE(ptr[1])
@@ -295,19 +333,16 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 }
 
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
 	char const *ptr = *data;
+	char const *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
-	}
-	*data = ptr < top ? ptr + 1: ptr;
+	eol = xdl_record_end(ptr, top);
+	*data = eol < top ? eol + 1 : eol;
 
-	return ha;
+	return xdl_hash_bytes(ptr, eol - ptr);
 }
 
 unsigned int xdl_hashbits(unsigned int size) {